@@ -48,6 +48,7 @@ class BlockchainTest(BitcoinTestFramework):
     def _test_gettxoutsetinfo(self):
         node = self.nodes[0]
         res = node.gettxoutsetinfo()
+        assert_equal(len(res[u'hash_serialized']), 64)
 
         assert_equal(res[u'total_amount'], Decimal('8725.00000000'))
         assert_equal(res[u'transactions'], 200)
@@ -55,7 +56,13 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(res[u'txouts'], 200)
         assert_equal(res[u'bytes_serialized'], 13924),
         assert_equal(len(res[u'bestblock']), 64)
-        assert_equal(len(res[u'hash_serialized']), 64)
+        assert_equal(len(res[u'hash_rolling']), 64)
+
+        # The incrementally maintained statistics agree with the full scan
+        fast = node.gettxoutsetinfo(True)
+        assert('hash_serialized' not in fast)
+        del res[u'hash_serialized']
+        assert_equal(fast, res)
 
     def _test_getblockheader(self):
         node = self.nodes[0]
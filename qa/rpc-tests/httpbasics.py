@@ -110,6 +110,15 @@ class HTTPBasicsTest (BitcoinTestFramework):
         out1 = conn.getresponse()
         assert_equal(out1.status, httplib.BAD_REQUEST)
 
+        # The requests above are counted, with their reply latency
+        info = self.nodes[2].gethttpinfo()
+        assert_equal(info['eventthreads'], 1)
+        assert_equal(info['workerthreads'], 4)
+        assert_equal(info['rejected'], 0)
+        assert_greater_than(info['requests'], 3)
+        assert_equal(info['latency']['p50'] <= info['latency']['p99'] <= info['latency']['max'], True)
+        assert_raises(JSONRPCException, self.nodes[2].gethttpinfo, 1)
+
 
 if __name__ == '__main__':
     HTTPBasicsTest ().main ()
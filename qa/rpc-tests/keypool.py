@@ -9,6 +9,7 @@
 
 from test_framework.test_framework import BitcoinTestFramework
 from test_framework.util import *
+import time
 
 
 def check_array_result(object_array, to_match, expected):
@@ -32,10 +33,29 @@ def check_array_result(object_array, to_match, expected):
     if num_matched == 0:
         raise AssertionError("No objects matched %s"%(str(to_match)))
 
+def wait_for_keypool(node, size, timeout=30):
+    """Wait for the background thread to refill the key pool to at least size keys"""
+    deadline = time.time() + timeout
+    while node.getwalletinfo()['keypoolsize'] < size:
+        if time.time() > deadline:
+            raise AssertionError("Key pool not refilled to %d keys: %d" % (size, node.getwalletinfo()['keypoolsize']))
+        time.sleep(0.1)
+
 class KeyPoolTest(BitcoinTestFramework):
 
     def run_test(self):
         nodes = self.nodes
+        # The key pool is filled in the background at startup, and refilled
+        # once half of it has been handed out
+        stop_node(nodes[0], 0)
+        nodes[0] = start_node(0, self.options.tmpdir, ["-keypool=20"])
+        wait_for_keypool(nodes[0], 21)
+        for i in range(15):
+            nodes[0].getnewaddress()
+        wait_for_keypool(nodes[0], 21)
+        stop_node(nodes[0], 0)
+        nodes[0] = start_node(0, self.options.tmpdir)
+
         # Encrypt wallet and wait to terminate
         nodes[0].encryptwallet('test')
         bitcoind_processes[0].wait()
@@ -199,14 +199,13 @@ class RESTTest (BitcoinTestFramework):
             json_request += txid+'-'+str(n)+'/'
         json_request = json_request.rstrip("/")
         response = http_post_call(url.hostname, url.port, '/rest/getutxos'+json_request+self.FORMAT_SEPARATOR+'json', '', True)
-        assert_equal(response.status, 500) #must be a 500 because we exceeding the limits
+        assert_equal(response.status, 200) #20 outpoints are well within the limit
 
-        json_request = '/checkmempool/'
-        for x in range(0, 15):
-            json_request += txid+'-'+str(n)+'/'
-        json_request = json_request.rstrip("/")
-        response = http_post_call(url.hostname, url.port, '/rest/getutxos'+json_request+self.FORMAT_SEPARATOR+'json', '', True)
-        assert_equal(response.status, 200) #must be a 500 because we exceeding the limits
+        for (count, status) in [(10001, 500), (10000, 200)]:
+            binaryRequest = b'\x01\xfd' + pack("<H", count)
+            binaryRequest += (binascii.unhexlify(txid) + pack("i", n)) * count
+            response = http_post_call(url.hostname, url.port, '/rest/getutxos'+self.FORMAT_SEPARATOR+'bin', binaryRequest, True)
+            assert_equal(response.status, status) #a 500 when exceeding the limit of 10000 outpoints
 
         self.nodes[0].generate(1) #generate block to not affect upcoming tests
         self.sync_all()
@@ -279,6 +278,32 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(response_header_json_str)
         assert_equal(len(json_obj), 5) #now we should have 5 header objects
 
+        # get the blocks themselves, by hash and by height, streamed from the block files
+        bb_height = self.nodes[0].getblock(bb_hash)['height']
+        tip_height = self.nodes[0].getblockcount()
+        expected = []
+        for height in range(bb_height, tip_height + 1):
+            expected.append(binascii.unhexlify(self.nodes[0].getblock(self.nodes[0].getblockhash(height), False)))
+        response_blocks = http_get_call(url.hostname, url.port, '/rest/blocks/'+bb_hash+'/3'+self.FORMAT_SEPARATOR+"bin", True)
+        assert_equal(response_blocks.status, 200)
+        assert_equal(response_blocks.read(), b''.join(expected[0:3]))
+        response_blocks_hex = http_get_call(url.hostname, url.port, '/rest/blocks/'+str(bb_height)+'/1000'+self.FORMAT_SEPARATOR+"hex", True)
+        assert_equal(response_blocks_hex.status, 200)
+        assert_equal(response_blocks_hex.read().strip(), binascii.hexlify(b''.join(expected))) #stops at the tip
+        response_blocks = http_get_call(url.hostname, url.port, '/rest/blocks/'+bb_hash+'/1001'+self.FORMAT_SEPARATOR+"bin", True)
+        assert_equal(response_blocks.status, 400)
+        response_blocks = http_get_call(url.hostname, url.port, '/rest/blocks/'+str(tip_height + 1)+'/1'+self.FORMAT_SEPARATOR+"bin", True)
+        assert_equal(response_blocks.status, 404)
+
+        # headers in binary may be asked for beyond the JSON limit
+        response_header = http_get_call(url.hostname, url.port, '/rest/headers/5000/0'+self.FORMAT_SEPARATOR+"bin", True)
+        assert_equal(response_header.status, 200)
+        response_header_str = response_header.read()
+        assert_equal(len(response_header_str), 80 * (tip_height + 1))
+        assert_equal(response_header_str[80 * bb_height:80 * bb_height + 80], expected[0][0:80])
+        response_header_json = http_get_call(url.hostname, url.port, '/rest/headers/5000/0'+self.FORMAT_SEPARATOR+"json", True)
+        assert_equal(response_header_json.status, 400)
+
         # do tx test
         tx_hash = block_json_obj['tx'][0]['txid']
         json_string = http_get_call(url.hostname, url.port, '/rest/tx/'+tx_hash+self.FORMAT_SEPARATOR+"json")
@@ -337,5 +362,19 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(json_string)
         assert_equal(json_obj['bestblockhash'], bb_hash)
 
+        # stream headers in several parts (of 1000 headers each)
+        self.nodes[1].generate(2100 - self.nodes[1].getblockcount())
+        self.sync_all()
+        tip_height = self.nodes[0].getblockcount()
+        expected = []
+        for height in range(0, tip_height + 1):
+            expected.append(binascii.unhexlify(self.nodes[0].getblockheader(self.nodes[0].getblockhash(height), False)))
+        response_header = http_get_call(url.hostname, url.port, '/rest/headers/5000/0'+self.FORMAT_SEPARATOR+"bin", True)
+        assert_equal(response_header.status, 200)
+        assert_equal(response_header.read(), b''.join(expected))
+        response_header_hex = http_get_call(url.hostname, url.port, '/rest/headers/2001/'+self.nodes[0].getblockhash(50)+self.FORMAT_SEPARATOR+"hex", True)
+        assert_equal(response_header_hex.status, 200)
+        assert_equal(response_header_hex.read().strip(), binascii.hexlify(b''.join(expected[50:2051])))
+
 if __name__ == '__main__':
     RESTTest ().main ()
@@ -54,6 +54,7 @@ is not re-performed once the node has already forked.
 import os
 import fnmatch
 import hashlib
+import time
 from test_framework.test_framework import BitcoinTestFramework
 from test_framework.util import *
 from random import randint
@@ -63,6 +64,15 @@ logging.basicConfig(format='%(levelname)s:%(message)s', level=logging.INFO)
 # backup block must be > 113 as these blocks are used for context setup
 backupblock = 114
 
+def wait_for_file(path, timeout=30):
+    """The auto backup is written in the background: poll for it"""
+    deadline = time.time() + timeout
+    while not os.path.isfile(path):
+        if time.time() > deadline:
+            return False
+        time.sleep(0.1)
+    return True
+
 class WalletBackupTest(BitcoinTestFramework):
 
     def setup_chain(self):
@@ -222,12 +232,12 @@ class WalletBackupTest(BitcoinTestFramework):
 
         # Test if the backup files exist
         for ci in [0,1,3]:
-            if os.path.isfile(nodebackupfile[ci]):
+            if wait_for_file(nodebackupfile[ci]):
                 nodebackupexists[ci] = 1
             else:
-                logging.info("Error backup does not exist: %s"%(nodebackupfile[0]))
+                logging.info("Error backup does not exist: %s"%(nodebackupfile[ci]))
 
-        if os.path.isfile(nodebackupfile[2]):
+        if wait_for_file(nodebackupfile[2]):
             nodebackupexists[2] = 1
             # take MD5 for comparison to .old file in later test
             node2backupfile_orig_md5 = hashlib.md5(open(nodebackupfile[2], 'rb').read()).hexdigest()
@@ -350,7 +360,7 @@ class WalletBackupTest(BitcoinTestFramework):
         logging.info("stopping node 1")
         stop_node(self.nodes[1], 1)
         logging.info("checking that wallet backup file exists: %s" % nodebackupfile[1])
-        assert(os.path.isfile(nodebackupfile[1]))
+        assert(wait_for_file(nodebackupfile[1]))
         logging.info("removing wallet backup file %s" % nodebackupfile[1])
         os.remove(nodebackupfile[1])
         # check that no wallet backup file created
@@ -0,0 +1,54 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "clientversion.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "version.h"
+
+/* Build a serialized block of about 1MB of transactions with typical P2PKH-sized scripts */
+static CDataStream CreateBlockStream()
+{
+    CBlock block;
+    for (int i = 0; i < 2000; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(2);
+        tx.vout.resize(2);
+        for (int j = 0; j < 2; j++) {
+            tx.vin[j].prevout.n = i * 2 + j;
+            tx.vin[j].scriptSig = CScript() << std::vector<unsigned char>(72, i) << std::vector<unsigned char>(33, j);
+            tx.vout[j].nValue = i;
+            tx.vout[j].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, j) << OP_EQUALVERIFY << OP_CHECKSIG;
+        }
+        block.vtx.push_back(tx);
+    }
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << block;
+    return stream;
+}
+
+static void DeserializeBlock(benchmark::State& state)
+{
+    CDataStream stream = CreateBlockStream();
+    while (state.KeepRunning()) {
+        CDataStream copy(stream);
+        CBlock block;
+        copy >> block;
+    }
+}
+
+static void DeserializeBlockArena(benchmark::State& state)
+{
+    CDataStream stream = CreateBlockStream();
+    while (state.KeepRunning()) {
+        CDataStream copy(stream);
+        CBlock block;
+        block.UnserializeWithArena(copy, copy.GetType(), copy.GetVersion(), copy.size());
+    }
+}
+
+BENCHMARK(DeserializeBlock);
+BENCHMARK(DeserializeBlockArena);
@@ -0,0 +1,67 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "wallet/wallet.h"
+
+#include <set>
+#include <vector>
+
+#include <boost/foreach.hpp>
+
+/* Fill vCoins with a synthetic wallet of 100k confirmed outputs of varied value */
+static void CreateCoins(CWallet& wallet, std::vector<COutput>& vCoins)
+{
+    for (int i = 0; i < 100000; i++) {
+        CMutableTransaction tx;
+        tx.nLockTime = i; // so all transactions get different hashes
+        tx.vout.resize(1);
+        tx.vout[0].nValue = (i % 997 + 1) * 1000;
+        const CWalletTx* wtx = new CWalletTx(&wallet, tx);
+        vCoins.push_back(COutput(wtx, 0, 6 * 24, true));
+    }
+}
+
+static void DeleteCoins(std::vector<COutput>& vCoins)
+{
+    BOOST_FOREACH(const COutput& output, vCoins)
+        delete output.tx;
+    vCoins.clear();
+}
+
+static void CoinSelectionKnapsack(benchmark::State& state)
+{
+    CWallet wallet;
+    std::vector<COutput> vCoins;
+    CreateCoins(wallet, vCoins);
+
+    LOCK(wallet.cs_wallet);
+    std::set<std::pair<const CWalletTx*, unsigned int> > setCoinsRet;
+    CAmount nValueRet;
+    while (state.KeepRunning()) {
+        bool fSuccess = wallet.SelectCoinsMinConf(5 * COIN + 12345, 1, 6, vCoins, setCoinsRet, nValueRet);
+        assert(fSuccess);
+    }
+    DeleteCoins(vCoins);
+}
+
+static void CoinSelectionBnB(benchmark::State& state)
+{
+    CWallet wallet;
+    std::vector<COutput> vCoins;
+    CreateCoins(wallet, vCoins);
+
+    LOCK(wallet.cs_wallet);
+    std::set<std::pair<const CWalletTx*, unsigned int> > setCoinsRet;
+    CAmount nValueRet;
+    while (state.KeepRunning()) {
+        bool fSuccess = wallet.SelectCoinsChangeless(vCoins, 5 * COIN + 12345, 148, 1820, setCoinsRet, nValueRet);
+        assert(fSuccess);
+    }
+    DeleteCoins(vCoins);
+}
+
+BENCHMARK(CoinSelectionKnapsack);
+BENCHMARK(CoinSelectionBnB);
@@ -0,0 +1,85 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "dbwrapper.h"
+#include "hash.h"
+#include "uint256.h"
+
+#include <boost/filesystem.hpp>
+
+/** Records per batch, about what a chain state flush writes per block */
+static const int BENCH_DB_BATCH_RECORDS = 1000;
+/** Size of a record's value, about that of a compressed coins record */
+static const int BENCH_DB_VALUE_SIZE = 80;
+/** Memory budget of the benchmarked databases */
+static const size_t BENCH_DB_CACHE_SIZE = 8 << 20;
+
+static uint256 BenchDBKey(uint32_t n)
+{
+    return Hash(BEGIN(n), END(n));
+}
+
+static void WriteBatches(benchmark::State& state, bool fBulkLoad)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    {
+        CDBOptions dbOptions(BENCH_DB_CACHE_SIZE);
+        dbOptions.fBulkLoad = fBulkLoad;
+        CDBWrapper db(path, dbOptions, false, true, true);
+        std::vector<unsigned char> value(BENCH_DB_VALUE_SIZE, 0x42);
+        uint32_t n = 0;
+        while (state.KeepRunning()) {
+            CDBBatch batch(&db.GetObfuscateKey());
+            for (int i = 0; i < BENCH_DB_BATCH_RECORDS; i++)
+                batch.Write(BenchDBKey(n++), value);
+            db.WriteBatch(batch);
+        }
+        db.FinishBulkLoad();
+    }
+    boost::filesystem::remove_all(path);
+}
+
+static void DBWriteBatch(benchmark::State& state)
+{
+    WriteBatches(state, false);
+}
+
+static void DBWriteBatchBulkLoad(benchmark::State& state)
+{
+    WriteBatches(state, true);
+}
+
+static void DBRandomRead(benchmark::State& state)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    {
+        CDBOptions dbOptions(BENCH_DB_CACHE_SIZE);
+        dbOptions.fBulkLoad = true;
+        CDBWrapper db(path, dbOptions, false, true, true);
+        const uint32_t nRecords = 200 * BENCH_DB_BATCH_RECORDS;
+        std::vector<unsigned char> value(BENCH_DB_VALUE_SIZE, 0x42);
+        for (uint32_t n = 0; n < nRecords; ) {
+            CDBBatch batch(&db.GetObfuscateKey());
+            for (int i = 0; i < BENCH_DB_BATCH_RECORDS; i++)
+                batch.Write(BenchDBKey(n++), value);
+            db.WriteBatch(batch);
+        }
+        db.FinishBulkLoad();
+
+        uint32_t n = 0;
+        while (state.KeepRunning()) {
+            for (int i = 0; i < BENCH_DB_BATCH_RECORDS; i++) {
+                n = n * 1103515245 + 12345;
+                db.Read(BenchDBKey(n % nRecords), value);
+            }
+        }
+    }
+    boost::filesystem::remove_all(path);
+}
+
+BENCHMARK(DBWriteBatch);
+BENCHMARK(DBWriteBatchBulkLoad);
+BENCHMARK(DBRandomRead);
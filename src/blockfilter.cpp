@@ -0,0 +1,185 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "crypto/common.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/script.h"
+
+#include <algorithm>
+
+#include <boost/foreach.hpp>
+
+// Fixed SipHash key of the element hashes
+static const uint64_t BLOCK_FILTER_K0 = 0x6b636f6c62726c66ULL;
+static const uint64_t BLOCK_FILTER_K1 = 0x7265746c69666b62ULL;
+
+/** Map x uniformly onto [0, n), as (x * n) >> 64 */
+static uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+    uint64_t x_hi = x >> 32, x_lo = x & 0xFFFFFFFF;
+    uint64_t n_hi = n >> 32, n_lo = n & 0xFFFFFFFF;
+    uint64_t ac = x_hi * n_hi;
+    uint64_t ad = x_hi * n_lo;
+    uint64_t bc = x_lo * n_hi;
+    uint64_t bd = x_lo * n_lo;
+    uint64_t mid34 = (bd >> 32) + (bc & 0xFFFFFFFF) + (ad & 0xFFFFFFFF);
+    return ac + (bc >> 32) + (ad >> 32) + (mid34 >> 32);
+}
+
+namespace {
+
+/** Writes a stream of bits, most significant first */
+class CBitWriter
+{
+private:
+    std::vector<unsigned char>& vch;
+    int nBits;
+
+public:
+    CBitWriter(std::vector<unsigned char>& vchIn) : vch(vchIn), nBits(8) {}
+
+    void Write(uint64_t data, int nCount)
+    {
+        while (nCount > 0) {
+            if (nBits == 8) {
+                vch.push_back(0);
+                nBits = 0;
+            }
+            int n = std::min(8 - nBits, nCount);
+            vch.back() |= ((data >> (nCount - n)) & ((1 << n) - 1)) << (8 - nBits - n);
+            nBits += n;
+            nCount -= n;
+        }
+    }
+};
+
+/** Reads a stream of bits written by CBitWriter */
+class CBitReader
+{
+private:
+    const std::vector<unsigned char>& vch;
+    size_t nPos;
+    int nBits;
+
+public:
+    CBitReader(const std::vector<unsigned char>& vchIn) : vch(vchIn), nPos(0), nBits(0) {}
+
+    /** Read nCount bits; returns false when the stream is exhausted */
+    bool Read(uint64_t& data, int nCount)
+    {
+        data = 0;
+        while (nCount > 0) {
+            if (nPos == vch.size())
+                return false;
+            int n = std::min(8 - nBits, nCount);
+            data = (data << n) | ((vch[nPos] >> (8 - nBits - n)) & ((1 << n) - 1));
+            nBits += n;
+            nCount -= n;
+            if (nBits == 8) {
+                nPos++;
+                nBits = 0;
+            }
+        }
+        return true;
+    }
+};
+
+/** Golomb-Rice decode the next difference of a filter */
+bool ReadDelta(CBitReader& reader, uint64_t& delta)
+{
+    uint64_t q = 0, bit;
+    while (true) {
+        if (!reader.Read(bit, 1))
+            return false;
+        if (!bit)
+            break;
+        q++;
+    }
+    if (!reader.Read(delta, CBlockFilter::P))
+        return false;
+    delta |= q << CBlockFilter::P;
+    return true;
+}
+
+} // anon namespace
+
+uint64_t CBlockFilter::HashElement(const CScript& script)
+{
+    return CSipHasher(BLOCK_FILTER_K0, BLOCK_FILTER_K1).Write(begin_ptr(script), script.size()).Finalize();
+}
+
+uint64_t CBlockFilter::HashElement(const COutPoint& outpoint)
+{
+    unsigned char n[4];
+    WriteLE32(n, outpoint.n);
+    return CSipHasher(BLOCK_FILTER_K0, BLOCK_FILTER_K1).Write(outpoint.hash.begin(), 32).Write(n, 4).Finalize();
+}
+
+CBlockFilter::CBlockFilter(const CBlock& block) : nElements(0)
+{
+    std::vector<uint64_t> vHashes;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        BOOST_FOREACH(const CTxOut& txout, tx.vout) {
+            const CScript& script = txout.scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN)
+                continue;
+            vHashes.push_back(HashElement(script));
+        }
+        if (tx.IsCoinBase())
+            continue;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            vHashes.push_back(HashElement(txin.prevout));
+    }
+    std::sort(vHashes.begin(), vHashes.end());
+    vHashes.erase(std::unique(vHashes.begin(), vHashes.end()), vHashes.end());
+
+    nElements = vHashes.size();
+    const uint64_t nRange = nElements * M;
+    CBitWriter writer(vchEncoded);
+    uint64_t nLast = 0;
+    BOOST_FOREACH(uint64_t hash, vHashes) {
+        // Mapping onto the range preserves the order of the hashes
+        uint64_t value = MapIntoRange(hash, nRange);
+        uint64_t delta = value - nLast;
+        for (uint64_t q = delta >> P; q > 0; q--)
+            writer.Write(1, 1);
+        writer.Write(0, 1);
+        writer.Write(delta, P);
+        nLast = value;
+    }
+}
+
+bool CBlockFilter::MatchAny(const std::vector<uint64_t>& vHashes) const
+{
+    if (nElements == 0 || vHashes.empty())
+        return false;
+
+    // Walk the sorted filter values and queried values together
+    const uint64_t nRange = nElements * M;
+    CBitReader reader(vchEncoded);
+    uint64_t value = 0, delta;
+    if (!ReadDelta(reader, delta))
+        return false;
+    value = delta;
+    uint32_t nRead = 1;
+    std::vector<uint64_t>::const_iterator it = vHashes.begin();
+    uint64_t query = MapIntoRange(*it, nRange);
+    while (true) {
+        if (query == value)
+            return true;
+        if (query < value) {
+            if (++it == vHashes.end())
+                return false;
+            query = MapIntoRange(*it, nRange);
+        } else {
+            if (nRead == nElements || !ReadDelta(reader, delta))
+                return false;
+            value += delta;
+            nRead++;
+        }
+    }
+}
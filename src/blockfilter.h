@@ -0,0 +1,60 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "serialize.h"
+
+#include <stdint.h>
+#include <vector>
+
+class CBlock;
+class COutPoint;
+class CScript;
+
+/**
+ * Compact filter of the output scripts and spent outpoints of a block,
+ * stored as a Golomb-coded set.
+ *
+ * Elements are hashed with SipHash under a fixed key, so a querier can hash
+ * its elements once and test them against the filters of many blocks. Each
+ * filter maps the hashes of its n elements onto [0, n * M) and stores their
+ * sorted differences Golomb-Rice coded with parameter P, which gives a false
+ * positive rate of about 1/M per queried element.
+ */
+class CBlockFilter
+{
+private:
+    uint32_t nElements;
+    std::vector<unsigned char> vchEncoded;
+
+public:
+    static const int P = 19;
+    static const uint64_t M = 784931;
+
+    CBlockFilter() : nElements(0) {}
+    explicit CBlockFilter(const CBlock& block);
+
+    /** Hash of an output script, as used to query filters */
+    static uint64_t HashElement(const CScript& script);
+    /** Hash of a spent outpoint, as used to query filters */
+    static uint64_t HashElement(const COutPoint& outpoint);
+
+    /** Whether any of the element hashes in vHashes, which must be sorted, may be in the block */
+    bool MatchAny(const std::vector<uint64_t>& vHashes) const;
+
+    unsigned int GetElementCount() const { return nElements; }
+    const std::vector<unsigned char>& GetEncoded() const { return vchEncoded; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(VARINT(nElements));
+        READWRITE(vchEncoded);
+    }
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
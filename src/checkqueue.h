@@ -8,10 +8,14 @@
 #include <algorithm>
 #include <vector>
 
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 template <typename T>
 class CCheckQueueControl;
@@ -212,4 +216,79 @@ public:
     }
 };
 
+/**
+ * A CCheckQueue with worker threads of its own, for parallel work outside of
+ * block validation. The workers run from Start() until Stop() or destruction,
+ * so a pool can serve a single job or live for the whole session.
+ *
+ * Run() may be called from any thread. As a queue only has one master at a
+ * time, concurrent callers take turns, each using all the workers.
+ */
+template <typename T>
+class CCheckQueuePool : private boost::noncopyable
+{
+private:
+    CCheckQueue<T> queue;
+    boost::scoped_ptr<boost::thread_group> threadGroup;
+
+    //! Held by the caller of Run() acting as the queue's master
+    boost::mutex mutexMaster;
+
+public:
+    //! Create a pool, with nThreads worker threads if not 0
+    CCheckQueuePool(unsigned int nBatchSizeIn, int nThreads = 0) : queue(nBatchSizeIn)
+    {
+        Start(nThreads);
+    }
+
+    ~CCheckQueuePool()
+    {
+        Stop();
+    }
+
+    //! Start nThreads worker threads, in addition to the thread calling Run()
+    void Start(int nThreads)
+    {
+        boost::unique_lock<boost::mutex> lock(mutexMaster);
+        if (threadGroup || nThreads <= 0)
+            return;
+        threadGroup.reset(new boost::thread_group());
+        for (int i = 0; i < nThreads; i++)
+            threadGroup->create_thread(boost::bind(&CCheckQueue<T>::Thread, &queue));
+    }
+
+    //! Stop the worker threads. Later calls to Run() do all the work themselves.
+    void Stop()
+    {
+        boost::unique_lock<boost::mutex> lock(mutexMaster);
+        if (!threadGroup)
+            return;
+        threadGroup->interrupt_all();
+        threadGroup->join_all();
+        threadGroup.reset();
+    }
+
+    //! Number of worker threads, not counting the thread calling Run()
+    int Size()
+    {
+        boost::unique_lock<boost::mutex> lock(mutexMaster);
+        return threadGroup ? (int)threadGroup->size() : 0;
+    }
+
+    //! Run all checks, on the calling thread too, and return whether all were successful
+    bool Run(std::vector<T>& vChecks)
+    {
+        boost::unique_lock<boost::mutex> lock(mutexMaster);
+        if (!threadGroup) {
+            BOOST_FOREACH (T& check, vChecks)
+                if (!check())
+                    return false;
+            return true;
+        }
+        CCheckQueueControl<T> control(&queue);
+        control.Add(vChecks);
+        return control.Wait();
+    }
+};
+
 #endif // BITCOIN_CHECKQUEUE_H
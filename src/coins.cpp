@@ -4,9 +4,13 @@
 
 #include "coins.h"
 
+#include "arith_uint256.h"
+#include "clientversion.h"
+#include "hash.h"
 #include "memusage.h"
 #include "random.h"
 
+#include <algorithm>
 #include <assert.h>
 
 /**
@@ -41,11 +45,70 @@ bool CCoins::Spend(uint32_t nPos)
     return true;
 }
 
+void CCoinsRunningStats::ApplyOutput(const uint256& txid, unsigned int nPos, const CTxOut& out, bool fAdd)
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << txid << VARINT(nPos) << out;
+    arith_uint256 hash = UintToArith256(hashRolling);
+    if (fAdd) {
+        hash += UintToArith256(ss.GetHash());
+        nTransactionOutputs++;
+        nTotalAmount += out.nValue;
+    } else {
+        hash -= UintToArith256(ss.GetHash());
+        nTransactionOutputs--;
+        nTotalAmount -= out.nValue;
+    }
+    hashRolling = ArithToUint256(hash);
+}
+
+void CCoinsRunningStats::ApplyCoins(const uint256& txid, const CCoins& coins, bool fAdd)
+{
+    // The same 32 + value size per record that CCoinsViewDB::GetStats counts.
+    uint64_t nSize = 32 + ::GetSerializeSize(coins, SER_DISK, CLIENT_VERSION);
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        if (!coins.vout[i].IsNull())
+            ApplyOutput(txid, i, coins.vout[i], fAdd);
+    }
+    if (fAdd) {
+        nTransactions++;
+        nSerializedSize += nSize;
+    } else {
+        nTransactions--;
+        nSerializedSize -= nSize;
+    }
+}
+
+void CCoinsRunningStats::ApplyChange(const uint256& txid, const CCoins& coinsOld, const CCoins& coinsNew)
+{
+    if (!coinsOld.IsPruned()) {
+        nTransactions--;
+        nSerializedSize -= 32 + ::GetSerializeSize(coinsOld, SER_DISK, CLIENT_VERSION);
+    }
+    if (!coinsNew.IsPruned()) {
+        nTransactions++;
+        nSerializedSize += 32 + ::GetSerializeSize(coinsNew, SER_DISK, CLIENT_VERSION);
+    }
+    // Outputs that are unspent and equal on both sides cancel out.
+    unsigned int nOutputs = std::max(coinsOld.vout.size(), coinsNew.vout.size());
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        const CTxOut* pOld = i < coinsOld.vout.size() && !coinsOld.vout[i].IsNull() ? &coinsOld.vout[i] : NULL;
+        const CTxOut* pNew = i < coinsNew.vout.size() && !coinsNew.vout[i].IsNull() ? &coinsNew.vout[i] : NULL;
+        if (pOld && pNew && *pOld == *pNew)
+            continue;
+        if (pOld)
+            ApplyOutput(txid, i, *pOld, false);
+        if (pNew)
+            ApplyOutput(txid, i, *pNew, true);
+    }
+}
+
 bool CCoinsView::GetCoins(const uint256 &txid, CCoins &coins) const { return false; }
 bool CCoinsView::HaveCoins(const uint256 &txid) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
 bool CCoinsView::GetStats(CCoinsStats &stats) const { return false; }
+CCoinsViewCursor *CCoinsView::Cursor() const { return 0; }
 
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
@@ -55,6 +118,11 @@ uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
 bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
 bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStats(stats); }
+CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
+
+CCoinsViewCursor::~CCoinsViewCursor()
+{
+}
 
 CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
 
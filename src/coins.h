@@ -305,11 +305,75 @@ struct CCoinsStats
     uint64_t nTransactionOutputs;
     uint64_t nSerializedSize;
     uint256 hashSerialized;
+    uint256 hashRolling;
     CAmount nTotalAmount;
 
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
 };
 
+/**
+ * UTXO set statistics that can be kept up to date block by block. Every
+ * field is a sum over the unspent records, so adding or removing one record
+ * (ApplyCoins) or output updates them without looking at the rest of the set.
+ * hashRolling is the sum, modulo 2^256, of a hash of each unspent output.
+ * It does not depend on the order outputs were added in, so it catches the
+ * running statistics drifting from the set on disk, but a sum like this can
+ * be forged with a generalized birthday attack: it must not be compared
+ * against a value from another node or used to trust a UTXO set. Use
+ * hashSerialized for that.
+ */
+struct CCoinsRunningStats
+{
+    uint256 hashBlock;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nSerializedSize;
+    CAmount nTotalAmount;
+    uint256 hashRolling;
+
+    CCoinsRunningStats() : nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hashBlock);
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nSerializedSize);
+        READWRITE(nTotalAmount);
+        READWRITE(hashRolling);
+    }
+
+    //! Add (fAdd) or remove the unspent outputs of the record for txid
+    void ApplyCoins(const uint256& txid, const CCoins& coins, bool fAdd);
+    //! Replace the record for txid, coinsOld, with coinsNew; either may be pruned
+    void ApplyChange(const uint256& txid, const CCoins& coinsOld, const CCoins& coinsNew);
+
+private:
+    void ApplyOutput(const uint256& txid, unsigned int nPos, const CTxOut& out, bool fAdd);
+};
+
+
+/** Cursor over the records of a CCoinsView, in txid order */
+class CCoinsViewCursor
+{
+public:
+    CCoinsViewCursor(const uint256 &hashBlockIn): hashBlock(hashBlockIn) {}
+    virtual ~CCoinsViewCursor();
+
+    virtual bool GetKey(uint256 &key) const = 0;
+    virtual bool GetValue(CCoins &coins) const = 0;
+    virtual unsigned int GetValueSize() const = 0;
+
+    virtual bool Valid() const = 0;
+    virtual void Next() = 0;
+
+    //! Get best block at the time this cursor was created
+    const uint256 &GetBestBlock() const { return hashBlock; }
+private:
+    uint256 hashBlock;
+};
 
 /** Abstract view on the open txout dataset. */
 class CCoinsView
@@ -332,6 +396,9 @@ public:
     //! Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats) const;
 
+    //! Get a cursor to iterate over the whole state, or NULL if not supported
+    virtual CCoinsViewCursor *Cursor() const;
+
     //! As we use CCoinsViews polymorphically, have a virtual destructor
     virtual ~CCoinsView() {}
 };
@@ -351,6 +418,7 @@ public:
     void SetBackend(CCoinsView &viewIn);
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+    CCoinsViewCursor *Cursor() const;
 };
 
 
@@ -0,0 +1,65 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSNAPSHOT_H
+#define BITCOIN_COINSNAPSHOT_H
+
+#include "coins.h"
+#include "protocol.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <string.h>
+
+/** Version of the UTXO set snapshot file format */
+static const int COINS_SNAPSHOT_VERSION = 1;
+/** Maximum number of coins records in one checksummed chunk of a snapshot */
+static const unsigned int COINS_SNAPSHOT_CHUNK_RECORDS = 10000;
+
+/**
+ * Header of a UTXO set snapshot file, as written by dumptxoutset and read
+ * by -loadutxosnapshot.
+ *
+ * The header is followed by the block headers from height 1 up to the
+ * snapshot block, each with its transaction count and then a checksum of
+ * that section. After that come the coins: chunks of up to
+ * COINS_SNAPSHOT_CHUNK_RECORDS (txid, CCoins) records in the usual
+ * compressed disk format, each written as a record count, a byte size, the
+ * data and a checksum of the data. A chunk with zero records ends the file.
+ * The stats cover the whole set, so a loaded snapshot can be checked
+ * against them, rolling hash included.
+ *
+ * All of that only shows the file is consistent with itself. What a loaded
+ * snapshot is trusted on is its coins hash: the double SHA256 of the
+ * snapshot block hash followed by the data of every chunk, in order.
+ * dumptxoutset reports it, and -loadutxosnapshothash must give the same
+ * value, taken from a source the user trusts rather than from the file.
+ */
+class CCoinsSnapshotHeader
+{
+public:
+    CMessageHeader::MessageStartChars pchMessageStart;
+    int nVersion;
+    uint256 hashBlock;
+    int nHeight;
+    CCoinsRunningStats stats;
+
+    CCoinsSnapshotHeader() : nVersion(COINS_SNAPSHOT_VERSION), nHeight(0)
+    {
+        memset(pchMessageStart, 0, sizeof(pchMessageStart));
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersionIn) {
+        READWRITE(FLATDATA(pchMessageStart));
+        READWRITE(nVersion);
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(stats);
+    }
+};
+
+#endif // BITCOIN_COINSNAPSHOT_H
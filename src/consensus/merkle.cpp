@@ -1,5 +1,6 @@
 #include "merkle.h"
 #include "hash.h"
+#include "crypto/sha256.h"
 #include "utilstrencodings.h"
 
 /*     WARNING! If you're reading this because you're learning about crypto
@@ -126,10 +127,29 @@ static void MerkleComputation(const std::vector<uint256>& leaves, uint256* proot
     if (proot) *proot = h;
 }
 
-uint256 ComputeMerkleRoot(const std::vector<uint256>& leaves, bool* mutated) {
-    uint256 hash;
-    MerkleComputation(leaves, &hash, mutated, -1, NULL);
-    return hash;
+/* Compute the merkle root level by level, overwriting hashes. Every level is
+ * hashed with a single (possibly SIMD accelerated) SHA256D64 call. */
+static uint256 MerkleRootInPlace(std::vector<uint256>& hashes, bool* mutated) {
+    bool mutation = false;
+    while (hashes.size() > 1) {
+        if (mutated) {
+            for (size_t pos = 0; pos + 1 < hashes.size(); pos += 2) {
+                if (hashes[pos] == hashes[pos + 1]) mutation = true;
+            }
+        }
+        if (hashes.size() & 1) {
+            hashes.push_back(hashes.back());
+        }
+        SHA256D64(hashes[0].begin(), hashes[0].begin(), hashes.size() / 2);
+        hashes.resize(hashes.size() / 2);
+    }
+    if (mutated) *mutated = mutation;
+    if (hashes.size() == 0) return uint256();
+    return hashes[0];
+}
+
+uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* mutated) {
+    return MerkleRootInPlace(hashes, mutated);
 }
 
 std::vector<uint256> ComputeMerkleBranch(const std::vector<uint256>& leaves, uint32_t position) {
@@ -151,22 +171,76 @@ uint256 ComputeMerkleRootFromBranch(const uint256& leaf, const std::vector<uint2
     return hash;
 }
 
-uint256 BlockMerkleRoot(const CBlock& block, bool* mutated)
+/* Total number of nodes in a Merkle tree over nLeaves leaves, as laid out by ComputeMerkleTree. */
+static size_t MerkleTreeSize(size_t nLeaves) {
+    size_t nSize = nLeaves;
+    for (size_t nLevel = nLeaves; nLevel > 1; nLevel = (nLevel + 1) / 2) {
+        nSize += (nLevel + 1) / 2;
+    }
+    return nSize;
+}
+
+std::vector<uint256> ComputeMerkleTree(const std::vector<uint256>& leaves, MerkleHashFunc hashfunc) {
+    std::vector<uint256> tree;
+    tree.reserve(MerkleTreeSize(leaves.size()));
+    tree.assign(leaves.begin(), leaves.end());
+    size_t nLevelBegin = 0;
+    for (size_t nLevel = leaves.size(); nLevel > 1; nLevel = (nLevel + 1) / 2) {
+        size_t nParentBegin = nLevelBegin + nLevel;
+        tree.resize(nParentBegin + (nLevel + 1) / 2);
+        // All complete pairs of the level are adjacent in memory and can be hashed at once.
+        hashfunc(tree[nParentBegin].begin(), tree[nLevelBegin].begin(), nLevel / 2);
+        if (nLevel & 1) {
+            // The odd node at the end of a level is hashed with itself.
+            unsigned char pair[64];
+            memcpy(pair, tree[nParentBegin - 1].begin(), 32);
+            memcpy(pair + 32, tree[nParentBegin - 1].begin(), 32);
+            hashfunc(tree.back().begin(), pair, 1);
+        }
+        nLevelBegin = nParentBegin;
+    }
+    return tree;
+}
+
+std::vector<uint256> BlockMerkleTree(const CBlock& block, MerkleHashFunc hashfunc)
 {
     std::vector<uint256> leaves;
     leaves.resize(block.vtx.size());
     for (size_t s = 0; s < block.vtx.size(); s++) {
         leaves[s] = block.vtx[s].GetHash();
     }
-    return ComputeMerkleRoot(leaves, mutated);
+    return ComputeMerkleTree(leaves, hashfunc);
+}
+
+uint256 BlockMerkleRoot(const CBlock& block, bool* mutated, MerkleHashFunc hashfunc)
+{
+    const std::vector<uint256> tree = BlockMerkleTree(block, hashfunc);
+    if (mutated) {
+        // Look for identical sibling nodes at any level (see the warning above).
+        *mutated = false;
+        size_t nLevelBegin = 0;
+        for (size_t nLevel = block.vtx.size(); nLevel > 1; nLevel = (nLevel + 1) / 2) {
+            for (size_t pos = 0; pos + 1 < nLevel; pos += 2) {
+                if (tree[nLevelBegin + pos] == tree[nLevelBegin + pos + 1]) {
+                    *mutated = true;
+                }
+            }
+            nLevelBegin += nLevel;
+        }
+    }
+    return tree.empty() ? uint256() : tree.back();
 }
 
 std::vector<uint256> BlockMerkleBranch(const CBlock& block, uint32_t position)
 {
-    std::vector<uint256> leaves;
-    leaves.resize(block.vtx.size());
-    for (size_t s = 0; s < block.vtx.size(); s++) {
-        leaves[s] = block.vtx[s].GetHash();
+    const std::vector<uint256> tree = BlockMerkleTree(block);
+    std::vector<uint256> branch;
+    size_t nLevelBegin = 0;
+    for (size_t nLevel = block.vtx.size(); nLevel > 1; nLevel = (nLevel + 1) / 2) {
+        size_t pos = std::min((size_t)(position ^ 1), nLevel - 1);
+        branch.push_back(tree[nLevelBegin + pos]);
+        position >>= 1;
+        nLevelBegin += nLevel;
     }
-    return ComputeMerkleBranch(leaves, position);
+    return branch;
 }
@@ -8,19 +8,39 @@
 #include <stdint.h>
 #include <vector>
 
+#include "crypto/sha256.h"
 #include "primitives/transaction.h"
 #include "primitives/block.h"
 #include "uint256.h"
 
-uint256 ComputeMerkleRoot(const std::vector<uint256>& leaves, bool* mutated = NULL);
+/*
+ * Function hashing pairs of adjacent 32-byte hashes into their parents, with
+ * the same signature and semantics as SHA256D64.
+ */
+typedef void (*MerkleHashFunc)(unsigned char* output, const unsigned char* input, size_t blocks);
+
+uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* mutated = NULL);
 std::vector<uint256> ComputeMerkleBranch(const std::vector<uint256>& leaves, uint32_t position);
 uint256 ComputeMerkleRootFromBranch(const uint256& leaf, const std::vector<uint256>& branch, uint32_t position);
 
+/*
+ * Compute all nodes of the Merkle tree over the given leaves, level by level
+ * starting with the leaves themselves and ending with the root. The last
+ * node of a level with an odd number of nodes is not duplicated.
+ */
+std::vector<uint256> ComputeMerkleTree(const std::vector<uint256>& leaves, MerkleHashFunc hashfunc = SHA256D64);
+
+/*
+ * Compute the Merkle tree (as laid out by ComputeMerkleTree) of the
+ * transactions in a block.
+ */
+std::vector<uint256> BlockMerkleTree(const CBlock& block, MerkleHashFunc hashfunc = SHA256D64);
+
 /*
  * Compute the Merkle root of the transactions in a block.
  * *mutated is set to true if a duplicated subtree was found.
  */
-uint256 BlockMerkleRoot(const CBlock& block, bool* mutated = NULL);
+uint256 BlockMerkleRoot(const CBlock& block, bool* mutated = NULL, MerkleHashFunc hashfunc = SHA256D64);
 
 /*
  * Compute the Merkle branch for the tree of transactions in a block, for a
@@ -6,8 +6,38 @@
 
 #include "crypto/common.h"
 
+#include <algorithm>
 #include <string.h>
 
+// The SIMD implementations are not built into libbitcoinconsensus.
+#if !defined(BUILD_BITCOIN_INTERNAL)
+#if defined(ENABLE_SSE41)
+#define USE_SHA256_SSE41 1
+namespace sha256_sse41
+{
+void Transform_4way(uint32_t* s, const unsigned char* chunks);
+}
+#endif
+#if defined(ENABLE_AVX2)
+#define USE_SHA256_AVX2 1
+namespace sha256_avx2
+{
+void Transform_8way(uint32_t* s, const unsigned char* chunks);
+}
+#endif
+#if defined(ENABLE_SHANI)
+#define USE_SHA256_SHANI 1
+namespace sha256_shani
+{
+void Transform(uint32_t* s, const unsigned char* chunk);
+}
+#endif
+#endif
+
+#if defined(USE_SHA256_SSE41) || defined(USE_SHA256_AVX2) || defined(USE_SHA256_SHANI)
+#include <cpuid.h>
+#endif
+
 // Internal implementation code.
 namespace
 {
@@ -128,8 +158,128 @@ void Transform(uint32_t* s, const unsigned char* chunk)
 }
 
 } // namespace sha256
+
+typedef void (*TransformType)(uint32_t*, const unsigned char*);
+
+/** The single-block transformation used by CSHA256, selected by SHA256AutoDetect. */
+TransformType Transform = sha256::Transform;
+
+/** Perform blocks independent transformations. s holds blocks*8 state words, chunks blocks*64 bytes. */
+typedef void (*TransformManyType)(uint32_t* s, const unsigned char* chunks, size_t blocks);
+
+void TransformManyGeneric(uint32_t* s, const unsigned char* chunks, size_t blocks)
+{
+    for (size_t i = 0; i < blocks; i++) {
+        Transform(s + 8 * i, chunks + 64 * i);
+    }
+}
+
+#if defined(USE_SHA256_SSE41)
+void TransformManySSE41(uint32_t* s, const unsigned char* chunks, size_t blocks)
+{
+    for (; blocks >= 4; blocks -= 4, s += 32, chunks += 256) {
+        sha256_sse41::Transform_4way(s, chunks);
+    }
+    TransformManyGeneric(s, chunks, blocks);
+}
+#endif
+
+#if defined(USE_SHA256_AVX2)
+void TransformManyAVX2(uint32_t* s, const unsigned char* chunks, size_t blocks)
+{
+    for (; blocks >= 8; blocks -= 8, s += 64, chunks += 512) {
+        sha256_avx2::Transform_8way(s, chunks);
+    }
+    TransformManyGeneric(s, chunks, blocks);
+}
+#endif
+
+/** The multi-block transformation used by SHA256D64 and SHA256D80, selected by SHA256AutoDetect. */
+TransformManyType TransformMany = TransformManyGeneric;
+
+/** Number of inputs hashed per TransformMany call. */
+const size_t BATCH_SIZE = 8;
+
+/** Hash the 32-byte digests in s (laid out as by TransformMany) a second time, writing the results to output. */
+void SecondHash(unsigned char* output, uint32_t* s, unsigned char* chunks, size_t blocks)
+{
+    for (size_t i = 0; i < blocks; i++) {
+        for (int j = 0; j < 8; j++) {
+            WriteBE32(chunks + 64 * i + 4 * j, s[8 * i + j]);
+        }
+        sha256::Initialize(s + 8 * i);
+    }
+    TransformMany(s, chunks, blocks);
+    for (size_t i = 0; i < blocks; i++) {
+        for (int j = 0; j < 8; j++) {
+            WriteBE32(output + 32 * i + 4 * j, s[8 * i + j]);
+        }
+    }
+}
+
+/** Fill the second half of each chunk with the padding for a 32-byte message. */
+void InitSecondHashChunks(unsigned char* chunks)
+{
+    memset(chunks, 0, 64 * BATCH_SIZE);
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        chunks[64 * i + 32] = 0x80;
+        chunks[64 * i + 62] = 0x01; // 256 bits
+    }
+}
+
+#if defined(USE_SHA256_SSE41) || defined(USE_SHA256_AVX2) || defined(USE_SHA256_SHANI)
+/** Check whether the OS saves the AVX (YMM) registers on context switches. */
+bool AVXEnabled()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+#endif
 } // namespace
 
+std::string SHA256AutoDetect()
+{
+    std::string ret = "standard";
+#if defined(USE_SHA256_SSE41) || defined(USE_SHA256_AVX2) || defined(USE_SHA256_SHANI)
+    bool have_sse41 = false;
+    bool have_avx2 = false;
+    bool have_shani = false;
+    uint32_t eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        have_sse41 = (ecx >> 19) & 1;
+        bool have_avx = ((ecx >> 27) & 1) && ((ecx >> 28) & 1) && AVXEnabled();
+        if (__get_cpuid_max(0, NULL) >= 7) {
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            have_avx2 = have_avx && ((ebx >> 5) & 1);
+            have_shani = have_sse41 && ((ebx >> 29) & 1);
+        }
+    }
+
+#if defined(USE_SHA256_SHANI)
+    if (have_shani) {
+        // A single SHA-NI stream outperforms the 8-way AVX2 code, so use it for everything.
+        Transform = sha256_shani::Transform;
+        TransformMany = TransformManyGeneric;
+        return "shani(1way)";
+    }
+#endif
+#if defined(USE_SHA256_AVX2)
+    if (have_avx2) {
+        TransformMany = TransformManyAVX2;
+        return ret + ",avx2(8way)";
+    }
+#endif
+#if defined(USE_SHA256_SSE41)
+    if (have_sse41) {
+        TransformMany = TransformManySSE41;
+        return ret + ",sse41(4way)";
+    }
+#endif
+#endif
+    return ret;
+}
+
 
 ////// SHA-256
 
@@ -147,12 +297,12 @@ CSHA256& CSHA256::Write(const unsigned char* data, size_t len)
         memcpy(buf + bufsize, data, 64 - bufsize);
         bytes += 64 - bufsize;
         data += 64 - bufsize;
-        sha256::Transform(s, buf);
+        Transform(s, buf);
         bufsize = 0;
     }
     while (end >= data + 64) {
         // Process full chunks directly from the source.
-        sha256::Transform(s, data);
+        Transform(s, data);
         bytes += 64;
         data += 64;
     }
@@ -187,3 +337,59 @@ CSHA256& CSHA256::Reset()
     sha256::Initialize(s);
     return *this;
 }
+
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks)
+{
+    uint32_t s[8 * BATCH_SIZE];
+    unsigned char padding[64 * BATCH_SIZE];
+    unsigned char chunks[64 * BATCH_SIZE];
+    // The first hash of every input ends with the same padding-only block.
+    memset(padding, 0, sizeof(padding));
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        padding[64 * i] = 0x80;
+        padding[64 * i + 62] = 0x02; // 512 bits
+    }
+    InitSecondHashChunks(chunks);
+    while (blocks) {
+        size_t n = std::min(blocks, BATCH_SIZE);
+        for (size_t i = 0; i < n; i++) {
+            sha256::Initialize(s + 8 * i);
+        }
+        TransformMany(s, input, n);
+        TransformMany(s, padding, n);
+        SecondHash(output, s, chunks, n);
+        input += 64 * n;
+        output += 32 * n;
+        blocks -= n;
+    }
+}
+
+void SHA256D80(unsigned char* output, const unsigned char* prefix, const unsigned char* tails, size_t blocks)
+{
+    uint32_t midstate[8];
+    uint32_t s[8 * BATCH_SIZE];
+    unsigned char tailchunks[64 * BATCH_SIZE];
+    unsigned char chunks[64 * BATCH_SIZE];
+    // All inputs share the state after their first 64 bytes.
+    sha256::Initialize(midstate);
+    Transform(midstate, prefix);
+    memset(tailchunks, 0, sizeof(tailchunks));
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        tailchunks[64 * i + 16] = 0x80;
+        tailchunks[64 * i + 62] = 0x02; // 640 bits
+        tailchunks[64 * i + 63] = 0x80;
+    }
+    InitSecondHashChunks(chunks);
+    while (blocks) {
+        size_t n = std::min(blocks, BATCH_SIZE);
+        for (size_t i = 0; i < n; i++) {
+            memcpy(s + 8 * i, midstate, sizeof(midstate));
+            memcpy(tailchunks + 64 * i, tails + 16 * i, 16);
+        }
+        TransformMany(s, tailchunks, n);
+        SecondHash(output, s, chunks, n);
+        tails += 16 * n;
+        output += 32 * n;
+        blocks -= n;
+    }
+}
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -25,4 +26,25 @@ public:
     CSHA256& Reset();
 };
 
+/** Autodetect the best available SHA256 implementation.
+ *  Returns the name of the implementation.
+ */
+std::string SHA256AutoDetect();
+
+/** Compute multiple double-SHA256's of 64-byte blobs.
+ *  output:  pointer to a blocks*32 byte output buffer
+ *  input:   pointer to a blocks*64 byte input buffer
+ *  blocks:  the number of hashes to compute.
+ */
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
+
+/** Compute multiple double-SHA256's of 80-byte blobs that share their first 64 bytes,
+ *  such as a block header with varying nonces.
+ *  output:  pointer to a blocks*32 byte output buffer
+ *  prefix:  pointer to the 64 bytes shared by all inputs
+ *  tails:   pointer to a blocks*16 byte buffer with the last 16 bytes of each input
+ *  blocks:  the number of hashes to compute.
+ */
+void SHA256D80(unsigned char* output, const unsigned char* prefix, const unsigned char* tails, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
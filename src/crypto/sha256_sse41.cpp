@@ -0,0 +1,107 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// This is a 4-way SIMD implementation of the SHA-256 compression function,
+// processing four independent states at once. It is only compiled when the
+// compiler supports SSE4.1, and only used after a runtime CPU check.
+
+#ifdef ENABLE_SSE41
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "crypto/common.h"
+
+namespace sha256_sse41 {
+namespace {
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+__m128i inline Add(__m128i x, __m128i y) { return _mm_add_epi32(x, y); }
+__m128i inline Xor(__m128i x, __m128i y) { return _mm_xor_si128(x, y); }
+__m128i inline Or(__m128i x, __m128i y) { return _mm_or_si128(x, y); }
+__m128i inline And(__m128i x, __m128i y) { return _mm_and_si128(x, y); }
+__m128i inline ShR(__m128i x, int n) { return _mm_srli_epi32(x, n); }
+__m128i inline ShL(__m128i x, int n) { return _mm_slli_epi32(x, n); }
+__m128i inline RotR(__m128i x, int n) { return Or(ShR(x, n), ShL(x, 32 - n)); }
+
+__m128i inline Ch(__m128i x, __m128i y, __m128i z) { return Xor(z, And(x, Xor(y, z))); }
+__m128i inline Maj(__m128i x, __m128i y, __m128i z) { return Or(And(x, y), And(z, Or(x, y))); }
+__m128i inline Sigma0(__m128i x) { return Xor(Xor(RotR(x, 2), RotR(x, 13)), RotR(x, 22)); }
+__m128i inline Sigma1(__m128i x) { return Xor(Xor(RotR(x, 6), RotR(x, 11)), RotR(x, 25)); }
+__m128i inline sigma0(__m128i x) { return Xor(Xor(RotR(x, 7), RotR(x, 18)), ShR(x, 3)); }
+__m128i inline sigma1(__m128i x) { return Xor(Xor(RotR(x, 17), RotR(x, 19)), ShR(x, 10)); }
+
+/** Gather word i of the four states. */
+__m128i inline LoadState(const uint32_t* s, int i)
+{
+    return _mm_set_epi32(s[24 + i], s[16 + i], s[8 + i], s[i]);
+}
+
+/** Gather the big-endian message word at offset of the four chunks. */
+__m128i inline LoadWord(const unsigned char* chunks, int offset)
+{
+    return _mm_set_epi32(ReadBE32(chunks + 192 + offset), ReadBE32(chunks + 128 + offset),
+                         ReadBE32(chunks + 64 + offset), ReadBE32(chunks + offset));
+}
+
+/** Add v to word i of the four states. */
+void inline StoreState(uint32_t* s, int i, __m128i v)
+{
+    s[i] += _mm_extract_epi32(v, 0);
+    s[8 + i] += _mm_extract_epi32(v, 1);
+    s[16 + i] += _mm_extract_epi32(v, 2);
+    s[24 + i] += _mm_extract_epi32(v, 3);
+}
+
+} // namespace
+
+/** Perform four independent SHA-256 transformations. s holds 4*8 state words, chunks 4*64 bytes. */
+void Transform_4way(uint32_t* s, const unsigned char* chunks)
+{
+    __m128i w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = LoadWord(chunks, 4 * i);
+    }
+    for (int i = 16; i < 64; i++) {
+        w[i] = Add(Add(sigma1(w[i - 2]), w[i - 7]), Add(sigma0(w[i - 15]), w[i - 16]));
+    }
+
+    __m128i a = LoadState(s, 0), b = LoadState(s, 1), c = LoadState(s, 2), d = LoadState(s, 3);
+    __m128i e = LoadState(s, 4), f = LoadState(s, 5), g = LoadState(s, 6), h = LoadState(s, 7);
+
+    for (int i = 0; i < 64; i++) {
+        __m128i t1 = Add(Add(h, Sigma1(e)), Add(Ch(e, f, g), Add(_mm_set1_epi32(K[i]), w[i])));
+        __m128i t2 = Add(Sigma0(a), Maj(a, b, c));
+        h = g;
+        g = f;
+        f = e;
+        e = Add(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = Add(t1, t2);
+    }
+
+    StoreState(s, 0, a);
+    StoreState(s, 1, b);
+    StoreState(s, 2, c);
+    StoreState(s, 3, d);
+    StoreState(s, 4, e);
+    StoreState(s, 5, f);
+    StoreState(s, 6, g);
+    StoreState(s, 7, h);
+}
+
+} // namespace sha256_sse41
+
+#endif // ENABLE_SSE41
@@ -7,6 +7,8 @@
 #include "util.h"
 #include "random.h"
 
+#include <algorithm>
+
 #include <boost/filesystem.hpp>
 
 #include <leveldb/cache.h>
@@ -29,14 +31,34 @@ void HandleError(const leveldb::Status& status) throw(dbwrapper_error)
     throw dbwrapper_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+static size_t GetBlockCacheSize(const CDBOptions& dbOptions)
+{
+    // Loading is write-heavy and reads mostly hit the coins cache above us
+    return dbOptions.fBulkLoad ? dbOptions.nCacheSize / 8 : dbOptions.nCacheSize / 2;
+}
+
+static size_t GetWriteBufferSize(const CDBOptions& dbOptions)
+{
+    // up to two write buffers may be held in memory simultaneously
+    return dbOptions.fBulkLoad ? dbOptions.nCacheSize * 7 / 16 : dbOptions.nCacheSize / 4;
+}
+
+static size_t GetMaxFileSize(const CDBOptions& dbOptions)
+{
+    return dbOptions.fBulkLoad ? std::max(dbOptions.nMaxFileSize, (size_t)DEFAULT_DB_BULK_LOAD_FILE_SIZE << 20) : dbOptions.nMaxFileSize;
+}
+
+static leveldb::Options GetOptions(const CDBOptions& dbOptions)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    // The block cache also holds the index and filter blocks of the open table files
+    options.block_cache = leveldb::NewLRUCache(GetBlockCacheSize(dbOptions));
+    options.write_buffer_size = GetWriteBufferSize(dbOptions);
     options.filter_policy = leveldb::NewBloomFilterPolicy(10);
     options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.max_open_files = dbOptions.nMaxOpenFiles;
+    options.max_file_size = GetMaxFileSize(dbOptions);
+    options.max_subcompactions = dbOptions.nCompactionThreads;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -45,14 +67,15 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+CDBWrapper::CDBWrapper(const boost::filesystem::path& path, const CDBOptions& dbOptionsIn, bool fMemory, bool fWipe, bool obfuscate) : dbOptions(dbOptionsIn)
 {
     penv = NULL;
+    nBlockCacheSize = GetBlockCacheSize(dbOptions);
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(dbOptions);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -90,6 +113,15 @@ CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, b
     LogPrintf("Using obfuscation key for %s: %s\n", path.string(), GetObfuscateKeyHex());
 }
 
+CDBSnapshot::CDBSnapshot(const CDBWrapper& db) : pdb(db.pdb), psnapshot(db.pdb->GetSnapshot())
+{
+}
+
+CDBSnapshot::~CDBSnapshot()
+{
+    pdb->ReleaseSnapshot(psnapshot);
+}
+
 CDBWrapper::~CDBWrapper()
 {
     delete pdb;
@@ -136,6 +168,46 @@ bool CDBWrapper::IsEmpty()
     return !(it->Valid());
 }
 
+void CDBWrapper::FinishBulkLoad()
+{
+    if (!dbOptions.fBulkLoad)
+        return;
+    // Shrink the write buffer and the files first, so the compaction
+    // already writes files of the normal size.
+    dbOptions.fBulkLoad = false;
+    nBlockCacheSize = GetBlockCacheSize(dbOptions);
+    options.block_cache->SetCapacity(nBlockCacheSize);
+    options.write_buffer_size = GetWriteBufferSize(dbOptions);
+    options.max_file_size = GetMaxFileSize(dbOptions);
+    pdb->SetWriteSizes(options.write_buffer_size, options.max_file_size);
+    LogPrintf("Compacting LevelDB after bulk load...\n");
+    int64_t nStart = GetTimeMillis();
+    pdb->CompactRange(NULL, NULL);
+    LogPrintf("Compacted LevelDB in %dms\n", GetTimeMillis() - nStart);
+}
+
+CDBCacheStats CDBWrapper::GetCacheStats() const
+{
+    CDBCacheStats stats;
+    stats.nBlockCacheSize = nBlockCacheSize;
+    stats.nBlockCacheUsage = options.block_cache->TotalCharge();
+    options.block_cache->GetLookupCounts(&stats.nBlockCacheHits, &stats.nBlockCacheMisses);
+    std::string strValue;
+    if (pdb->GetProperty("leveldb.table-cache-hits", &strValue))
+        stats.nTableCacheHits = atoi64(strValue);
+    if (pdb->GetProperty("leveldb.table-cache-misses", &strValue))
+        stats.nTableCacheMisses = atoi64(strValue);
+    return stats;
+}
+
+uint64_t CDBWrapper::GetSplitCompactions() const
+{
+    std::string strValue;
+    if (!pdb->GetProperty("leveldb.split-compactions", &strValue))
+        return 0;
+    return atoi64(strValue);
+}
+
 const std::vector<unsigned char>& CDBWrapper::GetObfuscateKey() const
 {
     return obfuscate_key;
@@ -25,6 +25,56 @@ public:
 
 void HandleError(const leveldb::Status& status) throw(dbwrapper_error);
 
+/** Table files each database may keep open; this many are already budgeted for in the core file descriptors */
+static const int MIN_DB_MAX_OPEN_FILES = 64;
+#ifdef __linux__
+static const int DEFAULT_DB_MAX_OPEN_FILES = 1000;
+#else
+static const int DEFAULT_DB_MAX_OPEN_FILES = MIN_DB_MAX_OPEN_FILES;
+#endif
+/** Target size of a table file, in MiB */
+static const int DEFAULT_DB_MAX_FILE_SIZE = 2;
+/** Target size of a table file while bulk loading, in MiB */
+static const int DEFAULT_DB_BULK_LOAD_FILE_SIZE = 32;
+/** Threads a large compaction may be split across */
+static const int DEFAULT_DB_COMPACTION_THREADS = 4;
+
+/** LevelDB tuning for one database */
+struct CDBOptions
+{
+    //! memory budget, split between the block cache and the write buffers
+    size_t nCacheSize;
+    //! number of table files LevelDB may keep open
+    int nMaxOpenFiles;
+    //! target size of a table file, in bytes, outside bulk loading
+    size_t nMaxFileSize;
+    //! until FinishBulkLoad(), give most of the budget to the write buffers and write larger table files
+    bool fBulkLoad;
+    //! number of threads a large compaction may be split across
+    int nCompactionThreads;
+
+    CDBOptions(size_t nCacheSizeIn = 0) : nCacheSize(nCacheSizeIn),
+        nMaxOpenFiles(MIN_DB_MAX_OPEN_FILES), nMaxFileSize(DEFAULT_DB_MAX_FILE_SIZE << 20), fBulkLoad(false),
+        nCompactionThreads(1) {}
+};
+
+/** Block cache and table cache counters of one database */
+struct CDBCacheStats
+{
+    //! capacity of the block cache, in bytes
+    size_t nBlockCacheSize;
+    //! bytes held in the block cache, including pinned index and filter blocks
+    size_t nBlockCacheUsage;
+    uint64_t nBlockCacheHits;
+    uint64_t nBlockCacheMisses;
+    //! lookups of an open table file, which holds the file's index and filter
+    uint64_t nTableCacheHits;
+    uint64_t nTableCacheMisses;
+
+    CDBCacheStats() : nBlockCacheSize(0), nBlockCacheUsage(0), nBlockCacheHits(0), nBlockCacheMisses(0),
+        nTableCacheHits(0), nTableCacheMisses(0) {}
+};
+
 /** Batch of changes queued to be written to a CDBWrapper */
 class CDBBatch
 {
@@ -132,8 +182,28 @@ public:
 
 };
 
+class CDBWrapper;
+
+/** A view of a CDBWrapper as of when it was taken, unaffected by later writes */
+class CDBSnapshot
+{
+private:
+    leveldb::DB* pdb;
+    const leveldb::Snapshot* psnapshot;
+
+    CDBSnapshot(const CDBSnapshot&);
+    CDBSnapshot& operator=(const CDBSnapshot&);
+
+    friend class CDBWrapper;
+
+public:
+    CDBSnapshot(const CDBWrapper& db);
+    ~CDBSnapshot();
+};
+
 class CDBWrapper
 {
+    friend class CDBSnapshot;
 private:
     //! custom environment this database is using (may be NULL in case of default environment)
     leveldb::Env* penv;
@@ -156,6 +226,12 @@ private:
     //! the database itself
     leveldb::DB* pdb;
 
+    //! the tuning the database was opened with; fBulkLoad is cleared by FinishBulkLoad()
+    CDBOptions dbOptions;
+
+    //! capacity given to options.block_cache
+    size_t nBlockCacheSize;
+
     //! a key used for optional XOR-obfuscation of the database
     std::vector<unsigned char> obfuscate_key;
 
@@ -170,25 +246,33 @@ private:
 public:
     /**
      * @param[in] path        Location in the filesystem where leveldb data will be stored.
-     * @param[in] nCacheSize  Configures various leveldb cache settings.
+     * @param[in] dbOptions   Configures various leveldb settings; a bare cache size uses the defaults for the rest.
      * @param[in] fMemory     If true, use leveldb's memory environment.
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
      *                        with a zero'd byte array.
      */
-    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    CDBWrapper(const boost::filesystem::path& path, const CDBOptions& dbOptions, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
     ~CDBWrapper();
 
+    /**
+     * Read the value of key, as of snapshot if one is given. Bulk lookups
+     * pass fFillCache false, so as not to evict the blocks other reads use.
+     */
     template <typename K, typename V>
-    bool Read(const K& key, V& value) const throw(dbwrapper_error)
+    bool Read(const K& key, V& value, const CDBSnapshot* snapshot = NULL, bool fFillCache = true) const throw(dbwrapper_error)
     {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(ssKey.GetSerializeSize(key));
         ssKey << key;
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
+        leveldb::ReadOptions readopts = readoptions;
+        if (snapshot)
+            readopts.snapshot = snapshot->psnapshot;
+        readopts.fill_cache = fFillCache;
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status = pdb->Get(readopts, slKey, &strValue);
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -264,6 +348,25 @@ public:
      */
     bool IsEmpty();
 
+    /**
+     * Leave bulk-load mode: go back to the block cache, write buffer and file
+     * sizes of a database opened normally, then compact the whole database, so
+     * that reads no longer have to search through the files written while
+     * loading. No-op otherwise.
+     */
+    void FinishBulkLoad();
+
+    /**
+     * Return the block cache and table cache counters since the database was opened.
+     */
+    CDBCacheStats GetCacheStats() const;
+
+    /**
+     * Return the number of compactions since the database was opened that were
+     * split across several threads (see CDBOptions::nCompactionThreads).
+     */
+    uint64_t GetSplitCompactions() const;
+
     /**
      * Accessor for obfuscate_key.
      */
@@ -221,6 +221,66 @@ static bool InitRPCAuthentication()
     return true;
 }
 
+static UniValue gethttpinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "gethttpinfo\n"
+            "\nReturns the state of the HTTP server and the latency of the requests it served,\n"
+            "from receiving them to sending the reply, since it started.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"eventthreads\": n,      (numeric) threads accepting connections and reading requests\n"
+            "  \"workerthreads\": n,     (numeric) threads handling the requests\n"
+            "  \"workqueue\": n,         (numeric) requests waiting for a worker thread\n"
+            "  \"workqueuemax\": n,      (numeric) requests that may wait before new ones are rejected\n"
+            "  \"rejected\": n,          (numeric) requests rejected because the work queue was full\n"
+            "  \"requests\": n,          (numeric) requests replied to\n"
+            "  \"latency\": {            (json object) reply latency in microseconds, within 1/8\n"
+            "    \"p50\": n,             (numeric) median\n"
+            "    \"p90\": n,             (numeric) 90th percentile\n"
+            "    \"p99\": n,             (numeric) 99th percentile\n"
+            "    \"p999\": n,            (numeric) 99.9th percentile\n"
+            "    \"max\": n              (numeric) maximum\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("gethttpinfo", "")
+            + HelpExampleRpc("gethttpinfo", "")
+        );
+
+    HTTPServerStats stats;
+    GetHTTPServerStats(stats);
+    UniValue latency(UniValue::VOBJ);
+    latency.push_back(Pair("p50", stats.latency.Percentile(50)));
+    latency.push_back(Pair("p90", stats.latency.Percentile(90)));
+    latency.push_back(Pair("p99", stats.latency.Percentile(99)));
+    latency.push_back(Pair("p999", stats.latency.Percentile(99.9)));
+    latency.push_back(Pair("max", stats.latency.Max()));
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("eventthreads", stats.nEventThreads));
+    ret.push_back(Pair("workerthreads", stats.nWorkerThreads));
+    ret.push_back(Pair("workqueue", (uint64_t)stats.nWorkQueueDepth));
+    ret.push_back(Pair("workqueuemax", (uint64_t)stats.nWorkQueueMaxDepth));
+    ret.push_back(Pair("rejected", stats.nRejected));
+    ret.push_back(Pair("requests", stats.latency.Count()));
+    ret.push_back(Pair("latency", latency));
+    return ret;
+}
+
+static const CRPCCommand vHTTPRPCCommands[] =
+{ //  category              name                      actor (function)         okSafeMode
+  //  --------------------- ------------------------  -----------------------  ----------
+    { "control",            "gethttpinfo",            &gethttpinfo,            true  },
+};
+
+void RegisterHTTPRPCCommands(CRPCTable& tableRPC)
+{
+    for (unsigned int vcidx = 0; vcidx < ARRAYLEN(vHTTPRPCCommands); vcidx++)
+        tableRPC.appendCommand(vHTTPRPCCommands[vcidx].name, &vHTTPRPCCommands[vcidx]);
+}
+
 bool StartHTTPRPC()
 {
     LogPrint("rpc", "Starting HTTP RPC server\n");
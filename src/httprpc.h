@@ -8,8 +8,14 @@
 #include <string>
 #include <map>
 
+class CRPCTable;
 class HTTPRequest;
 
+/** Add the RPC commands about the HTTP server to the table.
+ * Call this before StartRPC.
+ */
+void RegisterHTTPRPCCommands(CRPCTable& tableRPC);
+
 /** Start HTTP RPC subsystem.
  * Precondition; HTTP and RPC has been started.
  */
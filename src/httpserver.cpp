@@ -11,7 +11,9 @@
 #include "rpcprotocol.h" // For HTTP status codes
 #include "sync.h"
 #include "ui_interface.h"
+#include "utiltime.h"
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,12 +22,15 @@
 #include <sys/stat.h>
 #include <signal.h>
 
+#include <limits>
+
 #include <event2/event.h>
 #include <event2/http.h>
 #include <event2/thread.h>
 #include <event2/buffer.h>
 #include <event2/util.h>
 #include <event2/keyvalq_struct.h>
+#include <event2/listener.h>
 
 #ifdef EVENT__HAVE_NETINET_IN_H
 #include <netinet/in.h>
@@ -37,6 +42,16 @@
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
 #include <boost/foreach.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/version.hpp>
+#if BOOST_VERSION >= 105300
+#include <boost/atomic.hpp>
+#include <boost/lockfree/queue.hpp>
+#endif
+
+#if defined(LEV_OPT_REUSEABLE_PORT) && defined(SO_REUSEPORT)
+// Several event loops can listen on the same address, each with a socket of its own
+#define HAVE_HTTP_REUSEPORT 1
+#endif
 
 /** Maximum size of http request (request line + headers) */
 static const size_t MAX_HEADERS_SIZE = 8192;
@@ -164,6 +179,126 @@ public:
     }
 };
 
+#if BOOST_VERSION >= 105300
+/** Work queue that hands the work items to the worker threads without
+ * locking. Only idle workers sleep on a condition variable, and only to
+ * wake one of them does Enqueue take the mutex.
+ */
+template <typename WorkItem>
+class LockFreeWorkQueue
+{
+private:
+    boost::lockfree::queue<WorkItem*> queue;
+    /** Number of queued items, counted before they are pushed */
+    boost::atomic<size_t> depth;
+    boost::atomic<bool> running;
+    /** Number of worker threads that may be waiting on cond */
+    boost::atomic<int> numSleeping;
+    const size_t maxDepth;
+    /** Mutex protects numThreads, and waiting on cond */
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    int numThreads;
+
+    /** RAII object to keep track of number of running worker threads */
+    class ThreadCounter
+    {
+    public:
+        LockFreeWorkQueue &wq;
+        ThreadCounter(LockFreeWorkQueue &w): wq(w)
+        {
+            boost::lock_guard<boost::mutex> lock(wq.cs);
+            wq.numThreads += 1;
+        }
+        ~ThreadCounter()
+        {
+            boost::lock_guard<boost::mutex> lock(wq.cs);
+            wq.numThreads -= 1;
+            wq.cond.notify_all();
+        }
+    };
+
+public:
+    LockFreeWorkQueue(size_t maxDepth) : queue(maxDepth),
+                                         depth(0),
+                                         running(true),
+                                         numSleeping(0),
+                                         maxDepth(maxDepth),
+                                         numThreads(0)
+    {
+    }
+    /*( Precondition: worker threads have all stopped
+     * (call WaitExit)
+     */
+    ~LockFreeWorkQueue()
+    {
+        WorkItem* i = 0;
+        while (queue.pop(i))
+            delete i;
+    }
+    /** Enqueue a work item */
+    bool Enqueue(WorkItem* item)
+    {
+        if (depth.fetch_add(1) >= maxDepth) {
+            depth.fetch_sub(1);
+            return false;
+        }
+        queue.push(item);
+        // Either a worker about to sleep sees the new depth, or this sees it sleeping
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+        if (numSleeping.load() > 0) {
+            boost::unique_lock<boost::mutex> lock(cs);
+            cond.notify_one();
+        }
+        return true;
+    }
+    /** Thread function */
+    void Run()
+    {
+        ThreadCounter count(*this);
+        while (running) {
+            WorkItem* i = 0;
+            if (!queue.pop(i)) {
+                boost::unique_lock<boost::mutex> lock(cs);
+                numSleeping++;
+                // An item counted in depth but not pushed yet is only a moment away
+                if (running && depth.load() == 0)
+                    cond.wait(lock);
+                numSleeping--;
+                continue;
+            }
+            depth--;
+            (*i)();
+            delete i;
+        }
+    }
+    /** Interrupt and exit loops */
+    void Interrupt()
+    {
+        running = false;
+        boost::unique_lock<boost::mutex> lock(cs);
+        cond.notify_all();
+    }
+    /** Wait for worker threads to exit */
+    void WaitExit()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (numThreads > 0)
+            cond.wait(lock);
+    }
+
+    /** Return current depth of queue */
+    size_t Depth()
+    {
+        return depth.load();
+    }
+};
+
+typedef LockFreeWorkQueue<HTTPClosure> HTTPWorkQueue;
+#else
+typedef WorkQueue<HTTPClosure> HTTPWorkQueue;
+#endif
+
 struct HTTPPathHandler
 {
     HTTPPathHandler() {}
@@ -176,20 +311,42 @@ struct HTTPPathHandler
     HTTPRequestHandler handler;
 };
 
+/** An event loop thread, with an HTTP server of its own for the connections it accepts */
+struct HTTPEventLoop
+{
+    //! libevent event loop
+    struct event_base* base;
+    //! HTTP server
+    struct evhttp* http;
+    //! Bound listening sockets
+    std::vector<evhttp_bound_socket *> boundSockets;
+    boost::thread thread;
+
+    //! Statistics of the requests served; only this loop's thread adds to them
+    CCriticalSection cs_stats;
+    //! time from receiving requests to sending their replies
+    CLatencyHistogram latency;
+    //! requests turned away because the work queue was full
+    uint64_t nRejected;
+
+    HTTPEventLoop() : base(0), http(0), nRejected(0) {}
+};
+
 /** HTTP module state */
 
-//! libevent event loop
-static struct event_base* eventBase = 0;
-//! HTTP server
-struct evhttp* eventHTTP = 0;
+//! Event loops; the first one also serves EventBase()
+static std::vector<HTTPEventLoop*> eventLoops;
 //! List of subnets to allow RPC connections from
 static std::vector<CSubNet> rpc_allow_subnets;
-//! Work queue for handling longer requests off the event loop thread
-static WorkQueue<HTTPClosure>* workQueue = 0;
+//! Work queue for handling longer requests off the event loop threads
+static HTTPWorkQueue* workQueue = 0;
+static int workQueueMaxDepth = 0;
+static int numWorkerThreads = 0;
+//! Chunked replies being sent; each holds a worker thread until it ends
+static CCriticalSection cs_chunkedReplies;
+static int nChunkedReplies = 0;
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
-//! Bound listening sockets
-std::vector<evhttp_bound_socket *> boundSockets;
 
 /** Check if a network address is allowed to access the HTTP server */
 static bool ClientAllowed(const CNetAddr& netaddr)
@@ -252,7 +409,8 @@ static std::string RequestMethodString(HTTPRequest::RequestMethod m)
 /** HTTP request callback */
 static void http_request_cb(struct evhttp_request* req, void* arg)
 {
-    std::auto_ptr<HTTPRequest> hreq(new HTTPRequest(req));
+    HTTPEventLoop* loop = (HTTPEventLoop*)arg;
+    std::auto_ptr<HTTPRequest> hreq(new HTTPRequest(req, loop));
 
     LogPrint("http", "Received a %s request for %s from %s\n",
              RequestMethodString(hreq->GetRequestMethod()), hreq->GetURI(), hreq->GetPeer().ToString());
@@ -290,10 +448,15 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
     if (i != iend) {
         std::auto_ptr<HTTPWorkItem> item(new HTTPWorkItem(hreq.release(), path, i->handler));
         assert(workQueue);
-        if (workQueue->Enqueue(item.get()))
+        if (workQueue->Enqueue(item.get())) {
             item.release(); /* if true, queue took ownership */
-        else
+        } else {
+            {
+                LOCK(loop->cs_stats);
+                loop->nRejected++;
+            }
             item->req->WriteReply(HTTP_INTERNAL, "Work queue depth exceeded");
+        }
     } else {
         hreq->WriteReply(HTTP_NOTFOUND);
     }
@@ -316,8 +479,32 @@ static void ThreadHTTP(struct event_base* base, struct evhttp* http)
     LogPrint("http", "Exited http event loop\n");
 }
 
+/** Bind a listening socket for loop that the other event loops may bind to as well */
+static evhttp_bound_socket* HTTPBindReusePort(HTTPEventLoop* loop, const std::string& host, uint16_t port)
+{
+#ifdef HAVE_HTTP_REUSEPORT
+    struct evutil_addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = EVUTIL_AI_PASSIVE | EVUTIL_AI_ADDRCONFIG;
+    struct evutil_addrinfo* ai = NULL;
+    if (evutil_getaddrinfo(host.empty() ? NULL : host.c_str(), strprintf("%d", port).c_str(), &hints, &ai) != 0)
+        return NULL;
+    struct evconnlistener* listener = evconnlistener_new_bind(loop->base, NULL, NULL,
+        LEV_OPT_CLOSE_ON_FREE | LEV_OPT_CLOSE_ON_EXEC | LEV_OPT_REUSEABLE | LEV_OPT_REUSEABLE_PORT,
+        128, ai->ai_addr, ai->ai_addrlen);
+    evutil_freeaddrinfo(ai);
+    if (!listener)
+        return NULL;
+    return evhttp_bind_listener(loop->http, listener);
+#else
+    return NULL;
+#endif
+}
+
 /** Bind HTTP server to specified addresses */
-static bool HTTPBindAddresses(struct evhttp* http)
+static bool HTTPBindAddresses(const std::vector<HTTPEventLoop*>& loops)
 {
     int defaultPort = GetArg("-rpcport", BaseParams().RPCPort());
     std::vector<std::pair<std::string, uint16_t> > endpoints;
@@ -342,21 +529,31 @@ static bool HTTPBindAddresses(struct evhttp* http)
         endpoints.push_back(std::make_pair("0.0.0.0", defaultPort));
     }
 
-    // Bind addresses
+    // Bind addresses. With several event loops each listens on a socket of
+    // its own, and the kernel spreads the connections over them.
+    bool fReusePort = loops.size() > 1;
     for (std::vector<std::pair<std::string, uint16_t> >::iterator i = endpoints.begin(); i != endpoints.end(); ++i) {
         LogPrint("http", "Binding RPC on address %s port %i\n", i->first, i->second);
-        evhttp_bound_socket *bind_handle = evhttp_bind_socket_with_handle(http, i->first.empty() ? NULL : i->first.c_str(), i->second);
-        if (bind_handle) {
-            boundSockets.push_back(bind_handle);
-        } else {
-            LogPrintf("Binding RPC on address %s port %i failed.\n", i->first, i->second);
+        BOOST_FOREACH(HTTPEventLoop* loop, loops) {
+            evhttp_bound_socket *bind_handle = fReusePort ? HTTPBindReusePort(loop, i->first, i->second) :
+                evhttp_bind_socket_with_handle(loop->http, i->first.empty() ? NULL : i->first.c_str(), i->second);
+            if (bind_handle) {
+                loop->boundSockets.push_back(bind_handle);
+            } else {
+                LogPrintf("Binding RPC on address %s port %i failed.\n", i->first, i->second);
+                break;
+            }
         }
     }
-    return !boundSockets.empty();
+    BOOST_FOREACH(HTTPEventLoop* loop, loops) {
+        if (loop->boundSockets.empty())
+            return false;
+    }
+    return true;
 }
 
 /** Simple wrapper to set thread name and run work queue */
-static void HTTPWorkQueueRun(WorkQueue<HTTPClosure>* queue)
+static void HTTPWorkQueueRun(HTTPWorkQueue* queue)
 {
     RenameThread("bitcoin-httpworker");
     queue->Run();
@@ -375,11 +572,21 @@ static void libevent_log_cb(int severity, const char *msg)
         LogPrint("libevent", "libevent: %s\n", msg);
 }
 
-bool InitHTTPServer()
+/** Free the event loops (whose threads must have exited) */
+static void FreeEventLoops()
 {
-    struct evhttp* http = 0;
-    struct event_base* base = 0;
+    BOOST_FOREACH(HTTPEventLoop* loop, eventLoops) {
+        if (loop->http)
+            evhttp_free(loop->http);
+        if (loop->base)
+            event_base_free(loop->base);
+        delete loop;
+    }
+    eventLoops.clear();
+}
 
+bool InitHTTPServer()
+{
     if (!InitHTTPAllowList())
         return false;
 
@@ -406,29 +613,44 @@ bool InitHTTPServer()
     evthread_use_pthreads();
 #endif
 
-    base = event_base_new(); // XXX RAII
-    if (!base) {
-        LogPrintf("Couldn't create an event_base: exiting\n");
+    int eventThreads = std::max((int)GetArg("-rpceventthreads", DEFAULT_HTTP_EVENT_THREADS), 1);
+#ifndef HAVE_HTTP_REUSEPORT
+    if (eventThreads > 1) {
+        // Not silently ignored: release builds against libevent 2.0 would never use the option
+        uiInterface.ThreadSafeMessageBox(
+            "-rpceventthreads above 1 needs SO_REUSEPORT support, which this platform or libevent version (before 2.1.9) lacks.",
+            "", CClientUIInterface::MSG_ERROR);
         return false;
     }
+#endif
+    for (int i = 0; i < eventThreads; i++) {
+        HTTPEventLoop* loop = new HTTPEventLoop();
+        eventLoops.push_back(loop);
 
-    /* Create a new evhttp object to handle requests. */
-    http = evhttp_new(base); // XXX RAII
-    if (!http) {
-        LogPrintf("couldn't create evhttp. Exiting.\n");
-        event_base_free(base);
-        return false;
-    }
+        loop->base = event_base_new(); // XXX RAII
+        if (!loop->base) {
+            LogPrintf("Couldn't create an event_base: exiting\n");
+            FreeEventLoops();
+            return false;
+        }
+
+        /* Create a new evhttp object to handle requests. */
+        loop->http = evhttp_new(loop->base); // XXX RAII
+        if (!loop->http) {
+            LogPrintf("couldn't create evhttp. Exiting.\n");
+            FreeEventLoops();
+            return false;
+        }
 
-    evhttp_set_timeout(http, GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
-    evhttp_set_max_headers_size(http, MAX_HEADERS_SIZE);
-    evhttp_set_max_body_size(http, MAX_SIZE);
-    evhttp_set_gencb(http, http_request_cb, NULL);
+        evhttp_set_timeout(loop->http, GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
+        evhttp_set_max_headers_size(loop->http, MAX_HEADERS_SIZE);
+        evhttp_set_max_body_size(loop->http, MAX_SIZE);
+        evhttp_set_gencb(loop->http, http_request_cb, loop);
+    }
 
-    if (!HTTPBindAddresses(http)) {
+    if (!HTTPBindAddresses(eventLoops)) {
         LogPrintf("Unable to bind any endpoint for RPC server\n");
-        evhttp_free(http);
-        event_base_free(base);
+        FreeEventLoops();
         return false;
     }
 
@@ -436,36 +658,36 @@ bool InitHTTPServer()
     int workQueueDepth = std::max((long)GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
     LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
 
-    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
-    eventBase = base;
-    eventHTTP = http;
+    workQueue = new HTTPWorkQueue(workQueueDepth);
+    workQueueMaxDepth = workQueueDepth;
     return true;
 }
 
-boost::thread threadHTTP;
-
 bool StartHTTPServer()
 {
     LogPrint("http", "Starting HTTP server\n");
     int rpcThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
-    LogPrintf("HTTP: starting %d worker threads\n", rpcThreads);
-    threadHTTP = boost::thread(boost::bind(&ThreadHTTP, eventBase, eventHTTP));
+    LogPrintf("HTTP: starting %d event threads and %d worker threads\n", eventLoops.size(), rpcThreads);
+    BOOST_FOREACH(HTTPEventLoop* loop, eventLoops)
+        loop->thread = boost::thread(boost::bind(&ThreadHTTP, loop->base, loop->http));
 
     for (int i = 0; i < rpcThreads; i++)
         boost::thread(boost::bind(&HTTPWorkQueueRun, workQueue));
+    numWorkerThreads = rpcThreads;
     return true;
 }
 
 void InterruptHTTPServer()
 {
     LogPrint("http", "Interrupting HTTP server\n");
-    if (eventHTTP) {
+    BOOST_FOREACH(HTTPEventLoop* loop, eventLoops) {
         // Unlisten sockets
-        BOOST_FOREACH (evhttp_bound_socket *socket, boundSockets) {
-            evhttp_del_accept_socket(eventHTTP, socket);
+        BOOST_FOREACH (evhttp_bound_socket *socket, loop->boundSockets) {
+            evhttp_del_accept_socket(loop->http, socket);
         }
+        loop->boundSockets.clear();
         // Reject requests on current connections
-        evhttp_set_gencb(eventHTTP, http_reject_request_cb, NULL);
+        evhttp_set_gencb(loop->http, http_reject_request_cb, NULL);
     }
     if (workQueue)
         workQueue->Interrupt();
@@ -478,39 +700,52 @@ void StopHTTPServer()
         LogPrint("http", "Waiting for HTTP worker threads to exit\n");
         workQueue->WaitExit();
         delete workQueue;
+        workQueue = 0;
     }
-    if (eventBase) {
-        LogPrint("http", "Waiting for HTTP event thread to exit\n");
-        // Give event loop a few seconds to exit (to send back last RPC responses), then break it
+    if (!eventLoops.empty()) {
+        LogPrint("http", "Waiting for HTTP event threads to exit\n");
+        // Give event loops a few seconds to exit (to send back last RPC responses), then break them
         // Before this was solved with event_base_loopexit, but that didn't work as expected in
         // at least libevent 2.0.21 and always introduced a delay. In libevent
         // master that appears to be solved, so in the future that solution
         // could be used again (if desirable).
         // (see discussion in https://github.com/bitcoin/bitcoin/pull/6990)
+        int64_t nDeadline = GetTimeMillis() + 2000;
+        BOOST_FOREACH(HTTPEventLoop* loop, eventLoops) {
+            int64_t nWait = std::max(nDeadline - GetTimeMillis(), (int64_t)0);
 #if BOOST_VERSION >= 105000
-        if (!threadHTTP.try_join_for(boost::chrono::milliseconds(2000))) {
+            if (!loop->thread.try_join_for(boost::chrono::milliseconds(nWait))) {
 #else
-        if (!threadHTTP.timed_join(boost::posix_time::milliseconds(2000))) {
+            if (!loop->thread.timed_join(boost::posix_time::milliseconds(nWait))) {
 #endif
-            LogPrintf("HTTP event loop did not exit within allotted time, sending loopbreak\n");
-            event_base_loopbreak(eventBase);
-            threadHTTP.join();
+                LogPrintf("HTTP event loop did not exit within allotted time, sending loopbreak\n");
+                event_base_loopbreak(loop->base);
+                loop->thread.join();
+            }
         }
     }
-    if (eventHTTP) {
-        evhttp_free(eventHTTP);
-        eventHTTP = 0;
-    }
-    if (eventBase) {
-        event_base_free(eventBase);
-        eventBase = 0;
-    }
+    FreeEventLoops();
     LogPrint("http", "Stopped HTTP server\n");
 }
 
 struct event_base* EventBase()
 {
-    return eventBase;
+    return eventLoops.empty() ? 0 : eventLoops[0]->base;
+}
+
+void GetHTTPServerStats(HTTPServerStats& stats)
+{
+    stats.nEventThreads = eventLoops.size();
+    stats.nWorkerThreads = numWorkerThreads;
+    stats.nWorkQueueDepth = workQueue ? workQueue->Depth() : 0;
+    stats.nWorkQueueMaxDepth = workQueueMaxDepth;
+    stats.nRejected = 0;
+    stats.latency = CLatencyHistogram();
+    BOOST_FOREACH(HTTPEventLoop* loop, eventLoops) {
+        LOCK(loop->cs_stats);
+        stats.nRejected += loop->nRejected;
+        stats.latency.Add(loop->latency);
+    }
 }
 
 static void httpevent_callback_fn(evutil_socket_t, short, void* data)
@@ -539,12 +774,131 @@ void HTTPEvent::trigger(struct timeval* tv)
     else
         evtimer_add(ev, tv); // trigger after timeval passed
 }
-HTTPRequest::HTTPRequest(struct evhttp_request* req) : req(req),
-                                                       replySent(false)
+/** State of a chunked reply, shared between the worker thread producing it
+ * and the http event thread of its connection sending it.
+ */
+struct HTTPChunkedReply
+{
+    CWaitableCriticalSection cs;
+    //! Signalled when chunks were written out, and when the connection closes
+    CConditionVariable cond;
+    struct evhttp_request* req;
+    HTTPEventLoop* loop;
+    int64_t nTimeReceived;
+    //! Bytes handed to the http event thread (worker thread only)
+    uint64_t nQueued;
+    //! Bytes handed to libevent
+    uint64_t nPassed;
+    //! Bytes libevent wrote to the connection
+    uint64_t nWritten;
+    //! The client went away, or stopped reading
+    bool fClosed;
+
+    HTTPChunkedReply(struct evhttp_request* reqIn, HTTPEventLoop* loopIn, int64_t nTimeReceivedIn) :
+        req(reqIn), loop(loopIn), nTimeReceived(nTimeReceivedIn), nQueued(0), nPassed(0), nWritten(0), fClosed(false) {}
+};
+
+/** Callback for libevent: everything passed to the connection so far was written */
+static void http_reply_written_cb(struct evhttp_connection* evcon, void* arg)
+{
+    HTTPChunkedReply* reply = (HTTPChunkedReply*)arg;
+    boost::unique_lock<boost::mutex> lock(reply->cs);
+    reply->nWritten = reply->nPassed;
+    reply->cond.notify_all();
+}
+
+/** Callback for libevent: the connection of a chunked reply is closing */
+static void http_reply_closed_cb(struct evhttp_connection* evcon, void* arg)
+{
+    HTTPChunkedReply* reply = (HTTPChunkedReply*)arg;
+    boost::unique_lock<boost::mutex> lock(reply->cs);
+    reply->fClosed = true;
+    reply->cond.notify_all();
+}
+
+/** Record the latency of a reply; run in the thread of the loop sending it */
+static void http_record_reply(HTTPEventLoop* loop, int64_t nTimeReceived)
+{
+    LOCK(loop->cs_stats);
+    loop->latency.Add(GetTimeMicros() - nTimeReceived);
+}
+
+static void http_send_reply(HTTPEventLoop* loop, struct evhttp_request* req, int nStatus, int64_t nTimeReceived)
+{
+    evhttp_send_reply(req, nStatus, NULL, NULL);
+    http_record_reply(loop, nTimeReceived);
+}
+
+/* The handlers below run in the http event thread. Once its connection
+ * fails, libevent detaches the request from it, and frees the request
+ * when the reply is ended.
+ */
+static void http_reply_start(HTTPChunkedReply* reply, int nStatus)
+{
+    struct evhttp_connection* evcon = evhttp_request_get_connection(reply->req);
+    if (!evcon) {
+        http_reply_closed_cb(NULL, reply);
+        return;
+    }
+    evhttp_connection_set_closecb(evcon, http_reply_closed_cb, reply);
+    evhttp_send_reply_start(reply->req, nStatus, NULL);
+}
+
+static void http_reply_chunk(HTTPChunkedReply* reply, struct evbuffer* evb)
+{
+    bool fClosed;
+    {
+        boost::unique_lock<boost::mutex> lock(reply->cs);
+        fClosed = reply->fClosed || !evhttp_request_get_connection(reply->req);
+        if (!fClosed)
+            reply->nPassed += evbuffer_get_length(evb);
+    }
+    if (!fClosed) {
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+        evhttp_send_reply_chunk_with_cb(reply->req, evb, http_reply_written_cb, reply);
+#else
+        // No way to learn when the chunk was written: do not hold back the
+        // worker. MaxChunkedReplySize() bounds what may pile up instead.
+        evhttp_send_reply_chunk(reply->req, evb);
+        http_reply_written_cb(NULL, reply);
+#endif
+    } else {
+        http_reply_closed_cb(NULL, reply);
+    }
+    evbuffer_free(evb);
+}
+
+static void http_reply_end(HTTPChunkedReply* reply, bool fComplete)
+{
+    http_record_reply(reply->loop, reply->nTimeReceived);
+    struct evhttp_connection* evcon = evhttp_request_get_connection(reply->req);
+    if (evcon) {
+        evhttp_connection_set_closecb(evcon, NULL, NULL);
+        if (!fComplete) {
+            // Drop the connection rather than end the body, so that the
+            // client can tell the reply was cut short. This frees the request.
+            evhttp_connection_free(evcon);
+            delete reply;
+            return;
+        }
+    }
+    evhttp_send_reply_end(reply->req);
+    delete reply;
+}
+
+HTTPRequest::HTTPRequest(struct evhttp_request* req, HTTPEventLoop* loop) : req(req),
+                                                                           loop(loop),
+                                                                           replySent(false),
+                                                                           chunkedReply(0),
+                                                                           nTimeReceived(GetTimeMicros())
 {
 }
 HTTPRequest::~HTTPRequest()
 {
+    if (chunkedReply && !replySent) {
+        LogPrintf("%s: Unfinished chunked reply\n", __func__);
+        EndChunkedReply(false);
+    }
     if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
@@ -593,23 +947,105 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
 
 /** Closure sent to main thread to request a reply to be sent to
  * a HTTP request.
- * Replies must be sent in the main loop in the main http thread,
+ * Replies must be sent in the event loop serving the connection,
  * this cannot be done from worker threads.
  */
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
     assert(!replySent && req);
-    // Send event to main http thread to send reply message
+    // Send event to the http thread of the connection to send reply message
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
     evbuffer_add(evb, strReply.data(), strReply.size());
-    HTTPEvent* ev = new HTTPEvent(eventBase, true,
-        boost::bind(evhttp_send_reply, req, nStatus, (const char*)NULL, (struct evbuffer *)NULL));
+    HTTPEvent* ev = new HTTPEvent(loop->base, true,
+        boost::bind(http_send_reply, loop, req, nStatus, nTimeReceived));
     ev->trigger(0);
     replySent = true;
     req = 0; // transferred back to main thread
 }
 
+size_t MaxChunkedReplySize()
+{
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+    return std::numeric_limits<size_t>::max();
+#else
+    return MAX_HTTP_UNSENT_CHUNKS_SIZE;
+#endif
+}
+
+bool HTTPRequest::StartChunkedReply(int nStatus, const std::string& strContentType)
+{
+    assert(!replySent && !chunkedReply && req);
+    {
+        // Leave worker threads for other requests while replies are streamed
+        LOCK(cs_chunkedReplies);
+        if (nChunkedReplies >= numWorkerThreads / 2) {
+            LogPrint("http", "Too many chunked replies, refusing %s\n", GetURI());
+            return false;
+        }
+        nChunkedReplies++;
+    }
+    WriteHeader("Content-Type", strContentType);
+    chunkedReply = new HTTPChunkedReply(req, loop, nTimeReceived);
+    HTTPEvent* ev = new HTTPEvent(loop->base, true,
+        boost::bind(http_reply_start, chunkedReply, nStatus));
+    ev->trigger(0);
+    return true;
+}
+
+bool HTTPRequest::WriteReplyChunk(const char* data, size_t size)
+{
+    assert(!replySent && chunkedReply);
+    HTTPChunkedReply* reply = chunkedReply;
+    {
+        boost::unique_lock<boost::mutex> lock(reply->cs);
+        // Hold the worker back while the client is slow to read, but not forever
+        int64_t nTimeout = GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT);
+        while (!reply->fClosed && reply->nQueued - reply->nWritten > MAX_HTTP_UNSENT_CHUNKS_SIZE) {
+            if (!reply->cond.timed_wait(lock, boost::posix_time::seconds(nTimeout))) {
+                LogPrint("http", "Client stopped reading the reply to %s\n", GetURI());
+                reply->fClosed = true;
+            }
+        }
+        if (reply->fClosed)
+            return false;
+        if (reply->nQueued + size > MaxChunkedReplySize()) {
+            LogPrintf("%s: Chunked reply to %s exceeds %u bytes\n", __func__, GetURI(), MaxChunkedReplySize());
+            return false;
+        }
+        reply->nQueued += size;
+    }
+    if (size == 0)
+        return true;
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, data, size);
+    HTTPEvent* ev = new HTTPEvent(loop->base, true,
+        boost::bind(http_reply_chunk, reply, evb));
+    ev->trigger(0);
+    return true;
+}
+
+void HTTPRequest::EndChunkedReply(bool fComplete)
+{
+    assert(!replySent && chunkedReply);
+    {
+        boost::unique_lock<boost::mutex> lock(chunkedReply->cs);
+        if (chunkedReply->fClosed)
+            fComplete = false;
+    }
+    HTTPEvent* ev = new HTTPEvent(loop->base, true,
+        boost::bind(http_reply_end, chunkedReply, fComplete));
+    ev->trigger(0);
+    chunkedReply = 0; // freed by the main thread
+    {
+        LOCK(cs_chunkedReplies);
+        nChunkedReplies--;
+    }
+    replySent = true;
+    req = 0;
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
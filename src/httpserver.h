@@ -5,20 +5,28 @@
 #ifndef BITCOIN_HTTPSERVER_H
 #define BITCOIN_HTTPSERVER_H
 
+#include "latencyhistogram.h"
+
 #include <string>
+#include <vector>
 #include <stdint.h>
 #include <boost/thread.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/function.hpp>
 
 static const int DEFAULT_HTTP_THREADS=4;
+static const int DEFAULT_HTTP_EVENT_THREADS=1;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
+/** Bytes of a chunked reply that may wait for a client before WriteReplyChunk blocks */
+static const size_t MAX_HTTP_UNSENT_CHUNKS_SIZE = 4 * 1024 * 1024;
 
 struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+struct HTTPChunkedReply;
+struct HTTPEventLoop;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -34,6 +42,12 @@ void InterruptHTTPServer();
 /** Stop HTTP server */
 void StopHTTPServer();
 
+/** Largest chunked reply that may be sent. Before libevent 2.1.1 chunks
+ * cannot wait for the client to read them, so a whole reply may be held in
+ * memory and is limited to MAX_HTTP_UNSENT_CHUNKS_SIZE.
+ */
+size_t MaxChunkedReplySize();
+
 /** Handler for requests to a certain HTTP path */
 typedef boost::function<void(HTTPRequest* req, const std::string &)> HTTPRequestHandler;
 /** Register handler for prefix.
@@ -49,6 +63,22 @@ void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
  */
 struct event_base* EventBase();
 
+/** HTTP server statistics */
+struct HTTPServerStats
+{
+    int nEventThreads;
+    int nWorkerThreads;
+    size_t nWorkQueueDepth;
+    size_t nWorkQueueMaxDepth;
+    //! requests turned away because the work queue was full
+    uint64_t nRejected;
+    //! time from receiving requests to sending their replies
+    CLatencyHistogram latency;
+};
+
+/** Return statistics of the running HTTP server */
+void GetHTTPServerStats(HTTPServerStats& stats);
+
 /** In-flight HTTP request.
  * Thin C++ wrapper around evhttp_request.
  */
@@ -56,10 +86,15 @@ class HTTPRequest
 {
 private:
     struct evhttp_request* req;
+    //! event loop of the connection, whose thread must send the replies
+    HTTPEventLoop* loop;
     bool replySent;
+    //! state of the chunked reply, if one was started
+    HTTPChunkedReply* chunkedReply;
+    int64_t nTimeReceived;
 
 public:
-    HTTPRequest(struct evhttp_request* req);
+    HTTPRequest(struct evhttp_request* req, HTTPEventLoop* loop);
     ~HTTPRequest();
 
     enum RequestMethod {
@@ -112,6 +147,36 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a chunked reply: the status and headers are sent now, the body
+     * with WriteReplyChunk, and EndChunkedReply completes it. Use this
+     * instead of WriteReply for replies too large to build in memory.
+     *
+     * A chunked reply holds its worker thread until it ends, so at most half
+     * of the worker threads may send one. Returns false, without sending
+     * anything, when none is free; the caller should reply with an error.
+     */
+    bool StartChunkedReply(int nStatus, const std::string& strContentType);
+
+    /**
+     * Send the next part of a chunked reply. Blocks while more than
+     * MAX_HTTP_UNSENT_CHUNKS_SIZE bytes wait for the client. Returns false
+     * if the client went away or stopped reading, or if the reply would
+     * exceed MaxChunkedReplySize(); the caller should then stop producing
+     * the reply and end it.
+     */
+    bool WriteReplyChunk(const char* data, size_t size);
+
+    /**
+     * Complete a chunked reply. With fComplete false, or if a chunk could
+     * not be sent, the connection is dropped instead, so that the client
+     * can tell the reply was cut short.
+     *
+     * @note As with WriteReply, do not call any other HTTPRequest methods
+     * after calling this.
+     */
+    void EndChunkedReply(bool fComplete = true);
 };
 
 /** Event handler closure.
@@ -17,6 +17,7 @@
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"
 #include "httpserver.h"
 #include "httprpc.h"
 #include "key.h"
@@ -61,7 +62,9 @@
 #include <openssl/crypto.h>
 
 #if ENABLE_ZMQ
+#include "zmq/zmqabstractnotifier.h"
 #include "zmq/zmqnotificationinterface.h"
+#include "zmq/zmqpublisher.h"
 #endif
 
 using namespace std;
@@ -160,7 +163,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
@@ -193,9 +195,12 @@ void Shutdown()
     StopREST();
     StopRPC();
     StopHTTPServer();
+    StopValidationNotifications();
 #ifdef ENABLE_WALLET
-    if (pwalletMain)
+    if (pwalletMain) {
+        pwalletMain->WaitForAutoBackup();  // MVF-Core
         pwalletMain->Flush(false);
+    }
 #endif
     GenerateBitcoins(false, 0, Params());
     StopNode();
@@ -320,6 +325,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Maintain compact filters of the scripts and spent outputs of new blocks, used to speed up wallet rescans (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
@@ -335,6 +341,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    strUsage += HelpMessageOpt("-loadutxosnapshot=<file>", _("Start a new node from a UTXO set snapshot written by dumptxoutset, validating only the blocks after it (requires -prune and -loadutxosnapshothash)"));
+    strUsage += HelpMessageOpt("-loadutxosnapshothash=<hash>", _("The coins hash that dumptxoutset reported for the snapshot, from a source you trust; a snapshot that does not match it is refused"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
@@ -350,6 +358,7 @@ std::string HelpMessage(HelpMessageMode mode)
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
+    strUsage += HelpMessageOpt("-trustblockindex", strprintf(_("Skip re-checking proof of work when loading block index entries up to the height checked on an earlier start (default: %u)"), DEFAULT_TRUST_BLOCK_INDEX));
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
@@ -399,6 +408,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("Wallet options:"));
     strUsage += HelpMessageOpt("-disablewallet", _("Do not load the wallet and disable wallet RPC calls"));
     strUsage += HelpMessageOpt("-keypool=<n>", strprintf(_("Set key pool size to <n> (default: %u)"), DEFAULT_KEYPOOL_SIZE));
+    strUsage += HelpMessageOpt("-keypoolbackground", strprintf(_("Refill the key pool in a background thread when it falls below half its size (default: %u)"), DEFAULT_KEYPOOL_BACKGROUND));
     strUsage += HelpMessageOpt("-fallbackfee=<amt>", strprintf(_("A fee rate (in %s/kB) that will be used when fee estimation has insufficient data (default: %s)"),
         CURRENCY_UNIT, FormatMoney(DEFAULT_FALLBACK_FEE)));
     strUsage += HelpMessageOpt("-mintxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for transaction creation (default: %s)"),
@@ -426,6 +436,11 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-zmqpubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubhashblockhwm=<n>", strprintf(_("Set publish hash block outbound message high water mark (default: %d)"), DEFAULT_ZMQ_SNDHWM));
+    strUsage += HelpMessageOpt("-zmqpubhashtxhwm=<n>", strprintf(_("Set publish hash transaction outbound message high water mark (default: %d)"), DEFAULT_ZMQ_SNDHWM));
+    strUsage += HelpMessageOpt("-zmqpubrawblockhwm=<n>", strprintf(_("Set publish raw block outbound message high water mark (default: %d)"), DEFAULT_ZMQ_SNDHWM));
+    strUsage += HelpMessageOpt("-zmqpubrawtxhwm=<n>", strprintf(_("Set publish raw transaction outbound message high water mark (default: %d)"), DEFAULT_ZMQ_SNDHWM));
+    strUsage += HelpMessageOpt("-zmqqueuesize=<n>", strprintf(_("Drop notifications while <n> messages wait to be published (default: %u)"), DEFAULT_ZMQ_QUEUE_SIZE));
 #endif
 
     strUsage += HelpMessageGroup(_("Debugging/Testing options:"));
@@ -435,6 +450,10 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkmempool=<n>", strprintf("Run checks every <n> transactions (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", DEFAULT_CHECKPOINTS_ENABLED));
+        strUsage += HelpMessageOpt("-chainstatefilesize=<n>", strprintf("Target size of chain state database files in MiB (default: %u)", DEFAULT_DB_MAX_FILE_SIZE));
+        strUsage += HelpMessageOpt("-dbbulkload", strprintf("Open the databases for bulk loading: favour write buffers over read cache and use %u MiB table files until reindexing is finished or the node has caught up with the network, then compact both (default: 1 with -reindex, 0 otherwise)", DEFAULT_DB_BULK_LOAD_FILE_SIZE));
+        strUsage += HelpMessageOpt("-dbcompactionthreads=<n>", strprintf("Number of threads a large database compaction may be split across (default: %u, at most the number of cores)", DEFAULT_DB_COMPACTION_THREADS));
+        strUsage += HelpMessageOpt("-dbmaxopenfiles=<n>", strprintf("Number of files each database may keep open (minimum: %u, default: %u)", MIN_DB_MAX_OPEN_FILES, DEFAULT_DB_MAX_OPEN_FILES));
 #ifdef ENABLE_WALLET
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf("Flush wallet database activity from memory to disk log every <n> megabytes (default: %u)", DEFAULT_WALLET_DBLOGSIZE));
 #endif
@@ -513,6 +532,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
     if (showDebug) {
         strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
+        strUsage += HelpMessageOpt("-rpceventthreads=<n>", strprintf("Set the number of threads accepting RPC connections, each listening with SO_REUSEPORT; above 1 needs libevent 2.1.9 or newer (default: %d)", DEFAULT_HTTP_EVENT_THREADS));
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
     }
 
@@ -603,6 +623,25 @@ void CleanupBlockRevFiles()
     }
 }
 
+/** Leave bulk-load mode on both databases, see CDBWrapper::FinishBulkLoad */
+static void FinishBulkLoad()
+{
+    static CCriticalSection cs_FinishBulkLoad;
+    LOCK(cs_FinishBulkLoad);
+    pblocktree->FinishBulkLoad();
+    pcoinsdbview->FinishBulkLoad();
+}
+
+/** Leave bulk-load mode once the node has caught up with the network; until then check again every minute */
+static void FinishBulkLoadWhenSynced(CScheduler* scheduler)
+{
+    if (fReindex || fImporting || IsInitialBlockDownload()) {
+        scheduler->scheduleFromNow(boost::bind(&FinishBulkLoadWhenSynced, scheduler), 60);
+        return;
+    }
+    FinishBulkLoad();
+}
+
 void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
 {
     const CChainParams& chainparams = Params();
@@ -625,6 +664,7 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         pblocktree->WriteReindexing(false);
         fReindex = false;
         LogPrintf("Reindexing finished\n");
+        FinishBulkLoad();
         // To avoid ending up in a situation without genesis block, re-try initializing (no-op if reindexing worked):
         InitBlockIndex(chainparams);
     }
@@ -684,6 +724,7 @@ bool AppInitServers(boost::thread_group& threadGroup)
     RPCServer::OnPreCommand(&OnRPCPreCommand);
     if (!InitHTTPServer())
         return false;
+    RegisterHTTPRPCCommands(tableRPC);
     if (!StartRPC())
         return false;
     if (!StartHTTPRPC())
@@ -870,17 +911,41 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 #endif
     }
 
+    // blocks below a UTXO snapshot are never downloaded, as if pruned
+    if (mapArgs.count("-loadutxosnapshot") && !GetArg("-prune", 0))
+        return InitError(_("-loadutxosnapshot requires -prune, as the blocks below the snapshot are never downloaded."));
+    uint256 hashSnapshotCoins;
+    if (mapArgs.count("-loadutxosnapshot")) {
+        std::string strHash = GetArg("-loadutxosnapshothash", "");
+        if (strHash.size() != 64 || !IsHex(strHash))
+            return InitError(_("-loadutxosnapshot requires -loadutxosnapshothash, the coins hash of the snapshot taken from a source you trust."));
+        hashSnapshotCoins = uint256S(strHash);
+    }
+
     // Make sure enough file descriptors are available
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     int nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
+    // Database files beyond the minimum are not part of MIN_CORE_FILEDESCRIPTORS
+    int nDBMaxOpenFiles = std::max((int)GetArg("-dbmaxopenfiles", DEFAULT_DB_MAX_OPEN_FILES), MIN_DB_MAX_OPEN_FILES);
+#ifdef WIN32
+    int nDBFileDescriptors = 0;
+#else
+    int nDBFileDescriptors = 2 * (nDBMaxOpenFiles - MIN_DB_MAX_OPEN_FILES);
+#endif
+
     // Trim requested connection counts, to fit into system limitations
     nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
-    int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
+    int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + nDBFileDescriptors);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
     nMaxConnections = std::min(nFD - MIN_CORE_FILEDESCRIPTORS, nMaxConnections);
+    // Connections take precedence; the databases get what is left over
+    if (nDBFileDescriptors > nFD - MIN_CORE_FILEDESCRIPTORS - nMaxConnections) {
+        nDBFileDescriptors = nFD - MIN_CORE_FILEDESCRIPTORS - nMaxConnections;
+        nDBMaxOpenFiles = MIN_DB_MAX_OPEN_FILES + nDBFileDescriptors / 2;
+    }
 
     if (nMaxConnections < nUserMaxConnections)
         InitWarning(strprintf(_("Reducing -maxconnections from %d to %d, because of system limitations."), nUserMaxConnections, nMaxConnections));
@@ -932,6 +997,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    fBlockFilterIndex = GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX);
+
     fServer = GetBoolArg("-server", false);
 
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
@@ -1052,7 +1119,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
 
-    // Initialize elliptic curve code
+    // Initialize SHA256 implementation and elliptic curve code
+    std::string sha256_algo = SHA256AutoDetect();
+    LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
 
@@ -1101,14 +1170,20 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadHeaderCheck);
+            threadGroup.create_thread(&ThreadMerkleCheck);
+        }
     }
 
     // Start the lightweight task scheduler thread
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
 
+    // Deliver wallet and ZMQ notifications off the validation thread
+    StartValidationNotifications(threadGroup);
+
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
      * that the server is there and will be ready later).  Warmup mode will
@@ -1319,6 +1394,17 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
 
+    // per-database LevelDB settings
+    int nDBCompactionThreads = std::max(std::min((int)GetArg("-dbcompactionthreads", DEFAULT_DB_COMPACTION_THREADS), GetNumCores()), 1);
+    CDBOptions blockTreeDBOptions(nBlockTreeDBCache);
+    blockTreeDBOptions.nMaxOpenFiles = nDBMaxOpenFiles;
+    blockTreeDBOptions.nCompactionThreads = nDBCompactionThreads;
+    CDBOptions coinsDBOptions(nCoinDBCache);
+    coinsDBOptions.nMaxOpenFiles = nDBMaxOpenFiles;
+    coinsDBOptions.nCompactionThreads = nDBCompactionThreads;
+    coinsDBOptions.nMaxFileSize = std::max((int)GetArg("-chainstatefilesize", DEFAULT_DB_MAX_FILE_SIZE), 1) << 20;
+    LogPrintf("Database configuration: %d open files and %d compaction threads each\n", nDBMaxOpenFiles, nDBCompactionThreads);
+
     bool fLoaded = false;
     while (!fLoaded) {
         bool fReset = fReindex;
@@ -1335,8 +1421,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 delete pcoinscatcher;
                 delete pblocktree;
 
-                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
-                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
+                // a reindex rewrites both databases from scratch
+                blockTreeDBOptions.fBulkLoad = coinsDBOptions.fBulkLoad = GetBoolArg("-dbbulkload", fReindex);
+                pblocktree = new CBlockTreeDB(blockTreeDBOptions, false, fReindex);
+                pcoinsdbview = new CCoinsViewDB(coinsDBOptions, false, fReindex);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
@@ -1376,6 +1464,21 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                // Fill a new chain state from a UTXO snapshot, or finish an interrupted load
+                if (mapArgs.count("-loadutxosnapshot")) {
+                    if (!LoadCoinsSnapshot(chainparams, GetArg("-loadutxosnapshot", ""), hashSnapshotCoins)) {
+                        strLoadError = _("Error loading UTXO set snapshot");
+                        break;
+                    }
+                } else {
+                    bool fSnapshotIncomplete = false;
+                    pblocktree->ReadFlag("loadingutxosnapshot", fSnapshotIncomplete);
+                    if (fSnapshotIncomplete) {
+                        strLoadError = _("Loading a UTXO set snapshot was interrupted. Restart with the same -loadutxosnapshot to finish it");
+                        break;
+                    }
+                }
+
                 uiInterface.InitMessage(_("Verifying blocks..."));
                 if (fHavePruned && GetArg("-checkblocks", DEFAULT_CHECKBLOCKS) > MIN_BLOCKS_TO_KEEP) {
                     LogPrintf("Prune: pruned datadir may not have more than %d blocks; -checkblocks=%d may fail\n",
@@ -1398,6 +1501,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     strLoadError = _("Corrupted block database detected");
                     break;
                 }
+
+                if (!LoadCoinsStats()) {
+                    strLoadError = _("Error computing UTXO set statistics");
+                    break;
+                }
             } catch (const std::exception& e) {
                 if (fDebug) LogPrintf("%s\n", e.what());
                 strLoadError = _("Error opening block database");
@@ -1436,6 +1544,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    // A reindex leaves bulk-load mode as soon as it is finished, but
+    // -dbbulkload on its own only once the initial block download is over
+    if (coinsDBOptions.fBulkLoad)
+        scheduler.scheduleFromNow(boost::bind(&FinishBulkLoadWhenSynced, &scheduler), 60);
+
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1699,6 +1812,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
         // Run a thread to flush wallet periodically
         threadGroup.create_thread(boost::bind(&ThreadFlushWalletDB, boost::ref(pwalletMain->strWalletFile)));
+
+        // Run a thread to keep the key pool topped up
+        if (GetBoolArg("-keypoolbackground", DEFAULT_KEYPOOL_BACKGROUND)) {
+            boost::function<void()> maintainKeyPool = boost::bind(&CWallet::MaintainKeyPool, pwalletMain);
+            threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "keypool", maintainKeyPool));
+        }
     }
 #endif
 
@@ -0,0 +1,68 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "latencyhistogram.h"
+
+#include <algorithm>
+#include <math.h>
+
+//! Durations below this many microseconds have a bucket each; above, a power of two is split in 8 buckets
+static const int64_t LATENCY_LINEAR_BUCKETS = 16;
+
+CLatencyHistogram::CLatencyHistogram() : nCount(0), nMax(0)
+{
+}
+
+size_t CLatencyHistogram::BucketIndex(int64_t nMicros)
+{
+    if (nMicros < LATENCY_LINEAR_BUCKETS)
+        return std::max(nMicros, (int64_t)0);
+    int nLog2 = 0;
+    for (int64_t n = nMicros; n > 1; n >>= 1)
+        nLog2++;
+    return LATENCY_LINEAR_BUCKETS + (nLog2 - 4) * 8 + ((nMicros >> (nLog2 - 3)) & 7);
+}
+
+int64_t CLatencyHistogram::BucketMax(size_t nBucket)
+{
+    if (nBucket < (size_t)LATENCY_LINEAR_BUCKETS)
+        return nBucket;
+    int nLog2 = 4 + (nBucket - LATENCY_LINEAR_BUCKETS) / 8;
+    int64_t nMin = (int64_t)(8 + (nBucket - LATENCY_LINEAR_BUCKETS) % 8) << (nLog2 - 3);
+    return nMin + ((int64_t)1 << (nLog2 - 3)) - 1;
+}
+
+void CLatencyHistogram::Add(int64_t nMicros)
+{
+    size_t nBucket = BucketIndex(nMicros);
+    if (nBucket >= vCounts.size())
+        vCounts.resize(nBucket + 1);
+    vCounts[nBucket]++;
+    nCount++;
+    nMax = std::max(nMax, nMicros);
+}
+
+void CLatencyHistogram::Add(const CLatencyHistogram& other)
+{
+    if (other.vCounts.size() > vCounts.size())
+        vCounts.resize(other.vCounts.size());
+    for (size_t i = 0; i < other.vCounts.size(); i++)
+        vCounts[i] += other.vCounts[i];
+    nCount += other.nCount;
+    nMax = std::max(nMax, other.nMax);
+}
+
+int64_t CLatencyHistogram::Percentile(double fPercentile) const
+{
+    if (nCount == 0)
+        return 0;
+    uint64_t nRank = std::max((uint64_t)ceil(nCount * fPercentile / 100), (uint64_t)1);
+    uint64_t nSeen = 0;
+    for (size_t i = 0; i < vCounts.size(); i++) {
+        nSeen += vCounts[i];
+        if (nSeen >= nRank)
+            return std::min(BucketMax(i), nMax);
+    }
+    return nMax;
+}
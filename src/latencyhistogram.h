@@ -0,0 +1,35 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_LATENCYHISTOGRAM_H
+#define BITCOIN_LATENCYHISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/** Distribution of durations in microseconds, in buckets of at most 1/8 of their value. Not thread-safe. */
+class CLatencyHistogram
+{
+private:
+    std::vector<uint64_t> vCounts;
+    uint64_t nCount;
+    int64_t nMax;
+
+    static size_t BucketIndex(int64_t nMicros);
+    static int64_t BucketMax(size_t nBucket);
+
+public:
+    CLatencyHistogram();
+
+    void Add(int64_t nMicros);
+    /** Add the durations of another histogram, e.g. to combine those kept per thread */
+    void Add(const CLatencyHistogram& other);
+    uint64_t Count() const { return nCount; }
+    int64_t Max() const { return nMax; }
+    /** Return a duration (over-estimated by up to 1/8) that fPercentile percent of the added ones do not exceed */
+    int64_t Percentile(double fPercentile) const;
+};
+
+#endif // BITCOIN_LATENCYHISTOGRAM_H
@@ -71,16 +71,36 @@ struct DBImpl::CompactionState {
 
   uint64_t total_bytes;
 
+  // Part of the key range to compact, when the work is split into
+  // subcompactions: user keys in (begin, end], unbounded on a side
+  // whose has_ flag is false.
+  bool has_begin, has_end;
+  std::string begin, end;
+
+  // Outcome of this part of the compaction
+  Status status;
+  int64_t imm_micros;  // Micros spent doing imm_ compactions
+
   Output* current_output() { return &outputs[outputs.size()-1]; }
 
   explicit CompactionState(Compaction* c)
       : compaction(c),
         outfile(NULL),
         builder(NULL),
-        total_bytes(0) {
+        total_bytes(0),
+        has_begin(false),
+        has_end(false),
+        imm_micros(0) {
   }
 };
 
+struct DBImpl::SubcompactionThreadState {
+  DBImpl* db;
+  CompactionState* compact;
+  port::CondVar* done_cv;
+  int* remaining;  // Protected by db->mutex_
+};
+
 // Fix user-supplied options to be reasonable
 template <class T,class V>
 static void ClipToRange(T* ptr, V minvalue, V maxvalue) {
@@ -133,6 +153,8 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       seed_(0),
       tmp_batch_(new WriteBatch),
       bg_compaction_scheduled_(false),
+      imm_compaction_running_(false),
+      split_compactions_(0),
       manual_compaction_(NULL) {
   mem_->Ref();
   has_imm_.Release_Store(NULL);
@@ -550,6 +572,13 @@ void DBImpl::CompactRange(const Slice* begin, const Slice* end) {
   }
 }
 
+void DBImpl::SetWriteSizes(size_t write_buffer_size, size_t max_file_size) {
+  MutexLock l(&mutex_);
+  options_.write_buffer_size = write_buffer_size;
+  ClipToRange(&options_.write_buffer_size, 64<<10, 1<<30);
+  options_.max_file_size = max_file_size;
+}
+
 void DBImpl::TEST_CompactRange(int level, const Slice* begin,const Slice* end) {
   assert(level >= 0);
   assert(level + 1 < config::kNumLevels);
@@ -852,49 +881,98 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
   return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
 }
 
-Status DBImpl::DoCompactionWork(CompactionState* compact) {
-  const uint64_t start_micros = env_->NowMicros();
-  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
-
-  Log(options_.info_log,  "Compacting %d@%d + %d@%d files",
-      compact->compaction->num_input_files(0),
-      compact->compaction->level(),
-      compact->compaction->num_input_files(1),
-      compact->compaction->level() + 1);
+void DBImpl::GetSubcompactionBoundaries(
+    Compaction* c, std::vector<std::string>* boundaries) {
+  // The files in level+1 partition the key range; assume the input from
+  // the level itself is spread across it the same way.
+  const int level1_files = c->num_input_files(1);
+  if (options_.max_subcompactions <= 1 || level1_files < 2) {
+    return;
+  }
+  uint64_t total_bytes = 0;
+  uint64_t level1_bytes = 0;
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < c->num_input_files(which); i++) {
+      total_bytes += c->input(which, i)->file_size;
+      if (which == 1) level1_bytes += c->input(which, i)->file_size;
+    }
+  }
 
-  assert(versions_->NumLevelFiles(compact->compaction->level()) > 0);
-  assert(compact->builder == NULL);
-  assert(compact->outfile == NULL);
-  if (snapshots_.empty()) {
-    compact->smallest_snapshot = versions_->LastSequence();
-  } else {
-    compact->smallest_snapshot = snapshots_.oldest()->number_;
+  // A thread is not worth it for less than a couple of output files
+  uint64_t n = std::min(options_.max_subcompactions, level1_files);
+  n = std::min(n, total_bytes / (2 * c->MaxOutputFileSize()));
+  if (n <= 1) {
+    return;
+  }
+  uint64_t bytes = 0;
+  for (int i = 0; i + 1 < level1_files && boundaries->size() + 1 < n; i++) {
+    bytes += c->input(1, i)->file_size;
+    if (bytes * n >= level1_bytes * (boundaries->size() + 1)) {
+      const Slice user_key = c->input(1, i)->largest.user_key();
+      if (boundaries->empty() ||
+          user_comparator()->Compare(user_key, boundaries->back()) > 0) {
+        boundaries->push_back(user_key.ToString());
+      }
+    }
   }
+}
 
-  // Release mutex while we're actually doing the compaction work
-  mutex_.Unlock();
+void DBImpl::SubcompactionThread(void* arg) {
+  SubcompactionThreadState* state =
+      reinterpret_cast<SubcompactionThreadState*>(arg);
+  DBImpl* db = state->db;
+  db->DoSubcompactionWork(state->compact);
+  db->mutex_.Lock();
+  --*state->remaining;
+  state->done_cv->SignalAll();
+  db->mutex_.Unlock();
+  delete state;
+}
 
+void DBImpl::DoSubcompactionWork(CompactionState* compact) {
   Iterator* input = versions_->MakeInputIterator(compact->compaction);
-  input->SeekToFirst();
+  if (compact->has_begin) {
+    // Positions at or just past the last entry for "begin"; entries
+    // for "begin" itself are skipped below.
+    InternalKey start(compact->begin, 0, static_cast<ValueType>(0));
+    input->Seek(start.Encode());
+  } else {
+    input->SeekToFirst();
+  }
   Status status;
   ParsedInternalKey ikey;
   std::string current_user_key;
   bool has_current_user_key = false;
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
   for (; input->Valid() && !shutting_down_.Acquire_Load(); ) {
-    // Prioritize immutable compaction work
+    // Prioritize immutable compaction work; one thread of the compaction
+    // takes it on while the others carry on merging.
     if (has_imm_.NoBarrier_Load() != NULL) {
       const uint64_t imm_start = env_->NowMicros();
       mutex_.Lock();
-      if (imm_ != NULL) {
+      if (imm_ != NULL && !imm_compaction_running_) {
+        imm_compaction_running_ = true;
         CompactMemTable();
+        imm_compaction_running_ = false;
         bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
       }
       mutex_.Unlock();
-      imm_micros += (env_->NowMicros() - imm_start);
+      compact->imm_micros += (env_->NowMicros() - imm_start);
     }
 
     Slice key = input->key();
+    if ((compact->has_begin || compact->has_end) &&
+        ParseInternalKey(key, &ikey)) {
+      if (compact->has_end &&
+          user_comparator()->Compare(ikey.user_key, compact->end) > 0) {
+        break;
+      }
+      if (compact->has_begin &&
+          user_comparator()->Compare(ikey.user_key, compact->begin) <= 0) {
+        input->Next();
+        continue;
+      }
+    }
     if (compact->compaction->ShouldStopBefore(key) &&
         compact->builder != NULL) {
       status = FinishCompactionOutputFile(compact, input);
@@ -985,7 +1063,89 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     status = input->status();
   }
   delete input;
-  input = NULL;
+  compact->status = status;
+}
+
+Status DBImpl::DoCompactionWork(CompactionState* compact) {
+  const uint64_t start_micros = env_->NowMicros();
+
+  Log(options_.info_log,  "Compacting %d@%d + %d@%d files",
+      compact->compaction->num_input_files(0),
+      compact->compaction->level(),
+      compact->compaction->num_input_files(1),
+      compact->compaction->level() + 1);
+
+  assert(versions_->NumLevelFiles(compact->compaction->level()) > 0);
+  assert(compact->builder == NULL);
+  assert(compact->outfile == NULL);
+  if (snapshots_.empty()) {
+    compact->smallest_snapshot = versions_->LastSequence();
+  } else {
+    compact->smallest_snapshot = snapshots_.oldest()->number_;
+  }
+
+  // The first part of the key range is merged by this thread, the
+  // others each by a thread of their own.
+  std::vector<std::string> boundaries;
+  GetSubcompactionBoundaries(compact->compaction, &boundaries);
+  std::vector<CompactionState*> subs;
+  subs.push_back(compact);
+  for (size_t i = 0; i < boundaries.size(); i++) {
+    CompactionState* sub =
+        new CompactionState(compact->compaction->NewSubcompaction());
+    sub->smallest_snapshot = compact->smallest_snapshot;
+    subs.back()->has_end = true;
+    subs.back()->end = boundaries[i];
+    sub->has_begin = true;
+    sub->begin = boundaries[i];
+    subs.push_back(sub);
+  }
+  if (subs.size() > 1) {
+    Log(options_.info_log, "Compacting in %d subcompactions",
+        static_cast<int>(subs.size()));
+    split_compactions_++;
+  }
+
+  // Release mutex while we're actually doing the compaction work
+  mutex_.Unlock();
+
+  port::CondVar done_cv(&mutex_);
+  int remaining = subs.size() - 1;
+  for (size_t i = 1; i < subs.size(); i++) {
+    SubcompactionThreadState* state = new SubcompactionThreadState;
+    state->db = this;
+    state->compact = subs[i];
+    state->done_cv = &done_cv;
+    state->remaining = &remaining;
+    env_->StartThread(&DBImpl::SubcompactionThread, state);
+  }
+  DoSubcompactionWork(compact);
+
+  mutex_.Lock();
+  while (remaining > 0) {
+    done_cv.Wait();
+  }
+
+  // Outputs of later parts follow those of earlier ones in key order
+  Status status = compact->status;
+  int64_t imm_micros = compact->imm_micros;
+  for (size_t i = 1; i < subs.size(); i++) {
+    CompactionState* sub = subs[i];
+    if (status.ok()) {
+      status = sub->status;
+    }
+    imm_micros += sub->imm_micros;
+    if (sub->builder != NULL) {
+      sub->builder->Abandon();
+      delete sub->builder;
+    }
+    delete sub->outfile;
+    compact->outputs.insert(compact->outputs.end(),
+                            sub->outputs.begin(), sub->outputs.end());
+    compact->total_bytes += sub->total_bytes;
+    delete sub->compaction;
+    delete sub;
+  }
 
   CompactionStats stats;
   stats.micros = env_->NowMicros() - start_micros - imm_micros;
@@ -998,7 +1158,6 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     stats.bytes_written += compact->outputs[i].file_size;
   }
 
-  mutex_.Lock();
   stats_[compact->compaction->level() + 1].Add(stats);
 
   if (status.ok()) {
@@ -1392,6 +1551,20 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
       }
     }
     return true;
+  } else if (in == "table-cache-hits" || in == "table-cache-misses") {
+    uint64_t hits, misses;
+    table_cache_->GetLookupCounts(&hits, &misses);
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%llu", static_cast<unsigned long long>(
+        in == "table-cache-hits" ? hits : misses));
+    *value = buf;
+    return true;
+  } else if (in == "split-compactions") {
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%llu",
+             static_cast<unsigned long long>(split_compactions_));
+    *value = buf;
+    return true;
   } else if (in == "sstables") {
     *value = versions_->current()->DebugString();
     return true;
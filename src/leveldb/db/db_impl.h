@@ -17,6 +17,7 @@
 
 namespace leveldb {
 
+class Compaction;
 class MemTable;
 class TableCache;
 class Version;
@@ -41,6 +42,7 @@ class DBImpl : public DB {
   virtual bool GetProperty(const Slice& property, std::string* value);
   virtual void GetApproximateSizes(const Range* range, int n, uint64_t* sizes);
   virtual void CompactRange(const Slice* begin, const Slice* end);
+  virtual void SetWriteSizes(size_t write_buffer_size, size_t max_file_size);
 
   // Extra methods (for testing) that are not in the public DB interface
 
@@ -112,6 +114,11 @@ class DBImpl : public DB {
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void GetSubcompactionBoundaries(Compaction* c,
+                                  std::vector<std::string>* boundaries);
+  struct SubcompactionThreadState;
+  static void SubcompactionThread(void* arg);
+  void DoSubcompactionWork(CompactionState* compact);
 
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
@@ -122,7 +129,9 @@ class DBImpl : public DB {
   Env* const env_;
   const InternalKeyComparator internal_comparator_;
   const InternalFilterPolicy internal_filter_policy_;
-  const Options options_;  // options_.comparator == &internal_comparator_
+  // options_.comparator == &internal_comparator_.  Only SetWriteSizes()
+  // changes options_ after construction, with mutex_ held.
+  Options options_;
   bool owns_info_log_;
   bool owns_cache_;
   const std::string dbname_;
@@ -158,6 +167,12 @@ class DBImpl : public DB {
   // Has a background compaction been scheduled or is running?
   bool bg_compaction_scheduled_;
 
+  // Is one of the threads of a compaction busy compacting imm_?
+  bool imm_compaction_running_;
+
+  // Number of compactions split into subcompactions so far
+  uint64_t split_compactions_;
+
   // Information for a manual compaction
   struct ManualCompaction {
     int level;
@@ -986,6 +986,32 @@ TEST(DBTest, CompactionsGenerateMultipleFiles) {
   }
 }
 
+TEST(DBTest, SetWriteSizes) {
+  Options options = CurrentOptions();
+  Reopen(&options);
+
+  // With a large write buffer, 8MB of writes stay in the memtable
+  db_->SetWriteSizes(100000000, options.max_file_size);
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < 80; i++) {
+    values.push_back(RandomString(&rnd, 100000));
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  ASSERT_EQ(TotalTableFiles(), 0);
+
+  // Reopening moves updates to level-0.  With a large file size,
+  // compacting them gives a single file.
+  Reopen(&options);
+  db_->SetWriteSizes(options.write_buffer_size, 100 << 20);
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+  ASSERT_EQ(NumTableFilesAtLevel(1), 1);
+  for (int i = 0; i < 80; i++) {
+    ASSERT_EQ(Get(Key(i)), values[i]);
+  }
+}
+
 TEST(DBTest, RepeatedWritesToSameKey) {
   Options options = CurrentOptions();
   options.env = env_;
@@ -1894,6 +1920,8 @@ class ModelDB: public DB {
   }
   virtual void CompactRange(const Slice* start, const Slice* end) {
   }
+  virtual void SetWriteSizes(size_t write_buffer_size, size_t max_file_size) {
+  }
 
  private:
   class ModelIter: public Iterator {
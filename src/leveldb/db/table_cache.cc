@@ -35,7 +35,8 @@ TableCache::TableCache(const std::string& dbname,
     : env_(options->env),
       dbname_(dbname),
       options_(options),
-      cache_(NewLRUCache(entries)) {
+      cache_(NewLRUCache(entries)),
+      block_cache_id_(options->block_cache ? options->block_cache->NewId() : 0) {
 }
 
 TableCache::~TableCache() {
@@ -61,7 +62,8 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
       }
     }
     if (s.ok()) {
-      s = Table::Open(*options_, file, file_size, &table);
+      s = Table::Open(*options_, file, file_size, block_cache_id_, file_number,
+                      &table);
     }
 
     if (!s.ok()) {
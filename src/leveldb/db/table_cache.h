@@ -47,11 +47,18 @@ class TableCache {
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
 
+  // Store the number of lookups that found an open table, and the number
+  // that had to open the file.
+  void GetLookupCounts(uint64_t* hits, uint64_t* misses) const {
+    cache_->GetLookupCounts(hits, misses);
+  }
+
  private:
   Env* const env_;
   const std::string dbname_;
   const Options* options_;
   Cache* cache_;
+  const uint64_t block_cache_id_;  // Partition of options_->block_cache
 
   Status FindTable(uint64_t file_number, uint64_t file_size, Cache::Handle**);
 };
@@ -360,14 +360,21 @@ class Compaction {
   // is successful.
   void ReleaseInputs();
 
+  // Return a compaction over the same inputs, with its own position
+  // for ShouldStopBefore() and IsBaseLevelForKey(), for merging a part
+  // of the key range in parallel with this one.
+  // REQUIRES: lock is held
+  Compaction* NewSubcompaction() const;
+
  private:
   friend class Version;
   friend class VersionSet;
 
-  explicit Compaction(int level);
+  Compaction(const Options* options, int level);
 
   int level_;
   uint64_t max_output_file_size_;
+  int64_t max_grandparent_overlap_bytes_;
   Version* input_version_;
   VersionEdit edit_;
 
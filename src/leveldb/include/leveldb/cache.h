@@ -81,6 +81,18 @@ class Cache {
   // its cache keys.
   virtual uint64_t NewId() = 0;
 
+  // Return an estimate of the combined charges of all elements stored in the
+  // cache, including the ones pinned by outstanding handles.
+  virtual size_t TotalCharge() const = 0;
+
+  // Store the number of Lookup() calls so far that found an entry in
+  // *hits, and the number that did not in *misses.
+  virtual void GetLookupCounts(uint64_t* hits, uint64_t* misses) const = 0;
+
+  // Change the capacity of the cache.  Entries nobody holds a handle to
+  // are evicted until the combined charges fit in the new capacity.
+  virtual void SetCapacity(size_t capacity) = 0;
+
  private:
   void LRU_Remove(Handle* e);
   void LRU_Append(Handle* e);
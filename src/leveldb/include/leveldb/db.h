@@ -115,6 +115,12 @@ class DB {
   //     about the internal operation of the DB.
   //  "leveldb.sstables" - returns a multi-line string that describes all
   //     of the sstables that make up the db contents.
+  //  "leveldb.table-cache-hits" - the number of table lookups that found
+  //     the table already open.
+  //  "leveldb.table-cache-misses" - the number of table lookups that had
+  //     to open the table file.
+  //  "leveldb.split-compactions" - the number of compactions that were
+  //     split into subcompactions merged in parallel.
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
   // For each i in [0,n-1], store in "sizes[i]", the approximate
@@ -140,6 +146,14 @@ class DB {
   //    db->CompactRange(NULL, NULL);
   virtual void CompactRange(const Slice* begin, const Slice* end) = 0;
 
+  // Change the size of the write buffer, and the target size of the table
+  // files written from now on, as if the database had been opened with
+  // options.write_buffer_size and options.max_file_size set to these
+  // values.  Files that were already written keep their size until they
+  // are compacted.
+  virtual void SetWriteSizes(size_t write_buffer_size,
+                             size_t max_file_size) = 0;
+
  private:
   // No copying allowed
   DB(const DB&);
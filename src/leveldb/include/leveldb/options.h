@@ -135,6 +135,26 @@ struct Options {
   // Default: NULL
   const FilterPolicy* filter_policy;
 
+  // Leveldb will write up to this amount of bytes to a file before
+  // switching to a new one.
+  // Most clients should leave this parameter alone.  However if your
+  // filesystem is more efficient with larger files, you could
+  // consider increasing the value.  The downside will be longer
+  // compactions and hence longer latency/performance hiccups.
+  // Another reason to increase this parameter might be when you are
+  // initially populating a large database.
+  //
+  // Default: 2MB
+  size_t max_file_size;
+
+  // Large compactions are split into up to this many key ranges that
+  // are merged in parallel, each by its own thread.  The level being
+  // compacted into decides where the ranges start and end, so small
+  // compactions, or ones that touch a single file there, are not split.
+  //
+  // Default: 1
+  int max_subcompactions;
+
   // Create an Options object with default values for all fields.
   Options();
 };
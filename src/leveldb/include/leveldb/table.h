@@ -40,6 +40,20 @@ class Table {
                      uint64_t file_size,
                      Table** table);
 
+  // Like the above, but the blocks of the table are kept in
+  // options.block_cache under keys made of "cache_id" and "file_number",
+  // so they outlive this Table: a later Open() of the same file finds
+  // them there.  The index and filter blocks are kept in the cache as
+  // well, pinned while the table is open, so that they count towards
+  // its capacity.  "cache_id" should come from options.block_cache->NewId()
+  // and be shared by all tables of the same database.
+  static Status Open(const Options& options,
+                     RandomAccessFile* file,
+                     uint64_t file_size,
+                     uint64_t cache_id,
+                     uint64_t file_number,
+                     Table** table);
+
   ~Table();
 
   // Returns a new iterator over the table contents.
@@ -60,6 +74,13 @@ class Table {
   Rep* rep_;
 
   explicit Table(Rep* rep) { rep_ = rep; }
+  enum { kMaxCacheKeyPrefix = 16 };
+  static Status Open(const Options& options,
+                     RandomAccessFile* file,
+                     uint64_t file_size,
+                     const Slice& cache_key_prefix,
+                     bool cache_meta,
+                     Table** table);
   static Iterator* BlockReader(void*, const ReadOptions&, const Slice&);
 
   // Calls (*handle_result)(arg, ...) with the entry found after a call
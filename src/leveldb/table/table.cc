@@ -19,25 +19,98 @@ namespace leveldb {
 
 struct Table::Rep {
   ~Rep() {
-    delete filter;
-    delete [] filter_data;
-    delete index_block;
+    if (filter_handle != NULL) {
+      options.block_cache->Release(filter_handle);
+    } else {
+      delete filter;
+      delete [] filter_data;
+    }
+    if (index_handle != NULL) {
+      options.block_cache->Release(index_handle);
+    } else {
+      delete index_block;
+    }
+  }
+
+  // Block cache key of the block at "offset": the table's prefix
+  // followed by the offset.  "buf" must hold kMaxCacheKeyPrefix+8 bytes.
+  Slice CacheKey(uint64_t offset, char* buf) const {
+    memcpy(buf, cache_key_prefix, cache_key_prefix_size);
+    EncodeFixed64(buf + cache_key_prefix_size, offset);
+    return Slice(buf, cache_key_prefix_size + 8);
   }
 
   Options options;
   Status status;
   RandomAccessFile* file;
-  uint64_t cache_id;
+  char cache_key_prefix[kMaxCacheKeyPrefix];
+  size_t cache_key_prefix_size;
+  bool cache_blocks;  // Blocks are read into memory we own, so worth caching
+  bool cache_meta;    // Keep index and filter in the block cache
   FilterBlockReader* filter;
   const char* filter_data;
+  Cache::Handle* filter_handle;  // Pins filter, if it is in the block cache
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
   Block* index_block;
+  Cache::Handle* index_handle;   // Pins index_block, if it is in the block cache
+};
+
+// A filter kept in the block cache, along with the contents it reads
+struct CachedFilter {
+  FilterBlockReader* reader;
+  const char* data;
 };
 
+static void DeleteBlock(void* arg, void* ignored) {
+  delete reinterpret_cast<Block*>(arg);
+}
+
+static void DeleteCachedBlock(const Slice& key, void* value) {
+  Block* block = reinterpret_cast<Block*>(value);
+  delete block;
+}
+
+static void DeleteCachedFilter(const Slice& key, void* value) {
+  CachedFilter* filter = reinterpret_cast<CachedFilter*>(value);
+  delete filter->reader;
+  delete [] filter->data;
+  delete filter;
+}
+
+static void ReleaseBlock(void* arg, void* h) {
+  Cache* cache = reinterpret_cast<Cache*>(arg);
+  Cache::Handle* handle = reinterpret_cast<Cache::Handle*>(h);
+  cache->Release(handle);
+}
+
+Status Table::Open(const Options& options,
+                   RandomAccessFile* file,
+                   uint64_t size,
+                   Table** table) {
+  char prefix[8];
+  EncodeFixed64(prefix, options.block_cache ? options.block_cache->NewId() : 0);
+  return Open(options, file, size, Slice(prefix, sizeof(prefix)), false, table);
+}
+
 Status Table::Open(const Options& options,
                    RandomAccessFile* file,
                    uint64_t size,
+                   uint64_t cache_id,
+                   uint64_t file_number,
+                   Table** table) {
+  char prefix[16];
+  EncodeFixed64(prefix, cache_id);
+  EncodeFixed64(prefix + 8, file_number);
+  return Open(options, file, size, Slice(prefix, sizeof(prefix)),
+              options.block_cache != NULL, table);
+}
+
+Status Table::Open(const Options& options,
+                   RandomAccessFile* file,
+                   uint64_t size,
+                   const Slice& cache_key_prefix,
+                   bool cache_meta,
                    Table** table) {
   *table = NULL;
   if (size < Footer::kEncodedLength) {
@@ -49,40 +122,67 @@ Status Table::Open(const Options& options,
   Status s = file->Read(size - Footer::kEncodedLength, Footer::kEncodedLength,
                         &footer_input, footer_space);
   if (!s.ok()) return s;
+  // A file that serves reads from its own memory (e.g. an mmap-ed file)
+  // returns non-cachable blocks: skip the block cache for it.
+  const bool cache_blocks = (options.block_cache != NULL &&
+                             footer_input.data() == footer_space);
 
   Footer footer;
   s = footer.DecodeFrom(&footer_input);
   if (!s.ok()) return s;
 
-  // Read the index block
-  BlockContents contents;
-  Block* index_block = NULL;
-  if (s.ok()) {
+  Rep* rep = new Table::Rep;
+  rep->options = options;
+  rep->file = file;
+  rep->metaindex_handle = footer.metaindex_handle();
+  assert(cache_key_prefix.size() <= kMaxCacheKeyPrefix);
+  memcpy(rep->cache_key_prefix, cache_key_prefix.data(),
+         cache_key_prefix.size());
+  rep->cache_key_prefix_size = cache_key_prefix.size();
+  rep->cache_blocks = cache_blocks;
+  rep->cache_meta = cache_meta && cache_blocks;
+  rep->filter_data = NULL;
+  rep->filter = NULL;
+  rep->filter_handle = NULL;
+  rep->index_block = NULL;
+  rep->index_handle = NULL;
+
+  // Read the index block, unless the block cache still has it
+  Cache* block_cache = options.block_cache;
+  char cache_key_buffer[kMaxCacheKeyPrefix + 8];
+  Slice key;
+  if (rep->cache_meta) {
+    key = rep->CacheKey(footer.index_handle().offset(), cache_key_buffer);
+    rep->index_handle = block_cache->Lookup(key);
+    if (rep->index_handle != NULL) {
+      rep->index_block =
+          reinterpret_cast<Block*>(block_cache->Value(rep->index_handle));
+    }
+  }
+  if (rep->index_block == NULL) {
+    BlockContents contents;
     ReadOptions opt;
     if (options.paranoid_checks) {
       opt.verify_checksums = true;
     }
     s = ReadBlock(file, opt, footer.index_handle(), &contents);
     if (s.ok()) {
-      index_block = new Block(contents);
+      rep->index_block = new Block(contents);
+      if (rep->cache_meta && contents.cachable) {
+        rep->index_handle = block_cache->Insert(
+            key, rep->index_block, rep->index_block->size(),
+            &DeleteCachedBlock);
+      }
     }
   }
 
   if (s.ok()) {
     // We've successfully read the footer and the index block: we're
     // ready to serve requests.
-    Rep* rep = new Table::Rep;
-    rep->options = options;
-    rep->file = file;
-    rep->metaindex_handle = footer.metaindex_handle();
-    rep->index_block = index_block;
-    rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
-    rep->filter_data = NULL;
-    rep->filter = NULL;
     *table = new Table(rep);
     (*table)->ReadMeta(footer);
   } else {
-    if (index_block) delete index_block;
+    delete rep;
   }
 
   return s;
@@ -93,6 +193,20 @@ void Table::ReadMeta(const Footer& footer) {
     return;  // Do not need any metadata
   }
 
+  // A cached filter is kept under the offset of the metaindex block,
+  // which saves reading that block too.
+  if (rep_->cache_meta) {
+    char cache_key_buffer[kMaxCacheKeyPrefix + 8];
+    Cache* block_cache = rep_->options.block_cache;
+    rep_->filter_handle = block_cache->Lookup(
+        rep_->CacheKey(footer.metaindex_handle().offset(), cache_key_buffer));
+    if (rep_->filter_handle != NULL) {
+      rep_->filter = reinterpret_cast<CachedFilter*>(
+          block_cache->Value(rep_->filter_handle))->reader;
+      return;
+    }
+  }
+
   // TODO(sanjay): Skip this if footer.metaindex_handle() size indicates
   // it is an empty block.
   ReadOptions opt;
@@ -138,27 +252,22 @@ void Table::ReadFilter(const Slice& filter_handle_value) {
     rep_->filter_data = block.data.data();     // Will need to delete later
   }
   rep_->filter = new FilterBlockReader(rep_->options.filter_policy, block.data);
+  if (rep_->cache_meta && block.heap_allocated) {
+    // Hand both over to the block cache
+    CachedFilter* cached = new CachedFilter;
+    cached->reader = rep_->filter;
+    cached->data = rep_->filter_data;
+    char cache_key_buffer[kMaxCacheKeyPrefix + 8];
+    rep_->filter_handle = rep_->options.block_cache->Insert(
+        rep_->CacheKey(rep_->metaindex_handle.offset(), cache_key_buffer),
+        cached, block.data.size(), &DeleteCachedFilter);
+  }
 }
 
 Table::~Table() {
   delete rep_;
 }
 
-static void DeleteBlock(void* arg, void* ignored) {
-  delete reinterpret_cast<Block*>(arg);
-}
-
-static void DeleteCachedBlock(const Slice& key, void* value) {
-  Block* block = reinterpret_cast<Block*>(value);
-  delete block;
-}
-
-static void ReleaseBlock(void* arg, void* h) {
-  Cache* cache = reinterpret_cast<Cache*>(arg);
-  Cache::Handle* handle = reinterpret_cast<Cache::Handle*>(h);
-  cache->Release(handle);
-}
-
 // Convert an index iterator value (i.e., an encoded BlockHandle)
 // into an iterator over the contents of the corresponding block.
 Iterator* Table::BlockReader(void* arg,
@@ -177,11 +286,9 @@ Iterator* Table::BlockReader(void* arg,
 
   if (s.ok()) {
     BlockContents contents;
-    if (block_cache != NULL) {
-      char cache_key_buffer[16];
-      EncodeFixed64(cache_key_buffer, table->rep_->cache_id);
-      EncodeFixed64(cache_key_buffer+8, handle.offset());
-      Slice key(cache_key_buffer, sizeof(cache_key_buffer));
+    if (table->rep_->cache_blocks) {
+      char cache_key_buffer[kMaxCacheKeyPrefix + 8];
+      Slice key = table->rep_->CacheKey(handle.offset(), cache_key_buffer);
       cache_handle = block_cache->Lookup(key);
       if (cache_handle != NULL) {
         block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
@@ -10,7 +10,9 @@
 #include "db/memtable.h"
 #include "db/write_batch_internal.h"
 #include "leveldb/db.h"
+#include "leveldb/cache.h"
 #include "leveldb/env.h"
+#include "leveldb/filter_policy.h"
 #include "leveldb/iterator.h"
 #include "leveldb/table_builder.h"
 #include "table/block.h"
@@ -861,6 +863,65 @@ TEST(TableTest, ApproximateOffsetOfCompressed) {
   ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"),    4000,   6000));
 }
 
+TEST(TableTest, PinnedIndexAndFilter) {
+  const FilterPolicy* filter_policy = NewBloomFilterPolicy(10);
+  Options options;
+  options.block_size = 256;
+  options.compression = kNoCompression;
+  options.filter_policy = filter_policy;
+  options.block_cache = NewLRUCache(1 << 20);
+
+  StringSink sink;
+  TableBuilder builder(options, &sink);
+  for (int i = 0; i < 1000; i++) {
+    char key[20];
+    snprintf(key, sizeof(key), "k%06d", i);
+    builder.Add(key, std::string(10, 'x'));
+  }
+  ASSERT_OK(builder.Finish());
+  StringSource source(sink.contents());
+  const uint64_t cache_id = options.block_cache->NewId();
+
+  // Opening the table caches the index and filter blocks
+  Table* table;
+  ASSERT_OK(Table::Open(options, &source, sink.contents().size(),
+                        cache_id, 1, &table));
+  const size_t meta_charge = options.block_cache->TotalCharge();
+  ASSERT_GT(meta_charge, 0);
+  uint64_t hits, misses;
+  options.block_cache->GetLookupCounts(&hits, &misses);
+  ASSERT_EQ(0, hits);
+  ASSERT_EQ(2, misses);
+
+  Iterator* iter = table->NewIterator(ReadOptions());
+  int n = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    n++;
+  }
+  ASSERT_EQ(1000, n);
+  delete iter;
+  ASSERT_GT(options.block_cache->TotalCharge(), meta_charge);
+  delete table;
+
+  // They outlive the table, and a later open finds them
+  ASSERT_OK(Table::Open(options, &source, sink.contents().size(),
+                        cache_id, 1, &table));
+  options.block_cache->GetLookupCounts(&hits, &misses);
+  ASSERT_EQ(2, hits);
+  delete table;
+
+  // While the table is open they are kept, even beyond the cache's capacity
+  delete options.block_cache;
+  options.block_cache = NewLRUCache(1);
+  ASSERT_OK(Table::Open(options, &source, sink.contents().size(),
+                        cache_id, 1, &table));
+  ASSERT_EQ(meta_charge, options.block_cache->TotalCharge());
+  delete table;
+
+  delete options.block_cache;
+  delete filter_policy;
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
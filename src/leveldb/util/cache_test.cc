@@ -146,6 +146,42 @@ TEST(CacheTest, EvictionPolicy) {
   ASSERT_EQ(-1, Lookup(200));
 }
 
+TEST(CacheTest, UseExceedsCacheSize) {
+  // Overfill the cache, keeping handles on all inserted entries.
+  // Entries that are in use must not be evicted.
+  std::vector<Cache::Handle*> h;
+  for (int i = 0; i < kCacheSize + 100; i++) {
+    h.push_back(cache_->Insert(EncodeKey(1000+i), EncodeValue(2000+i), 1,
+                               &CacheTest::Deleter));
+  }
+  ASSERT_GT(cache_->TotalCharge(), kCacheSize);
+
+  // Check that all the entries can be found in the cache.
+  for (int i = 0; i < h.size(); i++) {
+    ASSERT_EQ(2000+i, Lookup(1000+i));
+  }
+  ASSERT_EQ(0, deleted_keys_.size());
+
+  for (int i = 0; i < h.size(); i++) {
+    cache_->Release(h[i]);
+  }
+}
+
+TEST(CacheTest, LookupCounts) {
+  uint64_t hits, misses;
+  cache_->GetLookupCounts(&hits, &misses);
+  ASSERT_EQ(0, hits);
+  ASSERT_EQ(0, misses);
+
+  Insert(100, 101);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+  cache_->GetLookupCounts(&hits, &misses);
+  ASSERT_EQ(2, hits);
+  ASSERT_EQ(1, misses);
+}
+
 TEST(CacheTest, HeavyEntries) {
   // Add a bunch of light and heavy entries and then count the combined
   // size of items still in the cache, which must be approximately the
@@ -173,6 +209,28 @@ TEST(CacheTest, HeavyEntries) {
   ASSERT_LE(cached_weight, kCacheSize + kCacheSize/10);
 }
 
+TEST(CacheTest, SetCapacity) {
+  Insert(100, 101);
+  Cache::Handle* h = cache_->Lookup(EncodeKey(100));
+  for (int i = 0; i < kCacheSize; i++) {
+    Insert(1000+i, 2000+i);
+  }
+
+  // Shrinking evicts down to the new capacity, but not entries in use
+  cache_->SetCapacity(kCacheSize / 2);
+  ASSERT_LE(cache_->TotalCharge(), kCacheSize/2 + kCacheSize/10);
+  ASSERT_EQ(-1, Lookup(1000));
+  ASSERT_EQ(101, Lookup(100));
+  cache_->Release(h);
+
+  // Growing lets the cache hold more again
+  cache_->SetCapacity(kCacheSize * 2);
+  for (int i = 0; i < kCacheSize; i++) {
+    Insert(1000+i, 2000+i);
+  }
+  ASSERT_GE(cache_->TotalCharge(), kCacheSize);
+}
+
 TEST(CacheTest, NewId) {
   uint64_t a = cache_->NewId();
   uint64_t b = cache_->NewId();
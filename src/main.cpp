@@ -8,9 +8,11 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockfilter.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinsnapshot.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
@@ -43,6 +45,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/math/distributions/poisson.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -67,6 +70,7 @@ int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
+bool fBlockFilterIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
@@ -595,8 +599,15 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
+namespace {
+/** Running statistics of the UTXO set in pcoinsTip, valid once fCoinsStatsLoaded is set. */
+CCoinsRunningStats coinsStatsTip;
+bool fCoinsStatsLoaded = false;
+} // anon namespace
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // mapOrphanTransactions
@@ -1535,14 +1546,26 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    // Open history file to read, at the index header WriteBlockToDisk wrote
+    // in front of the block when there is one, for the size of the block
+    CDiskBlockPos hpos = pos;
+    if (hpos.nPos >= 8)
+        hpos.nPos -= 8;
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
         return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
 
     // Read block
     try {
-        filein >> block;
+        size_t nSizeHint = CSerializeArena::CHUNK_SIZE;
+        if (hpos.nPos != pos.nPos) {
+            CMessageHeader::MessageStartChars blkStart;
+            unsigned int nSize;
+            filein >> FLATDATA(blkStart) >> nSize;
+            if (memcmp(blkStart, Params().MessageStart(), MESSAGE_START_SIZE) == 0)
+                nSizeHint = nSize;
+        }
+        block.UnserializeWithArena(filein, filein.GetType(), filein.GetVersion(), nSizeHint);
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
@@ -1565,6 +1588,37 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(CDataStream& ss, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    // The block is preceded by the index header WriteBlockToDisk wrote
+    CDiskBlockPos hpos = pos;
+    if (hpos.nPos < 8)
+        return error("%s: invalid block position %s", __func__, pos.ToString());
+    hpos.nPos -= 8;
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+
+    const size_t nOffset = ss.size();
+    try {
+        CMessageHeader::MessageStartChars blkStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blkStart) >> nSize;
+        if (memcmp(blkStart, messageStart, MESSAGE_START_SIZE))
+            return error("%s: block magic mismatch at %s", __func__, pos.ToString());
+        if (nSize < 80 || nSize > MAX_SIZE)
+            return error("%s: invalid block size %u at %s", __func__, nSize, pos.ToString());
+        ss.resize(nOffset + nSize);
+        filein.read(&ss[nOffset], nSize);
+    }
+    catch (const std::exception& e) {
+        // A short read must not leave a partial block appended to ss
+        ss.resize(nOffset);
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1779,6 +1833,11 @@ bool CScriptCheck::operator()() {
     return true;
 }
 
+bool CHeaderCheck::operator()() {
+    *phash = pheader->GetHash();
+    return CheckProofOfWork(*phash, pheader->nBits, *pparams);
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -1998,7 +2057,44 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const CO
     return fClean;
 }
 
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+/** Collect the txids of the records a block changes: its own transactions and the ones it spends from. */
+static void GetBlockCoinsTxids(const CBlock& block, std::set<uint256>& setTxids)
+{
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        setTxids.insert(tx.GetHash());
+        if (tx.IsCoinBase())
+            continue;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            setTxids.insert(txin.prevout.hash);
+    }
+}
+
+/** Copy the records for setTxids, as they are in view before a block is applied, into mapRecords */
+static void GetCoinsStatsRecords(const CCoinsViewCache& view, const std::set<uint256>& setTxids, std::map<uint256, CCoins>& mapRecords)
+{
+    BOOST_FOREACH(const uint256& txid, setTxids) {
+        const CCoins* coins = view.AccessCoins(txid);
+        CCoins& record = mapRecords[txid];
+        if (coins && !coins->IsPruned())
+            record = *coins;
+    }
+}
+
+/**
+ * Update stats from the records in mapBefore to the same records as they are
+ * in view now. Only the outputs that differ are hashed, so a block costs one
+ * hash per output it creates or spends, whatever it overwrote or pruned.
+ */
+static void ApplyCoinsStats(CCoinsRunningStats& stats, const CCoinsViewCache& view, const std::map<uint256, CCoins>& mapBefore)
+{
+    static const CCoins coinsEmpty;
+    for (std::map<uint256, CCoins>::const_iterator it = mapBefore.begin(); it != mapBefore.end(); ++it) {
+        const CCoins* coins = view.AccessCoins(it->first);
+        stats.ApplyChange(it->first, it->second, coins && !coins->IsPruned() ? *coins : coinsEmpty);
+    }
+}
+
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean, CCoinsRunningStats* pstats)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -2017,6 +2113,13 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock(): block and undo data inconsistent");
 
+    std::map<uint256, CCoins> mapStatsBefore;
+    if (pstats) {
+        std::set<uint256> setStatsTxids;
+        GetBlockCoinsTxids(block, setStatsTxids);
+        GetCoinsStatsRecords(view, setStatsTxids, mapStatsBefore);
+    }
+
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
@@ -2055,6 +2158,11 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
         }
     }
 
+    if (pstats) {
+        ApplyCoinsStats(*pstats, view, mapStatsBefore);
+        pstats->hashBlock = pindex->pprev->GetBlockHash();
+    }
+
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
@@ -2098,6 +2206,52 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+static CCheckQueue<CHeaderCheck> headercheckqueue(128);
+
+void ThreadHeaderCheck() {
+    RenameThread("bitcoin-hdrcheck");
+    headercheckqueue.Thread();
+}
+
+static CCheckQueue<CMerkleHashCheck> merklecheckqueue(128);
+/** CheckBlock may run outside cs_main, while the queue only supports one master at a time */
+static CCriticalSection cs_merklecheckqueue;
+
+void ThreadMerkleCheck() {
+    RenameThread("bitcoin-merkle");
+    merklecheckqueue.Thread();
+}
+
+bool CMerkleHashCheck::operator()() {
+    SHA256D64(output, input, blocks);
+    return true;
+}
+
+/**
+ * Hash a level of a merkle tree (see MerkleHashFunc), splitting large levels
+ * over the merkle hashing threads. Small levels are not worth the handoff.
+ */
+static void ParallelMerkleHash(unsigned char* output, const unsigned char* input, size_t blocks)
+{
+    static const size_t nBatchSize = 256;
+    if (nScriptCheckThreads == 0 || blocks < 4 * nBatchSize) {
+        SHA256D64(output, input, blocks);
+        return;
+    }
+
+    LOCK(cs_merklecheckqueue);
+    CCheckQueueControl<CMerkleHashCheck> control(&merklecheckqueue);
+    std::vector<CMerkleHashCheck> vChecks;
+    vChecks.reserve((blocks + nBatchSize - 1) / nBatchSize);
+    for (size_t pos = 0; pos < blocks; pos += nBatchSize) {
+        vChecks.push_back(CMerkleHashCheck(output + 32 * pos, input + 64 * pos, std::min(nBatchSize, blocks - pos)));
+    }
+    control.Add(vChecks);
+    // CMerkleHashCheck cannot fail, so neither can the queue as a whole.
+    bool fHashed = control.Wait();
+    assert(fHashed);
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -2213,7 +2367,7 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck)
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, CCoinsRunningStats* pstats)
 {
     const CChainParams& chainparams = Params();
     AssertLockHeld(cs_main);
@@ -2231,8 +2385,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // Special case for the genesis block, skipping connection of its transactions
     // (its coinbase is unspendable)
     if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
-        if (!fJustCheck)
+        if (!fJustCheck) {
             view.SetBestBlock(pindex->GetBlockHash());
+            if (pstats)
+                pstats->hashBlock = pindex->GetBlockHash();
+        }
         return true;
     }
 
@@ -2313,6 +2470,15 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CBlockUndo blockundo;
 
+    // Remember the records this block changes, so the statistics can be
+    // updated from the difference once all transactions are applied.
+    std::map<uint256, CCoins> mapStatsBefore;
+    if (pstats && !fJustCheck) {
+        std::set<uint256> setStatsTxids;
+        GetBlockCoinsTxids(block, setStatsTxids);
+        GetCoinsStatsRecords(view, setStatsTxids, mapStatsBefore);
+    }
+
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     std::vector<int> prevheights;
@@ -2423,15 +2589,24 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
+    if (fBlockFilterIndex)
+        if (!pblocktree->WriteBlockFilter(block.GetHash(), CBlockFilter(block)))
+            return AbortNode(state, "Failed to write block filter index");
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
+    if (pstats) {
+        ApplyCoinsStats(*pstats, view, mapStatsBefore);
+        pstats->hashBlock = pindex->GetBlockHash();
+    }
+
     int64_t nTime5 = GetTimeMicros(); nTimeIndex += nTime5 - nTime4;
     LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime5 - nTime4), nTimeIndex * 0.000001);
 
     // Watch for changes to the previous coinbase transaction.
     static uint256 hashPrevBestCoinBase;
-    GetMainSignals().UpdatedTransaction(hashPrevBestCoinBase);
+    NotifyUpdatedTransaction(hashPrevBestCoinBase);
     hashPrevBestCoinBase = block.vtx[0].GetHash();
 
     int64_t nTime6 = GetTimeMicros(); nTimeCallbacks += nTime6 - nTime5;
@@ -2537,11 +2712,14 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         // Flush the chainstate (which may refer to block index entries).
         if (!pcoinsTip->Flush())
             return AbortNode(state, "Failed to write to coin database");
+        // Store the running UTXO set statistics for the chain state just written.
+        if (fCoinsStatsLoaded && !pblocktree->WriteCoinsStats(coinsStatsTip))
+            return AbortNode(state, "Failed to write UTXO set statistics");
         nLastFlush = nNow;
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
         // Update best block in wallet (so we can detect restored wallets).
-        GetMainSignals().SetBestChain(chainActive.GetLocator());
+        NotifySetBestChain(chainActive.GetLocator());
         nLastSetChain = nNow;
     }
     } catch (const std::runtime_error& e) {
@@ -2678,9 +2856,11 @@ bool static DisconnectTip(CValidationState& state, const Consensus::Params& cons
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        if (!DisconnectBlock(block, state, pindexDelete, view))
+        CCoinsRunningStats statsNew(coinsStatsTip);
+        if (!DisconnectBlock(block, state, pindexDelete, view, NULL, &statsNew))
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
+        coinsStatsTip = statsNew;
     }
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
     // Write the chain state to disk, if necessary.
@@ -2741,7 +2921,8 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view);
+        CCoinsRunningStats statsNew(coinsStatsTip);
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, &statsNew);
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2752,6 +2933,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
+        coinsStatsTip = statsNew;
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
@@ -2771,9 +2953,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         SyncWithWallets(tx, NULL);
     }
     // ... and about transactions that got confirmed:
-    BOOST_FOREACH(const CTransaction &tx, pblock->vtx) {
-        SyncWithWallets(tx, pblock);
-    }
+    SyncBlockWithWallets(*pblock);
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
@@ -2933,13 +3113,17 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
  * or an activated best chain. pblock is either NULL or a pointer to a block
  * that is already loaded (to avoid loading it again from disk).
  */
-bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams, const CBlock *pblock) {
+bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams, const CBlock *pblock, bool fLimitQueue) {
     CBlockIndex *pindexMostWork = NULL;
     do {
         boost::this_thread::interruption_point();
         if (ShutdownRequested())
             break;
 
+        // Don't let the wallet and ZMQ notifications fall arbitrarily far behind
+        if (fLimitQueue)
+            LimitValidationInterfaceQueue();
+
         CBlockIndex *pindexNewTip = NULL;
         const CBlockIndex *pindexFork;
         bool fInitialDownload;
@@ -2995,7 +3179,7 @@ bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams,
                 }
                 // Notify external listeners about the new tip.
                 if (!vHashes.empty()) {
-                    GetMainSignals().UpdatedBlockTip(pindexNewTip);
+                    NotifyUpdatedBlockTip(pindexNewTip);
                 }
             }
         }
@@ -3082,17 +3266,45 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex) {
     return true;
 }
 
-CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
+namespace {
+/** Number of block index entries allocated together */
+const size_t BLOCK_INDEX_SLAB_SIZE = 4096;
+
+/**
+ * Block index entries live in contiguous slabs rather than separate heap
+ * allocations; entries are only ever freed all at once, by FreeBlockIndexSlabs.
+ */
+std::vector<CBlockIndex*> vBlockIndexSlabs;
+size_t nBlockIndexSlabUsed = BLOCK_INDEX_SLAB_SIZE;
+
+CBlockIndex* AllocBlockIndex()
+{
+    if (nBlockIndexSlabUsed == BLOCK_INDEX_SLAB_SIZE) {
+        vBlockIndexSlabs.push_back(new CBlockIndex[BLOCK_INDEX_SLAB_SIZE]);
+        nBlockIndexSlabUsed = 0;
+    }
+    return &vBlockIndexSlabs.back()[nBlockIndexSlabUsed++];
+}
+
+void FreeBlockIndexSlabs()
+{
+    BOOST_FOREACH(CBlockIndex* pslab, vBlockIndexSlabs)
+        delete[] pslab;
+    vBlockIndexSlabs.clear();
+    nBlockIndexSlabUsed = BLOCK_INDEX_SLAB_SIZE;
+}
+} // anon namespace
+
+static CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256& hash)
 {
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator it = mapBlockIndex.find(hash);
     if (it != mapBlockIndex.end())
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = AllocBlockIndex();
+    *pindexNew = CBlockIndex(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -3116,6 +3328,11 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     return pindexNew;
 }
 
+CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
+{
+    return AddToBlockIndex(block, block.GetHash());
+}
+
 /** Mark a block as having its data received and checked (up to BLOCK_VALID_TRANSACTIONS). */
 bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBlockIndex *pindexNew, const CDiskBlockPos& pos)
 {
@@ -3280,7 +3497,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     // Check the merkle root.
     if (fCheckMerkleRoot) {
         bool mutated;
-        uint256 hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
+        uint256 hashMerkleRoot2 = BlockMerkleRoot(block, &mutated, ParallelMerkleHash);
         if (block.hashMerkleRoot != hashMerkleRoot2)
             return state.DoS(100, error("CheckBlock(): hashMerkleRoot mismatch"),
                              REJECT_INVALID, "bad-txnmrklroot", true);
@@ -3414,11 +3631,14 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+/**
+ * Accept a header whose hash has already been computed by the caller. If fCheckPOW
+ * is false the caller must have verified the header's proof of work already.
+ */
+static bool AcceptBlockHeader(const CBlockHeader& block, const uint256& hash, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fCheckPOW)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = NULL;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
@@ -3433,7 +3653,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state))
+        if (!CheckBlockHeader(block, state, fCheckPOW))
             return false;
 
         // Get prev block index
@@ -3453,7 +3673,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return false;
     }
     if (pindex == NULL)
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, hash);
 
     if (ppindex)
         *ppindex = pindex;
@@ -3461,6 +3681,11 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
     return true;
 }
 
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+{
+    return AcceptBlockHeader(block, block.GetHash(), state, chainparams, ppindex, true);
+}
+
 /** Store block on disk. If dbp is non-NULL, the file is known to already reside on disk */
 static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, CDiskBlockPos* dbp)
 {
@@ -3759,9 +3984,7 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex(): new CBlockIndex failed");
+    CBlockIndex* pindexNew = AllocBlockIndex();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
@@ -3922,6 +4145,11 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
+        if (fHavePruned && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning or started from a UTXO snapshot, only go back as far as we have data.
+            LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
+            break;
+        }
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
@@ -3998,15 +4226,15 @@ void UnloadBlockIndex()
     setDirtyFileInfo.clear();
     mapNodeState.clear();
     recentRejects.reset(NULL);
+    coinsStatsTip = CCoinsRunningStats();
+    fCoinsStatsLoaded = false;
     versionbitscache.Clear();
     for (int b = 0; b < VERSIONBITS_NUM_BITS; b++) {
         warningcache[b].clear();
     }
 
-    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
+    FreeBlockIndexSlabs();
     fHavePruned = false;
 }
 
@@ -4018,6 +4246,325 @@ bool LoadBlockIndex()
     return true;
 }
 
+bool LoadCoinsStats()
+{
+    LOCK(cs_main);
+    CCoinsRunningStats stats;
+    uint256 hashBestBlock = pcoinsTip->GetBestBlock();
+    if (!pblocktree->ReadCoinsStats(stats) || stats.hashBlock != hashBestBlock) {
+        // Missing, or left behind by a crash or an older version: recompute
+        // them once from the chain state, which is empty before the genesis
+        // block is connected.
+        stats = CCoinsRunningStats();
+        if (!hashBestBlock.IsNull()) {
+            uiInterface.InitMessage(_("Computing UTXO set statistics..."));
+            LogPrintf("Computing UTXO set statistics...\n");
+            FlushStateToDisk();
+            CCoinsStats scan;
+            if (!pcoinsTip->GetStats(scan))
+                return error("%s: unable to scan the UTXO set", __func__);
+            stats.hashBlock = scan.hashBlock;
+            stats.nTransactions = scan.nTransactions;
+            stats.nTransactionOutputs = scan.nTransactionOutputs;
+            stats.nSerializedSize = scan.nSerializedSize;
+            stats.nTotalAmount = scan.nTotalAmount;
+            stats.hashRolling = scan.hashRolling;
+        }
+        if (!pblocktree->WriteCoinsStats(stats))
+            return error("%s: unable to write UTXO set statistics", __func__);
+    }
+    coinsStatsTip = stats;
+    fCoinsStatsLoaded = true;
+    return true;
+}
+
+bool GetCoinsStats(CCoinsRunningStats& stats)
+{
+    LOCK(cs_main);
+    if (!fCoinsStatsLoaded)
+        return false;
+    stats = coinsStatsTip;
+    return true;
+}
+
+namespace {
+
+/** Write one chunk of coins records, see CCoinsSnapshotHeader, and add it to the coins hash. */
+void WriteCoinsSnapshotChunk(CAutoFile& fileout, CHashWriter& hasherCoins, unsigned int nRecords, const CDataStream& ssChunk)
+{
+    fileout << nRecords << (unsigned int)ssChunk.size() << ssChunk << Hash(ssChunk.begin(), ssChunk.end());
+    hasherCoins.write(&ssChunk[0], ssChunk.size());
+}
+
+bool WriteCoinsSnapshot(CAutoFile& fileout, CCoinsSnapshotHeader& header, uint256& hashCoins)
+{
+    boost::scoped_ptr<CCoinsViewCursor> pcursor;
+    {
+        // Take the statistics, the headers and a cursor over the flushed
+        // chain state all at the same tip.
+        LOCK(cs_main);
+        FlushStateToDisk();
+        if (!GetCoinsStats(header.stats))
+            return error("%s: UTXO set statistics are not loaded", __func__);
+        pcursor.reset(pcoinsTip->Cursor());
+        if (!pcursor || pcursor->GetBestBlock() != header.stats.hashBlock)
+            return error("%s: unable to iterate over the UTXO set", __func__);
+        BlockMap::iterator mi = mapBlockIndex.find(header.stats.hashBlock);
+        if (mi == mapBlockIndex.end())
+            return error("%s: best block of the UTXO set is not in the block index", __func__);
+        const CBlockIndex* pindex = mi->second;
+
+        memcpy(header.pchMessageStart, Params().MessageStart(), sizeof(header.pchMessageStart));
+        header.hashBlock = pindex->GetBlockHash();
+        header.nHeight = pindex->nHeight;
+        fileout << header;
+
+        std::vector<const CBlockIndex*> vIndex(pindex->nHeight);
+        for (const CBlockIndex* pindexWalk = pindex; pindexWalk->pprev; pindexWalk = pindexWalk->pprev)
+            vIndex[pindexWalk->nHeight - 1] = pindexWalk;
+        CHashWriter hasher(SER_GETHASH, 0);
+        BOOST_FOREACH(const CBlockIndex* pindexWalk, vIndex) {
+            CBlockHeader blockheader = pindexWalk->GetBlockHeader();
+            fileout << blockheader << VARINT(pindexWalk->nTx);
+            hasher << blockheader << VARINT(pindexWalk->nTx);
+        }
+        fileout << hasher.GetHash();
+    }
+
+    // The cursor reads a consistent snapshot of the database, so the coins
+    // can be written without holding up block processing.
+    CHashWriter hasherCoins(SER_GETHASH, 0);
+    hasherCoins << header.hashBlock;
+    CDataStream ssChunk(SER_DISK, CLIENT_VERSION);
+    unsigned int nRecords = 0;
+    uint64_t nTotalRecords = 0;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        uint256 txid;
+        CCoins coins;
+        if (!pcursor->GetKey(txid) || !pcursor->GetValue(coins))
+            return error("%s: unable to read the UTXO set", __func__);
+        ssChunk << txid << coins;
+        if (++nRecords == COINS_SNAPSHOT_CHUNK_RECORDS) {
+            WriteCoinsSnapshotChunk(fileout, hasherCoins, nRecords, ssChunk);
+            ssChunk.clear();
+            nTotalRecords += nRecords;
+            nRecords = 0;
+        }
+    }
+    if (nRecords > 0) {
+        WriteCoinsSnapshotChunk(fileout, hasherCoins, nRecords, ssChunk);
+        nTotalRecords += nRecords;
+    }
+    fileout << (unsigned int)0;
+
+    if (nTotalRecords != header.stats.nTransactions)
+        return error("%s: wrote %u records, expected %u", __func__, nTotalRecords, header.stats.nTransactions);
+    hashCoins = hasherCoins.GetHash();
+    return true;
+}
+
+} // anon namespace
+
+bool DumpCoinsSnapshot(const boost::filesystem::path& path, CCoinsSnapshotHeader& header, uint256& hashCoins)
+{
+    // Write to a temporary file first, so an interrupted dump never leaves
+    // a file that looks complete.
+    boost::filesystem::path pathTmp(path.string() + ".incomplete");
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s: unable to open %s", __func__, pathTmp.string());
+
+    bool fSuccess = false;
+    try {
+        fSuccess = WriteCoinsSnapshot(fileout, header, hashCoins);
+        if (fSuccess)
+            FileCommit(fileout.Get());
+    } catch (...) {
+        fileout.fclose();
+        boost::filesystem::remove(pathTmp);
+        throw;
+    }
+    fileout.fclose();
+    if (!fSuccess || !RenameOver(pathTmp, path)) {
+        boost::filesystem::remove(pathTmp);
+        return error("%s: unable to write %s", __func__, path.string());
+    }
+    LogPrintf("%s: wrote %u transactions at height %d to %s, coins hash %s\n", __func__,
+        header.stats.nTransactions, header.nHeight, path.string(), hashCoins.ToString());
+    return true;
+}
+
+bool LoadCoinsSnapshot(const CChainParams& chainparams, const boost::filesystem::path& path, const uint256& hashCoinsExpected)
+{
+    LOCK(cs_main);
+    // A load that was interrupted leaves the best block at genesis, so it is
+    // simply repeated; the records already written are overwritten.
+    if (chainActive.Height() > 0) {
+        LogPrintf("%s: chain state is not empty, not loading %s\n", __func__, path.string());
+        return true;
+    }
+    if (chainActive.Genesis() == NULL)
+        return error("%s: cannot load a snapshot while reindexing", __func__);
+
+    FILE* file = fopen(path.string().c_str(), "rb");
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: unable to open %s", __func__, path.string());
+
+    // The file is read twice. The first pass checks all of it, and the
+    // coins hash in particular, without changing anything, so that a
+    // refused snapshot leaves no coins or headers behind. The second pass
+    // accepts the headers and writes the coins, and only takes chunks with
+    // the checksums the first pass saw.
+    CCoinsSnapshotHeader header;
+    CBlockIndex* pindex = NULL;
+    std::vector<CBlockIndex*> vIndex;
+    std::vector<unsigned int> vTx;
+    std::vector<uint256> vChunkHash;
+    CCoinsRunningStats stats;
+    try {
+        for (int nPass = 0; nPass < 2; nPass++) {
+            const bool fApply = nPass == 1;
+            uiInterface.InitMessage(fApply ? _("Loading UTXO set snapshot...") : _("Verifying UTXO set snapshot..."));
+            if (fseek(filein.Get(), 0, SEEK_SET) != 0)
+                return error("%s: unable to rewind %s", __func__, path.string());
+
+            filein >> header;
+            if (memcmp(header.pchMessageStart, chainparams.MessageStart(), sizeof(header.pchMessageStart)) != 0)
+                return error("%s: %s is not a snapshot for this network", __func__, path.string());
+            if (header.nVersion != COINS_SNAPSHOT_VERSION)
+                return error("%s: unsupported snapshot version %d", __func__, header.nVersion);
+
+            // Accept the headers leading to the snapshot block as if they had
+            // come from a peer. The first pass can only check them on their own.
+            CHashWriter hasher(SER_GETHASH, 0);
+            pindex = chainActive.Genesis();
+            uint256 hashPrev = pindex->GetBlockHash();
+            for (int nHeight = 1; nHeight <= header.nHeight; nHeight++) {
+                boost::this_thread::interruption_point();
+                CBlockHeader blockheader;
+                unsigned int nTx;
+                filein >> blockheader >> VARINT(nTx);
+                hasher << blockheader << VARINT(nTx);
+                CValidationState state;
+                if (blockheader.hashPrevBlock != hashPrev || nTx == 0 ||
+                    !(fApply ? AcceptBlockHeader(blockheader, state, chainparams, &pindex) : CheckBlockHeader(blockheader, state, true)))
+                    return error("%s: invalid block header at height %d", __func__, nHeight);
+                hashPrev = blockheader.GetHash();
+                if (fApply) {
+                    vIndex.push_back(pindex);
+                    vTx.push_back(nTx);
+                }
+            }
+            uint256 hashHeaders;
+            filein >> hashHeaders;
+            if (hashHeaders != hasher.GetHash() || hashPrev != header.hashBlock || header.stats.hashBlock != header.hashBlock)
+                return error("%s: block headers do not match the snapshot", __func__);
+
+            // Check every chunk and the totals of the whole set, then write the
+            // coins through the cache, in large batches. Everything so far came
+            // from the file itself; only the coins hash is pinned from outside,
+            // so it is what the snapshot is finally trusted on.
+            if (fApply)
+                pblocktree->WriteFlag("loadingutxosnapshot", true);
+            CHashWriter hasherCoins(SER_GETHASH, 0);
+            hasherCoins << header.hashBlock;
+            stats = CCoinsRunningStats();
+            size_t nChunk = 0;
+            while (true) {
+                boost::this_thread::interruption_point();
+                unsigned int nRecords, nSize;
+                filein >> nRecords;
+                if (nRecords == 0)
+                    break;
+                filein >> nSize;
+                if (nRecords > COINS_SNAPSHOT_CHUNK_RECORDS || nSize > MAX_SIZE)
+                    return error("%s: corrupt chunk", __func__);
+                std::vector<char> vchChunk(nSize);
+                if (nSize > 0)
+                    filein.read(&vchChunk[0], nSize);
+                uint256 hashChunk;
+                filein >> hashChunk;
+                if (hashChunk != Hash(vchChunk.begin(), vchChunk.end()))
+                    return error("%s: chunk checksum mismatch", __func__);
+                if (!fApply)
+                    vChunkHash.push_back(hashChunk);
+                else if (nChunk >= vChunkHash.size() || hashChunk != vChunkHash[nChunk])
+                    return error("%s: %s changed while it was loaded", __func__, path.string());
+                nChunk++;
+                if (nSize > 0)
+                    hasherCoins.write(&vchChunk[0], nSize);
+                CDataStream ssChunk(vchChunk, SER_DISK, CLIENT_VERSION);
+                for (unsigned int i = 0; i < nRecords; i++) {
+                    uint256 txid;
+                    CCoins coins;
+                    ssChunk >> txid >> coins;
+                    if (coins.IsPruned())
+                        return error("%s: spent record %s", __func__, txid.ToString());
+                    stats.ApplyCoins(txid, coins, true);
+                    if (fApply) {
+                        CCoinsModifier modifier = pcoinsTip->ModifyNewCoins(txid);
+                        modifier->swap(coins);
+                    }
+                }
+                if (fApply && pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage && !pcoinsTip->Flush())
+                    return error("%s: failed to write to coin database", __func__);
+            }
+            if (nChunk != vChunkHash.size())
+                return error("%s: %s changed while it was loaded", __func__, path.string());
+            if (stats.nTransactions != header.stats.nTransactions ||
+                stats.nTransactionOutputs != header.stats.nTransactionOutputs ||
+                stats.nSerializedSize != header.stats.nSerializedSize ||
+                stats.nTotalAmount != header.stats.nTotalAmount ||
+                stats.hashRolling != header.stats.hashRolling)
+                return error("%s: UTXO set does not match the snapshot statistics", __func__);
+            uint256 hashCoins = hasherCoins.GetHash();
+            if (hashCoins != hashCoinsExpected)
+                return error("%s: coins hash %s does not match the expected %s", __func__,
+                    hashCoins.ToString(), hashCoinsExpected.ToString());
+        }
+        stats.hashBlock = header.hashBlock;
+
+        // The chain below the snapshot block now looks like that of a node
+        // which validated it and pruned all block data.
+        for (size_t i = 0; i < vIndex.size(); i++) {
+            CBlockIndex* pindexWalk = vIndex[i];
+            pindexWalk->nTx = vTx[i];
+            pindexWalk->nChainTx = pindexWalk->pprev->nChainTx + pindexWalk->nTx;
+            pindexWalk->RaiseValidity(BLOCK_VALID_SCRIPTS);
+            setDirtyBlockIndex.insert(pindexWalk);
+        }
+        fHavePruned = true;
+        pblocktree->WriteFlag("prunedblockfiles", true);
+        pcoinsTip->SetBestBlock(header.hashBlock);
+        coinsStatsTip = stats;
+        fCoinsStatsLoaded = true;
+        setBlockIndexCandidates.insert(pindex);
+        UpdateTip(pindex);
+        PruneBlockIndexCandidates();
+        CValidationState state;
+        if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+            return error("%s: failed to write the chain state", __func__);
+        pblocktree->WriteFlag("loadingutxosnapshot", false);
+
+        // MVF-Core: activate the fork as a restart at this height would
+        if (!isMVFHardForkActive && ((chainActive.Height() >= FinalActivateForkHeight)
+                                 || ( VersionBitsTipState(chainparams.GetConsensus(), Consensus::DEPLOYMENT_SEGWIT) == THRESHOLD_ACTIVE
+                                      && GetBoolArg("-segwitfork", DEFAULT_TRIGGER_ON_SEGWIT))))
+        {
+            ActivateFork(chainActive.Height(), false);
+        }
+
+        LogPrintf("%s: loaded %u transactions at height %d from %s\n", __func__,
+            stats.nTransactions, chainActive.Height(), path.string());
+    } catch (const std::exception& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+    return true;
+}
+
 bool InitBlockIndex(const CChainParams& chainparams) 
 {
     LOCK(cs_main);
@@ -4049,7 +4596,8 @@ bool InitBlockIndex(const CChainParams& chainparams)
             CBlockIndex *pindex = AddToBlockIndex(block);
             if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
                 return error("LoadBlockIndex(): genesis block not accepted");
-            if (!ActivateBestChain(state, chainparams, &block))
+            // cs_main is held, so don't wait for the notification queue
+            if (!ActivateBestChain(state, chainparams, &block, false))
                 return error("LoadBlockIndex(): genesis block cannot be activated");
             // Force a chainstate write so that when we VerifyDB in a moment, it doesn't check stale data
             return FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
@@ -4061,16 +4609,99 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
-bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+/** Maximum number of bytes of raw blocks read ahead of their processing while importing a block file */
+static const uint64_t MAX_IMPORT_READAHEAD = 32 * HARDFORK_MAX_BLOCK_SIZE;
+/** Maximum number of blocks deserialized and checked in parallel while importing a block file */
+static const size_t MAX_IMPORT_BATCH = 32;
+/** Maximum memory used by out of order blocks kept decoded until their parent is imported */
+static const uint64_t MAX_IMPORT_UNKNOWN_PARENT_USAGE = 64 * HARDFORK_MAX_BLOCK_SIZE;
+/** Size of the reads raw blocks are split into, small enough to fit in the block file buffer */
+static const unsigned int IMPORT_READ_CHUNK = 64 * 1024;
+
+/** A block taken from a block file by LoadExternalBlockFile, before and after being decoded */
+struct CImportBlock
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+    CDataStream ssRaw;
+    unsigned int nSize;
+    CDiskBlockPos pos;
+    CBlock block;
+    bool fDecoded;
+    std::string strError;
 
-    int nLoaded = 0;
-    try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+    CImportBlock(unsigned int nSizeIn, const CDiskBlockPos& posIn) : ssRaw(SER_DISK, CLIENT_VERSION), nSize(nSizeIn), pos(posIn), fDecoded(false) {}
+};
+
+/** Approximate memory used by a decoded import block: its scripts in the arena, and the rest of it */
+static uint64_t ImportBlockMemoryUsage(const CImportBlock& import)
+{
+    return import.nSize + (import.block.arena ? import.block.arena->DynamicMemoryUsage() : 0);
+}
+
+/** Closure deserializing an imported block and running the context-free checks on it */
+class CImportBlockCheck
+{
+private:
+    CImportBlock *pimport;
+
+public:
+    CImportBlockCheck() : pimport(NULL) {}
+    CImportBlockCheck(CImportBlock& importIn) : pimport(&importIn) {}
+
+    bool operator()() {
+        try {
+            pimport->block.UnserializeWithArena(pimport->ssRaw, pimport->ssRaw.GetType(), pimport->ssRaw.GetVersion(), pimport->ssRaw.size());
+            pimport->fDecoded = true;
+        } catch (const std::exception& e) {
+            pimport->strError = e.what();
+            pimport->ssRaw.clear();
+            pimport->ssRaw.shrink_to_fit();
+            return true;
+        }
+        // The raw block is not needed anymore, but out of order blocks may be
+        // kept around for a long time: give its memory back, not only its size.
+        pimport->ssRaw.clear();
+        pimport->ssRaw.shrink_to_fit();
+        // The result is cached in fChecked, so ProcessNewBlock does not repeat the checks
+        CValidationState state;
+        CheckBlock(pimport->block, state);
+        return true;
+    }
+
+    void swap(CImportBlockCheck &check) {
+        std::swap(pimport, check.pimport);
+    }
+};
+
+/**
+ * Reads the raw blocks of a block file sequentially in a thread of its own,
+ * ahead of their processing by LoadExternalBlockFile.
+ */
+class CBlockFileReader
+{
+private:
+    CBufferedFile& blkdat;
+    const CChainParams& chainparams;
+    CDiskBlockPos posFile;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<boost::shared_ptr<CImportBlock> > queue;
+    uint64_t nQueuedBytes;
+    bool fDone;
+    std::string strError;
+
+    void Push(const boost::shared_ptr<CImportBlock>& pimport)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!queue.empty() && nQueuedBytes + pimport->nSize > MAX_IMPORT_READAHEAD)
+            cond.wait(lock);
+        queue.push_back(pimport);
+        nQueuedBytes += pimport->nSize;
+        cond.notify_all();
+    }
+
+    void ReadBlocks()
+    {
         uint64_t nRewind = blkdat.GetPos();
         while (!blkdat.eof()) {
             boost::this_thread::interruption_point();
@@ -4089,7 +4720,7 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                     continue;
                 // read size
                 blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                if (nSize < 80 || nSize > HARDFORK_MAX_BLOCK_SIZE)
                     continue;
             } catch (const std::exception&) {
                 // no valid block header found; don't complain
@@ -4098,31 +4729,130 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
             try {
                 // read block
                 uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
+                boost::shared_ptr<CImportBlock> pimport(new CImportBlock(nSize, posFile));
+                pimport->pos.nPos = nBlockPos;
                 blkdat.SetLimit(nBlockPos + nSize);
                 blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
+                pimport->ssRaw.resize(nSize);
+                for (unsigned int nRead = 0; nRead < nSize; nRead += IMPORT_READ_CHUNK)
+                    blkdat.read(&pimport->ssRaw[nRead], std::min(nSize - nRead, IMPORT_READ_CHUNK));
                 nRewind = blkdat.GetPos();
+                Push(pimport);
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+    }
+
+public:
+    CBlockFileReader(CBufferedFile& blkdatIn, const CChainParams& chainparamsIn, const CDiskBlockPos* dbp) :
+        blkdat(blkdatIn), chainparams(chainparamsIn), nQueuedBytes(0), fDone(false)
+    {
+        if (dbp)
+            posFile = *dbp;
+    }
+
+    /** Thread body */
+    void Run()
+    {
+        try {
+            ReadBlocks();
+        } catch (const boost::thread_interrupted&) {
+        } catch (const std::runtime_error& e) {
+            strError = e.what();
+        }
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fDone = true;
+        cond.notify_all();
+    }
+
+    /** Take up to nMax blocks, waiting for at least one. Returns false at the end of the file. */
+    bool Pop(std::vector<boost::shared_ptr<CImportBlock> >& vBatch, size_t nMax)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (queue.empty() && !fDone)
+            cond.wait(lock);
+        vBatch.clear();
+        while (!queue.empty() && vBatch.size() < nMax) {
+            nQueuedBytes -= queue.front()->nSize;
+            vBatch.push_back(queue.front());
+            queue.pop_front();
+        }
+        cond.notify_all();
+        return !vBatch.empty();
+    }
+
+    std::string GetError()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return strError;
+    }
+};
+
+bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+{
+    // Map of blocks with unknown parent, either kept in memory or (only for
+    // reindex) as a disk position to read them from again later
+    static std::multimap<uint256, std::pair<CDiskBlockPos, boost::shared_ptr<CImportBlock> > > mapBlocksUnknownParent;
+    static uint64_t nUnknownParentUsage = 0;
+    typedef std::multimap<uint256, std::pair<CDiskBlockPos, boost::shared_ptr<CImportBlock> > >::iterator UnknownParentIter;
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+    CBufferedFile blkdat(fileIn, 2*HARDFORK_MAX_BLOCK_SIZE, HARDFORK_MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+
+    // The file is read in a separate thread, and blocks are deserialized and
+    // checked in parallel on nScriptCheckThreads threads, before being
+    // processed in order here.
+    CBlockFileReader reader(blkdat, chainparams, dbp);
+    CCheckQueuePool<CImportBlockCheck> importpool(1, nScriptCheckThreads - 1);
+    boost::thread threadReader(boost::bind(&CBlockFileReader::Run, &reader));
+
+    try {
+        std::vector<boost::shared_ptr<CImportBlock> > vBatch;
+        bool fError = false;
+        while (!fError && reader.Pop(vBatch, MAX_IMPORT_BATCH)) {
+            boost::this_thread::interruption_point();
+
+            std::vector<CImportBlockCheck> vChecks;
+            vChecks.reserve(vBatch.size());
+            for (size_t i = 0; i < vBatch.size(); i++)
+                vChecks.push_back(CImportBlockCheck(*vBatch[i]));
+            importpool.Run(vChecks);
+
+            for (size_t i = 0; i < vBatch.size() && !fError; i++) {
+                CImportBlock& import = *vBatch[i];
+                if (!import.fDecoded) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, import.strError);
+                    continue;
+                }
+                CBlock& block = import.block;
 
                 // detect out of order blocks, and store them for later
                 uint256 hash = block.GetHash();
                 if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
                     LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
                             block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+                    const uint64_t nUsage = ImportBlockMemoryUsage(import);
+                    if (nUnknownParentUsage + nUsage <= MAX_IMPORT_UNKNOWN_PARENT_USAGE) {
+                        nUnknownParentUsage += nUsage;
+                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, std::make_pair(dbp ? import.pos : CDiskBlockPos(), vBatch[i])));
+                    } else if (dbp) {
+                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, std::make_pair(import.pos, boost::shared_ptr<CImportBlock>())));
+                    }
                     continue;
                 }
 
                 // process in case the block isn't known yet
                 if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
                     CValidationState state;
-                    if (ProcessNewBlock(state, chainparams, NULL, &block, true, dbp))
+                    if (ProcessNewBlock(state, chainparams, NULL, &block, true, dbp ? &import.pos : NULL))
                         nLoaded++;
-                    if (state.IsError())
+                    if (state.IsError()) {
+                        fError = true;
                         break;
+                    }
                 } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
                     LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
                 }
@@ -4133,31 +4863,48 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 while (!queue.empty()) {
                     uint256 head = queue.front();
                     queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+                    std::pair<UnknownParentIter, UnknownParentIter> range = mapBlocksUnknownParent.equal_range(head);
                     while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
+                        UnknownParentIter it = range.first;
+                        CDiskBlockPos* pos = it->second.first.IsNull() ? NULL : &it->second.first;
+                        CBlock blockDisk;
+                        const CBlock* pblock = NULL;
+                        if (it->second.second) {
+                            pblock = &it->second.second->block;
+                        } else if (pos && ReadBlockFromDisk(blockDisk, *pos, chainparams.GetConsensus())) {
+                            pblock = &blockDisk;
+                        }
+                        if (pblock)
                         {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
+                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, pblock->GetHash().ToString(),
                                     head.ToString());
                             CValidationState dummy;
-                            if (ProcessNewBlock(dummy, chainparams, NULL, &block, true, &it->second))
+                            if (ProcessNewBlock(dummy, chainparams, NULL, pblock, true, pos))
                             {
                                 nLoaded++;
-                                queue.push_back(block.GetHash());
+                                queue.push_back(pblock->GetHash());
                             }
                         }
+                        if (it->second.second)
+                            nUnknownParentUsage -= ImportBlockMemoryUsage(*it->second.second);
                         range.first++;
                         mapBlocksUnknownParent.erase(it);
                     }
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
         }
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
-    }
+    } catch (...) {
+        // the reader thread uses objects on this stack frame
+        threadReader.interrupt();
+        threadReader.join();
+        throw;
+    }
+    threadReader.interrupt();
+    threadReader.join();
+    if (!reader.GetError().empty())
+        AbortNode(std::string("System error: ") + reader.GetError());
     if (nLoaded > 0)
         LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
     return nLoaded > 0;
@@ -5190,21 +5937,51 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Hash all headers and check their proof of work before taking cs_main,
+        // spread over the verification threads if there are any. The contextual
+        // checks below then reuse the computed hashes.
+        std::vector<uint256> vHashes(nCount);
+        bool fPoWValid = true;
+        {
+            std::vector<CHeaderCheck> vChecks;
+            vChecks.reserve(nCount);
+            for (unsigned int n = 0; n < nCount; n++)
+                vChecks.push_back(CHeaderCheck(headers[n], vHashes[n], chainparams.GetConsensus()));
+            if (nScriptCheckThreads) {
+                CCheckQueueControl<CHeaderCheck> control(&headercheckqueue);
+                control.Add(vChecks);
+                fPoWValid = control.Wait();
+            } else {
+                BOOST_FOREACH(CHeaderCheck& check, vChecks) {
+                    if (!check()) {
+                        fPoWValid = false;
+                        break;
+                    }
+                }
+            }
+        }
+
         LOCK(cs_main);
 
+        if (!fPoWValid) {
+            Misbehaving(pfrom->GetId(), 50);
+            return error("invalid header received: proof of work failed");
+        }
+
         if (nCount == 0) {
             // Nothing interesting. Stop asking this peers for more headers.
             return true;
         }
 
         CBlockIndex *pindexLast = NULL;
-        BOOST_FOREACH(const CBlockHeader& header, headers) {
+        for (unsigned int n = 0; n < nCount; n++) {
+            const CBlockHeader& header = headers[n];
             CValidationState state;
             if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast)) {
+            if (!AcceptBlockHeader(header, vHashes[n], state, chainparams, &pindexLast, false)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -5278,7 +6055,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         CBlock block;
-        vRecv >> block;
+        block.UnserializeWithArena(vRecv, vRecv.GetType(), vRecv.GetVersion(), vRecv.size());
 
         CInv inv(MSG_BLOCK, block.GetHash());
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
@@ -6028,10 +6805,8 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        FreeBlockIndexSlabs();
 
         // orphan transactions
         mapOrphanTransactions.clear();
@@ -32,8 +32,12 @@
 class CBlockIndex;
 class CBlockTreeDB;
 class CBloomFilter;
+class CCoinsSnapshotHeader;
+class CCoinsViewDB;
 class CChainParams;
 class CInv;
+class CHeaderCheck;
+class CMerkleHashCheck;
 class CScriptCheck;
 class CTxMemPool;
 class CValidationInterface;
@@ -111,6 +115,7 @@ static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const unsigned int DEFAULT_BYTES_PER_SIGOP = 20;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 static const bool DEFAULT_TESTSAFEMODE = false;
@@ -139,6 +144,7 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fBlockFilterIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern unsigned int nBytesPerSigOp;
@@ -210,6 +216,14 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
 bool InitBlockIndex(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk */
 bool LoadBlockIndex();
+/** Load the running UTXO set statistics, computing them with a full scan if the stored ones do not match the chain state */
+bool LoadCoinsStats();
+/** Get the running UTXO set statistics of the tip, maintained by ConnectTip/DisconnectTip; false before LoadCoinsStats */
+bool GetCoinsStats(CCoinsRunningStats& stats);
+/** Write the UTXO set at the tip, and the headers leading to it, to a snapshot file (see CCoinsSnapshotHeader); hashCoins is set to its coins hash */
+bool DumpCoinsSnapshot(const boost::filesystem::path& path, CCoinsSnapshotHeader& header, uint256& hashCoins);
+/** Fill the empty chain state from a snapshot file whose coins hash must be hashCoinsExpected, leaving a chain that looks pruned below the snapshot block; a refused snapshot changes nothing */
+bool LoadCoinsSnapshot(const CChainParams& chainparams, const boost::filesystem::path& path, const uint256& hashCoinsExpected);
 /** Unload database information */
 void UnloadBlockIndex();
 /** Process protocol messages received from a given node */
@@ -222,6 +236,10 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header proof-of-work checking thread */
+void ThreadHeaderCheck();
+/** Run an instance of the merkle tree hashing thread */
+void ThreadMerkleCheck();
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -236,8 +254,12 @@ bool IsInitialBlockDownload();
 std::string GetWarnings(const std::string& strFor);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256 &hash, CTransaction &tx, const Consensus::Params& params, uint256 &hashBlock, bool fAllowSlow = false);
-/** Find the best known block, and make it the tip of the block chain */
-bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams, const CBlock* pblock = NULL);
+/**
+ * Find the best known block, and make it the tip of the block chain. Unless
+ * fLimitQueue is false, wait for the chain notifications to catch up between
+ * steps; callers holding cs_main must pass false, as the listeners take it.
+ */
+bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams, const CBlock* pblock = NULL, bool fLimitQueue = true);
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
 
 /**
@@ -420,22 +442,77 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the context-free proof-of-work check of one header.
+ * The computed block hash is stored through phash so that the caller does
+ * not need to hash the header again.
+ */
+class CHeaderCheck
+{
+private:
+    const CBlockHeader *pheader;
+    uint256 *phash;
+    const Consensus::Params *pparams;
+
+public:
+    CHeaderCheck(): pheader(0), phash(0), pparams(0) {}
+    CHeaderCheck(const CBlockHeader& headerIn, uint256& hashOut, const Consensus::Params& paramsIn) :
+        pheader(&headerIn), phash(&hashOut), pparams(&paramsIn) { }
+
+    bool operator()();
+
+    void swap(CHeaderCheck &check) {
+        std::swap(pheader, check.pheader);
+        std::swap(phash, check.phash);
+        std::swap(pparams, check.pparams);
+    }
+};
+
+/**
+ * Closure representing the hashing of a range of adjacent merkle tree node
+ * pairs into their parents, as done by SHA256D64.
+ */
+class CMerkleHashCheck
+{
+private:
+    unsigned char *output;
+    const unsigned char *input;
+    size_t blocks;
+
+public:
+    CMerkleHashCheck(): output(0), input(0), blocks(0) {}
+    CMerkleHashCheck(unsigned char* outputIn, const unsigned char* inputIn, size_t blocksIn) :
+        output(outputIn), input(inputIn), blocks(blocksIn) { }
+
+    bool operator()();
+
+    void swap(CMerkleHashCheck &check) {
+        std::swap(output, check.output);
+        std::swap(input, check.input);
+        std::swap(blocks, check.blocks);
+    }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Append the serialized block at pos to ss as it is stored, without deserializing or checking it. On failure ss is left unchanged. */
+bool ReadRawBlockFromDisk(CDataStream& ss, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 
 /** Functions for validating blocks and updating the block tree */
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+ *  of problems. Note that in any case, coins may be modified. If pstats is provided, the
+ *  change to the UTXO set is applied to it as well. */
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL, CCoinsRunningStats* pstats = NULL);
 
-/** Apply the effects of this block (with given index) on the UTXO set represented by coins */
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false);
+/** Apply the effects of this block (with given index) on the UTXO set represented by coins,
+ *  and on pstats if provided */
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false, CCoinsRunningStats* pstats = NULL);
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
@@ -526,6 +603,9 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Global variable that points to the chainstate database below pcoinsTip (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
@@ -12,6 +12,8 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "hash.h"
 #include "main.h"
 #include "net.h"
@@ -330,28 +332,36 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
 //
 bool static ScanHash(const CBlockHeader *pblock, uint32_t& nNonce, uint256 *phash)
 {
-    // Write the first 76 bytes of the block header to a double-SHA256 state.
-    CHash256 hasher;
+    // All candidate headers share their first 64 bytes; only the last 16
+    // bytes (end of the merkle root, time, bits and nonce) differ. Hash a
+    // batch of consecutive nonces at once so multi-way SHA256 can be used.
+    static const unsigned int nBatch = 8;
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     ss << *pblock;
     assert(ss.size() == 80);
-    hasher.Write((unsigned char*)&ss[0], 76);
+    unsigned char tails[16 * nBatch];
+    unsigned char hashes[32 * nBatch];
+    for (unsigned int i = 0; i < nBatch; i++)
+        memcpy(tails + 16 * i, &ss[64], 12);
 
     while (true) {
-        nNonce++;
-
-        // Write the last 4 bytes of the block header (the nonce) to a copy of
-        // the double-SHA256 state, and compute the result.
-        CHash256(hasher).Write((unsigned char*)&nNonce, 4).Finalize((unsigned char*)phash);
-
-        // Return the nonce if the hash has at least some zero bits,
-        // caller will check if it has enough to reach the target
-        if (((uint16_t*)phash)[15] == 0)
-            return true;
-
-        // If nothing found after trying for a while, return -1
-        if ((nNonce & 0xfff) == 0)
-            return false;
+        for (unsigned int i = 0; i < nBatch; i++)
+            WriteLE32(tails + 16 * i + 12, nNonce + 1 + i);
+        SHA256D80(hashes, (unsigned char*)&ss[0], tails, nBatch);
+
+        for (unsigned int i = 0; i < nBatch; i++) {
+            nNonce++;
+            memcpy(phash->begin(), hashes + 32 * i, 32);
+
+            // Return the nonce if the hash has at least some zero bits,
+            // caller will check if it has enough to reach the target
+            if (((uint16_t*)phash)[15] == 0)
+                return true;
+
+            // If nothing found after trying for a while, return -1
+            if ((nNonce & 0xfff) == 0)
+                return false;
+        }
     }
 }
 
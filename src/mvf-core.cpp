@@ -6,6 +6,7 @@
 #include "mvf-core.h"
 #include "mvf-btcfork_conf_parser.h"
 #include "init.h"
+#include "sync.h"
 #include "util.h"
 #include "utilstrencodings.h"   // for atoi64
 #include "chainparams.h"
@@ -166,6 +167,28 @@ boost::filesystem::path MVFGetConfigFile()
     return pathConfigFile;
 }
 
+// MVF-Core begin outcome of the background auto wallet backup (MVHF-CORE-DES-WABU-4)
+// guards btcfork.conf against concurrent writes from the backup thread
+static CCriticalSection cs_btcforkconf;
+static bool fBTCforkConfigWritten = false;
+static std::string strAutoBackupResult;
+
+/** Record the outcome of the auto wallet backup in btcfork.conf, or keep it until ActivateFork writes the file */
+void MVFRecordAutoBackup(const std::string& strBackupFile, bool fSuccess)
+{
+    LOCK(cs_btcforkconf);
+    if (fSuccess)
+        strAutoBackupResult = strprintf("autobackupfile=%s\n", strBackupFile);
+    else
+        strAutoBackupResult = "error: unable to perform automatic backup - exiting\n";
+
+    if (fBTCforkConfigWritten) {
+        std::ofstream btcforkfile(MVFGetConfigFile().string().c_str(), std::ios::out | std::ios::app);
+        btcforkfile << strAutoBackupResult;
+    }
+}
+// MVF-Core end
+
 /** Actions when the fork triggers (MVHF-CORE-DES-TRIG-6) */
 // doBackup parameter default is true
 void ActivateFork(int actualForkHeight, bool doBackup)
@@ -180,6 +203,7 @@ void ActivateFork(int actualForkHeight, bool doBackup)
         // (e.g. soft-fork activated)
         FinalActivateForkHeight = actualForkHeight;
 
+        LOCK(cs_btcforkconf);
         boost::filesystem::path pathBTCforkConfigFile(MVFGetConfigFile());
         LogPrintf("%s: MVF: checking for existence of %s\n", __func__, pathBTCforkConfigFile.string().c_str());
 
@@ -243,6 +267,11 @@ void ActivateFork(int actualForkHeight, bool doBackup)
             fAutoBackupDone = true;  // added because otherwise backup can sometimes be re-done
         }
 
+        // record a pre-fork auto backup that has already completed;
+        // one still in progress appends its outcome itself
+        btcforkfile << strAutoBackupResult;
+        fBTCforkConfigWritten = true;
+
         // close fork parameter file
         btcforkfile.close();
     }
@@ -25,6 +25,10 @@
  *
  *  The data type T must be movable by memmove/realloc(). Once we switch to C++,
  *  move constructors can be used instead.
+ *
+ *  Indirect storage can also be external (see assign_external), in which case
+ *  the top bit of capacity is set, and the memory is never freed or resized
+ *  in place. Any reallocation moves the elements to memory of our own.
  */
 template<unsigned int N, typename T, typename Size = uint32_t, typename Diff = int32_t>
 class prevector {
@@ -152,7 +156,10 @@ private:
     const T* direct_ptr(difference_type pos) const { return reinterpret_cast<const T*>(_union.direct) + pos; }
     T* indirect_ptr(difference_type pos) { return reinterpret_cast<T*>(_union.indirect) + pos; }
     const T* indirect_ptr(difference_type pos) const { return reinterpret_cast<const T*>(_union.indirect) + pos; }
+    static const size_type EXTERNAL_FLAG = ((size_type)1) << (sizeof(size_type) * 8 - 1);
+
     bool is_direct() const { return _size <= N; }
+    bool is_external() const { return !is_direct() && (_union.capacity & EXTERNAL_FLAG); }
 
     void change_capacity(size_type new_capacity) {
         if (new_capacity <= N) {
@@ -160,12 +167,20 @@ private:
                 T* indirect = indirect_ptr(0);
                 T* src = indirect;
                 T* dst = direct_ptr(0);
+                bool external = is_external();
                 memcpy(dst, src, size() * sizeof(T));
-                free(indirect);
+                if (!external) {
+                    free(indirect);
+                }
                 _size -= N + 1;
             }
         } else {
-            if (!is_direct()) {
+            if (is_external()) {
+                char* new_indirect = static_cast<char*>(malloc(((size_t)sizeof(T)) * new_capacity));
+                memcpy(new_indirect, _union.indirect, size() * sizeof(T));
+                _union.indirect = new_indirect;
+                _union.capacity = new_capacity;
+            } else if (!is_direct()) {
                 _union.indirect = static_cast<char*>(realloc(_union.indirect, ((size_t)sizeof(T)) * new_capacity));
                 _union.capacity = new_capacity;
             } else {
@@ -281,7 +296,7 @@ public:
         if (is_direct()) {
             return N;
         } else {
-            return _union.capacity;
+            return _union.capacity & ~EXTERNAL_FLAG;
         }
     }
 
@@ -321,6 +336,21 @@ public:
         resize(0);
     }
 
+    /**
+     * Replace the contents with n uninitialized elements (n > N) stored in
+     * external memory, which is not freed by this prevector and must outlive
+     * it or any modification of it.
+     */
+    void assign_external(T* ptr, size_type n) {
+        clear();
+        if (!is_direct() && !is_external()) {
+            free(_union.indirect);
+        }
+        _union.indirect = reinterpret_cast<char*>(ptr);
+        _union.capacity = n | EXTERNAL_FLAG;
+        _size = n + N + 1;
+    }
+
     iterator insert(iterator pos, const T& value) {
         size_type p = pos - begin();
         size_type new_size = size() + 1;
@@ -423,7 +453,7 @@ public:
 
     ~prevector() {
         clear();
-        if (!is_direct()) {
+        if (!is_direct() && !is_external()) {
             free(_union.indirect);
             _union.indirect = NULL;
         }
@@ -474,7 +504,7 @@ public:
     }
 
     size_t allocated_memory() const {
-        if (is_direct()) {
+        if (is_direct() || is_external()) {
             return 0;
         } else {
             return ((size_t)(sizeof(T))) * _union.capacity;
@@ -10,6 +10,8 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <boost/shared_ptr.hpp>
+
 /** Nodes collect new transactions into a block, hash them into a hash tree,
  * and scan through nonce values to make the block's hash satisfy proof-of-work
  * requirements.  When they solve the proof-of-work, they broadcast the block
@@ -78,6 +80,9 @@ public:
 
     // memory only
     mutable bool fChecked;
+    // Declared after vtx, so that assignment copies the scripts out before
+    // the arena backing them is released.
+    boost::shared_ptr<CSerializeArena> arena;
 
     CBlock()
     {
@@ -98,11 +103,29 @@ public:
         READWRITE(vtx);
     }
 
+    /**
+     * Deserialize the block with the scripts of its transactions allocated
+     * from a single arena, released at once together with the block instead
+     * of one by one. Copies of the transactions do not depend on the arena.
+     * nSizeHint is the serialized size of the block when the caller knows it,
+     * and sizes the first chunk of the arena.
+     */
+    template <typename Stream>
+    void UnserializeWithArena(Stream& s, int nType, int nVersion, size_t nSizeHint = CSerializeArena::CHUNK_SIZE)
+    {
+        vtx.clear();
+        arena.reset(new CSerializeArena(nSizeHint));
+        ::Unserialize(s, *(CBlockHeader*)this, nType, nVersion);
+        CArenaStream<Stream> as(s, *arena, nType, nVersion);
+        ::Unserialize(as, vtx, nType, nVersion);
+    }
+
     void SetNull()
     {
         CBlockHeader::SetNull();
         vtx.clear();
         fChecked = false;
+        arena.reset();
     }
 
     CBlockHeader GetBlockHeader() const
@@ -9,9 +9,11 @@
 #include "primitives/transaction.h"
 #include "main.h"
 #include "httpserver.h"
+#include "init.h"
 #include "rpcserver.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "utilstrencodings.h"
 #include "version.h"
@@ -23,7 +25,15 @@
 
 using namespace std;
 
-static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const size_t MAX_GETUTXOS_OUTPOINTS = 10000; //allow a max of 10000 outpoints to be queried at once
+//! getutxos reads the chainstate database on this many threads, kept by pcoinsdbview, once there are GETUTXOS_READS_PER_THREAD reads for each
+static const int GETUTXOS_READ_THREADS = 4;
+static const size_t GETUTXOS_READS_PER_THREAD = 256;
+static const long MAX_REST_HEADERS = 2000;
+//! Headers and blocks in .bin or .hex are streamed, so more of them may be asked for at once
+static const long MAX_REST_HEADERS_STREAMED = 100000;
+static const long MAX_REST_BLOCKS = 1000;
+static const size_t REST_HEADERS_PER_CHUNK = 1000;
 
 enum RetFormat {
     RF_UNDEF,
@@ -118,6 +128,57 @@ static bool ParseHashStr(const string& strReq, uint256& v)
     return true;
 }
 
+/** Find the block a range starts at, given by hash or by height in the active chain. Requires cs_main. */
+static bool ParseBlockStart(const string& strStart, CBlockIndex*& pindex)
+{
+    uint256 hash;
+    if (ParseHashStr(strStart, hash)) {
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        pindex = (it != mapBlockIndex.end()) ? it->second : NULL;
+        return true;
+    }
+    int32_t nHeight;
+    if (!ParseInt32(strStart, &nHeight) || nHeight < 0)
+        return false;
+    pindex = chainActive[nHeight];
+    return true;
+}
+
+/* A streamed .bin or .hex reply: the body is sent in parts as it is
+ * produced, with libevent's chunked replies.
+ */
+static bool StartStreamReply(HTTPRequest* req, RetFormat rf)
+{
+    if (!req->StartChunkedReply(HTTP_OK, rf == RF_HEX ? "text/plain" : "application/octet-stream"))
+        return RESTERR(req, HTTP_SERVICE_UNAVAILABLE, "Too many streamed replies, try again later");
+    return true;
+}
+
+/** Size of nSize bytes of data in a streamed reply, including the final newline of hex */
+static size_t StreamReplySize(RetFormat rf, size_t nSize)
+{
+    return rf == RF_HEX ? 2 * nSize + 1 : nSize;
+}
+
+static bool WriteStreamChunk(HTTPRequest* req, RetFormat rf, const CDataStream& ss)
+{
+    if (ss.empty())
+        return true;
+    if (rf == RF_HEX) {
+        string strHex = HexStr(ss.begin(), ss.end());
+        return req->WriteReplyChunk(strHex.data(), strHex.size());
+    }
+    return req->WriteReplyChunk(&ss[0], ss.size());
+}
+
+/** End a streamed reply; if it is not complete the client sees the connection drop */
+static void EndStreamReply(HTTPRequest* req, RetFormat rf, bool fComplete)
+{
+    if (fComplete && rf == RF_HEX)
+        fComplete = req->WriteReplyChunk("\n", 1);
+    req->EndChunkedReply(fComplete);
+}
+
 static bool CheckWarmup(HTTPRequest* req)
 {
     std::string statusmessage;
@@ -137,23 +198,21 @@ static bool rest_headers(HTTPRequest* req,
     boost::split(path, param, boost::is_any_of("/"));
 
     if (path.size() != 2)
-        return RESTERR(req, HTTP_BAD_REQUEST, "No header count specified. Use /rest/headers/<count>/<hash>.<ext>.");
+        return RESTERR(req, HTTP_BAD_REQUEST, "No header count specified. Use /rest/headers/<count>/<hash|height>.<ext>.");
 
     long count = strtol(path[0].c_str(), NULL, 10);
-    if (count < 1 || count > 2000)
+    const long nMaxCount = (rf == RF_BINARY || rf == RF_HEX) ? MAX_REST_HEADERS_STREAMED : MAX_REST_HEADERS;
+    if (count < 1 || count > nMaxCount)
         return RESTERR(req, HTTP_BAD_REQUEST, "Header count out of range: " + path[0]);
 
-    string hashStr = path[1];
-    uint256 hash;
-    if (!ParseHashStr(hashStr, hash))
-        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
-
     std::vector<const CBlockIndex *> headers;
-    headers.reserve(count);
     {
         LOCK(cs_main);
-        BlockMap::const_iterator it = mapBlockIndex.find(hash);
-        const CBlockIndex *pindex = (it != mapBlockIndex.end()) ? it->second : NULL;
+        CBlockIndex *pindex;
+        if (!ParseBlockStart(path[1], pindex))
+            return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash or height: " + path[1]);
+        if (pindex != NULL && chainActive.Contains(pindex))
+            headers.reserve(std::min((long)(chainActive.Height() - pindex->nHeight + 1), count));
         while (pindex != NULL && chainActive.Contains(pindex)) {
             headers.push_back(pindex);
             if (headers.size() == (unsigned long)count)
@@ -162,23 +221,41 @@ static bool rest_headers(HTTPRequest* req,
         }
     }
 
-    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
-    BOOST_FOREACH(const CBlockIndex *pindex, headers) {
-        ssHeader << pindex->GetBlockHeader();
-    }
-
     switch (rf) {
-    case RF_BINARY: {
-        string binaryHeader = ssHeader.str();
-        req->WriteHeader("Content-Type", "application/octet-stream");
-        req->WriteReply(HTTP_OK, binaryHeader);
-        return true;
-    }
-
+    case RF_BINARY:
     case RF_HEX: {
-        string strHex = HexStr(ssHeader.begin(), ssHeader.end()) + "\n";
-        req->WriteHeader("Content-Type", "text/plain");
-        req->WriteReply(HTTP_OK, strHex);
+        // Block index entries are never freed, so the headers can be
+        // serialized without cs_main
+        CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+        // Stop early rather than exceed what the HTTP server can stream
+        const size_t nMaxHeaders = MaxChunkedReplySize() / StreamReplySize(rf, 80);
+        if (headers.size() > nMaxHeaders)
+            headers.resize(nMaxHeaders);
+        if (headers.size() <= REST_HEADERS_PER_CHUNK) {
+            // Fits in one part: reply with a Content-Length as before
+            BOOST_FOREACH(const CBlockIndex *pindex, headers) {
+                ssHeader << pindex->GetBlockHeader();
+            }
+            if (rf == RF_HEX) {
+                req->WriteHeader("Content-Type", "text/plain");
+                req->WriteReply(HTTP_OK, HexStr(ssHeader.begin(), ssHeader.end()) + "\n");
+            } else {
+                req->WriteHeader("Content-Type", "application/octet-stream");
+                req->WriteReply(HTTP_OK, ssHeader.str());
+            }
+            return true;
+        }
+        if (!StartStreamReply(req, rf))
+            return false;
+        bool fComplete = true;
+        for (size_t i = 0; i < headers.size() && fComplete; i++) {
+            ssHeader << headers[i]->GetBlockHeader();
+            if ((i + 1) % REST_HEADERS_PER_CHUNK == 0 || i + 1 == headers.size()) {
+                fComplete = WriteStreamChunk(req, rf, ssHeader);
+                ssHeader.clear();
+            }
+        }
+        EndStreamReply(req, rf, fComplete);
         return true;
     }
     case RF_JSON: {
@@ -263,6 +340,70 @@ static bool rest_block(HTTPRequest* req,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_blocks(HTTPRequest* req,
+                        const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    if (rf != RF_BINARY && rf != RF_HEX)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+
+    vector<string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No block count specified. Use /rest/blocks/<hash|height>/<count>.<ext>.");
+
+    long count = strtol(path[1].c_str(), NULL, 10);
+    if (count < 1 || count > MAX_REST_BLOCKS)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Block count out of range: " + path[1]);
+
+    // cs_main is only held to find the blocks; they are read and sent without it
+    std::vector<CDiskBlockPos> vPos;
+    {
+        LOCK(cs_main);
+        CBlockIndex* pindex;
+        if (!ParseBlockStart(path[0], pindex))
+            return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash or height: " + path[0]);
+        if (pindex == NULL || !chainActive.Contains(pindex))
+            return RESTERR(req, HTTP_NOT_FOUND, path[0] + " not found");
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            return RESTERR(req, HTTP_NOT_FOUND, path[0] + " not available (pruned data)");
+        vPos.reserve(std::min((long)(chainActive.Height() - pindex->nHeight + 1), count));
+        while (pindex != NULL && (pindex->nStatus & BLOCK_HAVE_DATA)) {
+            vPos.push_back(pindex->GetBlockPos());
+            if (vPos.size() == (unsigned long)count)
+                break;
+            pindex = chainActive.Next(pindex);
+        }
+    }
+
+    // A block that cannot be read any more (pruned meanwhile) cuts the reply
+    // short; one that would exceed what the HTTP server can stream ends it early
+    if (!StartStreamReply(req, rf))
+        return false;
+    bool fComplete = true;
+    size_t nStreamed = 0;
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_FOREACH(const CDiskBlockPos& pos, vPos) {
+        ssBlock.clear();
+        if (ShutdownRequested() || !ReadRawBlockFromDisk(ssBlock, pos, Params().MessageStart())) {
+            fComplete = false;
+            break;
+        }
+        nStreamed += ssBlock.size();
+        if (nStreamed > ssBlock.size() && StreamReplySize(rf, nStreamed) > MaxChunkedReplySize())
+            break;
+        if (!WriteStreamChunk(req, rf, ssBlock)) {
+            fComplete = false;
+            break;
+        }
+    }
+    EndStreamReply(req, rf, fComplete);
+    return true;
+}
+
 static bool rest_block_extended(HTTPRequest* req, const std::string& strURIPart)
 {
     return rest_block(req, strURIPart, true);
@@ -468,8 +609,8 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
                 if (fInputParsed) //don't allow sending input over URI and HTTP RAW DATA
                     return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Combination of URI scheme inputs and raw post data is not allowed");
 
-                CDataStream oss(SER_NETWORK, PROTOCOL_VERSION);
-                oss << strRequestMutable;
+                // the body is the raw BIP64 request, not a serialized string
+                CDataStream oss(strRequestMutable.data(), strRequestMutable.data() + strRequestMutable.size(), SER_NETWORK, PROTOCOL_VERSION);
                 oss >> fCheckMemPool;
                 oss >> vOutPoints;
             }
@@ -494,43 +635,78 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     if (vOutPoints.size() > MAX_GETUTXOS_OUTPOINTS)
         return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, strprintf("Error: max outpoints exceeded (max: %d, tried: %d)", MAX_GETUTXOS_OUTPOINTS, vOutPoints.size()));
 
+    // look up every transaction once, in database key order
+    vector<uint256> vTxid;
+    vTxid.reserve(vOutPoints.size());
+    BOOST_FOREACH(const COutPoint& outpoint, vOutPoints)
+        vTxid.push_back(outpoint.hash);
+    std::sort(vTxid.begin(), vTxid.end());
+    vTxid.erase(std::unique(vTxid.begin(), vTxid.end()), vTxid.end());
+
+    // Under the locks, take what the mempool and the coins cache of the tip
+    // know, and a snapshot of the chainstate database, which together with
+    // the cache makes up the tip. The database is read after the locks are
+    // released.
+    vector<CCoins> vCoins(vTxid.size());
+    vector<uint256> vTxidToRead;
+    vector<size_t> vReadIndex;
+    vector<bool> vSpentInMempool(vOutPoints.size());
+    int nChainHeight;
+    uint256 hashChainTip;
+    boost::scoped_ptr<CDBSnapshot> psnapshot;
+    {
+        LOCK2(cs_main, mempool.cs);
+        nChainHeight = chainActive.Height();
+        hashChainTip = chainActive.Tip()->GetBlockHash();
+
+        for (size_t i = 0; i < vTxid.size(); i++) {
+            CTransaction tx;
+            // A transaction in the mempool is looked up there first, as it has no pruned outputs
+            if (fCheckMemPool && mempool.lookup(vTxid[i], tx)) {
+                vCoins[i] = CCoins(tx, MEMPOOL_HEIGHT);
+            } else if (pcoinsTip->HaveCoinsInCache(vTxid[i])) {
+                vCoins[i] = *pcoinsTip->AccessCoins(vTxid[i]);
+            } else {
+                vTxidToRead.push_back(vTxid[i]);
+                vReadIndex.push_back(i);
+            }
+        }
+        for (size_t i = 0; i < vOutPoints.size(); i++)
+            vSpentInMempool[i] = mempool.mapNextTx.count(vOutPoints[i]);
+
+        if (!vTxidToRead.empty())
+            psnapshot.reset(pcoinsdbview->NewSnapshot());
+    }
+    if (!vTxidToRead.empty()) {
+        vector<CCoins> vCoinsRead;
+        int nThreads = vTxidToRead.size() >= GETUTXOS_READ_THREADS * GETUTXOS_READS_PER_THREAD ? GETUTXOS_READ_THREADS : 1;
+        if (!pcoinsdbview->GetCoinsSorted(vTxidToRead, vCoinsRead, *psnapshot, nThreads))
+            return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Error: failed to read the UTXO set");
+        for (size_t i = 0; i < vReadIndex.size(); i++)
+            vCoins[vReadIndex[i]].swap(vCoinsRead[i]);
+        psnapshot.reset();
+    }
+
     // check spentness and form a bitmap (as well as a JSON capable human-readable string representation)
     vector<unsigned char> bitmap;
     vector<CCoin> outs;
     std::string bitmapStringRepresentation;
     boost::dynamic_bitset<unsigned char> hits(vOutPoints.size());
-    {
-        LOCK2(cs_main, mempool.cs);
-
-        CCoinsView viewDummy;
-        CCoinsViewCache view(&viewDummy);
-
-        CCoinsViewCache& viewChain = *pcoinsTip;
-        CCoinsViewMemPool viewMempool(&viewChain, mempool);
-
-        if (fCheckMemPool)
-            view.SetBackend(viewMempool); // switch cache backend to db+mempool in case user likes to query mempool
-
-        for (size_t i = 0; i < vOutPoints.size(); i++) {
-            CCoins coins;
-            uint256 hash = vOutPoints[i].hash;
-            if (view.GetCoins(hash, coins)) {
-                mempool.pruneSpent(hash, coins);
-                if (coins.IsAvailable(vOutPoints[i].n)) {
-                    hits[i] = true;
-                    // Safe to index into vout here because IsAvailable checked if it's off the end of the array, or if
-                    // n is valid but points to an already spent output (IsNull).
-                    CCoin coin;
-                    coin.nTxVer = coins.nVersion;
-                    coin.nHeight = coins.nHeight;
-                    coin.out = coins.vout.at(vOutPoints[i].n);
-                    assert(!coin.out.IsNull());
-                    outs.push_back(coin);
-                }
-            }
-
-            bitmapStringRepresentation.append(hits[i] ? "1" : "0"); // form a binary string representation (human-readable for json output)
+    for (size_t i = 0; i < vOutPoints.size(); i++) {
+        const CCoins& coins = vCoins[std::lower_bound(vTxid.begin(), vTxid.end(), vOutPoints[i].hash) - vTxid.begin()];
+        if (!vSpentInMempool[i] && coins.IsAvailable(vOutPoints[i].n)) {
+            hits[i] = true;
+            // Safe to index into vout here because IsAvailable checked if it's off the end of the array, or if
+            // n is valid but points to an already spent output (IsNull).
+            CCoin coin;
+            coin.nTxVer = coins.nVersion;
+            coin.nHeight = coins.nHeight;
+            coin.out = coins.vout.at(vOutPoints[i].n);
+            assert(!coin.out.IsNull());
+            outs.push_back(coin);
         }
+
+        bitmapStringRepresentation.append(hits[i] ? "1" : "0"); // form a binary string representation (human-readable for json output)
     }
     boost::to_block_range(hits, std::back_inserter(bitmap));
 
@@ -539,7 +715,7 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         // serialize data
         // use exact same output as mentioned in Bip64
         CDataStream ssGetUTXOResponse(SER_NETWORK, PROTOCOL_VERSION);
-        ssGetUTXOResponse << chainActive.Height() << chainActive.Tip()->GetBlockHash() << bitmap << outs;
+        ssGetUTXOResponse << nChainHeight << hashChainTip << bitmap << outs;
         string ssGetUTXOResponseString = ssGetUTXOResponse.str();
 
         req->WriteHeader("Content-Type", "application/octet-stream");
@@ -549,7 +725,7 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
 
     case RF_HEX: {
         CDataStream ssGetUTXOResponse(SER_NETWORK, PROTOCOL_VERSION);
-        ssGetUTXOResponse << chainActive.Height() << chainActive.Tip()->GetBlockHash() << bitmap << outs;
+        ssGetUTXOResponse << nChainHeight << hashChainTip << bitmap << outs;
         string strHex = HexStr(ssGetUTXOResponse.begin(), ssGetUTXOResponse.end()) + "\n";
 
         req->WriteHeader("Content-Type", "text/plain");
@@ -562,8 +738,8 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
 
         // pack in some essentials
         // use more or less the same output as mentioned in Bip64
-        objGetUTXOResponse.push_back(Pair("chainHeight", chainActive.Height()));
-        objGetUTXOResponse.push_back(Pair("chaintipHash", chainActive.Tip()->GetBlockHash().GetHex()));
+        objGetUTXOResponse.push_back(Pair("chainHeight", nChainHeight));
+        objGetUTXOResponse.push_back(Pair("chaintipHash", hashChainTip.GetHex()));
         objGetUTXOResponse.push_back(Pair("bitmap", bitmapStringRepresentation));
 
         UniValue utxos(UniValue::VARR);
@@ -603,6 +779,7 @@ static const struct {
       {"/rest/tx/", rest_tx},
       {"/rest/block/notxdetails/", rest_block_notxdetails},
       {"/rest/block/", rest_block_extended},
+      {"/rest/blocks/", rest_blocks},
       {"/rest/chaininfo", rest_chaininfo},
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
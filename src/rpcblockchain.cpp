@@ -8,6 +8,7 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "coins.h"
+#include "coinsnapshot.h"
 #include "consensus/validation.h"
 #include "main.h"
 #include "policy/policy.h"
@@ -15,6 +16,7 @@
 #include "rpcserver.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
@@ -22,6 +24,8 @@
 
 #include <stdint.h>
 
+#include <boost/filesystem.hpp>
+
 #include <univalue.h>
 
 using namespace std;
@@ -433,11 +437,15 @@ UniValue getblock(const UniValue& params, bool fHelp)
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( fast )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time, unless fast is set.\n"
+            "\nArguments:\n"
+            "1. fast    (boolean, optional, default=false) Return the statistics kept up to date as blocks\n"
+            "           are connected instead of scanning the whole set. This is instant, but does not\n"
+            "           return hash_serialized\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
@@ -445,16 +453,39 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash (not with fast)\n"
+            "  \"hash_rolling\": \"hash\",      (string) Order independent hash of the unspent outputs. It is a\n"
+            "                                 local consistency check only: it can be forged, so do not\n"
+            "                                 compare it with other nodes, use hash_serialized for that\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "true")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    bool fFast = false;
+    if (params.size() > 0)
+        fFast = params[0].get_bool();
+
     UniValue ret(UniValue::VOBJ);
 
+    {
+    LOCK(cs_main);
+    CCoinsRunningStats running;
+    if (fFast && GetCoinsStats(running) && mapBlockIndex.count(running.hashBlock)) {
+        ret.push_back(Pair("height", (int64_t)mapBlockIndex[running.hashBlock]->nHeight));
+        ret.push_back(Pair("bestblock", running.hashBlock.GetHex()));
+        ret.push_back(Pair("transactions", (int64_t)running.nTransactions));
+        ret.push_back(Pair("txouts", (int64_t)running.nTransactionOutputs));
+        ret.push_back(Pair("bytes_serialized", (int64_t)running.nSerializedSize));
+        ret.push_back(Pair("hash_rolling", running.hashRolling.GetHex()));
+        ret.push_back(Pair("total_amount", ValueFromAmount(running.nTotalAmount)));
+        return ret;
+    }
+    }
+
     CCoinsStats stats;
     FlushStateToDisk();
     if (pcoinsTip->GetStats(stats)) {
@@ -464,11 +495,58 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
         ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+        ret.push_back(Pair("hash_rolling", stats.hashRolling.GetHex()));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     }
     return ret;
 }
 
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrite the unspent transaction output set at the tip to a snapshot file, together with\n"
+            "the block headers leading to it. A new node can start from it with -loadutxosnapshot.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) The file to write, relative to the data directory if not absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",          (string) the file written\n"
+            "  \"bestblock\": \"hex\",      (string) the block hash of the snapshot\n"
+            "  \"height\": n,              (numeric) the block height of the snapshot\n"
+            "  \"transactions\": n,        (numeric) The number of transactions written\n"
+            "  \"txouts\": n,              (numeric) The number of unspent outputs written\n"
+            "  \"hash_rolling\": \"hash\",  (string) Order independent hash of the unspent outputs, see gettxoutsetinfo\n"
+            "  \"coins_hash\": \"hash\",    (string) Hash of the snapshot contents, to be passed with -loadutxosnapshothash\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path(params[0].get_str());
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    CCoinsSnapshotHeader header;
+    uint256 hashCoins;
+    if (!DumpCoinsSnapshot(path, header, hashCoins))
+        throw JSONRPCError(RPC_MISC_ERROR, "Failed to write the snapshot, see debug.log for details");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("bestblock", header.hashBlock.GetHex()));
+    ret.push_back(Pair("height", header.nHeight));
+    ret.push_back(Pair("transactions", (int64_t)header.stats.nTransactions));
+    ret.push_back(Pair("txouts", (int64_t)header.stats.nTransactionOutputs));
+    ret.push_back(Pair("hash_rolling", header.stats.hashRolling.GetHex()));
+    ret.push_back(Pair("coins_hash", hashCoins.GetHex()));
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -885,6 +963,64 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+static UniValue DBCacheStatsToJSON(const CDBCacheStats& stats)
+{
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("blockcachesize", (uint64_t)stats.nBlockCacheSize));
+    ret.push_back(Pair("blockcacheusage", (uint64_t)stats.nBlockCacheUsage));
+    ret.push_back(Pair("blockcachehits", stats.nBlockCacheHits));
+    ret.push_back(Pair("blockcachemisses", stats.nBlockCacheMisses));
+    uint64_t nLookups = stats.nBlockCacheHits + stats.nBlockCacheMisses;
+    ret.push_back(Pair("blockcachehitrate", nLookups ? (double)stats.nBlockCacheHits / nLookups : 0.0));
+    ret.push_back(Pair("tablecachehits", stats.nTableCacheHits));
+    ret.push_back(Pair("tablecachemisses", stats.nTableCacheMisses));
+    nLookups = stats.nTableCacheHits + stats.nTableCacheMisses;
+    ret.push_back(Pair("tablecachehitrate", nLookups ? (double)stats.nTableCacheHits / nLookups : 0.0));
+    return ret;
+}
+
+UniValue getdbcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbcacheinfo\n"
+            "\nReturns the LevelDB cache counters of the chainstate and block index databases,\n"
+            "since they were opened. The index and filter blocks of open table files are held\n"
+            "in the block cache.\n"
+            "On 64-bit systems LevelDB maps up to 1000 open table files into memory, which with\n"
+            "the default -dbmaxopenfiles on Linux is most of them. Data blocks of a mapped file are\n"
+            "read through the operating system's page cache and never enter the block cache, so\n"
+            "the block cache counters then stay near zero. The table cache counters are not affected.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {                (json object) the chainstate database\n"
+            "    \"blockcachesize\": xxxxx,     (numeric) capacity of the block cache, in bytes\n"
+            "    \"blockcacheusage\": xxxxx,    (numeric) bytes held in the block cache\n"
+            "    \"blockcachehits\": xxxxx,     (numeric) block lookups served from the cache\n"
+            "    \"blockcachemisses\": xxxxx,   (numeric) block lookups that had to read the disk\n"
+            "    \"blockcachehitrate\": x.xxx,  (numeric) fraction of block lookups served from the cache\n"
+            "    \"tablecachehits\": xxxxx,     (numeric) table lookups that found the table file open\n"
+            "    \"tablecachemisses\": xxxxx,   (numeric) table lookups that had to open the table file\n"
+            "    \"tablecachehitrate\": x.xxx   (numeric) fraction of table lookups that found the file open\n"
+            "  },\n"
+            "  \"blockindex\": {                (json object) the block index database, same fields\n"
+            "    ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbcacheinfo", "")
+            + HelpExampleRpc("getdbcacheinfo", "")
+        );
+
+    LOCK(cs_main);
+    UniValue ret(UniValue::VOBJ);
+    if (pcoinsdbview)
+        ret.push_back(Pair("chainstate", DBCacheStatsToJSON(pcoinsdbview->GetCacheStats())));
+    if (pblocktree)
+        ret.push_back(Pair("blockindex", DBCacheStatsToJSON(pblocktree->GetCacheStats())));
+    return ret;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -12,6 +12,7 @@
 #include "keystore.h"
 #include "main.h"
 #include "merkleblock.h"
+#include "mvf-core-globals.h"
 #include "net.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
@@ -537,11 +538,30 @@ static void TxInErrorToJSON(const CTxIn& txin, UniValue& vErrorsRet, const std::
     vErrorsRet.push_back(entry);
 }
 
+std::vector<int> ParseSignChains(const UniValue& v)
+{
+    std::vector<int> vChainIds;
+    std::string strChain = v.isNull() ? "active" : v.get_str();
+    if (strChain == "active")
+        vChainIds.push_back(CHAINID_ACTIVE);
+    else if (strChain == "legacy")
+        vChainIds.push_back(0);
+    else if (strChain == "fork")
+        vChainIds.push_back(FinalForkId);
+    else if (strChain == "both") {
+        vChainIds.push_back(0);
+        vChainIds.push_back(FinalForkId);
+    }
+    else
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid chain param, must be one of active, legacy, fork or both");
+    return vChainIds;
+}
+
 UniValue signrawtransaction(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() < 1 || params.size() > 4)
+    if (fHelp || params.size() < 1 || params.size() > 5)
         throw runtime_error(
-            "signrawtransaction \"hexstring\" ( [{\"txid\":\"id\",\"vout\":n,\"scriptPubKey\":\"hex\",\"redeemScript\":\"hex\"},...] [\"privatekey1\",...] sighashtype )\n"
+            "signrawtransaction \"hexstring\" ( [{\"txid\":\"id\",\"vout\":n,\"scriptPubKey\":\"hex\",\"redeemScript\":\"hex\"},...] [\"privatekey1\",...] sighashtype chain )\n"
             "\nSign inputs for raw transaction (serialized, hex-encoded).\n"
             "The second optional argument (may be null) is an array of previous transaction outputs that\n"
             "this transaction depends on but may not yet be in the block chain.\n"
@@ -575,6 +595,11 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
             "       \"ALL|ANYONECANPAY\"\n"
             "       \"NONE|ANYONECANPAY\"\n"
             "       \"SINGLE|ANYONECANPAY\"\n"
+            "5. \"chain\"           (string, optional, default=active) The chain to sign for. Must be one of\n"
+            "       \"active\"   the chain selected by the fork state\n"
+            "       \"legacy\"   the pre-fork chain\n"
+            "       \"fork\"     the fork chain\n"
+            "       \"both\"     both chains, hashing each input only once\n"
 
             "\nResult:\n"
             "{\n"
@@ -591,9 +616,12 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
             "    ,...\n"
             "  ]\n"
             "}\n"
+            "With chain \"both\" the fields above are for the pre-fork chain, and \"forkhex\",\n"
+            "\"forkcomplete\" and \"forkerrors\" hold the same for the fork chain.\n"
 
             "\nExamples:\n"
             + HelpExampleCli("signrawtransaction", "\"myhex\"")
+            + HelpExampleCli("signrawtransaction", "\"myhex\" null null ALL both")
             + HelpExampleRpc("signrawtransaction", "\"myhex\"")
         );
 
@@ -602,7 +630,7 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
 #else
     LOCK(cs_main);
 #endif
-    RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VARR)(UniValue::VARR)(UniValue::VSTR), true);
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VARR)(UniValue::VARR)(UniValue::VSTR)(UniValue::VSTR), true);
 
     vector<unsigned char> txData(ParseHexV(params[0], "argument 1"));
     CDataStream ssData(txData, SER_NETWORK, PROTOCOL_VERSION);
@@ -740,40 +768,57 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
 
     bool fHashSingle = ((nHashType & ~SIGHASH_ANYONECANPAY) == SIGHASH_SINGLE);
 
-    // Script verification errors
-    UniValue vErrors(UniValue::VARR);
+    vector<int> vChainIds = ParseSignChains(params.size() > 4 ? params[4] : NullUniValue);
+
+    // Signature hashes do not cover input scripts, so one snapshot of the
+    // transaction serves for hashing all inputs on all chains
+    const CTransaction txConst(mergedTx);
+    CTxSignatureHasher hasher(txConst);
+
+    // One signed transaction and list of script verification errors per chain
+    vector<CMutableTransaction> vSignedTx(vChainIds.size(), mergedTx);
+    vector<UniValue> vErrors(vChainIds.size(), UniValue(UniValue::VARR));
 
     // Sign what we can:
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
-        CTxIn& txin = mergedTx.vin[i];
+        const CTxIn& txin = mergedTx.vin[i];
         const CCoins* coins = view.AccessCoins(txin.prevout.hash);
         if (coins == NULL || !coins->IsAvailable(txin.prevout.n)) {
-            TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
+            for (unsigned int j = 0; j < vChainIds.size(); j++)
+                TxInErrorToJSON(txin, vErrors[j], "Input not found or already spent");
             continue;
         }
         const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
 
-        txin.scriptSig.clear();
-        // Only sign SIGHASH_SINGLE if there's a corresponding output:
-        if (!fHashSingle || (i < mergedTx.vout.size()))
-            SignSignature(keystore, prevPubKey, mergedTx, i, nHashType);
+        // Chains innermost, so all but the first reuse the input's hash state
+        for (unsigned int j = 0; j < vChainIds.size(); j++) {
+            CTxIn& txinSigned = vSignedTx[j].vin[i];
+            TransactionSignatureCreator creator(&keystore, &txConst, i, nHashType, vChainIds[j], &hasher);
 
-        // ... and merge in other signatures:
-        BOOST_FOREACH(const CMutableTransaction& txv, txVariants) {
-            txin.scriptSig = CombineSignatures(prevPubKey, mergedTx, i, txin.scriptSig, txv.vin[i].scriptSig);
-        }
-        ScriptError serror = SCRIPT_ERR_OK;
-        if (!VerifyScript(txin.scriptSig, prevPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, MutableTransactionSignatureChecker(&mergedTx, i), &serror)) {
-            TxInErrorToJSON(txin, vErrors, ScriptErrorString(serror));
+            txinSigned.scriptSig.clear();
+            // Only sign SIGHASH_SINGLE if there's a corresponding output:
+            if (!fHashSingle || (i < mergedTx.vout.size()))
+                ProduceSignature(creator, prevPubKey, txinSigned.scriptSig);
+
+            // ... and merge in other signatures:
+            BOOST_FOREACH(const CMutableTransaction& txv, txVariants) {
+                txinSigned.scriptSig = CombineSignatures(prevPubKey, creator.Checker(), txinSigned.scriptSig, txv.vin[i].scriptSig);
+            }
+            ScriptError serror = SCRIPT_ERR_OK;
+            if (!VerifyScript(txinSigned.scriptSig, prevPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, creator.Checker(), &serror)) {
+                TxInErrorToJSON(txinSigned, vErrors[j], ScriptErrorString(serror));
+            }
         }
     }
-    bool fComplete = vErrors.empty();
 
     UniValue result(UniValue::VOBJ);
-    result.push_back(Pair("hex", EncodeHexTx(mergedTx)));
-    result.push_back(Pair("complete", fComplete));
-    if (!vErrors.empty()) {
-        result.push_back(Pair("errors", vErrors));
+    for (unsigned int j = 0; j < vChainIds.size(); j++) {
+        string strPrefix = j > 0 ? "fork" : "";
+        result.push_back(Pair(strPrefix + "hex", EncodeHexTx(vSignedTx[j])));
+        result.push_back(Pair(strPrefix + "complete", vErrors[j].empty()));
+        if (!vErrors[j].empty()) {
+            result.push_back(Pair(strPrefix + "errors", vErrors[j]));
+        }
     }
 
     return result;
@@ -1105,6 +1105,18 @@ public:
     }
 };
 
+/** Stream that appends everything written to a byte vector */
+class CVectorAppender
+{
+    std::vector<char>& vch;
+public:
+    CVectorAppender(std::vector<char>& vchIn) : vch(vchIn) {}
+    void write(const char* pch, size_t size) { vch.insert(vch.end(), pch, pch + size); }
+};
+
+/** Size of an input serialized with an empty script: prevout, script length byte, nSequence */
+const size_t SIGHASH_INPUT_SIZE = 32 + 4 + 1 + 4;
+
 } // anon namespace
 
 uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, unsigned int nChainId)
@@ -1133,6 +1145,57 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     return ss.GetHash();
 }
 
+CTxSignatureHasher::CTxSignatureHasher(const CTransaction& txToIn) : txTo(txToIn), fCached(false), nCachedIn(0), cachedWriter(SER_GETHASH, 0)
+{
+    // An input index past the end blanks the scripts of all inputs
+    CScript scriptEmpty;
+    CTransactionSignatureSerializer txTmp(txTo, scriptEmpty, txTo.vin.size(), SIGHASH_ALL);
+
+    CVectorAppender header(vchHeader);
+    ::Serialize(header, txTo.nVersion, SER_GETHASH, 0);
+    ::WriteCompactSize(header, txTo.vin.size());
+
+    vchInputs.reserve(txTo.vin.size() * SIGHASH_INPUT_SIZE);
+    CVectorAppender inputs(vchInputs);
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+        txTmp.SerializeInput(inputs, i, SER_GETHASH, 0);
+    assert(vchInputs.size() == txTo.vin.size() * SIGHASH_INPUT_SIZE);
+
+    CVectorAppender tail(vchTail);
+    ::WriteCompactSize(tail, txTo.vout.size());
+    for (unsigned int i = 0; i < txTo.vout.size(); i++)
+        txTmp.SerializeOutput(tail, i, SER_GETHASH, 0);
+    ::Serialize(tail, txTo.nLockTime, SER_GETHASH, 0);
+}
+
+uint256 CTxSignatureHasher::GetHash(const CScript& scriptCode, unsigned int nIn, int nHashType, unsigned int nChainId) const
+{
+    if (nHashType != SIGHASH_ALL || nIn >= txTo.vin.size())
+        return SignatureHash(scriptCode, txTo, nIn, nHashType, nChainId);
+
+    if (!fCached || nCachedIn != nIn || cachedScriptCode != scriptCode) {
+        CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
+        CHashWriter ss(SER_GETHASH, 0);
+        ss.write(&vchHeader[0], vchHeader.size());
+        if (nIn > 0)
+            ss.write(&vchInputs[0], nIn * SIGHASH_INPUT_SIZE);
+        txTmp.SerializeInput(ss, nIn, SER_GETHASH, 0);
+        size_t nAfter = (nIn + 1) * SIGHASH_INPUT_SIZE;
+        if (nAfter < vchInputs.size())
+            ss.write(&vchInputs[nAfter], vchInputs.size() - nAfter);
+        ss.write(&vchTail[0], vchTail.size());
+
+        cachedWriter = ss;
+        cachedScriptCode = scriptCode;
+        nCachedIn = nIn;
+        fCached = true;
+    }
+
+    CHashWriter ss(cachedWriter);
+    ss << ((nChainId << 1) | nHashType);
+    return ss.GetHash();
+}
+
 bool TransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
     return pubkey.Verify(sighash, vchSig);
@@ -1153,19 +1216,20 @@ bool TransactionSignatureChecker::CheckSig(const vector<unsigned char>& vchSigIn
 
     // MVF-Core begin CSIG
     // MVF-Core TODO: evaluate if we can accept pre-fork signatures indefinitely
-    uint256 sighash0 = SignatureHash(scriptCode, *txTo, nIn, nHashType);
-    if (isMVFHardForkActive) {
-        uint256 sighash1 = SignatureHash(scriptCode, *txTo, nIn, nHashType, FinalForkId);
-        // MVF-Core CSIG TODO: remove the commented out code if we decide we do
-        // not need to accept old-style signatures at all after the fork
-        //if (!VerifySignature(vchSig, pubkey, sighash0) && !VerifySignature(vchSig, pubkey, sighash1))
-        if (!VerifySignature(vchSig, pubkey, sighash1))
-            return false;
-    }
-    else {
-        if (!VerifySignature(vchSig, pubkey, sighash0))
-            return false;
-    }
+    // Only the hash for the chain being checked is computed; after the fork
+    // old-style signatures are not accepted, so hashing for chain id 0 too
+    // would be wasted work.
+    // MVF-Core CSIG TODO: if we decide to accept old-style signatures after
+    // the fork, also check against the chain id 0 hash here
+    unsigned int nCheckChainId;
+    if (nChainId != CHAINID_ACTIVE)
+        nCheckChainId = nChainId;
+    else
+        nCheckChainId = isMVFHardForkActive ? FinalForkId : 0;
+    uint256 sighash = hasher ? hasher->GetHash(scriptCode, nIn, nHashType, nCheckChainId)
+                             : SignatureHash(scriptCode, *txTo, nIn, nHashType, nCheckChainId);
+    if (!VerifySignature(vchSig, pubkey, sighash))
+        return false;
     // MVF-Core end
 
     return true;
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_SCRIPT_INTERPRETER_H
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
+#include "hash.h"
 #include "script_error.h"
 #include "primitives/transaction.h"
 
@@ -92,8 +93,41 @@ bool CheckSignatureEncoding(const std::vector<unsigned char> &vchSig, unsigned i
 
 // MVF-Core begin CSIG extend with chain id
 uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, unsigned int nChainId=0);
+
+/** Chain id argument meaning "whichever chain the fork state selects" (0 before the fork, FinalForkId after) */
+static const int CHAINID_ACTIVE = -1;
 // MVF-Core end
 
+/**
+ * Computes the same hashes as SignatureHash for the inputs of one transaction,
+ * without serializing the whole transaction again for every input: the parts
+ * all inputs share are serialized once up front. The hash state of the last
+ * input, up to the hash type word, is kept, so hashing that input again (for
+ * another key, to verify, or for the other chain) costs one final block.
+ * Only SIGHASH_ALL is cached; other hash types go through SignatureHash.
+ * Not thread safe, and txTo must outlive the hasher.
+ */
+class CTxSignatureHasher
+{
+private:
+    const CTransaction& txTo;
+    //! nVersion and the number of inputs
+    std::vector<char> vchHeader;
+    //! every input serialized with an empty script, SIGHASH_INPUT_SIZE bytes each
+    std::vector<char> vchInputs;
+    //! the outputs and nLockTime
+    std::vector<char> vchTail;
+
+    mutable bool fCached;
+    mutable unsigned int nCachedIn;
+    mutable CScript cachedScriptCode;
+    mutable CHashWriter cachedWriter;
+
+public:
+    CTxSignatureHasher(const CTransaction& txToIn);
+    uint256 GetHash(const CScript& scriptCode, unsigned int nIn, int nHashType, unsigned int nChainId=0) const;
+};
+
 class BaseSignatureChecker
 {
 public:
@@ -120,12 +154,14 @@ class TransactionSignatureChecker : public BaseSignatureChecker
 private:
     const CTransaction* txTo;
     unsigned int nIn;
+    int nChainId;
+    const CTxSignatureHasher* hasher;
 
 protected:
     virtual bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 
 public:
-    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn) : txTo(txToIn), nIn(nInIn) {}
+    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, int nChainIdIn=CHAINID_ACTIVE, const CTxSignatureHasher* hasherIn=NULL) : txTo(txToIn), nIn(nInIn), nChainId(nChainIdIn), hasher(hasherIn) {}
     bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const;
     bool CheckLockTime(const CScriptNum& nLockTime) const;
     bool CheckSequence(const CScriptNum& nSequence) const;
@@ -137,7 +173,7 @@ private:
     const CTransaction txTo;
 
 public:
-    MutableTransactionSignatureChecker(const CMutableTransaction* txToIn, unsigned int nInIn) : TransactionSignatureChecker(&txTo, nInIn), txTo(*txToIn) {}
+    MutableTransactionSignatureChecker(const CMutableTransaction* txToIn, unsigned int nInIn, int nChainIdIn=CHAINID_ACTIVE) : TransactionSignatureChecker(&txTo, nInIn, nChainIdIn), txTo(*txToIn) {}
 };
 
 bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL);
@@ -13,13 +13,15 @@
 #include "uint256.h"
 #include "mvf-core-globals.h"  // MVF-Core added
 
+#include <algorithm>
+
 #include <boost/foreach.hpp>
 
 using namespace std;
 
 typedef std::vector<unsigned char> valtype;
 
-TransactionSignatureCreator::TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, int nHashTypeIn) : BaseSignatureCreator(keystoreIn), txTo(txToIn), nIn(nInIn), nHashType(nHashTypeIn), checker(txTo, nIn) {}
+TransactionSignatureCreator::TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, int nHashTypeIn, int nChainIdIn, const CTxSignatureHasher* hasherIn) : BaseSignatureCreator(keystoreIn), txTo(txToIn), nIn(nInIn), nHashType(nHashTypeIn), nChainId(nChainIdIn), hasher(hasherIn), checker(txTo, nIn, nChainIdIn, hasherIn) {}
 
 bool TransactionSignatureCreator::CreateSig(std::vector<unsigned char>& vchSig, const CKeyID& address, const CScript& scriptCode) const
 {
@@ -28,11 +30,13 @@ bool TransactionSignatureCreator::CreateSig(std::vector<unsigned char>& vchSig,
         return false;
 
     // MVF-Core begin CSIG
-    uint256 hash;
-    if (isMVFHardForkActive)
-        hash = SignatureHash(scriptCode, *txTo, nIn, nHashType, FinalForkId);
+    unsigned int nSignChainId;
+    if (nChainId != CHAINID_ACTIVE)
+        nSignChainId = nChainId;
     else
-        hash = SignatureHash(scriptCode, *txTo, nIn, nHashType);
+        nSignChainId = isMVFHardForkActive ? FinalForkId : 0;
+    uint256 hash = hasher ? hasher->GetHash(scriptCode, nIn, nHashType, nSignChainId)
+                          : SignatureHash(scriptCode, *txTo, nIn, nHashType, nSignChainId);
     // MVF-Core end
 
     if (!key.Sign(hash, vchSig))
@@ -155,6 +159,26 @@ bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CMutab
     return SignSignature(keystore, txout.scriptPubKey, txTo, nIn, nHashType);
 }
 
+bool SignTransaction(const CKeyStore& keystore, const CTransaction& txTo, const vector<CScript>& vPrevPubKeys, int nHashType,
+                     const vector<int>& vChainIds, vector<CMutableTransaction>& vTxRet, vector<bool>& vCompleteRet)
+{
+    assert(vPrevPubKeys.size() == txTo.vin.size());
+    CTxSignatureHasher hasher(txTo);
+    vTxRet.assign(vChainIds.size(), CMutableTransaction(txTo));
+    vCompleteRet.assign(vChainIds.size(), true);
+
+    // Inputs outermost, so that every chain after the first reuses the
+    // cached hash state of the input
+    for (unsigned int i = 0; i < txTo.vin.size(); i++) {
+        for (unsigned int j = 0; j < vChainIds.size(); j++) {
+            TransactionSignatureCreator creator(&keystore, &txTo, i, nHashType, vChainIds[j], &hasher);
+            if (!ProduceSignature(creator, vPrevPubKeys[i], vTxRet[j].vin[i].scriptSig))
+                vCompleteRet[j] = false;
+        }
+    }
+    return std::find(vCompleteRet.begin(), vCompleteRet.end(), false) == vCompleteRet.end();
+}
+
 static CScript PushAll(const vector<valtype>& values)
 {
     CScript result;
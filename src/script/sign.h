@@ -30,15 +30,23 @@ public:
     virtual bool CreateSig(std::vector<unsigned char>& vchSig, const CKeyID& keyid, const CScript& scriptCode) const =0;
 };
 
-/** A signature creator for transactions. */
+/**
+ * A signature creator for transactions. Signs for nChainId (0 for the
+ * pre-fork chain, FinalForkId for the fork chain, CHAINID_ACTIVE for
+ * whichever the fork state selects). Signature hashes go through hasher when
+ * one is given, so signing many inputs of the same transaction does not
+ * serialize it again for each of them.
+ */
 class TransactionSignatureCreator : public BaseSignatureCreator {
     const CTransaction* txTo;
     unsigned int nIn;
     int nHashType;
+    int nChainId;
+    const CTxSignatureHasher* hasher;
     const TransactionSignatureChecker checker;
 
 public:
-    TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, int nHashTypeIn=SIGHASH_ALL);
+    TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, int nHashTypeIn=SIGHASH_ALL, int nChainIdIn=CHAINID_ACTIVE, const CTxSignatureHasher* hasherIn=NULL);
     const BaseSignatureChecker& Checker() const { return checker; }
     bool CreateSig(std::vector<unsigned char>& vchSig, const CKeyID& keyid, const CScript& scriptCode) const;
 };
@@ -58,6 +66,17 @@ bool ProduceSignature(const BaseSignatureCreator& creator, const CScript& script
 bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CMutableTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CMutableTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 
+/**
+ * Sign all inputs of txTo once for each chain id in vChainIds, returning one
+ * signed copy of txTo per chain in vTxRet, and in vCompleteRet whether it
+ * could be signed completely. vPrevPubKeys[i] is the script of the output
+ * spent by input i. The transaction is serialized for hashing only once, and
+ * each input is hashed once for all chains. Returns true if every copy is
+ * complete.
+ */
+bool SignTransaction(const CKeyStore& keystore, const CTransaction& txTo, const std::vector<CScript>& vPrevPubKeys, int nHashType,
+                     const std::vector<int>& vChainIds, std::vector<CMutableTransaction>& vTxRet, std::vector<bool>& vCompleteRet);
+
 /** Combine two script signatures using a generic signature checker, intelligently, possibly with OP_0 placeholders. */
 CScript CombineSignatures(const CScript& scriptPubKey, const BaseSignatureChecker& checker, const CScript& scriptSig1, const CScript& scriptSig2);
 
@@ -13,8 +13,10 @@
 #include <ios>
 #include <limits>
 #include <map>
+#include <new>
 #include <set>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string>
 #include <string.h>
 #include <utility>
@@ -502,6 +504,8 @@ template<typename Stream, unsigned int N, typename T> void Serialize_impl(Stream
 template<typename Stream, unsigned int N, typename T, typename V> void Serialize_impl(Stream& os, const prevector<N, T>& v, int nType, int nVersion, const V&);
 template<typename Stream, unsigned int N, typename T> inline void Serialize(Stream& os, const prevector<N, T>& v, int nType, int nVersion);
 template<typename Stream, unsigned int N, typename T> void Unserialize_impl(Stream& is, prevector<N, T>& v, int nType, int nVersion, const unsigned char&);
+template<typename Stream> class CArenaStream;
+template<typename Stream, unsigned int N, typename T> void Unserialize_impl(CArenaStream<Stream>& is, prevector<N, T>& v, int nType, int nVersion, const unsigned char&);
 template<typename Stream, unsigned int N, typename T, typename V> void Unserialize_impl(Stream& is, prevector<N, T>& v, int nType, int nVersion, const V&);
 template<typename Stream, unsigned int N, typename T> inline void Unserialize(Stream& is, prevector<N, T>& v, int nType, int nVersion);
 
@@ -938,4 +942,120 @@ public:
     }
 };
 
+/**
+ * Memory for objects that are deserialized together and released together,
+ * such as the scripts of all transactions in a block. Allocations are carved
+ * out of large chunks, which are only freed when the arena is destroyed.
+ * The first chunk can be sized from the serialized size of what is being
+ * deserialized, which bounds the total size of its allocations, so that a
+ * small block does not pin a full chunk.
+ */
+class CSerializeArena
+{
+private:
+    std::vector<char*> vChunks;
+    size_t nChunkSize;
+    size_t nChunkUsed;
+    size_t nNextChunkSize;
+    size_t nAllocated;
+
+    CSerializeArena(const CSerializeArena&);
+    CSerializeArena& operator=(const CSerializeArena&);
+
+public:
+    /** Maximum size of the chunks allocated; larger objects are never placed in the arena */
+    static const size_t CHUNK_SIZE = 256 * 1024;
+
+    explicit CSerializeArena(size_t nFirstChunkSize = CHUNK_SIZE) :
+        nChunkSize(0), nChunkUsed(0), nNextChunkSize(nFirstChunkSize < CHUNK_SIZE ? nFirstChunkSize : CHUNK_SIZE), nAllocated(0) {}
+
+    ~CSerializeArena()
+    {
+        for (size_t i = 0; i < vChunks.size(); i++)
+            free(vChunks[i]);
+    }
+
+    void* Allocate(size_t nSize)
+    {
+        assert(nSize <= CHUNK_SIZE);
+        if (nChunkUsed + nSize > nChunkSize) {
+            const size_t nNewChunkSize = std::max(nNextChunkSize, nSize);
+            char* pchunk = static_cast<char*>(malloc(nNewChunkSize));
+            if (!pchunk)
+                throw std::bad_alloc();
+            vChunks.push_back(pchunk);
+            nChunkSize = nNewChunkSize;
+            nChunkUsed = 0;
+            nAllocated += nNewChunkSize;
+            // Only the first chunk follows the size hint
+            nNextChunkSize = CHUNK_SIZE;
+        }
+        void* ret = vChunks.back() + nChunkUsed;
+        nChunkUsed += nSize;
+        return ret;
+    }
+
+    size_t DynamicMemoryUsage() const
+    {
+        return nAllocated;
+    }
+};
+
+/**
+ * Input stream wrapper that makes prevectors of unsigned char (scripts)
+ * deserialized through it use storage in an arena.
+ */
+template<typename Stream>
+class CArenaStream
+{
+private:
+    Stream& stream;
+    CSerializeArena& arena;
+
+public:
+    int nType;
+    int nVersion;
+
+    CArenaStream(Stream& streamIn, CSerializeArena& arenaIn, int nTypeIn, int nVersionIn) :
+        stream(streamIn), arena(arenaIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    CArenaStream& read(char* pch, size_t nSize)
+    {
+        stream.read(pch, nSize);
+        return (*this);
+    }
+
+    CSerializeArena& GetArena() { return arena; }
+    int GetType() { return nType; }
+    int GetVersion() { return nVersion; }
+
+    template<typename T>
+    CArenaStream& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+template<typename Stream, unsigned int N, typename T>
+void Unserialize_impl(CArenaStream<Stream>& is, prevector<N, T>& v, int nType, int nVersion, const unsigned char&)
+{
+    v.clear();
+    unsigned int nSize = ReadCompactSize(is);
+    if (nSize > N && nSize * sizeof(T) <= CSerializeArena::CHUNK_SIZE) {
+        v.assign_external(static_cast<T*>(is.GetArena().Allocate(nSize * sizeof(T))), nSize);
+        is.read((char*)&v[0], nSize * sizeof(T));
+        return;
+    }
+    // Small scripts are stored inline, and huge ones are read as usual
+    unsigned int i = 0;
+    while (i < nSize)
+    {
+        unsigned int blk = std::min(nSize - i, (unsigned int)(1 + 4999999 / sizeof(T)));
+        v.resize(i + blk);
+        is.read((char*)&v[i], blk * sizeof(T));
+        i += blk;
+    }
+}
+
 #endif // BITCOIN_SERIALIZE_H
@@ -119,6 +119,8 @@ public:
     const_reference operator[](size_type pos) const  { return vch[pos + nReadPos]; }
     reference operator[](size_type pos)              { return vch[pos + nReadPos]; }
     void clear()                                     { vch.clear(); nReadPos = 0; }
+    /** Release the memory of the buffer beyond what the unread data needs */
+    void shrink_to_fit()                             { vector_type(vch.begin() + nReadPos, vch.end()).swap(vch); nReadPos = 0; }
     iterator insert(iterator it, const char& x=char()) { return vch.insert(it, x); }
     void insert(iterator it, size_type n, const char& x) { vch.insert(it, n, x); }
 
@@ -505,6 +507,9 @@ public:
         }
     }
 
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+
     // check whether we're at the end of the source file
     bool eof() const {
         return nReadPos == nSrcPos && feof(src);
@@ -0,0 +1,115 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "chain.h"
+#include "clientversion.h"
+#include "hash.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "txdb.h"
+#include "test/test_bitcoin.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+// Deterministic test data, so that false positives cannot make the tests flaky
+static uint256 TestHash(int n)
+{
+    return Hash(BEGIN(n), END(n));
+}
+
+static CScript TestScript(int n)
+{
+    CScript script;
+    script << OP_DUP << OP_HASH160 << ToByteVector(TestHash(n)) << OP_EQUALVERIFY << OP_CHECKSIG;
+    return script;
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_match)
+{
+    CBlock block;
+    std::vector<CScript> vScripts;
+    std::vector<COutPoint> vOutPoints;
+    for (int i = 0; i < 100; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        if (i == 0) {
+            tx.vin[0].prevout.SetNull();
+        } else {
+            tx.vin[0].prevout = COutPoint(TestHash(-i), i);
+            vOutPoints.push_back(tx.vin[0].prevout);
+        }
+        tx.vout.resize(2);
+        tx.vout[0].scriptPubKey = TestScript(i);
+        vScripts.push_back(tx.vout[0].scriptPubKey);
+        tx.vout[1].scriptPubKey = CScript() << OP_RETURN << ToByteVector(TestHash(1000 + i));
+        block.vtx.push_back(tx);
+    }
+
+    CBlockFilter filter(block);
+    BOOST_CHECK_EQUAL(filter.GetElementCount(), 199U);
+
+    CDataStream stream(SER_DISK, CLIENT_VERSION);
+    stream << filter;
+    CBlockFilter filter2;
+    stream >> filter2;
+    BOOST_CHECK(filter2.GetEncoded() == filter.GetEncoded());
+    BOOST_CHECK_EQUAL(filter2.GetElementCount(), filter.GetElementCount());
+
+    // Every element of the block matches
+    for (size_t i = 0; i < vScripts.size(); i++)
+        BOOST_CHECK(filter2.MatchAny(std::vector<uint64_t>(1, CBlockFilter::HashElement(vScripts[i]))));
+    for (size_t i = 0; i < vOutPoints.size(); i++)
+        BOOST_CHECK(filter2.MatchAny(std::vector<uint64_t>(1, CBlockFilter::HashElement(vOutPoints[i]))));
+
+    // Unrelated elements, the null coinbase outpoint and OP_RETURN outputs do not
+    std::vector<uint64_t> vOther;
+    for (int i = 100; i < 1100; i++)
+        vOther.push_back(CBlockFilter::HashElement(TestScript(i)));
+    vOther.push_back(CBlockFilter::HashElement(block.vtx[0].vin[0].prevout));
+    vOther.push_back(CBlockFilter::HashElement(block.vtx[1].vout[1].scriptPubKey));
+    std::sort(vOther.begin(), vOther.end());
+    BOOST_CHECK(!filter2.MatchAny(vOther));
+
+    // ... until one element of the block is included
+    vOther.push_back(CBlockFilter::HashElement(vOutPoints[42]));
+    std::sort(vOther.begin(), vOther.end());
+    BOOST_CHECK(filter2.MatchAny(vOther));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_empty)
+{
+    CBlock block;
+    CBlockFilter filter(block);
+    BOOST_CHECK_EQUAL(filter.GetElementCount(), 0U);
+    BOOST_CHECK(filter.GetEncoded().empty());
+    BOOST_CHECK(!filter.MatchAny(std::vector<uint64_t>(1, CBlockFilter::HashElement(TestScript(0)))));
+}
+
+BOOST_FIXTURE_TEST_CASE(block_filter_index, TestChain100Setup)
+{
+    CScript scriptPubKey = TestScript(1);
+    fBlockFilterIndex = true;
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    fBlockFilterIndex = DEFAULT_BLOCKFILTERINDEX;
+    BOOST_CHECK_EQUAL(chainActive.Height(), 101);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+
+    CBlockFilter filter;
+    BOOST_CHECK(pblocktree->ReadBlockFilter(block.GetHash(), filter));
+    BOOST_CHECK_EQUAL(filter.GetElementCount(), 1U);
+    BOOST_CHECK(filter.MatchAny(std::vector<uint64_t>(1, CBlockFilter::HashElement(scriptPubKey))));
+    // Blocks connected without the index have no filter
+    BOOST_CHECK(!pblocktree->ReadBlockFilter(chainActive.Tip()->pprev->GetBlockHash(), filter));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
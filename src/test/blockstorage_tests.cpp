@@ -0,0 +1,117 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "main.h"
+#include "mvf-core-globals.h"
+#include "pow.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockstorage_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(load_external_block_file)
+{
+    const CChainParams& chainparams = Params();
+
+    // Write the blocks of the chain to a file in reverse order, so every
+    // block but the last one read has to wait for its parent
+    std::vector<uint256> vHashes;
+    boost::filesystem::path path = pathTemp / "bootstrap.dat";
+    {
+        CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        for (CBlockIndex* pindex = chainActive.Tip(); pindex->pprev; pindex = pindex->pprev) {
+            CBlock block;
+            BOOST_CHECK(ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()));
+            fileout << FLATDATA(chainparams.MessageStart()) << (unsigned int)::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+            fileout << block;
+            vHashes.push_back(pindex->GetBlockHash());
+        }
+    }
+
+    ResetChainState();
+    BOOST_CHECK_EQUAL(chainActive.Height(), 0);
+    BOOST_CHECK(LoadExternalBlockFile(chainparams, fopen(path.string().c_str(), "rb")));
+    BOOST_CHECK_EQUAL(chainActive.Height(), 100);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == vHashes.front());
+}
+
+BOOST_AUTO_TEST_CASE(reload_block_index)
+{
+    // MVF-Core: reloading the index must not trigger the fork for later tests
+    int nForkHeightSaved = FinalActivateForkHeight;
+    FinalActivateForkHeight = 999999;
+
+    FlushStateToDisk();
+    uint256 hashTip = chainActive.Tip()->GetBlockHash();
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), 101U);
+
+    // Once checking every entry over several key ranges, once trusting the
+    // entries checked the first time
+    int nScriptCheckThreadsSaved = nScriptCheckThreads;
+    nScriptCheckThreads = 4;
+    for (int nPass = 0; nPass < 2; nPass++) {
+        if (nPass == 1)
+            mapArgs["-trustblockindex"] = "1";
+        UnloadBlockIndex();
+        BOOST_CHECK(mapBlockIndex.empty());
+        BOOST_CHECK(LoadBlockIndex());
+        BOOST_CHECK_EQUAL(mapBlockIndex.size(), 101U);
+        BOOST_CHECK_EQUAL(chainActive.Height(), 100);
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == hashTip);
+        BOOST_CHECK(chainActive.Tip()->nChainWork == chainActive.Tip()->pprev->nChainWork + GetBlockProof(*chainActive.Tip()));
+        int nCheckedHeight = -1;
+        BOOST_CHECK(pblocktree->ReadPowCheckedHeight(nCheckedHeight));
+        BOOST_CHECK_EQUAL(nCheckedHeight, 100);
+    }
+    mapArgs.erase("-trustblockindex");
+    nScriptCheckThreads = nScriptCheckThreadsSaved;
+    FinalActivateForkHeight = nForkHeightSaved;
+}
+
+BOOST_AUTO_TEST_CASE(read_raw_block)
+{
+    const CChainParams& chainparams = Params();
+    CBlockIndex* pindex = chainActive.Tip();
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()));
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+
+    // Appends the block as it was serialized
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << 42;
+    BOOST_CHECK(ReadRawBlockFromDisk(ss, pindex->GetBlockPos(), chainparams.MessageStart()));
+    BOOST_CHECK_EQUAL(ss.size(), 4 + ssBlock.size());
+    BOOST_CHECK(std::equal(ssBlock.begin(), ssBlock.end(), ss.begin() + 4));
+
+    // A position that does not follow a block header is rejected
+    size_t nSize = ss.size();
+    CDiskBlockPos pos = pindex->GetBlockPos();
+    pos.nPos += 1;
+    BOOST_CHECK(!ReadRawBlockFromDisk(ss, pos, chainparams.MessageStart()));
+    BOOST_CHECK_EQUAL(ss.size(), nSize);
+
+    // A block cut short, as in a truncated file, leaves nothing appended
+    CDiskBlockPos posShort(pindex->GetBlockPos().nFile + 1, 8);
+    {
+        CAutoFile fileout(OpenBlockFile(CDiskBlockPos(posShort.nFile, 0)), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!fileout.IsNull());
+        unsigned int nBlockSize = 1000;
+        fileout << FLATDATA(chainparams.MessageStart()) << nBlockSize;
+        fileout << std::vector<unsigned char>(100, 0x42);
+    }
+    BOOST_CHECK(!ReadRawBlockFromDisk(ss, posShort, chainparams.MessageStart()));
+    BOOST_CHECK_EQUAL(ss.size(), nSize);
+    boost::filesystem::remove(GetBlockPosFilename(posShort, "blk"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
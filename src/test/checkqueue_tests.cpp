@@ -0,0 +1,73 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+/** Check that marks its slot as done, and fails if told to */
+class CMarkCheck
+{
+private:
+    char* pfDone;
+    bool fFail;
+
+public:
+    CMarkCheck() : pfDone(NULL), fFail(false) {}
+    CMarkCheck(char& fDoneIn, bool fFailIn) : pfDone(&fDoneIn), fFail(fFailIn) {}
+
+    bool operator()() {
+        *pfDone = true;
+        return !fFail;
+    }
+
+    void swap(CMarkCheck& check) {
+        std::swap(pfDone, check.pfDone);
+        std::swap(fFail, check.fFail);
+    }
+};
+
+static bool RunMarkChecks(CCheckQueuePool<CMarkCheck>& pool, size_t nChecks, bool fFail)
+{
+    std::vector<char> vDone(nChecks, false);
+    std::vector<CMarkCheck> vChecks;
+    for (size_t i = 0; i < nChecks; i++)
+        vChecks.push_back(CMarkCheck(vDone[i], fFail && i == nChecks / 2));
+    bool fOk = pool.Run(vChecks);
+    if (!fFail)
+        BOOST_CHECK(std::find(vDone.begin(), vDone.end(), false) == vDone.end());
+    return fOk;
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_pool)
+{
+    // Without workers, the caller does all the work
+    CCheckQueuePool<CMarkCheck> pool(16);
+    BOOST_CHECK_EQUAL(pool.Size(), 0);
+    BOOST_CHECK(RunMarkChecks(pool, 1000, false));
+    BOOST_CHECK(!RunMarkChecks(pool, 1000, true));
+
+    // The same pool is reused for every job while its workers run
+    pool.Start(3);
+    BOOST_CHECK_EQUAL(pool.Size(), 3);
+    for (int i = 0; i < 10; i++) {
+        BOOST_CHECK(RunMarkChecks(pool, 1000, false));
+        BOOST_CHECK(!RunMarkChecks(pool, 1000, true));
+    }
+    BOOST_CHECK(RunMarkChecks(pool, 0, false));
+
+    pool.Stop();
+    BOOST_CHECK_EQUAL(pool.Size(), 0);
+    BOOST_CHECK(RunMarkChecks(pool, 1000, false));
+
+    // Workers can be started again after a stop
+    pool.Start(2);
+    BOOST_CHECK_EQUAL(pool.Size(), 2);
+    BOOST_CHECK(RunMarkChecks(pool, 1000, false));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
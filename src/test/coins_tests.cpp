@@ -8,10 +8,12 @@
 #include "test/test_bitcoin.h"
 #include "main.h"
 #include "consensus/validation.h"
+#include "txdb.h"
 
 #include <vector>
 #include <map>
 
+#include <boost/scoped_ptr.hpp>
 #include <boost/test/unit_test.hpp>
 
 namespace
@@ -347,4 +349,54 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
     BOOST_CHECK(spent_a_duplicate_coinbase);
 }
 
+BOOST_AUTO_TEST_CASE(coinsviewdb_get_coins_sorted)
+{
+    CCoinsViewDB view(CDBOptions(1 << 20), true);
+
+    std::vector<uint256> vTxid;
+    CCoinsMap mapCoins;
+    for (int i = 0; i < 1000; i++) {
+        vTxid.push_back(GetRandHash());
+        CCoinsCacheEntry& entry = mapCoins[vTxid.back()];
+        entry.coins.nHeight = i;
+        entry.coins.vout.resize(1 + i % 3);
+        for (size_t j = 0; j < entry.coins.vout.size(); j++)
+            entry.coins.vout[j].nValue = i + j;
+        entry.flags = CCoinsCacheEntry::DIRTY;
+    }
+    CCoinsMap mapWrite(mapCoins);
+    BOOST_CHECK(view.BatchWrite(mapWrite, GetRandHash()));
+
+    boost::scoped_ptr<CDBSnapshot> psnapshot(view.NewSnapshot());
+
+    // Spend everything after the snapshot was taken
+    mapWrite = mapCoins;
+    for (CCoinsMap::iterator it = mapWrite.begin(); it != mapWrite.end(); it++)
+        it->second.coins.Clear();
+    BOOST_CHECK(view.BatchWrite(mapWrite, GetRandHash()));
+
+    // Ask for the transactions along with some unknown ones
+    for (int i = 0; i < 100; i++)
+        vTxid.push_back(GetRandHash());
+    std::sort(vTxid.begin(), vTxid.end());
+
+    // On the calling thread, then also on the threads the view keeps
+    for (int nThreads = 1; nThreads <= 4; nThreads += 3) {
+        std::vector<CCoins> vCoins;
+        BOOST_CHECK(view.GetCoinsSorted(vTxid, vCoins, *psnapshot, nThreads));
+        BOOST_CHECK_EQUAL(vCoins.size(), vTxid.size());
+        for (size_t i = 0; i < vTxid.size(); i++) {
+            CCoinsMap::const_iterator it = mapCoins.find(vTxid[i]);
+            if (it == mapCoins.end())
+                BOOST_CHECK(vCoins[i].IsPruned());
+            else
+                BOOST_CHECK(vCoins[i] == it->second.coins);
+        }
+    }
+
+    // Without the snapshot, the coins are gone
+    CCoins coins;
+    BOOST_CHECK(!view.GetCoins(mapCoins.begin()->first, coins));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
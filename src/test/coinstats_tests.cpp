@@ -0,0 +1,182 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "coins.h"
+#include "coinsnapshot.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "mvf-core-globals.h"
+#include "script/interpreter.h"
+#include "txdb.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinstats_tests, TestChain100Setup)
+
+static void CheckCoinsStatsMatchScan()
+{
+    FlushStateToDisk();
+    CCoinsStats scan;
+    BOOST_CHECK(pcoinsTip->GetStats(scan));
+    CCoinsRunningStats running;
+    BOOST_CHECK(GetCoinsStats(running));
+    BOOST_CHECK(running.hashBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK(running.hashBlock == scan.hashBlock);
+    BOOST_CHECK_EQUAL(running.nTransactions, scan.nTransactions);
+    BOOST_CHECK_EQUAL(running.nTransactionOutputs, scan.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(running.nSerializedSize, scan.nSerializedSize);
+    BOOST_CHECK_EQUAL(running.nTotalAmount, scan.nTotalAmount);
+    BOOST_CHECK(running.hashRolling == scan.hashRolling);
+
+    CCoinsRunningStats stored;
+    BOOST_CHECK(pblocktree->ReadCoinsStats(stored));
+    BOOST_CHECK(stored.hashBlock == running.hashBlock);
+    BOOST_CHECK(stored.hashRolling == running.hashRolling);
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_running_stats, TestChain100Setup)
+{
+    CheckCoinsStatsMatchScan();
+    CCoinsRunningStats statsBefore;
+    BOOST_CHECK(GetCoinsStats(statsBefore));
+
+    // Spend a mature coinbase to two outputs, one of them spent again in
+    // the same block.
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    std::vector<CMutableTransaction> txns(2);
+    txns[0].vin.resize(1);
+    txns[0].vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    txns[0].vout.resize(2);
+    txns[0].vout[0].nValue = 10 * COIN;
+    txns[0].vout[0].scriptPubKey = CScript() << OP_TRUE;
+    txns[0].vout[1].nValue = 20 * COIN;
+    txns[0].vout[1].scriptPubKey = CScript() << OP_TRUE;
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(coinbaseKey.Sign(SignatureHash(scriptPubKey, txns[0], 0, SIGHASH_ALL), vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    txns[0].vin[0].scriptSig << vchSig;
+    txns[1].vin.resize(1);
+    txns[1].vin[0].prevout = COutPoint(txns[0].GetHash(), 1);
+    txns[1].vout.resize(1);
+    txns[1].vout[0].nValue = 19 * COIN;
+    txns[1].vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+    CreateAndProcessBlock(txns, scriptPubKey);
+    BOOST_CHECK_EQUAL(chainActive.Height(), 101);
+    CheckCoinsStatsMatchScan();
+
+    // Disconnecting the block restores the statistics exactly
+    CValidationState state;
+    BOOST_CHECK(InvalidateBlock(state, Params().GetConsensus(), chainActive.Tip()));
+    BOOST_CHECK_EQUAL(chainActive.Height(), 100);
+    CheckCoinsStatsMatchScan();
+    CCoinsRunningStats statsAfter;
+    BOOST_CHECK(GetCoinsStats(statsAfter));
+    BOOST_CHECK(statsAfter.hashRolling == statsBefore.hashRolling);
+    BOOST_CHECK_EQUAL(statsAfter.nSerializedSize, statsBefore.nSerializedSize);
+}
+
+BOOST_AUTO_TEST_CASE(coins_stats_apply_change)
+{
+    uint256 txid = coinbaseTxns[0].GetHash();
+    CCoins coinsOld(coinbaseTxns[0], 1);
+    CCoins coinsNew(coinsOld);
+    coinsNew.vout.resize(2);
+    coinsNew.vout[1].nValue = 5 * COIN;
+    coinsNew.vout[1].scriptPubKey = CScript() << OP_TRUE;
+
+    // Replacing a record is the same as removing the old one and adding
+    // the new one, whatever outputs the two have in common
+    CCoinsRunningStats statsChange, statsRecords;
+    statsChange.ApplyCoins(txid, coinsOld, true);
+    statsRecords.ApplyCoins(txid, coinsOld, true);
+    statsChange.ApplyChange(txid, coinsOld, coinsNew);
+    statsRecords.ApplyCoins(txid, coinsOld, false);
+    statsRecords.ApplyCoins(txid, coinsNew, true);
+    BOOST_CHECK(statsChange.hashRolling == statsRecords.hashRolling);
+    BOOST_CHECK_EQUAL(statsChange.nTransactions, 1U);
+    BOOST_CHECK_EQUAL(statsChange.nTransactionOutputs, statsRecords.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(statsChange.nSerializedSize, statsRecords.nSerializedSize);
+    BOOST_CHECK_EQUAL(statsChange.nTotalAmount, statsRecords.nTotalAmount);
+
+    // Pruning the record takes it out entirely
+    statsChange.ApplyChange(txid, coinsNew, CCoins());
+    BOOST_CHECK(statsChange.hashRolling.IsNull());
+    BOOST_CHECK_EQUAL(statsChange.nTransactions, 0U);
+    BOOST_CHECK_EQUAL(statsChange.nTransactionOutputs, 0U);
+    BOOST_CHECK_EQUAL(statsChange.nSerializedSize, 0U);
+    BOOST_CHECK_EQUAL(statsChange.nTotalAmount, 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_snapshot, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    int nForkHeightSaved = FinalActivateForkHeight;
+    FinalActivateForkHeight = 999999; // MVF-Core: set fork height so fork does not interfere
+
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    boost::filesystem::path path = pathTemp / "utxo.dat";
+    CCoinsSnapshotHeader header;
+    uint256 hashCoins;
+    BOOST_CHECK(DumpCoinsSnapshot(path, header, hashCoins));
+    BOOST_CHECK_EQUAL(header.nHeight, 101);
+    BOOST_CHECK(header.hashBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK(!boost::filesystem::exists(pathTemp / "utxo.dat.incomplete"));
+    CCoinsStats scan;
+    BOOST_CHECK(pcoinsTip->GetStats(scan));
+    BOOST_CHECK_EQUAL(header.stats.nTransactions, scan.nTransactions);
+    BOOST_CHECK(header.stats.hashRolling == scan.hashRolling);
+
+    // A snapshot that does not match the pinned coins hash is refused,
+    // even though it is consistent with its own statistics
+    ResetChainState();
+    BOOST_CHECK_EQUAL(chainActive.Height(), 0);
+    BOOST_CHECK(!LoadCoinsSnapshot(chainparams, path, uint256S("0x01")));
+    BOOST_CHECK_EQUAL(chainActive.Height(), 0);
+    // and leaves neither coins nor headers behind
+    BOOST_CHECK(!pcoinsTip->HaveCoins(coinbaseTxns[1].GetHash()));
+    BOOST_CHECK(!mapBlockIndex.count(header.hashBlock));
+    bool fLoading = false;
+    pblocktree->ReadFlag("loadingutxosnapshot", fLoading);
+    BOOST_CHECK(!fLoading);
+
+    // Start over with empty databases and load the snapshot
+    ResetChainState();
+    BOOST_CHECK(LoadCoinsSnapshot(chainparams, path, hashCoins));
+    BOOST_CHECK_EQUAL(chainActive.Height(), 101);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == header.hashBlock);
+    BOOST_CHECK(fHavePruned);
+    CheckCoinsStatsMatchScan();
+    CCoinsRunningStats running;
+    BOOST_CHECK(GetCoinsStats(running));
+    BOOST_CHECK(running.hashRolling == header.stats.hashRolling);
+
+    // Blocks on top of the snapshot are validated as usual, spending
+    // coins that came from it
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[1].GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 49 * COIN;
+    spend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(coinbaseKey.Sign(SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL), vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, spend), scriptPubKey);
+    BOOST_CHECK_EQUAL(chainActive.Height(), 102);
+    CheckCoinsStatsMatchScan();
+
+    // A second load leaves the chain alone
+    BOOST_CHECK(LoadCoinsSnapshot(chainparams, path, hashCoins));
+    BOOST_CHECK_EQUAL(chainActive.Height(), 102);
+
+    FinalActivateForkHeight = nForkHeightSaved;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
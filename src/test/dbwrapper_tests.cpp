@@ -204,4 +204,144 @@ BOOST_AUTO_TEST_CASE(existing_data_reindex)
     BOOST_CHECK_EQUAL(res3.ToString(), in2.ToString());
 }
  
+// Check that the tuning options take effect, and data survives a change of them.
+BOOST_AUTO_TEST_CASE(dbwrapper_options)
+{
+    path ph = temp_directory_path() / unique_path();
+    create_directories(ph);
+
+    // Bulk-load with a small block cache and large table files
+    CDBOptions dbOptions(1 << 16);
+    dbOptions.fBulkLoad = true;
+    dbOptions.nMaxFileSize = 32 << 10;
+    std::vector<uint256> values;
+    CDBWrapper* dbw = new CDBWrapper(ph, dbOptions, false, false, true);
+    BOOST_CHECK_EQUAL(dbw->GetCacheStats().nBlockCacheSize, (1 << 13));
+    for (int i = 0; i < 4096; i++) {
+        values.push_back(GetRandHash());
+        BOOST_CHECK(dbw->Write(i, values.back()));
+    }
+
+    // Finishing restores the normal block cache, and compacts into tiny
+    // table files, so the data has to be split
+    dbw->FinishBulkLoad();
+    BOOST_CHECK_EQUAL(dbw->GetCacheStats().nBlockCacheSize, (1 << 15));
+    int nTableFiles = 0;
+    for (directory_iterator it(ph); it != directory_iterator(); ++it) {
+        if (it->path().extension() == ".ldb")
+            nTableFiles++;
+    }
+    BOOST_CHECK(nTableFiles > 1);
+
+    // Calling it again is a no-op
+    dbw->FinishBulkLoad();
+    delete dbw;
+
+    // Reopen with the default file size
+    CDBOptions dbOptions2(1 << 20);
+    dbOptions2.nMaxOpenFiles = 1000;
+    CDBWrapper dbw2(ph, dbOptions2, false, false, true);
+    for (int i = 0; i < 4096; i++) {
+        uint256 res;
+        BOOST_CHECK(dbw2.Read(i, res));
+        BOOST_CHECK(res == values[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_cache_stats)
+{
+    path ph = temp_directory_path() / unique_path();
+    create_directories(ph);
+
+    // Load into small table files that don't overlap, so reads don't trigger compactions
+    CDBOptions dbOptions(1 << 16);
+    dbOptions.fBulkLoad = true;
+    dbOptions.nMaxFileSize = 32 << 10;
+    CDBWrapper* dbw = new CDBWrapper(ph, dbOptions, false, false, true);
+    for (int i = 0; i < 4096; i++)
+        BOOST_CHECK(dbw->Write(i, GetRandHash()));
+    dbw->FinishBulkLoad();
+    delete dbw;
+
+    CDBWrapper dbw2(ph, (1 << 20), false, false, true);
+    CDBCacheStats stats = dbw2.GetCacheStats();
+    BOOST_CHECK_EQUAL(stats.nBlockCacheSize, (1 << 19));
+    BOOST_CHECK_EQUAL(stats.nBlockCacheHits, 0);
+    BOOST_CHECK_EQUAL(stats.nTableCacheHits, 0);
+
+    uint256 res;
+    for (int i = 0; i < 4096; i++)
+        BOOST_CHECK(dbw2.Read(i, res));
+    stats = dbw2.GetCacheStats();
+    BOOST_CHECK(stats.nTableCacheMisses > 1);
+    BOOST_CHECK(stats.nTableCacheHits > 0);
+    // Holds the data blocks read, and the pinned index and filter blocks
+    BOOST_CHECK(stats.nBlockCacheUsage <= stats.nBlockCacheSize);
+
+    // Everything read is cached now
+    const CDBCacheStats statsBefore = stats;
+    for (int i = 0; i < 4096; i++)
+        BOOST_CHECK(dbw2.Read(i, res));
+    stats = dbw2.GetCacheStats();
+    BOOST_CHECK_EQUAL(stats.nBlockCacheMisses, statsBefore.nBlockCacheMisses);
+    // Table files the OS maps into memory are read without the block cache
+    if (statsBefore.nBlockCacheMisses > 0)
+        BOOST_CHECK(stats.nBlockCacheHits > statsBefore.nBlockCacheHits);
+    BOOST_CHECK_EQUAL(stats.nTableCacheMisses, statsBefore.nTableCacheMisses);
+}
+
+// Check that compactions split across threads keep every key's latest version.
+BOOST_AUTO_TEST_CASE(dbwrapper_subcompactions)
+{
+    path ph = temp_directory_path() / unique_path();
+    create_directories(ph);
+
+    // Small write buffers and table files make for many overlapping compactions
+    CDBOptions dbOptions(1 << 16);
+    dbOptions.nMaxFileSize = 32 << 10;
+    dbOptions.nCompactionThreads = 4;
+    std::map<int, uint256> values;
+    CDBWrapper dbw(ph, dbOptions, false, false, true);
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 10000; i++) {
+            if (round == 2 && i % 3 == 0) {
+                BOOST_CHECK(dbw.Erase(i));
+                values.erase(i);
+            } else {
+                values[i] = GetRandHash();
+                BOOST_CHECK(dbw.Write(i, values[i]));
+            }
+        }
+    }
+    BOOST_CHECK(dbw.GetSplitCompactions() > 0);
+
+    for (int i = 0; i < 10000; i++) {
+        uint256 res;
+        BOOST_CHECK_EQUAL(dbw.Read(i, res), values.count(i) > 0);
+        if (values.count(i))
+            BOOST_CHECK(res == values[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_snapshot)
+{
+    path ph = temp_directory_path() / unique_path();
+    CDBWrapper dbw(ph, (1 << 20), true, false, true);
+    uint256 in = GetRandHash();
+    uint256 res;
+    BOOST_CHECK(dbw.Write('a', in));
+
+    CDBSnapshot snapshot(dbw);
+    BOOST_CHECK(dbw.Write('a', GetRandHash()));
+    BOOST_CHECK(dbw.Erase('a'));
+    BOOST_CHECK(dbw.Write('b', in));
+
+    // The snapshot sees the database as it was
+    BOOST_CHECK(dbw.Read('a', res, &snapshot));
+    BOOST_CHECK(res == in);
+    BOOST_CHECK(!dbw.Read('b', res, &snapshot));
+    BOOST_CHECK(!dbw.Read('a', res));
+    BOOST_CHECK(dbw.Read('b', res));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
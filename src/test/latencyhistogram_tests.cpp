@@ -0,0 +1,65 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "latencyhistogram.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(latencyhistogram_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(latency_histogram)
+{
+    CLatencyHistogram histogram;
+    BOOST_CHECK_EQUAL(histogram.Count(), 0);
+    BOOST_CHECK_EQUAL(histogram.Percentile(50), 0);
+
+    // Small durations are counted exactly
+    for (int i = 1; i <= 10; i++)
+        histogram.Add(i);
+    BOOST_CHECK_EQUAL(histogram.Count(), 10);
+    BOOST_CHECK_EQUAL(histogram.Percentile(50), 5);
+    BOOST_CHECK_EQUAL(histogram.Percentile(90), 9);
+    BOOST_CHECK_EQUAL(histogram.Percentile(100), 10);
+    BOOST_CHECK_EQUAL(histogram.Max(), 10);
+
+    // Larger ones within 1/8, never beyond the maximum
+    CLatencyHistogram large;
+    for (int64_t i = 1; i <= 100000; i++)
+        large.Add(i * 10);
+    BOOST_CHECK_EQUAL(large.Max(), 1000000);
+    const double percentiles[] = {1, 50, 90, 99, 99.9};
+    for (unsigned int i = 0; i < ARRAYLEN(percentiles); i++) {
+        int64_t nExact = (int64_t)(percentiles[i] * 10000);
+        int64_t nEstimate = large.Percentile(percentiles[i]);
+        BOOST_CHECK(nEstimate >= nExact);
+        BOOST_CHECK(nEstimate <= nExact + nExact / 8);
+    }
+    BOOST_CHECK_EQUAL(large.Percentile(100), 1000000);
+
+    // Durations of more than a day still fit
+    large.Add(1000LL * 1000 * 3600 * 48);
+    BOOST_CHECK_EQUAL(large.Percentile(100), 1000LL * 1000 * 3600 * 48);
+}
+
+BOOST_AUTO_TEST_CASE(latency_histogram_add)
+{
+    // Histograms kept apart add up to one of all the durations
+    CLatencyHistogram all, odd, even;
+    for (int64_t i = 1; i <= 1000; i++) {
+        all.Add(i * 7);
+        (i % 2 ? odd : even).Add(i * 7);
+    }
+    CLatencyHistogram sum;
+    sum.Add(odd);
+    sum.Add(even);
+    BOOST_CHECK_EQUAL(sum.Count(), all.Count());
+    BOOST_CHECK_EQUAL(sum.Max(), all.Max());
+    const double percentiles[] = {1, 50, 90, 99, 99.9, 100};
+    for (unsigned int i = 0; i < ARRAYLEN(percentiles); i++)
+        BOOST_CHECK_EQUAL(sum.Percentile(percentiles[i]), all.Percentile(percentiles[i]));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
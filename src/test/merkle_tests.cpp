@@ -115,6 +115,8 @@ BOOST_AUTO_TEST_CASE(merkle_test)
             BOOST_CHECK((newRoot == uint256()) == (ntx == 0));
             BOOST_CHECK(oldMutated == newMutated);
             BOOST_CHECK(newMutated == !!mutate);
+            // BlockMerkleTree builds the same full tree, level by level, as the old mechanism.
+            BOOST_CHECK(BlockMerkleTree(block) == merkleTree);
             // If no mutation was done (once for every ntx value), try up to 16 branches.
             if (mutate == 0) {
                 for (int loop = 0; loop < std::min(ntx, 16); loop++) {
@@ -133,4 +135,26 @@ BOOST_AUTO_TEST_CASE(merkle_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(merkle_tree_layout)
+{
+    CBlock block;
+    block.vtx.resize(7);
+    std::vector<uint256> leaves;
+    for (int j = 0; j < 7; j++) {
+        CMutableTransaction mtx;
+        mtx.nLockTime = j;
+        block.vtx[j] = mtx;
+        leaves.push_back(block.vtx[j].GetHash());
+    }
+    // 7 leaves, then levels of 4, 2 and 1 nodes.
+    std::vector<uint256> tree = BlockMerkleTree(block);
+    BOOST_CHECK_EQUAL(tree.size(), 14U);
+    BOOST_CHECK(tree == ComputeMerkleTree(leaves));
+    BOOST_CHECK(std::equal(leaves.begin(), leaves.end(), tree.begin()));
+    BOOST_CHECK(tree.back() == BlockMerkleRoot(block));
+    BOOST_CHECK(tree.back() == ComputeMerkleRoot(leaves));
+    // The odd node of a level is hashed with itself.
+    BOOST_CHECK(tree[10] == Hash(tree[6].begin(), tree[6].end(), tree[6].begin(), tree[6].end()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
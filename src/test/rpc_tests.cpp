@@ -225,6 +225,18 @@ BOOST_AUTO_TEST_CASE(json_parse_errors)
     BOOST_CHECK_THROW(ParseNonRFCJSONValue("3J98t1WpEZ73CNmQviecrnyiWrnqRhWNL"), std::runtime_error);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_getdbcacheinfo)
+{
+    UniValue r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("getdbcacheinfo"));
+    BOOST_CHECK(find_value(r.get_obj(), "chainstate").isObject());
+    UniValue o = find_value(r.get_obj(), "blockindex");
+    BOOST_CHECK(o.isObject());
+    BOOST_CHECK_EQUAL(find_value(o, "blockcachesize").get_int64(), 1 << 19);
+    BOOST_CHECK(find_value(o, "blockcachehitrate").isNum());
+    BOOST_CHECK_THROW(CallRPC("getdbcacheinfo 1"), runtime_error);
+}
+
 BOOST_AUTO_TEST_CASE(rpc_ban)
 {
     BOOST_CHECK_NO_THROW(CallRPC(string("clearbanned")));
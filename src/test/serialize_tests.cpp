@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "serialize.h"
+#include "primitives/block.h"
 #include "streams.h"
 #include "hash.h"
 #include "test/test_bitcoin.h"
@@ -276,4 +277,57 @@ BOOST_AUTO_TEST_CASE(insert_delete)
     BOOST_CHECK_EQUAL(ss.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(block_arena)
+{
+    CBlock block;
+    for (int i = 0; i < 50; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(i * 3, i);
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << std::vector<unsigned char>(20, i);
+        block.vtx.push_back(tx);
+    }
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    std::string strBlock = ss.str();
+
+    CBlock arenablock;
+    arenablock.UnserializeWithArena(ss, ss.GetType(), ss.GetVersion());
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK(arenablock.arena);
+    BOOST_CHECK(arenablock.arena->DynamicMemoryUsage() > 0);
+    ss << arenablock;
+    BOOST_CHECK(ss.str() == strBlock);
+
+    // The serialized size bounds the scripts, so a single chunk of that size holds them
+    arenablock.UnserializeWithArena(ss, ss.GetType(), ss.GetVersion(), strBlock.size());
+    BOOST_CHECK_EQUAL(arenablock.arena->DynamicMemoryUsage(), strBlock.size());
+    ss << arenablock;
+    BOOST_CHECK(ss.str() == strBlock);
+
+    // Copies stay valid after the arena is released
+    CTransaction tx = arenablock.vtx[49];
+    CBlock copy;
+    copy = arenablock;
+    arenablock.SetNull();
+    BOOST_CHECK(!arenablock.arena);
+    BOOST_CHECK(tx == block.vtx[49]);
+    copy.arena.reset();
+    ss.clear();
+    ss << copy;
+    BOOST_CHECK(ss.str() == strBlock);
+
+    // Scripts in the arena can still be modified
+    CDataStream ss2(strBlock.data(), strBlock.data() + strBlock.size(), SER_NETWORK, PROTOCOL_VERSION);
+    arenablock.UnserializeWithArena(ss2, ss2.GetType(), ss2.GetVersion());
+    CMutableTransaction mtx(arenablock.vtx[49]);
+    CScript& script = const_cast<CScript&>(arenablock.vtx[49].vin[0].scriptSig);
+    script << OP_TRUE;
+    mtx.vin[0].scriptSig << OP_TRUE;
+    BOOST_CHECK(script == mtx.vin[0].scriptSig);
+    script.resize(10);
+    BOOST_CHECK(CScript(script.begin(), script.end()) == CScript(mtx.vin[0].scriptSig.begin(), mtx.vin[0].scriptSig.begin() + 10));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
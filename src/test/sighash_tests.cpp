@@ -5,10 +5,15 @@
 #include "consensus/validation.h"
 #include "data/sighash.json.h"
 #include "hash.h"
+#include "key.h"
+#include "keystore.h"
 #include "main.h" // For CheckTransaction
+#include "policy/policy.h"
 #include "random.h"
 #include "script/interpreter.h"
 #include "script/script.h"
+#include "script/sign.h"
+#include "script/standard.h"
 #include "serialize.h"
 #include "streams.h"
 #include "test/test_bitcoin.h"
@@ -166,6 +171,68 @@ BOOST_AUTO_TEST_CASE(sighash_test)
     #endif
 }
 
+// Goal: check that CTxSignatureHasher matches SignatureHash, for every
+// chain id and whether or not the input's hash state is cached
+BOOST_AUTO_TEST_CASE(sighash_hasher_test)
+{
+    seed_insecure_rand(false);
+
+    for (int i=0; i<2000; i++) {
+        int nHashType = (insecure_rand() % 4) ? SIGHASH_ALL : insecure_rand();
+        CMutableTransaction txMut;
+        RandomTransaction(txMut, (nHashType & 0x1f) == SIGHASH_SINGLE);
+        const CTransaction txTo(txMut);
+        CTxSignatureHasher hasher(txTo);
+
+        for (int j=0; j<4; j++) {
+            CScript scriptCode;
+            RandomScript(scriptCode);
+            unsigned int nIn = insecure_rand() % txTo.vin.size();
+            unsigned int nChainId = insecure_rand() % 0x1000000;
+
+            BOOST_CHECK(hasher.GetHash(scriptCode, nIn, nHashType) == SignatureHash(scriptCode, txTo, nIn, nHashType));
+            BOOST_CHECK(hasher.GetHash(scriptCode, nIn, nHashType, nChainId) == SignatureHash(scriptCode, txTo, nIn, nHashType, nChainId));
+            BOOST_CHECK(hasher.GetHash(scriptCode, nIn, nHashType) == SignatureHash(scriptCode, txTo, nIn, nHashType));
+        }
+    }
+}
+
+// Goal: check that signing for both chains gives signatures valid on
+// exactly the chain they were made for
+BOOST_AUTO_TEST_CASE(sign_transaction_chains)
+{
+    static const int nForkId = 0x555555;
+    CBasicKeyStore keystore;
+    std::vector<CScript> vPrevPubKeys;
+    CMutableTransaction txMut;
+    for (int i=0; i<3; i++) {
+        CKey key;
+        key.MakeNewKey(i % 2 == 0);
+        keystore.AddKey(key);
+        vPrevPubKeys.push_back(GetScriptForDestination(key.GetPubKey().GetID()));
+        txMut.vin.push_back(CTxIn(GetRandHash(), i));
+    }
+    txMut.vout.push_back(CTxOut(1000, vPrevPubKeys[0]));
+    const CTransaction txTo(txMut);
+
+    std::vector<int> vChainIds;
+    vChainIds.push_back(0);
+    vChainIds.push_back(nForkId);
+    std::vector<CMutableTransaction> vSignedTx;
+    std::vector<bool> vComplete;
+    BOOST_CHECK(SignTransaction(keystore, txTo, vPrevPubKeys, SIGHASH_ALL, vChainIds, vSignedTx, vComplete));
+    BOOST_CHECK_EQUAL(vSignedTx.size(), 2U);
+
+    for (unsigned int j=0; j<vChainIds.size(); j++) {
+        BOOST_CHECK(vComplete[j]);
+        for (unsigned int i=0; i<txTo.vin.size(); i++) {
+            const CScript& scriptSig = vSignedTx[j].vin[i].scriptSig;
+            BOOST_CHECK(VerifyScript(scriptSig, vPrevPubKeys[i], STANDARD_SCRIPT_VERIFY_FLAGS, MutableTransactionSignatureChecker(&vSignedTx[j], i, vChainIds[j])));
+            BOOST_CHECK(!VerifyScript(scriptSig, vPrevPubKeys[i], STANDARD_SCRIPT_VERIFY_FLAGS, MutableTransactionSignatureChecker(&vSignedTx[j], i, vChainIds[1 - j])));
+        }
+    }
+}
+
 // Goal: check that SignatureHash generates correct hash
 BOOST_AUTO_TEST_CASE(sighash_from_data)
 {
@@ -64,4 +64,22 @@ BOOST_AUTO_TEST_CASE(streams_serializedata_xor)
             std::string(ds.begin(), ds.end()));  
 }         
 
+BOOST_AUTO_TEST_CASE(streams_shrink_to_fit)
+{
+    CDataStream ds(SER_DISK, 0);
+    ds.resize(1000, 'x');
+    ds << 'a' << 'b' << 'c';
+    char c;
+    for (int i = 0; i < 1001; i++)
+        ds >> c;
+    ds.shrink_to_fit();
+    BOOST_CHECK_EQUAL(ds.size(), 2U);
+    BOOST_CHECK_EQUAL(std::string(ds.begin(), ds.end()), "bc");
+    ds << 'd';
+    BOOST_CHECK_EQUAL(std::string(ds.begin(), ds.end()), "bcd");
+    ds.clear();
+    ds.shrink_to_fit();
+    BOOST_CHECK(ds.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -25,12 +25,15 @@ struct BasicTestingSetup {
  * and wallet (if enabled) setup.
  */
 struct TestingSetup: public BasicTestingSetup {
-    CCoinsViewDB *pcoinsdbview;
     boost::filesystem::path pathTemp;
     boost::thread_group threadGroup;
 
     TestingSetup(const std::string& chainName = CBaseChainParams::MAIN);
     ~TestingSetup();
+
+    // Replace the block index and the chainstate with empty ones, holding
+    // only the genesis block. Block files are left alone.
+    void ResetChainState();
 };
 
 class CBlock;
@@ -0,0 +1,74 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "test/test_bitcoin.h"
+#include "validationinterface.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+namespace {
+/** Records the transactions it is told about, in order */
+class CTxRecorder : public CValidationInterface
+{
+public:
+    std::vector<uint256> vSeen;
+    boost::thread::id threadId;
+
+protected:
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+    {
+        vSeen.push_back(tx.GetHash());
+        threadId = boost::this_thread::get_id();
+    }
+};
+} // anon namespace
+
+BOOST_FIXTURE_TEST_SUITE(validationinterface_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(queued_notifications_in_order)
+{
+    CTxRecorder recorder;
+    RegisterValidationInterface(&recorder);
+
+    std::vector<CMutableTransaction> vTx(100);
+    for (unsigned int i = 0; i < vTx.size(); i++)
+        vTx[i].nLockTime = i;
+
+    // Without the notification thread, delivery is immediate
+    SyncWithWallets(vTx[0], NULL);
+    BOOST_CHECK_EQUAL(recorder.vSeen.size(), 1U);
+    BOOST_CHECK(recorder.threadId == boost::this_thread::get_id());
+
+    boost::thread_group threadGroup;
+    StartValidationNotifications(threadGroup);
+
+    CBlock block;
+    block.vtx.push_back(vTx[1]);
+    SyncBlockWithWallets(block);
+    for (unsigned int i = 2; i < vTx.size(); i++)
+        SyncWithWallets(vTx[i], NULL);
+    SyncWithValidationInterfaceQueue();
+
+    BOOST_CHECK_EQUAL(recorder.vSeen.size(), vTx.size());
+    for (unsigned int i = 0; i < vTx.size(); i++)
+        BOOST_CHECK(recorder.vSeen[i] == vTx[i].GetHash());
+    BOOST_CHECK(recorder.threadId != boost::this_thread::get_id());
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    StopValidationNotifications();
+
+    // Back to immediate delivery
+    SyncWithWallets(vTx[0], NULL);
+    BOOST_CHECK_EQUAL(recorder.vSeen.size(), vTx.size() + 1);
+
+    UnregisterValidationInterface(&recorder);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -5,8 +5,10 @@
 
 #include "txdb.h"
 
+#include "blockfilter.h"
 #include "chain.h"
 #include "chainparams.h"
+#include "checkqueue.h"
 #include "hash.h"
 #include "main.h"
 #include "pow.h"
@@ -14,6 +16,9 @@
 
 #include <stdint.h>
 
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -22,14 +27,65 @@ static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_BLOCK_INDEX = 'b';
+static const char DB_BLOCK_FILTER = 'g';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_POW_CHECKED_HEIGHT = 'P';
+static const char DB_COINS_STATS = 'u';
 
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+/**
+ * Closure reading the coins of (*pvTxid)[nBegin, nEnd) from a snapshot of the
+ * chainstate. Run in parallel over disjoint ranges by GetCoinsSorted.
+ */
+class CCoinsReadCheck
+{
+private:
+    const CDBWrapper* pdb;
+    const std::vector<uint256>* pvTxid;
+    size_t nBegin;
+    size_t nEnd;
+    const CDBSnapshot* psnapshot;
+    std::vector<CCoins>* pvCoins;
+
+public:
+    CCoinsReadCheck() : pdb(NULL), pvTxid(NULL), nBegin(0), nEnd(0), psnapshot(NULL), pvCoins(NULL) {}
+    CCoinsReadCheck(const CDBWrapper* pdbIn, const std::vector<uint256>* pvTxidIn, size_t nBeginIn, size_t nEndIn,
+                    const CDBSnapshot* psnapshotIn, std::vector<CCoins>* pvCoinsIn) :
+        pdb(pdbIn), pvTxid(pvTxidIn), nBegin(nBeginIn), nEnd(nEndIn), psnapshot(psnapshotIn), pvCoins(pvCoinsIn) {}
+
+    bool operator()() {
+        try {
+            for (size_t i = nBegin; i < nEnd; i++) {
+                if (!pdb->Read(make_pair(DB_COINS, (*pvTxid)[i]), (*pvCoins)[i], psnapshot, false))
+                    (*pvCoins)[i] = CCoins();
+            }
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+            return false;
+        }
+        return true;
+    }
+
+    void swap(CCoinsReadCheck& check) {
+        std::swap(pdb, check.pdb);
+        std::swap(pvTxid, check.pvTxid);
+        std::swap(nBegin, check.nBegin);
+        std::swap(nEnd, check.nEnd);
+        std::swap(psnapshot, check.psnapshot);
+        std::swap(pvCoins, check.pvCoins);
+    }
+};
+
+CCoinsViewDB::CCoinsViewDB(const CDBOptions& dbOptions, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", dbOptions, fMemory, fWipe, true),
+                                                                                    readpool(new CCheckQueuePool<CCoinsReadCheck>(1))
+{
+}
+
+CCoinsViewDB::~CCoinsViewDB()
 {
 }
 
@@ -41,6 +97,20 @@ bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
     return db.Exists(make_pair(DB_COINS, txid));
 }
 
+bool CCoinsViewDB::GetCoinsSorted(const std::vector<uint256> &vTxid, std::vector<CCoins> &vCoins, const CDBSnapshot &snapshot, int nThreads) const {
+    assert(nThreads >= 1);
+    vCoins.assign(vTxid.size(), CCoins());
+    CCoinsReadCheck check(&db, &vTxid, 0, vTxid.size(), &snapshot, &vCoins);
+    if (nThreads == 1)
+        return check();
+
+    readpool->Start(nThreads - 1);
+    std::vector<CCoinsReadCheck> vChecks(nThreads);
+    for (int i = 0; i < nThreads; i++)
+        vChecks[i] = CCoinsReadCheck(&db, &vTxid, i * vTxid.size() / nThreads, (i + 1) * vTxid.size() / nThreads, &snapshot, &vCoins);
+    return readpool->Run(vChecks);
+}
+
 uint256 CCoinsViewDB::GetBestBlock() const {
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
@@ -71,7 +141,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CBlockTreeDB::CBlockTreeDB(const CDBOptions& dbOptions, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", dbOptions, fMemory, fWipe) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -94,6 +164,50 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
+CCoinsViewCursor *CCoinsViewDB::Cursor() const
+{
+    /* The iterator sees a consistent snapshot of the database as of its
+       creation; the same const-cast as in GetStats applies. */
+    CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper*>(&db)->NewIterator(), GetBestBlock());
+    i->pcursor->Seek(DB_COINS);
+    // Cache key of first record
+    if (!i->pcursor->Valid() || !i->pcursor->GetKey(i->keyTmp))
+        i->keyTmp.first = 0; // Make sure Valid() and GetKey() return false
+    return i;
+}
+
+bool CCoinsViewDBCursor::GetKey(uint256 &key) const
+{
+    // Return cached key
+    if (keyTmp.first == DB_COINS) {
+        key = keyTmp.second;
+        return true;
+    }
+    return false;
+}
+
+bool CCoinsViewDBCursor::GetValue(CCoins &coins) const
+{
+    return pcursor->GetValue(coins);
+}
+
+unsigned int CCoinsViewDBCursor::GetValueSize() const
+{
+    return pcursor->GetValueSize();
+}
+
+bool CCoinsViewDBCursor::Valid() const
+{
+    return keyTmp.first == DB_COINS;
+}
+
+void CCoinsViewDBCursor::Next()
+{
+    pcursor->Next();
+    if (!pcursor->Valid() || !pcursor->GetKey(keyTmp))
+        keyTmp.first = 0; // Invalidate cached key after last record so that Valid() and GetKey() return false
+}
+
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
@@ -105,6 +219,7 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
+    CCoinsRunningStats running;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         std::pair<char, uint256> key;
@@ -123,6 +238,7 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
                 }
                 stats.nSerializedSize += 32 + pcursor->GetValueSize();
                 ss << VARINT(0);
+                running.ApplyCoins(key.second, coins, true);
             } else {
                 return error("CCoinsViewDB::GetStats() : unable to read value");
             }
@@ -136,6 +252,7 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
     stats.hashSerialized = ss.GetHash();
+    stats.hashRolling = running.hashRolling;
     stats.nTotalAmount = nTotalAmount;
     return true;
 }
@@ -163,6 +280,14 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadBlockFilter(const uint256 &hash, CBlockFilter &filter) {
+    return Read(make_pair(DB_BLOCK_FILTER, hash), filter);
+}
+
+bool CBlockTreeDB::WriteBlockFilter(const uint256 &hash, const CBlockFilter &filter) {
+    return Write(make_pair(DB_BLOCK_FILTER, hash), filter);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -175,45 +300,155 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts()
+bool CBlockTreeDB::WritePowCheckedHeight(int nHeight) {
+    return Write(DB_POW_CHECKED_HEIGHT, nHeight);
+}
+
+bool CBlockTreeDB::ReadPowCheckedHeight(int &nHeight) {
+    return Read(DB_POW_CHECKED_HEIGHT, nHeight);
+}
+
+bool CBlockTreeDB::WriteCoinsStats(const CCoinsRunningStats &stats) {
+    return Write(DB_COINS_STATS, stats);
+}
+
+bool CBlockTreeDB::ReadCoinsStats(CCoinsRunningStats &stats) {
+    return Read(DB_COINS_STATS, stats);
+}
+
+namespace {
+
+/** Block index entries read from one range of keys, with their hashes */
+struct CBlockIndexRange
 {
-    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    std::vector<std::pair<uint256, CDiskBlockIndex> > vEntries;
+    std::string strError;
+};
+
+/**
+ * Closure reading the block index entries whose hash starts with a byte in
+ * [nBegin, nEnd), and checking the proof of work of those above
+ * nTrustedHeight. Run in parallel over disjoint ranges by LoadBlockIndexGuts.
+ */
+class CBlockIndexRangeCheck
+{
+private:
+    CBlockTreeDB* pdb;
+    int nBegin;
+    int nEnd;
+    int nTrustedHeight;
+    CBlockIndexRange* prange;
+
+    void Load();
+
+public:
+    CBlockIndexRangeCheck() : pdb(NULL), nBegin(0), nEnd(0), nTrustedHeight(-1), prange(NULL) {}
+    CBlockIndexRangeCheck(CBlockTreeDB* pdbIn, int nBeginIn, int nEndIn, int nTrustedHeightIn, CBlockIndexRange* prangeIn) :
+        pdb(pdbIn), nBegin(nBeginIn), nEnd(nEndIn), nTrustedHeight(nTrustedHeightIn), prange(prangeIn) {}
+
+    bool operator()() {
+        Load();
+        // Errors are reported through prange, after all ranges are read
+        return true;
+    }
 
-    pcursor->Seek(make_pair(DB_BLOCK_INDEX, uint256()));
+    void swap(CBlockIndexRangeCheck& check) {
+        std::swap(pdb, check.pdb);
+        std::swap(nBegin, check.nBegin);
+        std::swap(nEnd, check.nEnd);
+        std::swap(nTrustedHeight, check.nTrustedHeight);
+        std::swap(prange, check.prange);
+    }
+};
+
+void CBlockIndexRangeCheck::Load()
+{
+    boost::scoped_ptr<CDBIterator> pcursor(pdb->NewIterator());
+
+    uint256 hashBegin;
+    *hashBegin.begin() = (unsigned char)nBegin;
+    pcursor->Seek(make_pair(DB_BLOCK_INDEX, hashBegin));
 
-    // Load mapBlockIndex
     while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
         std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nTx            = diskindex.nTx;
-
-                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
-                    return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
-
-                pcursor->Next();
-            } else {
-                return error("LoadBlockIndex() : failed to read value");
-            }
-        } else {
+        if (!pcursor->GetKey(key) || key.first != DB_BLOCK_INDEX || *key.second.begin() >= nEnd)
             break;
+        prange->vEntries.push_back(std::make_pair(key.second, CDiskBlockIndex()));
+        CDiskBlockIndex& diskindex = prange->vEntries.back().second;
+        if (!pcursor->GetValue(diskindex)) {
+            prange->strError = "failed to read value";
+            return;
+        }
+        // Entries at or below nTrustedHeight were checked on an earlier start;
+        // for them the key stands in for the header hash
+        if (diskindex.nHeight > nTrustedHeight) {
+            uint256 hash = diskindex.GetBlockHash();
+            if (hash != key.second) {
+                prange->strError = strprintf("block hash mismatch: %s", key.second.ToString());
+                return;
+            }
+            if (!CheckProofOfWork(hash, diskindex.nBits, Params().GetConsensus())) {
+                prange->strError = strprintf("CheckProofOfWork failed: %s", diskindex.ToString());
+                return;
+            }
         }
+        pcursor->Next();
     }
+}
+
+} // anon namespace
+
+bool CBlockTreeDB::LoadBlockIndexGuts()
+{
+    int nTrustedHeight = -1;
+    if (GetBoolArg("-trustblockindex", DEFAULT_TRUST_BLOCK_INDEX) && !ReadPowCheckedHeight(nTrustedHeight))
+        nTrustedHeight = -1;
+
+    // Read and check the entries over disjoint ranges of keys in parallel
+    int nRanges = std::max(nScriptCheckThreads, 1);
+    std::vector<CBlockIndexRange> vRanges(nRanges);
+    std::vector<CBlockIndexRangeCheck> vChecks;
+    for (int i = 0; i < nRanges; i++)
+        vChecks.push_back(CBlockIndexRangeCheck(this, i * 256 / nRanges, (i + 1) * 256 / nRanges, nTrustedHeight, &vRanges[i]));
+    CCheckQueuePool<CBlockIndexRangeCheck> rangepool(1, nRanges - 1);
+    rangepool.Run(vChecks);
+    boost::this_thread::interruption_point();
+
+    size_t nEntries = 0;
+    BOOST_FOREACH(const CBlockIndexRange& range, vRanges) {
+        if (!range.strError.empty())
+            return error("LoadBlockIndex(): %s", range.strError);
+        nEntries += range.vEntries.size();
+    }
+
+    // Load mapBlockIndex
+    mapBlockIndex.reserve(mapBlockIndex.size() + nEntries);
+    int nMaxHeight = -1;
+    BOOST_FOREACH(const CBlockIndexRange& range, vRanges) {
+        for (size_t i = 0; i < range.vEntries.size(); i++) {
+            const CDiskBlockIndex& diskindex = range.vEntries[i].second;
+            // Construct block index object
+            CBlockIndex* pindexNew = InsertBlockIndex(range.vEntries[i].first);
+            pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
+            pindexNew->nHeight        = diskindex.nHeight;
+            pindexNew->nFile          = diskindex.nFile;
+            pindexNew->nDataPos       = diskindex.nDataPos;
+            pindexNew->nUndoPos       = diskindex.nUndoPos;
+            pindexNew->nVersion       = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->nTime          = diskindex.nTime;
+            pindexNew->nBits          = diskindex.nBits;
+            pindexNew->nNonce         = diskindex.nNonce;
+            pindexNew->nStatus        = diskindex.nStatus;
+            pindexNew->nTx            = diskindex.nTx;
+            nMaxHeight = std::max(nMaxHeight, diskindex.nHeight);
+        }
+    }
+
+    // Everything up to here has had its proof of work checked now
+    int nCheckedHeight;
+    if (nMaxHeight > 0 && (!ReadPowCheckedHeight(nCheckedHeight) || nCheckedHeight < nMaxHeight))
+        WritePowCheckedHeight(nMaxHeight);
 
     return true;
 }
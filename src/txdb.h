@@ -14,38 +14,85 @@
 #include <utility>
 #include <vector>
 
+#include <boost/scoped_ptr.hpp>
+
 class CBlockFileInfo;
+class CBlockFilter;
 class CBlockIndex;
+class CCoinsReadCheck;
 struct CDiskTxPos;
 class uint256;
 
+template <typename T> class CCheckQueuePool;
+
 //! -dbcache default (MiB)
 static const int64_t nDefaultDbCache = 100;
 //! max. -dbcache in (MiB)
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -trustblockindex default
+static const bool DEFAULT_TRUST_BLOCK_INDEX = false;
 
 /** CCoinsView backed by the coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
+    //! threads helping GetCoinsSorted, started by its first call that asks for them
+    boost::scoped_ptr<CCheckQueuePool<CCoinsReadCheck> > readpool;
 public:
-    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CCoinsViewDB(const CDBOptions& dbOptions, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
     bool GetCoins(const uint256 &txid, CCoins &coins) const;
     bool HaveCoins(const uint256 &txid) const;
+    /**
+     * Look up the coins of many transactions as of snapshot. vTxid must be
+     * sorted, so that the reads follow the order of the database; they are
+     * spread over nThreads threads: the caller's, and nThreads - 1 the view
+     * starts on first use and keeps for later calls. The reads do not fill
+     * the block cache. Transactions without coins get empty ones. Returns
+     * false if the database could not be read.
+     */
+    bool GetCoinsSorted(const std::vector<uint256> &vTxid, std::vector<CCoins> &vCoins, const CDBSnapshot &snapshot, int nThreads = 1) const;
+    /** Take a snapshot of the database, to read from with GetCoinsSorted */
+    CDBSnapshot *NewSnapshot() const { return new CDBSnapshot(db); }
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+    CCoinsViewCursor *Cursor() const;
+    void FinishBulkLoad() { db.FinishBulkLoad(); }
+    CDBCacheStats GetCacheStats() const { return db.GetCacheStats(); }
+};
+
+/** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
+class CCoinsViewDBCursor: public CCoinsViewCursor
+{
+public:
+    ~CCoinsViewDBCursor() {}
+
+    bool GetKey(uint256 &key) const;
+    bool GetValue(CCoins &coins) const;
+    unsigned int GetValueSize() const;
+
+    bool Valid() const;
+    void Next();
+
+private:
+    CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
+        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
+    boost::scoped_ptr<CDBIterator> pcursor;
+    std::pair<char, uint256> keyTmp;
+
+    friend class CCoinsViewDB;
 };
 
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CDBWrapper
 {
 public:
-    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CBlockTreeDB(const CDBOptions& dbOptions, bool fMemory = false, bool fWipe = false);
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
@@ -57,8 +104,14 @@ public:
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    bool ReadBlockFilter(const uint256 &hash, CBlockFilter &filter);
+    bool WriteBlockFilter(const uint256 &hash, const CBlockFilter &filter);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    bool WritePowCheckedHeight(int nHeight);
+    bool ReadPowCheckedHeight(int &nHeight);
+    bool WriteCoinsStats(const CCoinsRunningStats &stats);
+    bool ReadCoinsStats(CCoinsRunningStats &stats);
     bool LoadBlockIndexGuts();
 };
 
@@ -6,8 +6,152 @@
 
 #include "validationinterface.h"
 
+#include "primitives/block.h"
+#include "util.h"
+
+#include <deque>
+
+#include <boost/foreach.hpp>
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+
 static CMainSignals g_signals;
 
+namespace {
+
+/**
+ * Chain notifications waiting for the notification thread. A single thread
+ * delivers them in FIFO order, so listeners see them in the order they were
+ * raised.
+ */
+class CValidationQueue
+{
+private:
+    boost::mutex cs;
+    //! Signalled when a notification is queued and when one has been delivered
+    boost::condition_variable cond;
+    std::deque<boost::function<void ()> > queue;
+    //! Whether the notification thread is servicing the queue
+    bool fRunning;
+    //! Whether a notification is being delivered right now
+    bool fBusy;
+
+    static void Deliver(const boost::function<void ()>& func)
+    {
+        try {
+            func();
+        } catch (const std::exception& e) {
+            PrintExceptionContinue(&e, "validation notification");
+        } catch (...) {
+            PrintExceptionContinue(NULL, "validation notification");
+        }
+    }
+
+public:
+    CValidationQueue() : fRunning(false), fBusy(false) {}
+
+    void Push(const boost::function<void ()>& func)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            // Keep behind anything still undelivered, to preserve the order
+            if (fRunning || !queue.empty()) {
+                queue.push_back(func);
+                cond.notify_all();
+                return;
+            }
+        }
+        Deliver(func);
+    }
+
+    void Start()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fRunning = true;
+    }
+
+    /** Deliver queued notifications until interrupted */
+    void Service()
+    {
+        RenameThread("bitcoin-notify");
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (true) {
+            try {
+                while (queue.empty())
+                    cond.wait(lock);
+            } catch (const boost::thread_interrupted&) {
+                // Whatever is left gets delivered by Stop; don't keep waiters waiting
+                fRunning = false;
+                cond.notify_all();
+                throw;
+            }
+            boost::function<void ()> func = queue.front();
+            queue.pop_front();
+            fBusy = true;
+            lock.unlock();
+            {
+                // Finish the notification even if asked to shut down meanwhile
+                boost::this_thread::disable_interruption di;
+                Deliver(func);
+            }
+            lock.lock();
+            fBusy = false;
+            cond.notify_all();
+        }
+    }
+
+    void Stop()
+    {
+        std::deque<boost::function<void ()> > remaining;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fRunning = false;
+            remaining.swap(queue);
+            cond.notify_all();
+        }
+        BOOST_FOREACH(const boost::function<void ()>& func, remaining)
+            Deliver(func);
+    }
+
+    /** Wait while the thread runs and more than nMaxQueued notifications are undelivered */
+    void WaitForQueue(size_t nMaxQueued)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (fRunning && queue.size() + (fBusy ? 1 : 0) > nMaxQueued)
+            cond.wait(lock);
+    }
+};
+
+CValidationQueue validationQueue;
+
+void FireSyncTransaction(const CTransaction& tx, const boost::shared_ptr<const CBlock>& pblock)
+{
+    g_signals.SyncTransaction(tx, pblock.get());
+}
+
+void FireSyncBlockTransactions(const boost::shared_ptr<const CBlock>& pblock)
+{
+    g_signals.SyncBlockTransactions(*pblock);
+}
+
+void FireUpdatedBlockTip(const CBlockIndex* pindex)
+{
+    g_signals.UpdatedBlockTip(pindex);
+}
+
+void FireUpdatedTransaction(const uint256& hash)
+{
+    g_signals.UpdatedTransaction(hash);
+}
+
+void FireSetBestChain(const CBlockLocator& locator)
+{
+    g_signals.SetBestChain(locator);
+}
+
+} // anon namespace
+
 CMainSignals& GetMainSignals()
 {
     return g_signals;
@@ -16,6 +160,7 @@ CMainSignals& GetMainSignals()
 void RegisterValidationInterface(CValidationInterface* pwalletIn) {
     g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
     g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
+    g_signals.SyncBlockTransactions.connect(boost::bind(&CValidationInterface::SyncBlockTransactions, pwalletIn, _1));
     g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
     g_signals.SetBestChain.connect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
 
@@ -41,6 +186,7 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
     g_signals.BackupWalletAuto.disconnect(boost::bind(&CValidationInterface::BackupWalletAuto, pwalletIn, _1, _2));
 
     g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
+    g_signals.SyncBlockTransactions.disconnect(boost::bind(&CValidationInterface::SyncBlockTransactions, pwalletIn, _1));
     g_signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
     g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
 }
@@ -54,10 +200,60 @@ void UnregisterAllValidationInterfaces() {
     g_signals.SetBestChain.disconnect_all_slots();
     g_signals.BackupWalletAuto.disconnect_all_slots();  // MVF-Core
     g_signals.UpdatedTransaction.disconnect_all_slots();
+    g_signals.SyncBlockTransactions.disconnect_all_slots();
     g_signals.SyncTransaction.disconnect_all_slots();
     g_signals.UpdatedBlockTip.disconnect_all_slots();
 }
 
+// The notifications below copy what they refer to, as the caller's objects
+// may be gone by the time they are delivered.
+
 void SyncWithWallets(const CTransaction &tx, const CBlock *pblock) {
-    g_signals.SyncTransaction(tx, pblock);
+    if (g_signals.SyncTransaction.empty())
+        return;
+    boost::shared_ptr<const CBlock> pblockCopy;
+    if (pblock)
+        pblockCopy = boost::make_shared<CBlock>(*pblock);
+    validationQueue.Push(boost::bind(&FireSyncTransaction, tx, pblockCopy));
+}
+
+void SyncBlockWithWallets(const CBlock &block) {
+    if (g_signals.SyncBlockTransactions.empty())
+        return;
+    validationQueue.Push(boost::bind(&FireSyncBlockTransactions, boost::shared_ptr<const CBlock>(boost::make_shared<CBlock>(block))));
+}
+
+void NotifyUpdatedBlockTip(const CBlockIndex* pindex) {
+    // Block index entries are never deleted while the node runs
+    validationQueue.Push(boost::bind(&FireUpdatedBlockTip, pindex));
+}
+
+void NotifyUpdatedTransaction(const uint256& hash) {
+    validationQueue.Push(boost::bind(&FireUpdatedTransaction, hash));
+}
+
+void NotifySetBestChain(const CBlockLocator& locator) {
+    validationQueue.Push(boost::bind(&FireSetBestChain, locator));
+}
+
+void StartValidationNotifications(boost::thread_group& threadGroup) {
+    validationQueue.Start();
+    threadGroup.create_thread(boost::bind(&CValidationQueue::Service, &validationQueue));
+}
+
+void StopValidationNotifications() {
+    validationQueue.Stop();
+}
+
+void SyncWithValidationInterfaceQueue() {
+    validationQueue.WaitForQueue(0);
+}
+
+void LimitValidationInterfaceQueue() {
+    validationQueue.WaitForQueue(MAX_VALIDATION_QUEUE_SIZE);
+}
+
+void CValidationInterface::SyncBlockTransactions(const CBlock &block) {
+    BOOST_FOREACH(const CTransaction &tx, block.vtx)
+        SyncTransaction(tx, &block);
 }
@@ -10,6 +10,10 @@
 #include <boost/signals2/signal.hpp>
 #include <boost/shared_ptr.hpp>
 
+namespace boost {
+    class thread_group;
+} // namespace boost
+
 class CBlock;
 struct CBlockLocator;
 class CBlockIndex;
@@ -29,11 +33,43 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 void UnregisterAllValidationInterfaces();
 /** Push an updated transaction to all registered wallets */
 void SyncWithWallets(const CTransaction& tx, const CBlock* pblock = NULL);
+/** Push all transactions of a connected block to all registered wallets */
+void SyncBlockWithWallets(const CBlock& block);
+/** Tell all registered listeners about a new chain tip */
+void NotifyUpdatedBlockTip(const CBlockIndex* pindex);
+/** Tell all registered listeners a transaction may have changed without new data */
+void NotifyUpdatedTransaction(const uint256& hash);
+/** Tell all registered listeners about a new active chain, so they can record it */
+void NotifySetBestChain(const CBlockLocator& locator);
+
+/** Most chain notifications queued before LimitValidationInterfaceQueue makes validation wait */
+static const unsigned int MAX_VALIDATION_QUEUE_SIZE = 256;
+
+/**
+ * The chain notifications above are delivered, in the order they were
+ * raised, on a thread of their own once this has been called, so that
+ * connecting blocks does not wait for the wallets and ZMQ notifiers.
+ * Until then, and after StopValidationNotifications, they are delivered
+ * immediately in the thread raising them.
+ */
+void StartValidationNotifications(boost::thread_group& threadGroup);
+/** Deliver what is still queued in the calling thread, after the notification thread was interrupted */
+void StopValidationNotifications();
+/**
+ * Wait until all chain notifications raised so far have been delivered, e.g.
+ * before an RPC reads the wallet. Must not be called holding cs_main or
+ * any lock the listeners take.
+ */
+void SyncWithValidationInterfaceQueue();
+/** Wait while more than MAX_VALIDATION_QUEUE_SIZE notifications are queued; same locking rule */
+void LimitValidationInterfaceQueue();
 
 class CValidationInterface {
 protected:
     virtual void UpdatedBlockTip(const CBlockIndex *pindex) {}
     virtual void SyncTransaction(const CTransaction &tx, const CBlock *pblock) {}
+    /** Calls SyncTransaction for each transaction; override to handle the block's transactions together */
+    virtual void SyncBlockTransactions(const CBlock &block);
     virtual void SetBestChain(const CBlockLocator &locator) {}
 
     virtual bool BackupWalletAuto(const std::string& strDest, int BackupBlock) {return true;}  // MVF-Core TODO: trace to design
@@ -54,6 +90,8 @@ struct CMainSignals {
     boost::signals2::signal<void (const CBlockIndex *)> UpdatedBlockTip;
     /** Notifies listeners of updated transaction data (transaction, and optionally the block it is found in. */
     boost::signals2::signal<void (const CTransaction &, const CBlock *)> SyncTransaction;
+    /** Notifies listeners of all transactions in a newly connected block at once. */
+    boost::signals2::signal<void (const CBlock &)> SyncBlockTransactions;
     /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */
     boost::signals2::signal<void (const uint256 &)> UpdatedTransaction;
     /** Notifies listeners of a new active block chain. */
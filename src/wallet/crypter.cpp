@@ -4,6 +4,8 @@
 
 #include "crypter.h"
 
+#include "checkqueue.h"
+#include "main.h" // For nScriptCheckThreads
 #include "script/script.h"
 #include "script/standard.h"
 #include "util.h"
@@ -135,6 +137,46 @@ static bool DecryptKey(const CKeyingMaterial& vMasterKey, const std::vector<unsi
     return key.VerifyPubKey(vchPubKey);
 }
 
+/** Closure that decrypts one crypted key and checks it against its public key */
+class CCryptedKeyCheck
+{
+private:
+    const CKeyingMaterial* pMasterKey;
+    const CPubKey* pPubKey;
+    const std::vector<unsigned char>* pCryptedSecret;
+
+public:
+    CCryptedKeyCheck() : pMasterKey(NULL), pPubKey(NULL), pCryptedSecret(NULL) {}
+    CCryptedKeyCheck(const CKeyingMaterial& vMasterKeyIn, const CPubKey& vchPubKeyIn, const std::vector<unsigned char>& vchCryptedSecretIn) :
+        pMasterKey(&vMasterKeyIn), pPubKey(&vchPubKeyIn), pCryptedSecret(&vchCryptedSecretIn) {}
+
+    bool operator()() {
+        CKey key;
+        return DecryptKey(*pMasterKey, *pCryptedSecret, *pPubKey, key);
+    }
+
+    void swap(CCryptedKeyCheck &check) {
+        std::swap(pMasterKey, check.pMasterKey);
+        std::swap(pPubKey, check.pPubKey);
+        std::swap(pCryptedSecret, check.pCryptedSecret);
+    }
+};
+
+/**
+ * Check that all keys in [mi, miEnd) decrypt with vMasterKey. With a large
+ * wallet this dominates the first unlock, so the keys are spread over the
+ * script check threads.
+ */
+static bool CheckCryptedKeys(const CKeyingMaterial& vMasterKey, CryptedKeyMap::const_iterator mi, CryptedKeyMap::const_iterator miEnd)
+{
+    std::vector<CCryptedKeyCheck> vChecks;
+    for (; mi != miEnd; ++mi)
+        vChecks.push_back(CCryptedKeyCheck(vMasterKey, mi->second.first, mi->second.second));
+
+    CCheckQueuePool<CCryptedKeyCheck> keypool(128, nScriptCheckThreads - 1);
+    return keypool.Run(vChecks);
+}
+
 bool CCryptoKeyStore::SetCrypted()
 {
     LOCK(cs_KeyStore);
@@ -170,20 +212,19 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
         bool keyPass = false;
         bool keyFail = false;
         CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
-        for (; mi != mapCryptedKeys.end(); ++mi)
+        if (mi != mapCryptedKeys.end())
         {
+            // A wrong passphrase already fails on the first key
             const CPubKey &vchPubKey = (*mi).second.first;
             const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
             CKey key;
-            if (!DecryptKey(vMasterKeyIn, vchCryptedSecret, vchPubKey, key))
-            {
-                keyFail = true;
-                break;
-            }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
+            keyPass = DecryptKey(vMasterKeyIn, vchCryptedSecret, vchPubKey, key);
+            keyFail = !keyPass;
+            ++mi;
         }
+        // The first unlock checks all the other keys too
+        if (keyPass && !fDecryptionThoroughlyChecked)
+            keyFail = !CheckCryptedKeys(vMasterKeyIn, mi, mapCryptedKeys.end());
         if (keyPass && keyFail)
         {
             LogPrintf("The wallet is probably corrupted: Some keys decrypt but not all.\n");
@@ -224,7 +224,7 @@ void CDBEnv::CheckpointLSN(const std::string& strFile)
 }
 
 
-CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL)
+CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL), fBatchTxn(false)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -244,6 +244,7 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
 
         strFile = strFilename;
         ++bitdb.mapFileUseCount[strFile];
+        ++bitdb.mapFileOpenCount[strFile];
         pdb = bitdb.mapDb[strFile];
         if (pdb == NULL) {
             pdb = new Db(bitdb.dbenv, 0);
@@ -280,6 +281,13 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
 
             bitdb.mapDb[strFile] = pdb;
         }
+
+        // Only join a batch from the thread that opened it: it may commit and free its transaction at any time
+        std::map<std::string, std::pair<boost::thread::id, DbTxn*> >::const_iterator mi = bitdb.mapFileBatchTxn.find(strFile);
+        if (mi != bitdb.mapFileBatchTxn.end() && mi->second.first == boost::this_thread::get_id()) {
+            activeTxn = mi->second.second;
+            fBatchTxn = true;
+        }
     }
 }
 
@@ -300,12 +308,13 @@ void CDB::Close()
 {
     if (!pdb)
         return;
-    if (activeTxn)
+    if (activeTxn && !fBatchTxn)
         activeTxn->abort();
     activeTxn = NULL;
     pdb = NULL;
 
-    if (fFlushOnClose)
+    // The batch checkpoints once it has committed
+    if (fFlushOnClose && !fBatchTxn)
         Flush();
 
     {
@@ -314,6 +323,39 @@ void CDB::Close()
     }
 }
 
+CDBTxnBatch::CDBTxnBatch(const std::string& strFilename) : CDB(strFilename, "r+"), fOwner(false)
+{
+    // Nested batches simply join the outer one
+    if (!pdb || fBatchTxn)
+        return;
+
+    LOCK(bitdb.cs_db);
+    // Another thread's batch is open on the file: its handles could not join ours, so write without one
+    if (bitdb.mapFileBatchTxn.count(strFile))
+        return;
+    activeTxn = bitdb.TxnBegin();
+    if (!activeTxn) {
+        LogPrintf("CDBTxnBatch: Failed to begin transaction on %s, writing without one\n", strFile);
+        return;
+    }
+    fOwner = true;
+    bitdb.mapFileBatchTxn[strFile] = std::make_pair(boost::this_thread::get_id(), activeTxn);
+}
+
+CDBTxnBatch::~CDBTxnBatch()
+{
+    if (!fOwner)
+        return;
+    {
+        LOCK(bitdb.cs_db);
+        bitdb.mapFileBatchTxn.erase(strFile);
+    }
+    int ret = activeTxn->commit(0);
+    activeTxn = NULL;
+    if (ret != 0)
+        LogPrintf("CDBTxnBatch: Error %d committing transaction on %s\n", ret, strFile);
+}
+
 void CDBEnv::CloseDb(const string& strFile)
 {
     {
@@ -17,6 +17,7 @@
 #include <vector>
 
 #include <boost/filesystem/path.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <db_cxx.h>
 
@@ -40,7 +41,11 @@ public:
     mutable CCriticalSection cs_db;
     DbEnv *dbenv;
     std::map<std::string, int> mapFileUseCount;
+    //! Number of times each file was opened, for copies made without cs_db to tell whether the file was used meanwhile
+    std::map<std::string, unsigned int> mapFileOpenCount;
     std::map<std::string, Db*> mapDb;
+    //! Thread and transaction of the CDBTxnBatch open on a file, joined by every handle that thread opens on it meanwhile
+    std::map<std::string, std::pair<boost::thread::id, DbTxn*> > mapFileBatchTxn;
 
     CDBEnv();
     ~CDBEnv();
@@ -77,6 +82,14 @@ public:
     void CloseDb(const std::string& strFile);
     bool RemoveDb(const std::string& strFile);
 
+    //! Whether the calling thread has a CDBTxnBatch open on strFile
+    bool HasThreadBatchTxn(const std::string& strFile)
+    {
+        LOCK(cs_db);
+        std::map<std::string, std::pair<boost::thread::id, DbTxn*> >::const_iterator mi = mapFileBatchTxn.find(strFile);
+        return mi != mapFileBatchTxn.end() && mi->second.first == boost::this_thread::get_id();
+    }
+
     DbTxn* TxnBegin(int flags = DB_TXN_WRITE_NOSYNC)
     {
         DbTxn* ptxn = NULL;
@@ -99,6 +112,8 @@ protected:
     DbTxn* activeTxn;
     bool fReadOnly;
     bool fFlushOnClose;
+    //! activeTxn belongs to a CDBTxnBatch; it is not ours to commit or abort
+    bool fBatchTxn;
 
     explicit CDB(const std::string& strFilename, const char* pszMode = "r+", bool fFlushOnCloseIn=true);
     ~CDB() { Close(); }
@@ -153,6 +168,8 @@ protected:
             return false;
         if (fReadOnly)
             assert(!"Write called on database in read-only mode");
+        if (!activeTxn && bitdb.HasThreadBatchTxn(strFile))
+            assert(!"Write called outside the batch open on the database by this thread");
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
@@ -182,6 +199,8 @@ protected:
             return false;
         if (fReadOnly)
             assert(!"Erase called on database in read-only mode");
+        if (!activeTxn && bitdb.HasThreadBatchTxn(strFile))
+            assert(!"Erase called outside the batch open on the database by this thread");
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
@@ -222,7 +241,7 @@ protected:
         if (!pdb)
             return NULL;
         Dbc* pcursor = NULL;
-        int ret = pdb->cursor(NULL, &pcursor, 0);
+        int ret = pdb->cursor(activeTxn, &pcursor, 0);
         if (ret != 0)
             return NULL;
         return pcursor;
@@ -268,6 +287,9 @@ protected:
 public:
     bool TxnBegin()
     {
+        // Within a batch, transactions nest in it
+        if (pdb && fBatchTxn)
+            return true;
         if (!pdb || activeTxn)
             return false;
         DbTxn* ptxn = bitdb.TxnBegin();
@@ -279,6 +301,9 @@ public:
 
     bool TxnCommit()
     {
+        // The batch commits the nested transaction with the rest of it
+        if (pdb && fBatchTxn)
+            return true;
         if (!pdb || !activeTxn)
             return false;
         int ret = activeTxn->commit(0);
@@ -288,7 +313,8 @@ public:
 
     bool TxnAbort()
     {
-        if (!pdb || !activeTxn)
+        // A nested transaction cannot be undone apart from its batch
+        if (!pdb || !activeTxn || fBatchTxn)
             return false;
         int ret = activeTxn->abort();
         activeTxn = NULL;
@@ -309,4 +335,31 @@ public:
     bool static Rewrite(const std::string& strFile, const char* pszSkip = NULL);
 };
 
+/**
+ * Groups every write to a database file into a single transaction for as
+ * long as it is in scope. Any CDB the same thread opens on the file in the
+ * meantime joins that transaction instead of committing its writes one by
+ * one, so callers deep inside need no changes. The outermost batch on a file
+ * commits and checkpoints the log once when it goes out of scope. If the
+ * process dies before that, none of the batch's writes are kept.
+ *
+ * Handles opened by other threads use transactions of their own. Handles
+ * that join must not outlive the batch. The wallet holds cs_wallet while a
+ * batch is open, so that other threads do not wait on its database locks.
+ *
+ * On a handle that joined, TxnBegin and TxnCommit are no-ops that succeed,
+ * and TxnAbort fails. A handle the thread opened before the batch must not
+ * write to the file without a transaction while the batch is open: it would
+ * wait on the batch's own locks. Write and Erase assert against that.
+ */
+class CDBTxnBatch : public CDB
+{
+private:
+    bool fOwner;
+
+public:
+    explicit CDBTxnBatch(const std::string& strFilename);
+    ~CDBTxnBatch();
+};
+
 #endif // BITCOIN_WALLET_DB_H
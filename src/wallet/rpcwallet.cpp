@@ -13,9 +13,11 @@
 #include "netbase.h"
 #include "policy/rbf.h"
 #include "rpcserver.h"
+#include "script/sign.h"
 #include "timedata.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "validationinterface.h"
 #include "wallet.h"
 #include "walletdb.h"
 
@@ -46,6 +48,8 @@ bool EnsureWalletIsAvailable(bool avoidException)
         else
             return false;
     }
+    // Let the wallet catch up with the chain notifications raised so far
+    SyncWithValidationInterfaceQueue();
     return true;
 }
 
@@ -133,9 +137,6 @@ UniValue getnewaddress(const UniValue& params, bool fHelp)
     if (params.size() > 0)
         strAccount = AccountFromValue(params[0]);
 
-    if (!pwalletMain->IsLocked())
-        pwalletMain->TopUpKeyPool();
-
     // Generate a new key that is added to wallet
     CPubKey newKey;
     if (!pwalletMain->GetKeyFromPool(newKey))
@@ -236,9 +237,6 @@ UniValue getrawchangeaddress(const UniValue& params, bool fHelp)
 
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
-    if (!pwalletMain->IsLocked())
-        pwalletMain->TopUpKeyPool();
-
     CReserveKey reservekey(pwalletMain);
     CPubKey vchPubKey;
     if (!reservekey.GetReservedKey(vchPubKey))
@@ -2438,13 +2436,13 @@ UniValue fundrawtransaction(const UniValue& params, bool fHelp)
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size() < 1 || params.size() > 2)
+    if (fHelp || params.size() < 1 || params.size() > 3)
         throw runtime_error(
-                            "fundrawtransaction \"hexstring\" includeWatching\n"
+                            "fundrawtransaction \"hexstring\" includeWatching ( \"signchain\" )\n"
                             "\nAdd inputs to a transaction until it has enough in value to meet its out value.\n"
                             "This will not modify existing inputs, and will add one change output to the outputs.\n"
                             "Note that inputs which were signed may need to be resigned after completion since in/outputs have been added.\n"
-                            "The inputs added will not be signed, use signrawtransaction for that.\n"
+                            "The inputs added will not be signed unless signchain is given; otherwise use signrawtransaction for that.\n"
                             "Note that all existing inputs must have their previous output transaction be in the wallet.\n"
                             "Note that all inputs selected must be of standard form and P2SH scripts must be"
                             "in the wallet using importaddress or addmultisigaddress (to calculate fees).\n"
@@ -2452,12 +2450,17 @@ UniValue fundrawtransaction(const UniValue& params, bool fHelp)
                             "\nArguments:\n"
                             "1. \"hexstring\"     (string, required) The hex string of the raw transaction\n"
                             "2. includeWatching (boolean, optional, default false) Also select inputs which are watch only\n"
+                            "3. \"signchain\"   (string, optional) Also sign all inputs with the wallet's keys for this chain:\n"
+                            "                   \"active\", \"legacy\" (pre-fork), \"fork\" or \"both\"\n"
                             "\nResult:\n"
                             "{\n"
                             "  \"hex\":       \"value\", (string)  The resulting raw transaction (hex-encoded string)\n"
                             "  \"fee\":       n,         (numeric) Fee the resulting transaction pays\n"
                             "  \"changepos\": n          (numeric) The position of the added change output, or -1\n"
+                            "  \"complete\":  true|false (boolean) Only with signchain: if the transaction is completely signed\n"
                             "}\n"
+                            "With signchain \"both\", \"hex\" and \"complete\" are for the pre-fork chain, and\n"
+                            "\"forkhex\" and \"forkcomplete\" hold the same for the fork chain.\n"
                             "\"hex\"             \n"
                             "\nExamples:\n"
                             "\nCreate a transaction with no inputs\n"
@@ -2470,7 +2473,7 @@ UniValue fundrawtransaction(const UniValue& params, bool fHelp)
                             + HelpExampleCli("sendrawtransaction", "\"signedtransactionhex\"")
                             );
 
-    RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VBOOL));
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VBOOL)(UniValue::VSTR));
 
     // parse hex string from parameter
     CTransaction origTx;
@@ -2492,7 +2495,32 @@ UniValue fundrawtransaction(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INTERNAL_ERROR, strFailReason);
 
     UniValue result(UniValue::VOBJ);
-    result.push_back(Pair("hex", EncodeHexTx(tx)));
+    if (params.size() > 2) {
+        vector<int> vChainIds = ParseSignChains(params[2]);
+
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        EnsureWalletIsUnlocked();
+
+        // FundTransaction made sure all inputs spend wallet transactions
+        vector<CScript> vPrevPubKeys;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            map<uint256, CWalletTx>::const_iterator mi = pwalletMain->mapWallet.find(txin.prevout.hash);
+            if (mi == pwalletMain->mapWallet.end() || txin.prevout.n >= mi->second.vout.size())
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Input not found in wallet");
+            vPrevPubKeys.push_back(mi->second.vout[txin.prevout.n].scriptPubKey);
+        }
+
+        vector<CMutableTransaction> vSignedTx;
+        vector<bool> vComplete;
+        SignTransaction(*pwalletMain, CTransaction(tx), vPrevPubKeys, SIGHASH_ALL, vChainIds, vSignedTx, vComplete);
+        for (unsigned int j = 0; j < vChainIds.size(); j++) {
+            string strPrefix = j > 0 ? "fork" : "";
+            result.push_back(Pair(strPrefix + "hex", EncodeHexTx(vSignedTx[j])));
+            result.push_back(Pair(strPrefix + "complete", (bool)vComplete[j]));
+        }
+    }
+    else
+        result.push_back(Pair("hex", EncodeHexTx(tx)));
     result.push_back(Pair("changepos", nChangePos));
     result.push_back(Pair("fee", ValueFromAmount(nFee)));
 
@@ -361,4 +361,51 @@ BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
     BOOST_CHECK_EQUAL(setCoinsRet.size(), 101);
 }
 
+BOOST_AUTO_TEST_CASE(changeless_selection)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    LOCK(wallet.cs_wallet);
+
+    empty_wallet();
+
+    // an empty wallet has nothing to offer
+    BOOST_CHECK(!wallet.SelectCoinsChangeless(vCoins, 1 * CENT, 0, 0, setCoinsRet, nValueRet));
+
+    add_coin(1 * CENT);
+    add_coin(2 * CENT);
+    add_coin(3 * CENT);
+    add_coin(5 * CENT);
+    add_coin(8 * CENT);
+
+    // an exact match is found even where the largest coins don't lead to one
+    BOOST_CHECK(wallet.SelectCoinsChangeless(vCoins, 7 * CENT, 0, 0, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 7 * CENT);
+    BOOST_CHECK(wallet.SelectCoinsChangeless(vCoins, 19 * CENT, 0, 0, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 19 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 5U);
+
+    // nothing adds up to more than the wallet holds
+    BOOST_CHECK(!wallet.SelectCoinsChangeless(vCoins, 20 * CENT, 0, 0, setCoinsRet, nValueRet));
+
+    // the input fee is paid for each coin: 2 + 5 covers 7 cents less two fees,
+    // while 8 alone would overshoot the allowed excess
+    BOOST_CHECK(wallet.SelectCoinsChangeless(vCoins, 7 * CENT - 2000, 1000, 0, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 7 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+
+    // a small excess is accepted when no exact match exists
+    BOOST_CHECK(!wallet.SelectCoinsChangeless(vCoins, 7 * CENT + 1, 0, 0, setCoinsRet, nValueRet));
+    BOOST_CHECK(wallet.SelectCoinsChangeless(vCoins, 7 * CENT + 1, 0, CENT, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 8 * CENT);
+
+    // coins worth less than the fee to spend them are never picked
+    BOOST_CHECK(wallet.SelectCoinsChangeless(vCoins, 1 * CENT - 10, 1 * CENT, CENT, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 2 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 1U);
+
+    empty_wallet();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -7,11 +7,14 @@
 #include "wallet/wallet.h"
 
 #include "base58.h"
+#include "blockfilter.h"
 #include "checkpoints.h"
 #include "chain.h"
+#include "checkqueue.h"
 #include "coincontrol.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "init.h"
 #include "key.h"
 #include "keystore.h"
 #include "main.h"
@@ -22,6 +25,7 @@
 #include "script/script.h"
 #include "script/sign.h"
 #include "timedata.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilmoneystr.h"
@@ -30,6 +34,7 @@
 #include <assert.h>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -294,6 +299,8 @@ bool CWallet::ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase,
 
 void CWallet::SetBestChain(const CBlockLocator& loc)
 {
+    // Wait for any database batch of another thread to be committed
+    LOCK(cs_wallet);
     CWalletDB walletdb(strWalletFile);
     walletdb.WriteBestBlock(loc);
 }
@@ -472,6 +479,36 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
     return false;
 }
 
+/**
+ * Get the wallet transactions in setUnspentWalletTxs, dropping those which
+ * have no unspent outputs of ours any more. Immature coinbases are kept.
+ */
+void CWallet::GetUnspentWalletTxs(std::vector<const CWalletTx*>& vpwtx) const
+{
+    AssertLockHeld(cs_wallet);
+    vpwtx.clear();
+    vpwtx.reserve(setUnspentWalletTxs.size());
+    std::set<uint256>::iterator it = setUnspentWalletTxs.begin();
+    while (it != setUnspentWalletTxs.end())
+    {
+        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(*it);
+        if (mi == mapWallet.end()) {
+            setUnspentWalletTxs.erase(it++);
+            continue;
+        }
+        const CWalletTx& wtx = mi->second;
+        bool fUnspent = wtx.IsCoinBase() && wtx.GetBlocksToMaturity() > 0;
+        for (unsigned int i = 0; !fUnspent && i < wtx.vout.size(); i++)
+            fUnspent = !IsSpent(*it, i) && IsMine(wtx.vout[i]) != ISMINE_NO;
+        if (!fUnspent) {
+            setUnspentWalletTxs.erase(it++);
+            continue;
+        }
+        vpwtx.push_back(&wtx);
+        ++it;
+    }
+}
+
 void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(make_pair(outpoint, wtxid));
@@ -598,6 +635,24 @@ int64_t CWallet::IncOrderPosNext(CWalletDB *pwalletdb)
     return nRet;
 }
 
+void CWalletTx::MarkDirty()
+{
+    fCreditCached = false;
+    fAvailableCreditCached = false;
+    fWatchDebitCached = false;
+    fWatchCreditCached = false;
+    fAvailableWatchCreditCached = false;
+    fImmatureWatchCreditCached = false;
+    fDebitCached = false;
+    fChangeCached = false;
+
+    // The outputs of ours may have become unspent again
+    if (pwallet) {
+        LOCK(pwallet->cs_wallet);
+        pwallet->setUnspentWalletTxs.insert(GetHash());
+    }
+}
+
 void CWallet::MarkDirty()
 {
     {
@@ -902,6 +957,16 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
     }
 }
 
+void CWallet::SyncBlockTransactions(const CBlock& block)
+{
+    LOCK2(cs_main, cs_wallet);
+
+    // Commit the writes for all of the block's transactions together
+    CDBTxnBatch batch(strWalletFile);
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        SyncTransaction(tx, &block);
+}
+
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
 {
     LOCK2(cs_main, cs_wallet);
@@ -1042,6 +1107,27 @@ CAmount CWallet::GetChange(const CTransaction& tx) const
 }
 
 // MVF-Core begin auto wallet backup procedure (MVHF-CORE-DES-WABU-4)
+static boost::thread_group threadGroupAutoBackup;
+
+static void ThreadBackupWalletAuto(const CWallet* pwallet, const std::string strBackupFile)
+{
+    RenameThread("bitcoin-wbackup");
+    bool fSuccess = false;
+    try {
+        fSuccess = BackupWalletSnapshot(*pwallet, strBackupFile);
+    } catch (const std::exception& e) {
+        PrintExceptionContinue(&e, "ThreadBackupWalletAuto()");
+    }
+    MVFRecordAutoBackup(strBackupFile, fSuccess);
+    if (fSuccess)
+        LogPrintf("MVF: Wallet automatically backed up to: %s\n",strBackupFile);
+    else {
+        // shutdown in case of wallet backup failure (MVHF-CORE-DES-WABU-5)
+        LogPrintf("MVF: Automatic wallet backup to %s failed - shutting down\n",strBackupFile);
+        StartShutdown();
+    }
+}
+
 bool CWallet::BackupWalletAuto(const std::string& strDest, int BackupBlock)
 {
     // check if backup from previous block exists
@@ -1061,15 +1147,20 @@ bool CWallet::BackupWalletAuto(const std::string& strDest, int BackupBlock)
     if (boost::filesystem::exists(strBackupFile))
         boost::filesystem::rename(strBackupFile,strprintf("%s.%s.old",strBackupFile,GetTime()));
 
-    // call common backup wallet function
-	if (BackupWallet(*this, strBackupFile))
-		LogPrintf("MVF: Wallet automatically backed up to: %s\n",strBackupFile);
-	else
-		// backup failed
-		return false;
+    // copy the wallet in the background so block connection isn't held up;
+    // the outcome is recorded and a failure shuts the node down.
+    // Callers hold cs_main and cs_btcforkconf, which the backup thread may
+    // need to finish, so an earlier backup still running is not waited for.
+    LogPrintf("MVF: Scheduling automatic wallet backup to: %s\n",strBackupFile);
+    threadGroupAutoBackup.create_thread(boost::bind(&ThreadBackupWalletAuto, this, strBackupFile));
 
     return true;
 }
+
+void CWallet::WaitForAutoBackup()
+{
+    threadGroupAutoBackup.join_all();
+}
 // MVF-Core end
 
 
@@ -1215,10 +1306,83 @@ bool CWalletTx::WriteToDisk(CWalletDB *pwalletdb)
     return pwalletdb->WriteTx(GetHash(), *this);
 }
 
+/** Number of blocks read and matched in parallel per wallet rescan batch */
+static const unsigned int WALLET_RESCAN_BATCH = 32;
+
+/** A block of a wallet rescan batch, with the transactions paying to the wallet */
+struct CWalletScanBlock
+{
+    CBlockIndex* pindex;
+    CDiskBlockPos pos;
+    CBlock block;
+    bool fRead;
+    std::vector<bool> vOutputIsMine;
+    //! whether the block was skipped because its filter did not match the wallet
+    bool fSkipped;
+    CBlockFilter filter;
+
+    CWalletScanBlock(CBlockIndex* pindexIn) : pindex(pindexIn), pos(pindexIn->GetBlockPos()), fRead(false), fSkipped(false) {}
+};
+
+/**
+ * Closure reading a block for a wallet rescan and matching its outputs against
+ * the wallet. With the filter element hashes of the wallet given, blocks whose
+ * filter does not match them are skipped without being read.
+ */
+class CWalletScanCheck
+{
+private:
+    const CWallet* pwallet;
+    CWalletScanBlock* pscan;
+    const std::vector<uint64_t>* pvFilterHashes;
+
+public:
+    CWalletScanCheck() : pwallet(NULL), pscan(NULL), pvFilterHashes(NULL) {}
+    CWalletScanCheck(const CWallet* pwalletIn, CWalletScanBlock& scanIn, const std::vector<uint64_t>* pvFilterHashesIn) : pwallet(pwalletIn), pscan(&scanIn), pvFilterHashes(pvFilterHashesIn) {}
+
+    bool operator()() {
+        if (pvFilterHashes && pblocktree->ReadBlockFilter(pscan->pindex->GetBlockHash(), pscan->filter) && !pscan->filter.MatchAny(*pvFilterHashes)) {
+            pscan->fSkipped = true;
+            return true;
+        }
+        pscan->fSkipped = false;
+
+        CBlock& block = pscan->block;
+        if (!ReadBlockFromDisk(block, pscan->pos, Params().GetConsensus()) || block.GetHash() != pscan->pindex->GetBlockHash()) {
+            block.SetNull();
+            return true;
+        }
+        pscan->vOutputIsMine.resize(block.vtx.size(), false);
+        for (size_t i = 0; i < block.vtx.size(); i++) {
+            BOOST_FOREACH(const CTxOut& txout, block.vtx[i].vout) {
+                if (pwallet->IsMine(txout) != ISMINE_NO) {
+                    pscan->vOutputIsMine[i] = true;
+                    break;
+                }
+            }
+        }
+        pscan->fRead = true;
+        return true;
+    }
+
+    void swap(CWalletScanCheck &check) {
+        std::swap(pwallet, check.pwallet);
+        std::swap(pscan, check.pscan);
+        std::swap(pvFilterHashes, check.pvFilterHashes);
+    }
+};
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
+ *
+ * Blocks are read and their outputs matched against the wallet keys on
+ * nScriptCheckThreads threads, a batch at a time, and only the wallet
+ * updates are applied in order. cs_main is released between batches, so
+ * the node keeps processing blocks during long rescans. With -blockfilterindex,
+ * blocks whose filter matches none of the wallet scripts and outpoints are not
+ * read at all.
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
@@ -1227,6 +1391,9 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     const CChainParams& chainParams = Params();
 
     CBlockIndex* pindex = pindexStart;
+    double dProgressStart, dProgressTip;
+    std::vector<uint64_t> vFilterHashes;
+    const std::vector<uint64_t>* pvFilterHashes = fBlockFilterIndex ? &vFilterHashes : NULL;
     {
         LOCK2(cs_main, cs_wallet);
 
@@ -1236,31 +1403,127 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
             pindex = chainActive.Next(pindex);
 
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex)
+        dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+
+        if (pvFilterHashes)
+            GetFilterElementHashes(vFilterHashes);
+    }
+
+    CCheckQueuePool<CWalletScanCheck> scanpool(1, nScriptCheckThreads - 1);
+    std::vector<CWalletScanBlock> vBatch;
+    while (pindex)
+    {
+        vBatch.clear();
+        {
+            LOCK(cs_main);
+            // continue on the new branch if the chain was reorganized in the meantime
+            if (!chainActive.Contains(pindex))
+                pindex = chainActive.Next(chainActive.FindFork(pindex));
+            for (CBlockIndex* pindexBatch = pindex; pindexBatch && vBatch.size() < WALLET_RESCAN_BATCH; pindexBatch = chainActive.Next(pindexBatch))
+                vBatch.push_back(CWalletScanBlock(pindexBatch));
+        }
+        if (vBatch.empty())
+            break;
+
+        std::vector<CWalletScanCheck> vChecks;
+        vChecks.reserve(vBatch.size());
+        for (size_t i = 0; i < vBatch.size(); i++)
+            vChecks.push_back(CWalletScanCheck(this, vBatch[i], pvFilterHashes));
+        scanpool.Run(vChecks);
+
+        LOCK2(cs_main, cs_wallet);
+        // one database transaction for whatever this batch adds to the wallet
+        CDBTxnBatch dbbatch(strWalletFile);
+        // filter element hashes of the wallet transactions added in this batch
+        std::vector<uint64_t> vNewFilterHashes;
+        for (size_t i = 0; i < vBatch.size(); i++)
         {
+            CWalletScanBlock& scan = vBatch[i];
+            pindex = scan.pindex;
+            if (!chainActive.Contains(pindex))
+                break;
             if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
                 ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex, Params().GetConsensus());
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            // A skipped block may still spend an output found earlier in this batch
+            if (scan.fSkipped && scan.filter.MatchAny(vNewFilterHashes))
+                CWalletScanCheck(this, scan, NULL)();
+
+            for (size_t j = 0; scan.fRead && j < scan.block.vtx.size(); j++)
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+                const CTransaction& tx = scan.block.vtx[j];
+                // Only transactions paying to us, or spending or conflicting
+                // with wallet transactions, can involve the wallet
+                bool fInvolvesMe = scan.vOutputIsMine[j] || mapWallet.count(tx.GetHash());
+                for (size_t k = 0; !fInvolvesMe && k < tx.vin.size(); k++)
+                    fInvolvesMe = mapWallet.count(tx.vin[k].prevout.hash) || mapTxSpends.count(tx.vin[k].prevout);
+                if (fInvolvesMe && AddToWalletIfInvolvingMe(tx, &scan.block, fUpdate)) {
                     ret++;
+                    if (pvFilterHashes) {
+                        for (unsigned int k = 0; k < tx.vout.size(); k++)
+                            vNewFilterHashes.push_back(CBlockFilter::HashElement(COutPoint(tx.GetHash(), k)));
+                        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                            vNewFilterHashes.push_back(CBlockFilter::HashElement(txin.prevout));
+                        std::sort(vNewFilterHashes.begin(), vNewFilterHashes.end());
+                    }
+                }
             }
             pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
-            }
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+        if (!vNewFilterHashes.empty()) {
+            size_t nOld = vFilterHashes.size();
+            vFilterHashes.insert(vFilterHashes.end(), vNewFilterHashes.begin(), vNewFilterHashes.end());
+            std::inplace_merge(vFilterHashes.begin(), vFilterHashes.begin() + nOld, vFilterHashes.end());
+        }
+        if (pindex && GetTime() >= nNow + 60) {
+            nNow = GetTime();
+            LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+        }
     }
+
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     return ret;
 }
 
+/**
+ * Get the sorted filter element hashes (see CBlockFilter) of the scripts the
+ * wallet watches for and of the outpoints its transactions create or spend.
+ */
+void CWallet::GetFilterElementHashes(std::vector<uint64_t>& vHashes) const
+{
+    AssertLockHeld(cs_wallet);
+    vHashes.clear();
+
+    std::set<CKeyID> setKeys;
+    GetKeys(setKeys);
+    BOOST_FOREACH(const CKeyID& keyid, setKeys) {
+        vHashes.push_back(CBlockFilter::HashElement(GetScriptForDestination(keyid)));
+        CPubKey pubkey;
+        if (GetPubKey(keyid, pubkey))
+            vHashes.push_back(CBlockFilter::HashElement(GetScriptForRawPubKey(pubkey)));
+    }
+    {
+        LOCK(cs_KeyStore);
+        BOOST_FOREACH(const PAIRTYPE(CScriptID, CScript)& item, mapScripts) {
+            vHashes.push_back(CBlockFilter::HashElement(GetScriptForDestination(item.first)));
+            vHashes.push_back(CBlockFilter::HashElement(item.second));
+        }
+        BOOST_FOREACH(const CScript& script, setWatchOnly)
+            vHashes.push_back(CBlockFilter::HashElement(script));
+    }
+
+    for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+        for (unsigned int i = 0; i < it->second.vout.size(); i++)
+            vHashes.push_back(CBlockFilter::HashElement(COutPoint(it->first, i)));
+    }
+    for (TxSpends::const_iterator it = mapTxSpends.begin(); it != mapTxSpends.end(); ++it)
+        vHashes.push_back(CBlockFilter::HashElement(it->first));
+
+    std::sort(vHashes.begin(), vHashes.end());
+    vHashes.erase(std::unique(vHashes.begin(), vHashes.end()), vHashes.end());
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     // If transactions aren't being broadcasted, don't let them into local mempool either
@@ -1591,9 +1854,10 @@ CAmount CWallet::GetBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        std::vector<const CWalletTx*> vpwtx;
+        GetUnspentWalletTxs(vpwtx);
+        BOOST_FOREACH(const CWalletTx* pcoin, vpwtx)
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1607,9 +1871,10 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        std::vector<const CWalletTx*> vpwtx;
+        GetUnspentWalletTxs(vpwtx);
+        BOOST_FOREACH(const CWalletTx* pcoin, vpwtx)
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1622,9 +1887,10 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        std::vector<const CWalletTx*> vpwtx;
+        GetUnspentWalletTxs(vpwtx);
+        BOOST_FOREACH(const CWalletTx* pcoin, vpwtx)
         {
-            const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureCredit();
         }
     }
@@ -1636,9 +1902,10 @@ CAmount CWallet::GetWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        std::vector<const CWalletTx*> vpwtx;
+        GetUnspentWalletTxs(vpwtx);
+        BOOST_FOREACH(const CWalletTx* pcoin, vpwtx)
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1652,9 +1919,10 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        std::vector<const CWalletTx*> vpwtx;
+        GetUnspentWalletTxs(vpwtx);
+        BOOST_FOREACH(const CWalletTx* pcoin, vpwtx)
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1667,9 +1935,10 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        std::vector<const CWalletTx*> vpwtx;
+        GetUnspentWalletTxs(vpwtx);
+        BOOST_FOREACH(const CWalletTx* pcoin, vpwtx)
         {
-            const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
     }
@@ -1682,10 +1951,11 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        std::vector<const CWalletTx*> vpwtx;
+        GetUnspentWalletTxs(vpwtx);
+        BOOST_FOREACH(const CWalletTx* pcoin, vpwtx)
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+            const uint256& wtxid = pcoin->GetHash();
 
             if (!CheckFinalTx(*pcoin))
                 continue;
@@ -1708,8 +1978,8 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
                 isminetype mine = IsMine(pcoin->vout[i]);
                 if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected((*it).first, i)))
+                    !IsLockedCoin(wtxid, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
+                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(wtxid, i)))
                         vCoins.push_back(COutput(pcoin, i, nDepth,
                                                  ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
                                                   (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO)));
@@ -1718,7 +1988,7 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
     }
 }
 
-static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
+static void ApproximateBestSubset(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
                                   vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
 {
     vector<char> vfIncluded;
@@ -1774,7 +2044,119 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,uns
     }
 }
 
-bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins,
+/**
+ * Depth-first search over the coins, largest first, for the subset whose value
+ * lands closest to nTargetValue without exceeding nTargetValue + nCostOfChange.
+ * Branches that can no longer reach the target, or that already overshoot the
+ * window, are cut; the search gives up after BNB_TOTAL_TRIES steps.
+ */
+static bool SelectCoinsBnB(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTargetValue, const CAmount& nCostOfChange,
+                           set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet)
+{
+    setCoinsRet.clear();
+    nValueRet = 0;
+
+    CAmount nRemaining = 0;
+    for (unsigned int i = 0; i < vValue.size(); i++)
+        nRemaining += vValue[i].first;
+    if (nRemaining < nTargetValue)
+        return false;
+
+    sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+
+    // vfSelected holds the decision for each coin on the current branch
+    vector<bool> vfSelected;
+    vector<bool> vfBest;
+    vfSelected.reserve(vValue.size());
+    CAmount nSelected = 0;
+    CAmount nBestExcess = std::numeric_limits<CAmount>::max();
+
+    for (unsigned int nTries = 0; nTries < BNB_TOTAL_TRIES; nTries++)
+    {
+        bool fBacktrack = false;
+        if (nSelected + nRemaining < nTargetValue || nSelected > nTargetValue + nCostOfChange)
+            fBacktrack = true;
+        else if (nSelected >= nTargetValue)
+        {
+            if (nSelected - nTargetValue < nBestExcess)
+            {
+                nBestExcess = nSelected - nTargetValue;
+                vfBest = vfSelected;
+                vfBest.resize(vValue.size(), false);
+                if (nBestExcess == 0)
+                    break;
+            }
+            fBacktrack = true;
+        }
+
+        if (fBacktrack)
+        {
+            // Walk back to the last included coin and try the branch without it
+            while (!vfSelected.empty() && !vfSelected.back())
+            {
+                vfSelected.pop_back();
+                nRemaining += vValue[vfSelected.size()].first;
+            }
+            if (vfSelected.empty())
+                break;
+            vfSelected.back() = false;
+            nSelected -= vValue[vfSelected.size() - 1].first;
+        }
+        else
+        {
+            const unsigned int i = vfSelected.size();
+            nRemaining -= vValue[i].first;
+            // Including a coin equal in value to one just excluded would only
+            // repeat a branch that has already been searched
+            if (i > 0 && !vfSelected.back() && vValue[i].first == vValue[i - 1].first)
+                vfSelected.push_back(false);
+            else
+            {
+                vfSelected.push_back(true);
+                nSelected += vValue[i].first;
+            }
+        }
+    }
+
+    if (vfBest.empty())
+        return false;
+
+    for (unsigned int i = 0; i < vValue.size(); i++)
+        if (vfBest[i])
+        {
+            setCoinsRet.insert(vValue[i].second);
+            nValueRet += vValue[i].second.first->vout[vValue[i].second.second].nValue;
+        }
+    return true;
+}
+
+bool CWallet::SelectCoinsChangeless(const vector<COutput>& vCoins, const CAmount& nTargetValue, const CAmount& nInputFee, const CAmount& nCostOfChange,
+                                    set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
+{
+    vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > > vValue;
+    vValue.reserve(vCoins.size());
+
+    BOOST_FOREACH(const COutput &output, vCoins)
+    {
+        if (!output.fSpendable)
+            continue;
+
+        const CWalletTx *pcoin = output.tx;
+
+        // Same depth requirement as the first pass of SelectCoins
+        if (output.nDepth < (pcoin->IsFromMe(ISMINE_ALL) ? 1 : 6))
+            continue;
+
+        // Coins that cost more to spend than they are worth can never help
+        CAmount nEffectiveValue = pcoin->vout[output.i].nValue - nInputFee;
+        if (nEffectiveValue > 0)
+            vValue.push_back(make_pair(nEffectiveValue, make_pair(pcoin, output.i)));
+    }
+
+    return SelectCoinsBnB(vValue, nTargetValue, nCostOfChange, setCoinsRet, nValueRet);
+}
+
+bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const vector<COutput>& vCoins,
                                  set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
 {
     setCoinsRet.clear();
@@ -1787,13 +2169,17 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > > vValue;
     CAmount nTotalLower = 0;
 
-    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
-
+    // Shuffle pointers rather than copying every candidate output
+    vector<const COutput*> vpCoins;
+    vpCoins.reserve(vCoins.size());
     BOOST_FOREACH(const COutput &output, vCoins)
-    {
-        if (!output.fSpendable)
-            continue;
+        if (output.fSpendable)
+            vpCoins.push_back(&output);
+    random_shuffle(vpCoins.begin(), vpCoins.end(), GetRandInt);
 
+    BOOST_FOREACH(const COutput *poutput, vpCoins)
+    {
+        const COutput &output = *poutput;
         const CWalletTx *pcoin = output.tx;
 
         if (output.nDepth < (pcoin->IsFromMe(ISMINE_ALL) ? nConfMine : nConfTheirs))
@@ -1875,15 +2261,12 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     return true;
 }
 
-bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl) const
+bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl) const
 {
-    vector<COutput> vCoins;
-    AvailableCoins(vCoins, true, coinControl);
-
     // coin control -> return all selected outputs (we want all selected to go into the transaction for sure)
     if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs)
     {
-        BOOST_FOREACH(const COutput& out, vCoins)
+        BOOST_FOREACH(const COutput& out, vAvailableCoins)
         {
             if (!out.fSpendable)
                  continue;
@@ -1915,14 +2298,16 @@ bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*
             return false; // TODO: Allow non-wallet inputs
     }
 
-    // remove preset inputs from vCoins
-    for (vector<COutput>::iterator it = vCoins.begin(); it != vCoins.end() && coinControl && coinControl->HasSelected();)
+    // remove preset inputs from the candidates; only copy when there are any
+    vector<COutput> vCoinsNoPreset;
+    if (!setPresetCoins.empty())
     {
-        if (setPresetCoins.count(make_pair(it->tx, it->i)))
-            it = vCoins.erase(it);
-        else
-            ++it;
+        vCoinsNoPreset.reserve(vAvailableCoins.size());
+        BOOST_FOREACH(const COutput& out, vAvailableCoins)
+            if (!setPresetCoins.count(make_pair(out.tx, out.i)))
+                vCoinsNoPreset.push_back(out);
     }
+    const vector<COutput>& vCoins = setPresetCoins.empty() ? vAvailableCoins : vCoinsNoPreset;
 
     bool res = nTargetValue <= nValueFromPresetInputs ||
         SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, vCoins, setCoinsRet, nValueRet) ||
@@ -2044,6 +2429,15 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
     {
         LOCK2(cs_main, cs_wallet);
         {
+            // Gather the candidate coins once; every pass of the fee loop selects from them
+            vector<COutput> vAvailableCoins;
+            AvailableCoins(vAvailableCoins, true, coinControl);
+
+            // The first pass looks for inputs that pay amount and fee without
+            // needing change. Not with coin control inputs, or when the fee comes
+            // out of the amounts, as both rely on a change output.
+            bool fTryChangeless = nSubtractFeeFromAmount == 0 && !(coinControl && coinControl->HasSelected());
+
             nFeeRet = 0;
             // Start with no fee and loop until there is enough fee
             while (true)
@@ -2093,7 +2487,28 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                 // Choose coins to use
                 set<pair<const CWalletTx*,unsigned int> > setCoins;
                 CAmount nValueIn = 0;
-                if (!SelectCoins(nValueToSelect, setCoins, nValueIn, coinControl))
+                bool fChangeless = false;
+                if (fTryChangeless)
+                {
+                    fTryChangeless = false;
+                    // Rate the coins by what they are worth once the fee to spend
+                    // them is paid. Fees are rounded up so that the estimate is never
+                    // below what the final size check asks for.
+                    const CAmount nFeePerK = GetMinimumFee(1000, nTxConfirmTarget, mempool);
+                    const unsigned int nBytesOutputs = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION);
+                    const CAmount nFeeOutputs = (nFeePerK * nBytesOutputs + 999) / 1000;
+                    const CAmount nInputFee = (nFeePerK * WALLET_INPUT_SIZE_ESTIMATE + 999) / 1000;
+                    // Overpaying by less than a change output would cost to create and
+                    // later spend is cheaper than creating it
+                    const CAmount nCostOfChange = (nFeePerK * (WALLET_CHANGE_OUTPUT_SIZE_ESTIMATE + WALLET_INPUT_SIZE_ESTIMATE)) / 1000;
+                    if (nFeePerK > 0 && SelectCoinsChangeless(vAvailableCoins, nValue + nFeeOutputs, nInputFee, nCostOfChange, setCoins, nValueIn))
+                    {
+                        fChangeless = true;
+                        nFeeRet = nValueIn - nValue;
+                        nValueToSelect = nValueIn;
+                    }
+                }
+                if (!fChangeless && !SelectCoins(vAvailableCoins, nValueToSelect, setCoins, nValueIn, coinControl))
                 {
                     strFailReason = _("Insufficient funds");
                     return false;
@@ -2196,13 +2611,14 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                 // Sign
                 int nIn = 0;
                 CTransaction txNewConst(txNew);
+                CTxSignatureHasher hasher(txNewConst);
                 BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
                 {
                     bool signSuccess;
                     const CScript& scriptPubKey = coin.first->vout[coin.second].scriptPubKey;
                     CScript& scriptSigRes = txNew.vin[nIn].scriptSig;
                     if (sign)
-                        signSuccess = ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, SIGHASH_ALL), scriptPubKey, scriptSigRes);
+                        signSuccess = ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, SIGHASH_ALL, CHAINID_ACTIVE, &hasher), scriptPubKey, scriptSigRes);
                     else
                         signSuccess = ProduceSignature(DummySignatureCreator(this), scriptPubKey, scriptSigRes);
 
@@ -2374,6 +2790,7 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
         {
             LOCK(cs_wallet);
             setKeyPool.clear();
+            mapKeyPoolCache.clear();
             // Note: can't top-up keypool here, because wallet is locked.
             // User will be prompted to unlock wallet the next operation
             // that requires a new key.
@@ -2401,6 +2818,7 @@ DBErrors CWallet::ZapWalletTx(std::vector<CWalletTx>& vWtx)
         {
             LOCK(cs_wallet);
             setKeyPool.clear();
+            mapKeyPoolCache.clear();
             // Note: can't top-up keypool here, because wallet is locked.
             // User will be prompted to unlock wallet the next operation
             // that requires a new key.
@@ -2478,10 +2896,12 @@ bool CWallet::NewKeyPool()
 {
     {
         LOCK(cs_wallet);
+        CDBTxnBatch batch(strWalletFile);
         CWalletDB walletdb(strWalletFile);
         BOOST_FOREACH(int64_t nIndex, setKeyPool)
             walletdb.ErasePool(nIndex);
         setKeyPool.clear();
+        mapKeyPoolCache.clear();
 
         if (IsLocked())
             return false;
@@ -2490,8 +2910,10 @@ bool CWallet::NewKeyPool()
         for (int i = 0; i < nKeys; i++)
         {
             int64_t nIndex = i+1;
-            walletdb.WritePool(nIndex, CKeyPool(GenerateNewKey()));
+            CKeyPool keypool(GenerateNewKey());
+            walletdb.WritePool(nIndex, keypool);
             setKeyPool.insert(nIndex);
+            mapKeyPoolCache[nIndex] = keypool;
         }
         LogPrintf("CWallet::NewKeyPool wrote %d new keys\n", nKeys);
     }
@@ -2506,6 +2928,8 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         if (IsLocked())
             return false;
 
+        // Write all new keys and their pool entries in one transaction
+        CDBTxnBatch batch(strWalletFile);
         CWalletDB walletdb(strWalletFile);
 
         // Top up key pool
@@ -2515,18 +2939,83 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         else
             nTargetSize = max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t) 0);
 
-        while (setKeyPool.size() < (nTargetSize + 1))
+        AddKeyPoolKeys(walletdb, nTargetSize + 1, std::numeric_limits<unsigned int>::max());
+    }
+    return true;
+}
+
+unsigned int CWallet::AddKeyPoolKeys(CWalletDB& walletdb, unsigned int nTargetSize, unsigned int nMaxKeys)
+{
+    AssertLockHeld(cs_wallet);
+    unsigned int nAdded = 0;
+    while (setKeyPool.size() < nTargetSize && nAdded < nMaxKeys)
+    {
+        int64_t nEnd = 1;
+        if (!setKeyPool.empty())
+            nEnd = *(--setKeyPool.end()) + 1;
+        CKeyPool keypool(GenerateNewKey());
+        if (!walletdb.WritePool(nEnd, keypool))
+            throw runtime_error("TopUpKeyPool(): writing generated key failed");
+        setKeyPool.insert(nEnd);
+        mapKeyPoolCache[nEnd] = keypool;
+        nAdded++;
+        LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
+    }
+    return nAdded;
+}
+
+void CWallet::NotifyKeyPoolLow()
+{
+    boost::unique_lock<boost::mutex> lock(csKeyPoolLow);
+    fKeyPoolLow = true;
+    condKeyPoolLow.notify_one();
+}
+
+void CWallet::MaintainKeyPool()
+{
+    {
+        LOCK(cs_wallet);
+        fKeyPoolMaintained = true;
+    }
+    NotifyKeyPoolLow();
+
+    try {
+        while (true)
         {
-            int64_t nEnd = 1;
-            if (!setKeyPool.empty())
-                nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
-                throw runtime_error("TopUpKeyPool(): writing generated key failed");
-            setKeyPool.insert(nEnd);
-            LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
+            {
+                boost::unique_lock<boost::mutex> lock(csKeyPoolLow);
+                while (!fKeyPoolLow)
+                    condKeyPoolLow.wait(lock);
+                fKeyPoolLow = false;
+            }
+
+            unsigned int nTargetSize = max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t) 0) + 1;
+            while (true)
+            {
+                boost::this_thread::interruption_point();
+                LOCK(cs_wallet);
+                if (IsLocked())
+                    break;
+                CDBTxnBatch batch(strWalletFile);
+                CWalletDB walletdb(strWalletFile);
+                if (AddKeyPoolKeys(walletdb, nTargetSize, KEYPOOL_BACKGROUND_CHUNK) < KEYPOOL_BACKGROUND_CHUNK)
+                    break;
+            }
         }
     }
-    return true;
+    catch (const boost::thread_interrupted&)
+    {
+        LOCK(cs_wallet);
+        fKeyPoolMaintained = false;
+        throw;
+    }
+    catch (const std::exception& e)
+    {
+        // Key handout falls back to refilling the pool itself
+        LogPrintf("%s: %s, no longer refilling the key pool in the background\n", __func__, e.what());
+        LOCK(cs_wallet);
+        fKeyPoolMaintained = false;
+    }
 }
 
 void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
@@ -2537,18 +3026,36 @@ void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
         LOCK(cs_wallet);
 
         if (!IsLocked())
-            TopUpKeyPool();
+        {
+            if (!fKeyPoolMaintained)
+                TopUpKeyPool();
+            else if (setKeyPool.empty())
+            {
+                // The background thread fell behind; generate just the key needed now
+                CWalletDB walletdb(strWalletFile);
+                AddKeyPoolKeys(walletdb, 1, 1);
+            }
+        }
 
         // Get the oldest key
         if(setKeyPool.empty())
             return;
 
-        CWalletDB walletdb(strWalletFile);
-
         nIndex = *(setKeyPool.begin());
         setKeyPool.erase(setKeyPool.begin());
-        if (!walletdb.ReadPool(nIndex, keypool))
-            throw runtime_error("ReserveKeyFromKeyPool(): read failed");
+        if (fKeyPoolMaintained && setKeyPool.size() <= max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t) 0) / 2)
+            NotifyKeyPoolLow();
+
+        std::map<int64_t, CKeyPool>::const_iterator it = mapKeyPoolCache.find(nIndex);
+        if (it != mapKeyPoolCache.end())
+            keypool = it->second;
+        else
+        {
+            CWalletDB walletdb(strWalletFile);
+            if (!walletdb.ReadPool(nIndex, keypool))
+                throw runtime_error("ReserveKeyFromKeyPool(): read failed");
+            mapKeyPoolCache[nIndex] = keypool;
+        }
         if (!HaveKey(keypool.vchPubKey.GetID()))
             throw runtime_error("ReserveKeyFromKeyPool(): unknown key in key pool");
         assert(keypool.vchPubKey.IsValid());
@@ -2559,6 +3066,10 @@ void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
 void CWallet::KeepKey(int64_t nIndex)
 {
     // Remove from key pool
+    {
+        LOCK(cs_wallet);
+        mapKeyPoolCache.erase(nIndex);
+    }
     if (fFileBacked)
     {
         CWalletDB walletdb(strWalletFile);
@@ -2613,10 +3124,10 @@ std::map<CTxDestination, CAmount> CWallet::GetAddressBalances()
 
     {
         LOCK(cs_wallet);
-        BOOST_FOREACH(PAIRTYPE(uint256, CWalletTx) walletEntry, mapWallet)
+        std::vector<const CWalletTx*> vpwtx;
+        GetUnspentWalletTxs(vpwtx);
+        BOOST_FOREACH(const CWalletTx* pcoin, vpwtx)
         {
-            CWalletTx *pcoin = &walletEntry.second;
-
             if (!CheckFinalTx(*pcoin) || !pcoin->IsTrusted())
                 continue;
 
@@ -2635,7 +3146,7 @@ std::map<CTxDestination, CAmount> CWallet::GetAddressBalances()
                 if(!ExtractDestination(pcoin->vout[i].scriptPubKey, addr))
                     continue;
 
-                CAmount n = IsSpent(walletEntry.first, i) ? 0 : pcoin->vout[i].nValue;
+                CAmount n = IsSpent(pcoin->GetHash(), i) ? 0 : pcoin->vout[i].nValue;
 
                 if (!balances.count(addr))
                     balances[addr] = 0;
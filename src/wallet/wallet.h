@@ -27,6 +27,8 @@
 #include <vector>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
 
 /**
  * Settings
@@ -38,6 +40,10 @@ extern bool bSpendZeroConfChange;
 extern bool fSendFreeTransactions;
 
 static const unsigned int DEFAULT_KEYPOOL_SIZE = 100;
+//! -keypoolbackground default
+static const bool DEFAULT_KEYPOOL_BACKGROUND = true;
+//! Number of keys the background keypool thread generates per hold of cs_wallet
+static const unsigned int KEYPOOL_BACKGROUND_CHUNK = 16;
 //! -paytxfee default
 static const CAmount DEFAULT_TRANSACTION_FEE = 0;
 //! -paytxfee will warn if called with a higher fee than this amount (in satoshis) per KB
@@ -61,6 +67,12 @@ static const CAmount nHighTransactionMaxFeeWarning = 100 * nHighTransactionFeeWa
 //! Largest (in bytes) free transaction we're willing to create
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
 static const bool DEFAULT_WALLETBROADCAST = true;
+//! Size (in bytes) assumed for a P2PKH input when selecting coins by their value net of fees
+static const unsigned int WALLET_INPUT_SIZE_ESTIMATE = 148;
+//! Size (in bytes) assumed for a P2PKH change output
+static const unsigned int WALLET_CHANGE_OUTPUT_SIZE_ESTIMATE = 34;
+//! Number of search steps after which branch and bound coin selection gives up
+static const unsigned int BNB_TOTAL_TRIES = 100000;
 
 class CAccountingEntry;
 class CBlockIndex;
@@ -353,17 +365,7 @@ public:
     }
 
     //! make sure balances are recalculated
-    void MarkDirty()
-    {
-        fCreditCached = false;
-        fAvailableCreditCached = false;
-        fWatchDebitCached = false;
-        fWatchCreditCached = false;
-        fAvailableWatchCreditCached = false;
-        fImmatureWatchCreditCached = false;
-        fDebitCached = false;
-        fChangeCached = false;
-    }
+    void MarkDirty();
 
     void BindWallet(CWallet *pwalletIn)
     {
@@ -469,7 +471,7 @@ private:
      * all coins from coinControl are selected; Never select unconfirmed coins
      * if they are not ours
      */
-    bool SelectCoins(const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL) const;
+    bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL) const;
 
     CWalletDB *pwalletdbEncryption;
 
@@ -498,6 +500,15 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /* Wakes MaintainKeyPool when the key pool runs low */
+    boost::mutex csKeyPoolLow;
+    boost::condition_variable condKeyPoolLow;
+    bool fKeyPoolLow;
+    void NotifyKeyPoolLow();
+
+    /* Add at most nMaxKeys new keys to the key pool, up to nTargetSize keys; returns the number added */
+    unsigned int AddKeyPoolKeys(CWalletDB& walletdb, unsigned int nTargetSize, unsigned int nMaxKeys);
+
 public:
     /*
      * Main wallet lock.
@@ -512,6 +523,10 @@ public:
     std::string strWalletFile;
 
     std::set<int64_t> setKeyPool;
+    //! Pool entries written or read since load, so reserving a key needs no database read
+    std::map<int64_t, CKeyPool> mapKeyPoolCache;
+    //! Set while MaintainKeyPool runs for this wallet; key handout then leaves refilling to it
+    bool fKeyPoolMaintained;
     std::map<CKeyID, CKeyMetadata> mapKeyMetadata;
 
     typedef std::map<unsigned int, CMasterKey> MasterKeyMap;
@@ -549,9 +564,18 @@ public:
         nLastResend = 0;
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
+        fKeyPoolMaintained = false;
+        fKeyPoolLow = false;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
+    /**
+     * Hashes of the wallet transactions which may still have unspent outputs
+     * of ours, so the balances and AvailableCoins don't need to look at all
+     * of mapWallet. Transactions are added whenever they are marked dirty,
+     * and dropped lazily once found to be fully spent.
+     */
+    mutable std::set<uint256> setUnspentWalletTxs;
     std::list<CAccountingEntry> laccentries;
 
     typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
@@ -572,6 +596,8 @@ public:
     const CWalletTx* GetWalletTx(const uint256& hash) const;
 
     bool BackupWalletAuto(const std::string& strDest, int BackupBlock); // MVF-Core TODO: trace to design
+    //! wait for a scheduled automatic backup to finish writing (MVHF-CORE-DES-WABU-4)
+    void WaitForAutoBackup();
 
     //! check whether we are allowed to upgrade (or already support) to the named feature
     bool CanSupportFeature(enum WalletFeature wf) { AssertLockHeld(cs_wallet); return nWalletMaxVersion >= wf; }
@@ -587,9 +613,18 @@ public:
      * completion the coin set and corresponding actual target value is
      * assembled
      */
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+
+    /**
+     * Branch and bound search for coins whose value, less nInputFee for each
+     * coin spent, is at least nTargetValue and at most nTargetValue +
+     * nCostOfChange, so that no change output is needed; Only coins that
+     * would be picked by the first pass of SelectCoins are considered
+     */
+    bool SelectCoinsChangeless(const std::vector<COutput>& vCoins, const CAmount& nTargetValue, const CAmount& nInputFee, const CAmount& nCostOfChange, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
+    void GetUnspentWalletTxs(std::vector<const CWalletTx*>& vpwtx) const;
 
     bool IsLockedCoin(uint256 hash, unsigned int n) const;
     void LockCoin(COutPoint& output);
@@ -648,8 +683,10 @@ public:
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    void SyncBlockTransactions(const CBlock& block);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    void GetFilterElementHashes(std::vector<uint64_t>& vHashes) const;
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime);
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime);
@@ -691,6 +728,14 @@ public:
 
     bool NewKeyPool();
     bool TopUpKeyPool(unsigned int kpSize = 0);
+    /**
+     * Keep the key pool above half of -keypool in the background, refilling
+     * it in chunks of KEYPOOL_BACKGROUND_CHUNK keys so that key handout only
+     * waits for cs_wallet briefly. Runs until the thread is interrupted, or
+     * until the wallet cannot be written to; key handout then refills the
+     * pool itself again.
+     */
+    void MaintainKeyPool();
     void ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool);
     void KeepKey(int64_t nIndex);
     void ReturnKey(int64_t nIndex);
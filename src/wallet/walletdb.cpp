@@ -6,6 +6,7 @@
 #include "wallet/walletdb.h"
 
 #include "base58.h"
+#include "checkqueue.h"
 #include "consensus/validation.h"
 #include "main.h" // For CheckTransaction
 #include "protocol.h"
@@ -345,9 +346,102 @@ public:
     }
 };
 
+/** Number of wallet transaction records decoded together while loading */
+static const unsigned int WALLET_LOAD_TX_BATCH = 4096;
+
+/** A wallet transaction record, kept in serialized form until decoded */
+struct CWalletTxRecord
+{
+    uint256 hash;
+    CDataStream ssValue;
+    CWalletTx wtx;
+    bool fValid;
+
+    CWalletTxRecord(const uint256& hashIn, const CDataStream& ssValueIn) : hash(hashIn), ssValue(ssValueIn), fValid(false) {}
+};
+
+/** Closure that deserializes and checks one wallet transaction record */
+class CWalletTxRecordCheck
+{
+private:
+    CWalletTxRecord* precord;
+
+public:
+    CWalletTxRecordCheck() : precord(NULL) {}
+    CWalletTxRecordCheck(CWalletTxRecord* precordIn) : precord(precordIn) {}
+
+    bool operator()() {
+        try {
+            precord->ssValue >> precord->wtx;
+            CValidationState state;
+            precord->fValid = CheckTransaction(precord->wtx, state) && (precord->wtx.GetHash() == precord->hash) && state.IsValid();
+        } catch (...) {
+            precord->fValid = false;
+        }
+        // A bad record only costs its own transaction, see LoadWalletTx
+        return true;
+    }
+
+    void swap(CWalletTxRecordCheck &check) {
+        std::swap(precord, check.precord);
+    }
+};
+
+/** Decode a batch of wallet transaction records, spread over the threads of txpool */
+static void DecodeWalletTxRecords(vector<CWalletTxRecord>& vRecords, CCheckQueuePool<CWalletTxRecordCheck>& txpool)
+{
+    vector<CWalletTxRecordCheck> vChecks;
+    vChecks.reserve(vRecords.size());
+    for (size_t i = 0; i < vRecords.size(); i++)
+        vChecks.push_back(CWalletTxRecordCheck(&vRecords[i]));
+    txpool.Run(vChecks);
+}
+
+/** Add a decoded wallet transaction record to the wallet */
+static bool LoadWalletTx(CWallet* pwallet, CWalletTxRecord& record, CWalletScanState &wss, string& strErr)
+{
+    if (!record.fValid)
+        return false;
+
+    const uint256& hash = record.hash;
+    CDataStream& ssValue = record.ssValue;
+    CWalletTx& wtx = record.wtx;
+
+    // Undo serialize changes in 31600
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        wss.vWalletUpgrade.push_back(hash);
+    }
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    pwallet->AddToWallet(wtx, true, NULL);
+    return true;
+}
+
+/**
+ * Read one wallet record. With pvTxRecords, transaction records are only
+ * collected there, to be decoded in a batch and passed to LoadWalletTx.
+ */
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
-             CWalletScanState &wss, string& strType, string& strErr)
+             CWalletScanState &wss, string& strType, string& strErr,
+             vector<CWalletTxRecord>* pvTxRecords = NULL)
 {
     try {
         // Unserialize
@@ -370,36 +464,16 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         {
             uint256 hash;
             ssKey >> hash;
-            CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
-                return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+            if (pvTxRecords)
             {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
+                pvTxRecords->push_back(CWalletTxRecord(hash, ssValue));
+                return true;
             }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->AddToWallet(wtx, true, NULL);
+            CWalletTxRecord record(hash, ssValue);
+            CWalletTxRecordCheck check(&record);
+            check();
+            if (!LoadWalletTx(pwallet, record, wss, strErr))
+                return false;
         }
         else if (strType == "acentry")
         {
@@ -636,23 +710,47 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             return DB_CORRUPT;
         }
 
+        // Transaction records are decoded in parallel, a batch at a time, and
+        // then added to the wallet in the order they were read
+        CCheckQueuePool<CWalletTxRecordCheck> txpool(64, nScriptCheckThreads - 1);
+        vector<CWalletTxRecord> vTxRecords;
+        vTxRecords.reserve(WALLET_LOAD_TX_BATCH);
         while (true)
         {
             // Read next record
             CDataStream ssKey(SER_DISK, CLIENT_VERSION);
             CDataStream ssValue(SER_DISK, CLIENT_VERSION);
             int ret = ReadAtCursor(pcursor, ssKey, ssValue);
-            if (ret == DB_NOTFOUND)
-                break;
-            else if (ret != 0)
+            if (ret != 0 && ret != DB_NOTFOUND)
             {
                 LogPrintf("Error reading next record from wallet database\n");
                 return DB_CORRUPT;
             }
 
+            if (vTxRecords.size() >= WALLET_LOAD_TX_BATCH || (ret == DB_NOTFOUND && !vTxRecords.empty()))
+            {
+                DecodeWalletTxRecords(vTxRecords, txpool);
+                for (size_t i = 0; i < vTxRecords.size(); i++)
+                {
+                    string strErr;
+                    if (!LoadWalletTx(pwallet, vTxRecords[i], wss, strErr))
+                    {
+                        // Leave bad transaction records alone, but do warn the
+                        // user there is something wrong and rescan
+                        fNoncriticalErrors = true;
+                        SoftSetBoolArg("-rescan", true);
+                    }
+                    if (!strErr.empty())
+                        LogPrintf("%s\n", strErr);
+                }
+                vTxRecords.clear();
+            }
+            if (ret == DB_NOTFOUND)
+                break;
+
             // Try to be tolerant of single corrupt records:
             string strType, strErr;
-            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
+            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr, &vTxRecords))
             {
                 // losing keys is considered a catastrophic error, anything else
                 // we assume the user can live with:
@@ -903,6 +1001,81 @@ bool BackupWallet(const CWallet& wallet, const string& strDest)
     return false;
 }
 
+/** Copy pathSrc to pathDest and commit the copy to disk */
+static bool CopyFileCommitted(const boost::filesystem::path& pathSrc, const boost::filesystem::path& pathDest)
+{
+    FILE* filein = fopen(pathSrc.string().c_str(), "rb");
+    if (!filein)
+        return false;
+    FILE* fileout = fopen(pathDest.string().c_str(), "wb");
+    if (!fileout) {
+        fclose(filein);
+        return false;
+    }
+    char buf[65536];
+    bool fCopied = true;
+    size_t nRead;
+    while (fCopied && (nRead = fread(buf, 1, sizeof(buf), filein)) > 0)
+        fCopied = fwrite(buf, 1, nRead, fileout) == nRead;
+    fCopied = fCopied && !ferror(filein) && fflush(fileout) == 0;
+    if (fCopied)
+        FileCommit(fileout);
+    fclose(filein);
+    fclose(fileout);
+    return fCopied;
+}
+
+bool BackupWalletSnapshot(const CWallet& wallet, const string& strDest)
+{
+    if (!wallet.fFileBacked)
+        return false;
+
+    boost::filesystem::path pathSrc = GetDataDir() / wallet.strWalletFile;
+    boost::filesystem::path pathDest(strDest);
+    if (boost::filesystem::is_directory(pathDest))
+        pathDest /= wallet.strWalletFile;
+    boost::filesystem::path pathTmp(pathDest.string() + ".tmp");
+
+    while (true)
+    {
+        // Only flushing log data to the dat file needs the database to be
+        // idle. The file is copied without holding cs_db, so the wallet can
+        // carry on being used, and copied again if it was opened meanwhile.
+        bool fIdle = false;
+        unsigned int nOpenCount = 0;
+        {
+            LOCK(bitdb.cs_db);
+            if (!bitdb.mapFileUseCount.count(wallet.strWalletFile) || bitdb.mapFileUseCount[wallet.strWalletFile] == 0)
+            {
+                bitdb.CloseDb(wallet.strWalletFile);
+                bitdb.CheckpointLSN(wallet.strWalletFile);
+                bitdb.mapFileUseCount.erase(wallet.strWalletFile);
+                nOpenCount = bitdb.mapFileOpenCount[wallet.strWalletFile];
+                fIdle = true;
+            }
+        }
+        if (fIdle) {
+            if (!CopyFileCommitted(pathSrc, pathTmp)) {
+                LogPrintf("error copying wallet.dat to %s\n", pathTmp.string());
+                remove(pathTmp.string().c_str());
+                return false;
+            }
+            LOCK(bitdb.cs_db);
+            if (bitdb.mapFileOpenCount[wallet.strWalletFile] == nOpenCount)
+                break;
+        }
+        MilliSleep(100);
+    }
+
+    if (!RenameOver(pathTmp, pathDest)) {
+        LogPrintf("error copying wallet.dat to %s\n", pathDest.string());
+        remove(pathTmp.string().c_str());
+        return false;
+    }
+    LogPrintf("copied wallet.dat to %s\n", pathDest.string());
+    return true;
+}
+
 //
 // Try to (very carefully!) recover wallet.dat if there is a problem.
 //
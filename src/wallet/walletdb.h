@@ -141,6 +141,8 @@ private:
 };
 
 bool BackupWallet(const CWallet& wallet, const std::string& strDest);
+/** Like BackupWallet, but only blocks the database while flushing it, not while copying it */
+bool BackupWalletSnapshot(const CWallet& wallet, const std::string& strDest);
 void ThreadFlushWalletDB(const std::string& strFile);
 
 #endif // BITCOIN_WALLET_WALLETDB_H
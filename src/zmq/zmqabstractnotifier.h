@@ -9,13 +9,17 @@
 
 class CBlockIndex;
 class CZMQAbstractNotifier;
+class CZMQPublisher;
+
+/** Default number of messages a ZMQ socket holds for a subscriber that lags behind (ZMQ_SNDHWM) */
+static const int DEFAULT_ZMQ_SNDHWM = 1000;
 
 typedef CZMQAbstractNotifier* (*CZMQNotifierFactory)();
 
 class CZMQAbstractNotifier
 {
 public:
-    CZMQAbstractNotifier() : psocket(0) { }
+    CZMQAbstractNotifier() : psocket(0), nHighWaterMark(DEFAULT_ZMQ_SNDHWM), ppublisher(0) { }
     virtual ~CZMQAbstractNotifier();
 
     template <typename T>
@@ -28,6 +32,9 @@ public:
     void SetType(const std::string &t) { type = t; }
     std::string GetAddress() const { return address; }
     void SetAddress(const std::string &a) { address = a; }
+    int GetHighWaterMark() const { return nHighWaterMark; }
+    void SetHighWaterMark(int n) { nHighWaterMark = n; }
+    void SetPublisher(CZMQPublisher *p) { ppublisher = p; }
 
     virtual bool Initialize(void *pcontext) = 0;
     virtual void Shutdown() = 0;
@@ -39,6 +46,9 @@ protected:
     void *psocket;
     std::string type;
     std::string address;
+    int nHighWaterMark;
+    //! sends the messages, on a thread of its own
+    CZMQPublisher *ppublisher;
 };
 
 #endif // BITCOIN_ZMQ_ZMQABSTRACTNOTIFIER_H
@@ -4,18 +4,20 @@
 
 #include "zmqnotificationinterface.h"
 #include "zmqpublishnotifier.h"
+#include "zmqpublisher.h"
 
 #include "version.h"
 #include "main.h"
 #include "streams.h"
 #include "util.h"
+#include "utilstrencodings.h"
 
 void zmqError(const char *str)
 {
     LogPrint("zmq", "zmq: Error: %s, errno=%s\n", str, zmq_strerror(errno));
 }
 
-CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL)
+CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL), ppublisher(NULL)
 {
 }
 
@@ -27,6 +29,7 @@ CZMQNotificationInterface::~CZMQNotificationInterface()
     {
         delete *i;
     }
+    delete ppublisher;
 }
 
 CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const std::map<std::string, std::string> &args)
@@ -50,6 +53,11 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
             CZMQAbstractNotifier *notifier = factory();
             notifier->SetType(i->first);
             notifier->SetAddress(address);
+            std::map<std::string, std::string>::const_iterator k = args.find("-zmq" + i->first + "hwm");
+            if (k!=args.end())
+            {
+                notifier->SetHighWaterMark(std::max(0, atoi(k->second)));
+            }
             notifiers.push_back(notifier);
         }
     }
@@ -59,6 +67,18 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
         notificationInterface = new CZMQNotificationInterface();
         notificationInterface->notifiers = notifiers;
 
+        size_t nQueueSize = DEFAULT_ZMQ_QUEUE_SIZE;
+        std::map<std::string, std::string>::const_iterator j = args.find("-zmqqueuesize");
+        if (j!=args.end())
+        {
+            nQueueSize = std::max(1, atoi(j->second));
+        }
+        notificationInterface->ppublisher = new CZMQPublisher(nQueueSize);
+        for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
+        {
+            (*i)->SetPublisher(notificationInterface->ppublisher);
+        }
+
         if (!notificationInterface->Initialize())
         {
             delete notificationInterface;
@@ -104,6 +124,7 @@ bool CZMQNotificationInterface::Initialize()
         return false;
     }
 
+    ppublisher->Start();
     return true;
 }
 
@@ -113,10 +134,15 @@ void CZMQNotificationInterface::Shutdown()
     LogPrint("zmq", "zmq: Shutdown notification interface\n");
     if (pcontext)
     {
+        // Stop sending before the sockets go away
+        ppublisher->Stop();
         for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
         {
             CZMQAbstractNotifier *notifier = *i;
-            LogPrint("zmq", "   Shutdown notifier %s at %s\n", notifier->GetType(), notifier->GetAddress());
+            uint32_t nMessages;
+            uint64_t nDropped;
+            ppublisher->GetCounts(static_cast<CZMQAbstractPublishNotifier*>(notifier), nMessages, nDropped);
+            LogPrint("zmq", "   Shutdown notifier %s at %s (%u messages, %u dropped)\n", notifier->GetType(), notifier->GetAddress(), nMessages, nDropped);
             notifier->Shutdown();
         }
         zmq_ctx_destroy(pcontext);
@@ -11,6 +11,7 @@
 
 class CBlockIndex;
 class CZMQAbstractNotifier;
+class CZMQPublisher;
 
 class CZMQNotificationInterface : public CValidationInterface
 {
@@ -32,6 +33,7 @@ private:
 
     void *pcontext;
     std::list<CZMQAbstractNotifier*> notifiers;
+    CZMQPublisher *ppublisher;
 };
 
 #endif // BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
@@ -0,0 +1,91 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "zmqpublisher.h"
+#include "zmqpublishnotifier.h"
+
+#include "util.h"
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+
+CZMQPublisher::CZMQPublisher(size_t nMaxQueuedIn) : nMaxQueued(nMaxQueuedIn), fStopping(false), pthread(NULL)
+{
+}
+
+CZMQPublisher::~CZMQPublisher()
+{
+    Stop();
+}
+
+void CZMQPublisher::Start()
+{
+    assert(!pthread);
+    pthread = new boost::thread(boost::bind(&TraceThread<boost::function<void ()> >, "zmqpub",
+                                            boost::function<void ()>(boost::bind(&CZMQPublisher::ThreadPublish, this))));
+}
+
+void CZMQPublisher::Stop()
+{
+    if (!pthread)
+        return;
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fStopping = true;
+        cond.notify_all();
+    }
+    pthread->join();
+    delete pthread;
+    pthread = NULL;
+
+    boost::unique_lock<boost::mutex> lock(cs);
+    BOOST_FOREACH(const CZMQQueuedMessage& msg, queue) {
+        msg.pnotifier->nDropped++;
+        delete msg.pbody;
+    }
+    queue.clear();
+}
+
+void CZMQPublisher::ThreadPublish()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (true) {
+        while (queue.empty() && !fStopping)
+            cond.wait(lock);
+        if (fStopping)
+            return;
+        CZMQQueuedMessage msg = queue.front();
+        queue.pop_front();
+        lock.unlock();
+        bool fSent = msg.pnotifier->SendQueuedMessage(msg.pbody, msg.blockPos, msg.nSequence);
+        lock.lock();
+        if (!fSent)
+            msg.pnotifier->nDropped++;
+    }
+}
+
+void CZMQPublisher::Push(CZMQAbstractPublishNotifier* pnotifier, CDataStream* pbody, const CDiskBlockPos& blockPos)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    CZMQQueuedMessage msg;
+    msg.pnotifier = pnotifier;
+    msg.pbody = pbody;
+    msg.blockPos = blockPos;
+    msg.nSequence = pnotifier->nSequence++;
+    if (queue.size() >= nMaxQueued) {
+        pnotifier->nDropped++;
+        LogPrint("zmq", "zmq: Queue full, dropped %s message %u\n", pnotifier->GetType(), msg.nSequence);
+        delete pbody;
+        return;
+    }
+    queue.push_back(msg);
+    cond.notify_one();
+}
+
+void CZMQPublisher::GetCounts(const CZMQAbstractPublishNotifier* pnotifier, uint32_t& nMessages, uint64_t& nDropped)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    nMessages = pnotifier->nSequence;
+    nDropped = pnotifier->nDropped;
+}
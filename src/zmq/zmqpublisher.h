@@ -0,0 +1,68 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ZMQ_ZMQPUBLISHER_H
+#define BITCOIN_ZMQ_ZMQPUBLISHER_H
+
+#include "chain.h"
+#include "streams.h"
+
+#include <deque>
+
+#include <boost/thread.hpp>
+
+class CZMQAbstractPublishNotifier;
+
+/** Default number of messages that may wait for the publisher thread before new ones are dropped */
+static const unsigned int DEFAULT_ZMQ_QUEUE_SIZE = 1000;
+
+/** A message waiting for the publisher thread */
+struct CZMQQueuedMessage
+{
+    CZMQAbstractPublishNotifier* pnotifier;
+    //! the message body, handed to ZMQ without copying; NULL for a block still to be read
+    CDataStream* pbody;
+    //! where to read the raw block from, if pbody is NULL
+    CDiskBlockPos blockPos;
+    uint32_t nSequence;
+};
+
+/**
+ * Sends the messages of the publish notifiers on a thread of its own, so
+ * that the validation notifications only queue them. When nMaxQueued
+ * messages are waiting, new ones are dropped and counted; their sequence
+ * numbers are used up all the same, so subscribers can tell.
+ */
+class CZMQPublisher
+{
+private:
+    boost::mutex cs;
+    //! Signalled when a message is queued, and when stopping
+    boost::condition_variable cond;
+    std::deque<CZMQQueuedMessage> queue;
+    const size_t nMaxQueued;
+    bool fStopping;
+    boost::thread* pthread;
+
+    void ThreadPublish();
+
+public:
+    CZMQPublisher(size_t nMaxQueuedIn = DEFAULT_ZMQ_QUEUE_SIZE);
+    ~CZMQPublisher();
+
+    void Start();
+    /** Stop the publisher thread; the messages it did not send yet are dropped */
+    void Stop();
+
+    /**
+     * Queue a message of pnotifier: pbody, or the raw block at blockPos if
+     * pbody is NULL. Takes ownership of pbody. Does not block.
+     */
+    void Push(CZMQAbstractPublishNotifier* pnotifier, CDataStream* pbody, const CDiskBlockPos& blockPos = CDiskBlockPos());
+
+    /** Return the number of messages pnotifier queued, and how many of them were dropped */
+    void GetCounts(const CZMQAbstractPublishNotifier* pnotifier, uint32_t& nMessages, uint64_t& nDropped);
+};
+
+#endif // BITCOIN_ZMQ_ZMQPUBLISHER_H
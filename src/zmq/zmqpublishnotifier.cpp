@@ -4,48 +4,73 @@
 
 #include "chainparams.h"
 #include "zmqpublishnotifier.h"
+#include "zmqpublisher.h"
+#include "crypto/common.h"
 #include "main.h"
+#include "streams.h"
 #include "util.h"
 
 static std::multimap<std::string, CZMQAbstractPublishNotifier*> mapPublishNotifiers;
 
-// Internal function to send multipart message
-static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
+// Called by ZMQ, possibly on one of its own threads, once it is done with a message body
+static void zmq_free_body(void * /*data*/, void *hint)
 {
-    va_list args;
-    va_start(args, size);
-
-    while (1)
-    {
-        zmq_msg_t msg;
-
-        int rc = zmq_msg_init_size(&msg, size);
-        if (rc != 0)
-        {
-            zmqError("Unable to initialize ZMQ msg");
-            return -1;
-        }
-
-        void *buf = zmq_msg_data(&msg);
-        memcpy(buf, data, size);
-
-        data = va_arg(args, const void*);
+    delete static_cast<CDataStream*>(hint);
+}
 
-        rc = zmq_msg_send(&msg, sock, data ? ZMQ_SNDMORE : 0);
-        if (rc == -1)
-        {
-            zmqError("Unable to send ZMQ msg");
-            zmq_msg_close(&msg);
-            return -1;
-        }
+// Internal function to send the parts of a message: command, body and sequence number.
+// The body is handed to ZMQ without copying it; this takes ownership of it.
+static int zmq_send_message(void *sock, const char *command, CDataStream *pbody, uint32_t nSequence)
+{
+    zmq_msg_t msg;
 
+    size_t size = strlen(command);
+    if (zmq_msg_init_size(&msg, size) != 0)
+    {
+        zmqError("Unable to initialize ZMQ msg");
+        delete pbody;
+        return -1;
+    }
+    memcpy(zmq_msg_data(&msg), command, size);
+    if (zmq_msg_send(&msg, sock, ZMQ_SNDMORE) == -1)
+    {
+        zmqError("Unable to send ZMQ msg");
         zmq_msg_close(&msg);
+        delete pbody;
+        return -1;
+    }
+    zmq_msg_close(&msg);
 
-        if (!data)
-            break;
+    if (zmq_msg_init_data(&msg, &(*pbody->begin()), pbody->size(), zmq_free_body, pbody) != 0)
+    {
+        zmqError("Unable to initialize ZMQ msg");
+        delete pbody;
+        return -1;
+    }
+    // From here on closing msg releases the body
+    if (zmq_msg_send(&msg, sock, ZMQ_SNDMORE) == -1)
+    {
+        zmqError("Unable to send ZMQ msg");
+        zmq_msg_close(&msg);
+        return -1;
+    }
+    zmq_msg_close(&msg);
 
-        size = va_arg(args, size_t);
+    unsigned char seq[4];
+    WriteLE32(seq, nSequence);
+    if (zmq_msg_init_size(&msg, sizeof(seq)) != 0)
+    {
+        zmqError("Unable to initialize ZMQ msg");
+        return -1;
+    }
+    memcpy(zmq_msg_data(&msg), seq, sizeof(seq));
+    if (zmq_msg_send(&msg, sock, 0) == -1)
+    {
+        zmqError("Unable to send ZMQ msg");
+        zmq_msg_close(&msg);
+        return -1;
     }
+    zmq_msg_close(&msg);
     return 0;
 }
 
@@ -65,7 +90,16 @@ bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
             return false;
         }
 
-        int rc = zmq_bind(psocket, address.c_str());
+        LogPrint("zmq", "zmq: Outbound message high water mark for %s at %s is %d\n", type, address, nHighWaterMark);
+
+        int rc = zmq_setsockopt(psocket, ZMQ_SNDHWM, &nHighWaterMark, sizeof(nHighWaterMark));
+        if (rc != 0)
+        {
+            zmqError("Failed to set outbound message high water mark");
+            return false;
+        }
+
+        rc = zmq_bind(psocket, address.c_str());
         if (rc!=0)
         {
             zmqError("Failed to bind address");
@@ -117,56 +151,79 @@ void CZMQAbstractPublishNotifier::Shutdown()
     psocket = 0;
 }
 
-bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+void CZMQAbstractPublishNotifier::Publish(CDataStream *pbody)
+{
+    ppublisher->Push(this, pbody);
+}
+
+void CZMQAbstractPublishNotifier::PublishBlock(const CDiskBlockPos &pos)
+{
+    ppublisher->Push(this, NULL, pos);
+}
+
+bool CZMQAbstractPublishNotifier::SendQueuedMessage(CDataStream *pbody, const CDiskBlockPos &blockPos, uint32_t nSequenceIn)
+{
+    if (!pbody)
+    {
+        // The block as stored is what we publish; no need to deserialize it
+        pbody = new CDataStream(SER_NETWORK, PROTOCOL_VERSION);
+        if (!ReadRawBlockFromDisk(*pbody, blockPos, Params().MessageStart()))
+        {
+            // Not only a zmq debug message: subscribers miss this block, e.g. when it was pruned
+            LogPrintf("zmq: Can't read block from disk at %s, not publishing %s\n", blockPos.ToString(), command);
+            delete pbody;
+            return false;
+        }
+    }
+    return zmq_send_message(psocket, command, pbody, nSequenceIn) == 0;
+}
+
+// The hashes are published in the byte order they are displayed in
+static CDataStream *HashBody(const uint256 &hash)
 {
-    uint256 hash = pindex->GetBlockHash();
-    LogPrint("zmq", "zmq: Publish hashblock %s\n", hash.GetHex());
     char data[32];
     for (unsigned int i = 0; i < 32; i++)
         data[31 - i] = hash.begin()[i];
-    int rc = zmq_send_multipart(psocket, "hashblock", 9, data, 32, 0);
-    return rc == 0;
+    CDataStream *pbody = new CDataStream(SER_NETWORK, PROTOCOL_VERSION);
+    pbody->write(data, 32);
+    return pbody;
+}
+
+bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+{
+    uint256 hash = pindex->GetBlockHash();
+    LogPrint("zmq", "zmq: Publish hashblock %s\n", hash.GetHex());
+    Publish(HashBody(hash));
+    return true;
 }
 
 bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
 {
     uint256 hash = transaction.GetHash();
     LogPrint("zmq", "zmq: Publish hashtx %s\n", hash.GetHex());
-    char data[32];
-    for (unsigned int i = 0; i < 32; i++)
-        data[31 - i] = hash.begin()[i];
-    int rc = zmq_send_multipart(psocket, "hashtx", 6, data, 32, 0);
-    return rc == 0;
+    Publish(HashBody(hash));
+    return true;
 }
 
 bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
-    const Consensus::Params& consensusParams = Params().GetConsensus();
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    CDiskBlockPos pos;
     {
         LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex, consensusParams))
-        {
-            zmqError("Can't read block from disk");
-            return false;
-        }
-
-        ss << block;
+        pos = pindex->GetBlockPos();
     }
-
-    int rc = zmq_send_multipart(psocket, "rawblock", 8, &(*ss.begin()), ss.size(), 0);
-    return rc == 0;
+    PublishBlock(pos);
+    return true;
 }
 
 bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
 {
     uint256 hash = transaction.GetHash();
     LogPrint("zmq", "zmq: Publish rawtx %s\n", hash.GetHex());
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss << transaction;
-    int rc = zmq_send_multipart(psocket, "rawtx", 5, &(*ss.begin()), ss.size(), 0);
-    return rc == 0;
+    CDataStream *pbody = new CDataStream(SER_NETWORK, PROTOCOL_VERSION);
+    *pbody << transaction;
+    Publish(pbody);
+    return true;
 }
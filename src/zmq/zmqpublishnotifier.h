@@ -8,35 +8,66 @@
 #include "zmqabstractnotifier.h"
 
 class CBlockIndex;
+class CDataStream;
+struct CDiskBlockPos;
 
+/**
+ * Publishes three-part messages: the command, the body and a
+ * little-endian 32-bit sequence number counting the notifier's messages.
+ * The notifications only queue the messages; CZMQPublisher sends them.
+ */
 class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
 {
+    friend class CZMQPublisher;
+
+private:
+    const char *command;
+    //! sequence number of the next message (protected by CZMQPublisher::cs)
+    uint32_t nSequence;
+    //! messages queued but never sent (protected by CZMQPublisher::cs)
+    uint64_t nDropped;
+
+protected:
+    /** Queue a message with body pbody, taking ownership of it */
+    void Publish(CDataStream *pbody);
+    /** Queue a message with the raw block at pos, read when it is sent */
+    void PublishBlock(const CDiskBlockPos &pos);
+
 public:
+    CZMQAbstractPublishNotifier(const char *commandIn) : command(commandIn), nSequence(0), nDropped(0) { }
+
     bool Initialize(void *pcontext);
     void Shutdown();
+
+    /** Called on the publisher thread: send a queued message (see CZMQPublisher::Push) */
+    bool SendQueuedMessage(CDataStream *pbody, const CDiskBlockPos &blockPos, uint32_t nSequenceIn);
 };
 
 class CZMQPublishHashBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
+    CZMQPublishHashBlockNotifier() : CZMQAbstractPublishNotifier("hashblock") { }
     bool NotifyBlock(const CBlockIndex *pindex);
 };
 
 class CZMQPublishHashTransactionNotifier : public CZMQAbstractPublishNotifier
 {
 public:
+    CZMQPublishHashTransactionNotifier() : CZMQAbstractPublishNotifier("hashtx") { }
     bool NotifyTransaction(const CTransaction &transaction);
 };
 
 class CZMQPublishRawBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
+    CZMQPublishRawBlockNotifier() : CZMQAbstractPublishNotifier("rawblock") { }
     bool NotifyBlock(const CBlockIndex *pindex);
 };
 
 class CZMQPublishRawTransactionNotifier : public CZMQAbstractPublishNotifier
 {
 public:
+    CZMQPublishRawTransactionNotifier() : CZMQAbstractPublishNotifier("rawtx") { }
     bool NotifyTransaction(const CTransaction &transaction);
 };
 